@@ -0,0 +1,145 @@
+#include "adaptive_bit_rate.h"
+
+#include <assert.h>
+#include <inttypes.h>
+
+#include "config.h"
+#include "util/log.h"
+
+#define WINDOW_DURATION 1000000 // us
+#define HIGH_QUEUEING_DELAY 100000 // us
+#define LOW_QUEUEING_DELAY 30000 // us
+// the number of windows with a low delay before increasing the bit rate
+#define INCREASE_WINDOWS 3
+#define MIN_BIT_RATE 500000
+
+void
+adaptive_bit_rate_init(struct adaptive_bit_rate *abr, uint32_t bit_rate,
+                       uint32_t max_bit_rate) {
+    assert(bit_rate <= max_bit_rate);
+    abr->min_bit_rate = bit_rate < MIN_BIT_RATE ? bit_rate : MIN_BIT_RATE;
+    abr->max_bit_rate = max_bit_rate;
+    abr->bit_rate = bit_rate;
+    abr->window_count = 0;
+    abr->window_started = false;
+    abr->stable_windows = 0;
+    abr->skip_window = false;
+    abr->throughput = 0;
+    abr->queueing_delay = 0;
+}
+
+static int64_t
+get_base_offset(const struct adaptive_bit_rate *abr) {
+    int64_t base = abr->window_min_offset;
+    unsigned count = abr->window_count < ADAPTIVE_BIT_RATE_BASE_WINDOWS
+                   ? abr->window_count
+                   : ADAPTIVE_BIT_RATE_BASE_WINDOWS;
+    for (unsigned i = 0; i < count; ++i) {
+        if (abr->base_offsets[i] < base) {
+            base = abr->base_offsets[i];
+        }
+    }
+    return base;
+}
+
+static void
+start_window(struct adaptive_bit_rate *abr, int64_t start) {
+    abr->window_started = true;
+    abr->window_start = start;
+    abr->window_min_offset = INT64_MAX;
+    abr->window_bytes = 0;
+    abr->window_delay_sum = 0;
+    abr->window_frames = 0;
+}
+
+// return the new target bit rate
+static uint32_t
+decide(struct adaptive_bit_rate *abr) {
+    if (abr->skip_window) {
+        abr->skip_window = false;
+        return abr->bit_rate;
+    }
+
+    if (abr->queueing_delay > HIGH_QUEUEING_DELAY) {
+        abr->stable_windows = 0;
+        // go below the throughput, so that the queues drain
+        uint32_t rate = abr->throughput < abr->bit_rate ? abr->throughput
+                                                        : abr->bit_rate;
+        uint32_t target = (uint64_t) rate * 85 / 100;
+        if (target < abr->min_bit_rate) {
+            target = abr->min_bit_rate;
+        }
+        if (target < abr->bit_rate) {
+            abr->skip_window = true;
+        }
+        return target;
+    }
+
+    if (abr->queueing_delay > LOW_QUEUEING_DELAY) {
+        abr->stable_windows = 0;
+        return abr->bit_rate;
+    }
+
+    // do not increase the bit rate while the stream does not use it (e.g. the
+    // device screen content does not change)
+    if (++abr->stable_windows < INCREASE_WINDOWS
+            || abr->throughput < abr->bit_rate / 4) {
+        return abr->bit_rate;
+    }
+
+    abr->stable_windows = 0;
+    uint64_t target = (uint64_t) abr->bit_rate * 110 / 100;
+    return target < abr->max_bit_rate ? target : abr->max_bit_rate;
+}
+
+static bool
+end_window(struct adaptive_bit_rate *abr, int64_t end) {
+    int64_t duration = end - abr->window_start;
+    assert(duration > 0);
+    uint64_t throughput = abr->window_bytes * 8 * 1000000 / duration;
+    abr->throughput = throughput < UINT32_MAX ? throughput : UINT32_MAX;
+    abr->queueing_delay = abr->window_frames
+                        ? abr->window_delay_sum / abr->window_frames
+                        : 0;
+
+    unsigned index = abr->window_count++ % ADAPTIVE_BIT_RATE_BASE_WINDOWS;
+    abr->base_offsets[index] = abr->window_min_offset;
+
+    uint32_t target = decide(abr);
+    if (target == abr->bit_rate) {
+        return false;
+    }
+
+    LOGD("Bit rate %" PRIu32 " -> %" PRIu32 " (throughput %" PRIu32
+         ", queueing delay %" PRIu32 " us)", abr->bit_rate, target,
+         abr->throughput, abr->queueing_delay);
+    abr->bit_rate = target;
+    return true;
+}
+
+bool
+adaptive_bit_rate_push(struct adaptive_bit_rate *abr, int64_t arrival_time,
+                       int64_t pts, size_t size) {
+    bool changed = false;
+    if (!abr->window_started) {
+        start_window(abr, arrival_time);
+    } else if (arrival_time - abr->window_start >= WINDOW_DURATION) {
+        changed = end_window(abr, arrival_time);
+        start_window(abr, arrival_time);
+    }
+
+    abr->window_bytes += size;
+
+    if (pts >= 0) {
+        int64_t offset = arrival_time - pts;
+        if (offset < abr->window_min_offset) {
+            abr->window_min_offset = offset;
+        }
+        int64_t delay = offset - get_base_offset(abr);
+        assert(delay >= 0);
+        abr->window_delay_sum += delay;
+        ++abr->window_frames;
+    }
+
+    return changed;
+}
@@ -0,0 +1,62 @@
+#ifndef ADAPTIVE_BIT_RATE_H
+#define ADAPTIVE_BIT_RATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+// the number of windows over which the base delay is the minimum
+#define ADAPTIVE_BIT_RATE_BASE_WINDOWS 20
+
+// Adapt the encoder bit rate to the throughput of the link to the device.
+//
+// The "offset" of a packet is its arrival time on the client minus its PTS
+// (both clocks are unrelated, only the variations matter). Its increase over
+// the minimum of the last windows is the time spent in the queues (mainly the
+// socket buffers, when the link is slower than the encoder output).
+//
+// On each window (1 second), if the average queueing delay is high, the bit
+// rate is decreased below the measured throughput, so that the queues drain.
+// If it stays low for several windows, the bit rate is increased
+// (multiplicatively), up to the maximum.
+//
+// It only depends on the times it is given, so that it can be tested against
+// traces.
+struct adaptive_bit_rate {
+    uint32_t min_bit_rate;
+    uint32_t max_bit_rate;
+    uint32_t bit_rate; // the current target
+
+    int64_t base_offsets[ADAPTIVE_BIT_RATE_BASE_WINDOWS]; // per window
+    unsigned window_count;
+
+    bool window_started;
+    int64_t window_start;
+    int64_t window_min_offset;
+    uint64_t window_bytes;
+    uint64_t window_delay_sum;
+    unsigned window_frames;
+
+    unsigned stable_windows; // consecutive windows with a low delay
+    bool skip_window; // the queues are still draining after a decrease
+
+    // the estimations on the last window
+    uint32_t throughput; // in bits/s
+    uint32_t queueing_delay; // average, in us
+};
+
+// bit_rate is the initial value (the minimum is lowered to it if necessary)
+void
+adaptive_bit_rate_init(struct adaptive_bit_rate *abr, uint32_t bit_rate,
+                       uint32_t max_bit_rate);
+
+// Record a packet received at arrival_time (in us), with its PTS (in us,
+// negative for a config packet).
+// Return true if the target bit rate changed.
+bool
+adaptive_bit_rate_push(struct adaptive_bit_rate *abr, int64_t arrival_time,
+                       int64_t pts, size_t size);
+
+#endif
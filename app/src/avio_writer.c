@@ -0,0 +1,498 @@
+// for pwrite(), posix_memalign(), fallocate() and O_DIRECT
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+#include "avio_writer.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+#include "config.h"
+#include "compat.h"
+#include "util/lock.h"
+#include "util/log.h"
+
+// size of the buffer of the AVIOContext itself, copied to the chunks
+#define AVIO_BUFFER_SIZE 0x10000
+
+static struct avio_writer_chunk *
+avio_writer_chunk_new(void) {
+    struct avio_writer_chunk *chunk = SDL_malloc(sizeof(*chunk));
+    if (!chunk) {
+        return NULL;
+    }
+
+    if (posix_memalign((void **) &chunk->data, AVIO_WRITER_ALIGNMENT,
+                       AVIO_WRITER_CHUNK_SIZE)) {
+        SDL_free(chunk);
+        return NULL;
+    }
+
+    chunk->offset = 0;
+    chunk->len = 0;
+    return chunk;
+}
+
+static void
+avio_writer_chunk_delete(struct avio_writer_chunk *chunk) {
+    free(chunk->data);
+    SDL_free(chunk);
+}
+
+static void
+avio_writer_chunk_queue_clear(struct avio_writer_chunk_queue *queue) {
+    while (!queue_is_empty(queue)) {
+        struct avio_writer_chunk *chunk;
+        queue_take(queue, next, &chunk);
+        avio_writer_chunk_delete(chunk);
+    }
+}
+
+static bool
+write_all(int fd, const uint8_t *data, size_t len, int64_t offset) {
+    while (len) {
+        ssize_t w = pwrite(fd, data, len, offset);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += w;
+        len -= w;
+        offset += w;
+    }
+    return true;
+}
+
+static bool
+avio_writer_write_chunk(struct avio_writer *writer,
+                        struct avio_writer_chunk *chunk) {
+    if (writer->direct_fd != -1 && chunk->len == AVIO_WRITER_CHUNK_SIZE
+            && !(chunk->offset % AVIO_WRITER_ALIGNMENT)) {
+        // a full chunk at an aligned position satisfies the O_DIRECT
+        // constraints (the data buffer is aligned too)
+        ssize_t w = pwrite(writer->direct_fd, chunk->data, chunk->len,
+                           chunk->offset);
+        if (w == (ssize_t) chunk->len) {
+            return true;
+        }
+        if (w < 0 && errno == EINVAL) {
+            // the filesystem does not support O_DIRECT
+            LOGW("Direct I/O not supported for %s", writer->filename);
+            close(writer->direct_fd);
+            writer->direct_fd = -1;
+            w = 0;
+        } else if (w < 0) {
+            return false;
+        }
+        // write the remaining data through the page cache
+        return write_all(writer->fd, chunk->data + w, chunk->len - w,
+                         chunk->offset + w);
+    }
+
+    return write_all(writer->fd, chunk->data, chunk->len, chunk->offset);
+}
+
+static int
+run_avio_writer(void *data) {
+    struct avio_writer *writer = data;
+
+    for (;;) {
+        mutex_lock(writer->mutex);
+
+        while (!writer->stopped && queue_is_empty(&writer->pending)) {
+            cond_wait(writer->cond, writer->mutex);
+        }
+
+        if (queue_is_empty(&writer->pending)) {
+            // stopped and everything is written
+            mutex_unlock(writer->mutex);
+            break;
+        }
+
+        struct avio_writer_chunk *chunk;
+        queue_take(&writer->pending, next, &chunk);
+        bool failed = writer->failed;
+
+        mutex_unlock(writer->mutex);
+
+        bool ok = true;
+        if (!failed) {
+            // a failed write must not be followed by more data
+            int64_t start = av_gettime_relative();
+            ok = avio_writer_write_chunk(writer, chunk);
+            uint32_t latency = av_gettime_relative() - start;
+            if (ok) {
+                writer->bytes_written += chunk->len;
+                writer->write_time += latency;
+                if (latency > writer->worst_latency) {
+                    writer->worst_latency = latency;
+                }
+            } else {
+                LOGE("Could not write to %s: %s", writer->filename,
+                     strerror(errno));
+            }
+        }
+
+        mutex_lock(writer->mutex);
+        if (!ok) {
+            writer->failed = true;
+        }
+        queue_push(&writer->free_chunks, next, chunk);
+        cond_signal(writer->cond);
+        mutex_unlock(writer->mutex);
+    }
+
+    LOGD("AVIO writer thread ended");
+
+    return 0;
+}
+
+// get an empty chunk from the pool, waiting for the flush thread if necessary
+static struct avio_writer_chunk *
+avio_writer_acquire(struct avio_writer *writer) {
+    mutex_lock(writer->mutex);
+
+    if (queue_is_empty(&writer->free_chunks) && !writer->failed) {
+        // the disk does not keep up, the muxer must wait
+        ++writer->stalls;
+        do {
+            cond_wait(writer->cond, writer->mutex);
+        } while (queue_is_empty(&writer->free_chunks) && !writer->failed);
+    }
+
+    struct avio_writer_chunk *chunk = NULL;
+    if (!writer->failed) {
+        queue_take(&writer->free_chunks, next, &chunk);
+    }
+
+    mutex_unlock(writer->mutex);
+
+    if (chunk) {
+        chunk->offset = writer->pos;
+        chunk->len = 0;
+    }
+    return chunk;
+}
+
+static void
+avio_writer_submit(struct avio_writer *writer) {
+    struct avio_writer_chunk *chunk = writer->current;
+    assert(chunk && chunk->len);
+    writer->current = NULL;
+
+    mutex_lock(writer->mutex);
+    queue_push(&writer->pending, next, chunk);
+    cond_signal(writer->cond);
+    mutex_unlock(writer->mutex);
+}
+
+static int
+avio_writer_write_packet(void *opaque, uint8_t *buf, int buf_size) {
+    struct avio_writer *writer = opaque;
+
+    int remaining = buf_size;
+    while (remaining) {
+        if (!writer->current) {
+            writer->current = avio_writer_acquire(writer);
+            if (!writer->current) {
+                // a previous write failed
+                return AVERROR(EIO);
+            }
+        }
+
+        struct avio_writer_chunk *chunk = writer->current;
+        assert(chunk->offset + (int64_t) chunk->len == writer->pos);
+
+        size_t n = AVIO_WRITER_CHUNK_SIZE - chunk->len;
+        if (n > (size_t) remaining) {
+            n = remaining;
+        }
+
+        memcpy(chunk->data + chunk->len, buf, n);
+        chunk->len += n;
+        writer->pos += n;
+        buf += n;
+        remaining -= n;
+
+        if (chunk->len == AVIO_WRITER_CHUNK_SIZE) {
+            avio_writer_submit(writer);
+        }
+    }
+
+    if (writer->pos > writer->size) {
+        writer->size = writer->pos;
+    }
+
+    return buf_size;
+}
+
+static int64_t
+avio_writer_seek(void *opaque, int64_t offset, int whence) {
+    struct avio_writer *writer = opaque;
+
+    if (whence & AVSEEK_SIZE) {
+        return writer->size;
+    }
+
+    int64_t pos;
+    switch (whence & ~AVSEEK_FORCE) {
+        case SEEK_SET:
+            pos = offset;
+            break;
+        case SEEK_CUR:
+            pos = writer->pos + offset;
+            break;
+        case SEEK_END:
+            pos = writer->size + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+
+    if (pos < 0) {
+        return AVERROR(EINVAL);
+    }
+
+    if (pos != writer->pos) {
+        if (writer->current && writer->current->len) {
+            avio_writer_submit(writer);
+        } else if (writer->current) {
+            // the chunk is still empty, just move it
+            writer->current->offset = pos;
+        }
+        writer->pos = pos;
+    }
+
+    return pos;
+}
+
+static void
+avio_writer_preallocate(struct avio_writer *writer, uint32_t size) {
+#ifdef __linux__
+    // reserve the extents without changing the file size, so that the file
+    // is never longer than its content
+    if (fallocate(writer->fd, FALLOC_FL_KEEP_SIZE, 0, size)) {
+        LOGW("Could not preallocate %s: %s", writer->filename,
+             strerror(errno));
+    }
+#else
+    (void) size;
+    LOGW("Preallocation is not supported on this platform");
+#endif
+}
+
+static int
+avio_writer_open_direct(const char *filename) {
+#ifdef O_DIRECT
+    int fd = open(filename, O_WRONLY | O_DIRECT);
+    if (fd == -1) {
+        LOGW("Could not open %s for direct I/O: %s", filename,
+             strerror(errno));
+    }
+    return fd;
+#else
+    (void) filename;
+    LOGW("Direct I/O is not supported on this platform");
+    return -1;
+#endif
+}
+
+bool
+avio_writer_supports(const char *filename) {
+    struct stat sb;
+    if (stat(filename, &sb)) {
+        return errno == ENOENT;
+    }
+    return S_ISREG(sb.st_mode);
+}
+
+bool
+avio_writer_open(struct avio_writer *writer, const char *filename,
+                 size_t buffer_size, uint32_t preallocate, bool direct_io) {
+    writer->filename = SDL_strdup(filename);
+    if (!writer->filename) {
+        LOGC("Could not strdup filename");
+        return false;
+    }
+
+    writer->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (writer->fd == -1) {
+        LOGE("Could not open %s: %s", filename, strerror(errno));
+        goto error_free_filename;
+    }
+
+    if (preallocate) {
+        avio_writer_preallocate(writer, preallocate);
+    }
+
+    writer->direct_fd = direct_io ? avio_writer_open_direct(filename) : -1;
+
+    writer->mutex = SDL_CreateMutex();
+    if (!writer->mutex) {
+        LOGC("Could not create mutex");
+        goto error_close;
+    }
+
+    writer->cond = SDL_CreateCond();
+    if (!writer->cond) {
+        LOGC("Could not create cond");
+        goto error_destroy_mutex;
+    }
+
+    queue_init(&writer->pending);
+    queue_init(&writer->free_chunks);
+
+    // at least 2 chunks, so that the muxer may write while flushing
+    writer->chunk_count = buffer_size / AVIO_WRITER_CHUNK_SIZE;
+    if (writer->chunk_count < 2) {
+        writer->chunk_count = 2;
+    }
+    for (unsigned i = 0; i < writer->chunk_count; ++i) {
+        struct avio_writer_chunk *chunk = avio_writer_chunk_new();
+        if (!chunk) {
+            LOGC("Could not allocate write buffer");
+            goto error_free_chunks;
+        }
+        queue_push(&writer->free_chunks, next, chunk);
+    }
+
+    uint8_t *buffer = av_malloc(AVIO_BUFFER_SIZE);
+    if (!buffer) {
+        LOGC("Could not allocate AVIO buffer");
+        goto error_free_chunks;
+    }
+
+    writer->avio = avio_alloc_context(buffer, AVIO_BUFFER_SIZE, 1, writer,
+                                      NULL, avio_writer_write_packet,
+                                      avio_writer_seek);
+    if (!writer->avio) {
+        LOGC("Could not allocate AVIO context");
+        av_free(buffer);
+        goto error_free_chunks;
+    }
+
+    writer->stopped = false;
+    writer->failed = false;
+    writer->current = NULL;
+    writer->pos = 0;
+    writer->size = 0;
+    writer->stalls = 0;
+    writer->start_time = av_gettime_relative();
+    writer->bytes_written = 0;
+    writer->write_time = 0;
+    writer->worst_latency = 0;
+
+    LOGD("Starting AVIO writer thread");
+    writer->thread = SDL_CreateThread(run_avio_writer, "avio-writer", writer);
+    if (!writer->thread) {
+        LOGC("Could not start AVIO writer thread");
+        goto error_free_avio;
+    }
+
+    return true;
+
+error_free_avio:
+    av_freep(&writer->avio->buffer);
+#ifdef SCRCPY_LAVF_HAS_AVIO_CONTEXT_FREE
+    avio_context_free(&writer->avio);
+#else
+    av_freep(&writer->avio);
+#endif
+error_free_chunks:
+    avio_writer_chunk_queue_clear(&writer->free_chunks);
+    SDL_DestroyCond(writer->cond);
+error_destroy_mutex:
+    SDL_DestroyMutex(writer->mutex);
+error_close:
+    if (writer->direct_fd != -1) {
+        close(writer->direct_fd);
+    }
+    close(writer->fd);
+error_free_filename:
+    SDL_free(writer->filename);
+
+    return false;
+}
+
+void
+avio_writer_flush(struct avio_writer *writer) {
+    // move the AVIOContext buffer to the current chunk
+    avio_flush(writer->avio);
+
+    if (writer->current && writer->current->len) {
+        // the following data starts a new chunk
+        avio_writer_submit(writer);
+    }
+}
+
+static void
+avio_writer_log_stats(struct avio_writer *writer) {
+    float mb = (float) writer->bytes_written / (1024 * 1024);
+    float elapsed = (av_gettime_relative() - writer->start_time) / 1000000.f;
+    // the throughput of the disk, measured during the write calls
+    float throughput = writer->write_time
+                     ? mb * 1000000 / writer->write_time
+                     : 0;
+    LOGI("Recording I/O: %.1f MiB written in %.1f s (disk throughput: "
+         "%.1f MiB/s, worst flush latency: %u ms, buffer stalls: %u)",
+         mb, elapsed, throughput, writer->worst_latency / 1000,
+         writer->stalls);
+}
+
+bool
+avio_writer_close(struct avio_writer *writer) {
+    avio_writer_flush(writer);
+    if (writer->current) {
+        // empty chunk
+        mutex_lock(writer->mutex);
+        queue_push(&writer->free_chunks, next, writer->current);
+        mutex_unlock(writer->mutex);
+        writer->current = NULL;
+    }
+
+    mutex_lock(writer->mutex);
+    writer->stopped = true;
+    cond_signal(writer->cond);
+    mutex_unlock(writer->mutex);
+
+    SDL_WaitThread(writer->thread, NULL);
+
+    bool ok = !writer->failed && !writer->avio->error;
+
+    if (writer->direct_fd != -1) {
+        close(writer->direct_fd);
+    }
+    if (close(writer->fd)) {
+        LOGE("Could not close %s: %s", writer->filename, strerror(errno));
+        ok = false;
+    }
+
+    if (ok) {
+        avio_writer_log_stats(writer);
+    }
+
+    av_freep(&writer->avio->buffer);
+#ifdef SCRCPY_LAVF_HAS_AVIO_CONTEXT_FREE
+    avio_context_free(&writer->avio);
+#else
+    av_freep(&writer->avio);
+#endif
+    avio_writer_chunk_queue_clear(&writer->free_chunks);
+    assert(queue_is_empty(&writer->pending));
+    SDL_DestroyCond(writer->cond);
+    SDL_DestroyMutex(writer->mutex);
+    SDL_free(writer->filename);
+
+    return ok;
+}
@@ -0,0 +1,85 @@
+#ifndef AVIO_WRITER_H
+#define AVIO_WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <libavformat/avio.h>
+#include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_thread.h>
+
+#include "config.h"
+#include "util/queue.h"
+
+// the chunk size is a multiple of the O_DIRECT alignment
+#define AVIO_WRITER_ALIGNMENT 4096
+#define AVIO_WRITER_CHUNK_SIZE (1 << 20) // 1 MiB
+
+struct avio_writer_chunk {
+    uint8_t *data; // aligned to AVIO_WRITER_ALIGNMENT
+    int64_t offset; // position of data in the file
+    size_t len;
+    struct avio_writer_chunk *next;
+};
+
+struct avio_writer_chunk_queue QUEUE(struct avio_writer_chunk);
+
+// Output for a muxer (AVFormatContext.pb), writing to a file asynchronously.
+//
+// The muxer writes into a pool of large chunks, which are written to the file
+// by a dedicated flush thread, so that a slow disk does not stall the caller
+// (unless the whole pool is waiting to be written).
+//
+// Seeking (to patch a header) is supported: the current chunk is submitted,
+// and the following data is written at the new position. The chunks are
+// written in order, so the latest data always wins.
+struct avio_writer {
+    char *filename;
+    int fd;
+    int direct_fd; // opened with O_DIRECT for aligned chunks, or -1
+    AVIOContext *avio;
+
+    SDL_Thread *thread;
+    SDL_mutex *mutex;
+    SDL_cond *cond; // signaled when a chunk is submitted or released
+    bool stopped;
+    bool failed; // set on write failure
+    struct avio_writer_chunk_queue pending; // chunks to write, in order
+    struct avio_writer_chunk_queue free_chunks;
+    unsigned chunk_count;
+
+    // only accessed from the muxer thread
+    struct avio_writer_chunk *current;
+    int64_t pos;
+    int64_t size;
+    uint32_t stalls; // number of times the pool was exhausted
+    int64_t start_time;
+
+    // only accessed from the flush thread (read after join)
+    uint64_t bytes_written;
+    uint64_t write_time; // in us, time spent in write calls
+    uint32_t worst_latency; // in us, for a single chunk
+};
+
+// return true if filename is a regular file or does not exist yet (the
+// writer needs to seek)
+bool
+avio_writer_supports(const char *filename);
+
+// buffer_size is the total size of the chunk pool
+// if preallocate is not 0, reserve the file extents in advance (Linux only)
+// if direct_io is set, write aligned chunks bypassing the page cache
+bool
+avio_writer_open(struct avio_writer *writer, const char *filename,
+                 size_t buffer_size, uint32_t preallocate, bool direct_io);
+
+// write the pending data to the file (e.g. after a complete fragment)
+void
+avio_writer_flush(struct avio_writer *writer);
+
+// flush, wait for all the data to be written, and log the statistics
+// return false if any write failed
+bool
+avio_writer_close(struct avio_writer *writer);
+
+#endif
@@ -71,6 +71,18 @@ scrcpy_print_usage(const char *arg0) {
         "    -h, --help\n"
         "        Print this help.\n"
         "\n"
+        "    --hidden-max-fps value\n"
+        "        Throttle the mirroring while the window is hidden or\n"
+        "        minimized: pause the decoding, and limit the frame rate of\n"
+        "        screen capture to this value (the recording continues, at\n"
+        "        this frame rate). The initial frame rate is restored when\n"
+        "        the window is visible again.\n"
+        "        The device encoder is restarted on each change, so the\n"
+        "        recordings and the replay buffer also receive the throttled\n"
+        "        stream while the window is hidden (the replay buffer keeps\n"
+        "        the content encoded before the restart).\n"
+        "        Default is 0 (disabled).\n"
+        "\n"
         "    --legacy-paste\n"
         "        Inject computer clipboard text as a sequence of key events\n"
         "        on Ctrl+v (like MOD+Shift+v).\n"
@@ -84,6 +96,13 @@ scrcpy_print_usage(const char *arg0) {
         "        90 degrees rotation counterclockwise.\n"
         "        Default is %d%s.\n"
         "\n"
+        "    --max-bit-rate value\n"
+        "        Adapt the bit rate to the throughput of the link to the\n"
+        "        device (measured from the video stream), starting from\n"
+        "        --bit-rate and up to this value.\n"
+        "        Unit suffixes are supported: 'K' (x1000) and 'M' (x1000000).\n"
+        "        Default is 0 (the bit rate is fixed).\n"
+        "\n"
         "    --max-fps value\n"
         "        Limit the frame rate of screen capture (officially supported\n"
         "        since Android 10, but may work on earlier versions).\n"
@@ -120,18 +139,85 @@ scrcpy_print_usage(const char *arg0) {
         "        special character, but breaks the expected behavior of alpha\n"
         "        keys in games (typically WASD).\n"
         "\n"
+        "    --print-input-latency\n"
+        "        Request an acknowledgement from the device for each input\n"
+        "        event, once injected, and print the input latency (at each\n"
+        "        stage, from the computer event to the device injection) on\n"
+        "        exit.\n"
+        "\n"
         "    --push-target path\n"
         "        Set the target directory for pushing files to the device by\n"
         "        drag & drop. It is passed as-is to \"adb push\".\n"
         "        Default is \"/sdcard/\".\n"
         "\n"
         "    -r, --record file.mp4\n"
-        "        Record screen to file.\n"
+        "        Record screen to file (\"-\" for stdout).\n"
         "        The format is determined by the --record-format option if\n"
-        "        set, or by the file extension (.mp4 or .mkv).\n"
+        "        set, or by the file extension (.mp4, .mkv or .ts). Stdout\n"
+        "        is recorded to MPEG-TS by default.\n"
+        "        This option may be repeated to record to several outputs at\n"
+        "        once (up to %d), each written from its own thread.\n"
+        "\n"
+        "    --record-buffer-size bytes\n"
+        "        Set the size of the buffer used to write the recording\n"
+        "        asynchronously (from a separate thread), so that a slow disk\n"
+        "        does not delay the recorder. Set 0 to write synchronously.\n"
+        "        Supports suffix 'K' and 'M'. Not supported on Windows.\n"
+        "        Default is 16M.\n"
+        "\n"
+        "    --record-direct-io\n"
+        "        Write the recording bypassing the system page cache (with\n"
+        "        O_DIRECT), to avoid filling the cache with data which will\n"
+        "        not be read. Requires the buffered writer (see\n"
+        "        --record-buffer-size).\n"
         "\n"
         "    --record-format format\n"
-        "        Force recording format (either mp4 or mkv).\n"
+        "        Force recording format (either mp4, mkv or ts) of the\n"
+        "        previous --record (or of the first one if it is passed\n"
+        "        before any --record).\n"
+        "\n"
+        "    --record-fragment-duration ms\n"
+        "        Start a new MP4 fragment every ms milliseconds (implies\n"
+        "        --record-fragmented).\n"
+        "\n"
+        "    --record-fragmented\n"
+        "        Record to a fragmented MP4 file: the sample index is written\n"
+        "        along the stream (a new fragment on each keyframe) instead of\n"
+        "        at the end, so that the recording stops immediately and the\n"
+        "        file remains playable if scrcpy is killed.\n"
+        "\n"
+        "    --record-index\n"
+        "        Write an index of the recorded frames to <file>.idx along\n"
+        "        the recording (one line per frame: pts in microseconds,\n"
+        "        offset of the keyframe cluster/fragment in the file or -1,\n"
+        "        size, keyframe flag), usable even if the recording is\n"
+        "        interrupted.\n"
+        "\n"
+        "    --record-on-demand\n"
+        "        Do not start recording immediately: start and stop it at\n"
+        "        runtime with MOD+Shift+r (or SIGUSR2 on Linux and macOS).\n"
+        "        A new recording starts immediately (from the last\n"
+        "        keyframe). The record filename may contain a pattern for\n"
+        "        the recording index (e.g. --record file_%%03d.mp4).\n"
+        "\n"
+        "    --record-preallocate bytes\n"
+        "        Reserve the given size on disk for each recording file in\n"
+        "        advance, to reduce fragmentation (Linux only). Supports\n"
+        "        suffix 'K' and 'M'. Requires the buffered writer (see\n"
+        "        --record-buffer-size).\n"
+        "\n"
+        "    --record-segment-duration seconds\n"
+        "        Split the recording into several files: a new file is\n"
+        "        started on the first keyframe after the given duration.\n"
+        "        The record filename must contain a pattern for the segment\n"
+        "        index (e.g. --record file_%%03d.mp4).\n"
+        "\n"
+        "    --record-segment-size bytes\n"
+        "        Split the recording into several files: a new file is\n"
+        "        started on the first keyframe once the current one exceeds\n"
+        "        the given size. Supports suffix 'K' and 'M'.\n"
+        "        The record filename must contain a pattern for the segment\n"
+        "        index (e.g. --record file_%%03d.mp4).\n"
         "\n"
         "    --render-driver name\n"
         "        Request SDL to use the given render driver (this is just a\n"
@@ -146,6 +232,25 @@ scrcpy_print_usage(const char *arg0) {
         "        This flag forces to render all frames, at a cost of a\n"
         "        possible increased latency.\n"
         "\n"
+        "    --replay-buffer seconds\n"
+        "        Keep (at least) the last given seconds of video in memory,\n"
+        "        to save them on demand (MOD+Shift+s, or SIGUSR1 on Linux\n"
+        "        and macOS) to the file given by --replay-file.\n"
+        "\n"
+        "    --replay-buffer-size bytes\n"
+        "        Limit the memory used by the replay buffer (whole GOPs are\n"
+        "        discarded). Supports suffix 'K' and 'M'.\n"
+        "\n"
+        "    --replay-file file.mp4\n"
+        "        Set the file to save the replay buffer to. It may contain a\n"
+        "        pattern for the replay index (e.g. replay_%%03d.mp4).\n"
+        "        The format is determined by the file extension (.mp4 or\n"
+        "        .mkv).\n"
+        "        If the device encoder configuration changed (e.g. on\n"
+        "        rotation), one file is written per configuration (using the\n"
+        "        next indexes). Without a pattern, only the content after the\n"
+        "        last change is saved.\n"
+        "\n"
         "    --rotation value\n"
         "        Set the initial display rotation.\n"
         "        Possibles values are 0, 1, 2 and 3. Each increment adds a 90\n"
@@ -176,9 +281,38 @@ scrcpy_print_usage(const char *arg0) {
         "        on exit.\n"
         "        It only shows physical touches (not clicks from scrcpy).\n"
         "\n"
+        "    --touch-batch-window ms\n"
+        "        Batch the consecutive touch moves received by the device\n"
+        "        within this window into a single injected event (the older\n"
+        "        moves are injected as its history, so the gesture velocity\n"
+        "        is preserved). This delays the moves by at most this\n"
+        "        duration.\n"
+        "        Default is 0 (disabled).\n"
+        "\n"
 #ifdef V4L2SINK
         "    --v4l2sink /dev/videoN\n"
-        "        Output to v4l2loopback device. Doesn't support screen rotation.\n"
+        "        Output to v4l2loopback device.\n"
+        "        The frames are written as raw images, in yuv420p by default\n"
+        "        (see --v4l2sink-format). An existing regular file or pipe\n"
+        "        may also be given instead of a device.\n"
+        "\n"
+        "    --v4l2sink-format format\n"
+        "        Pixel format of the frames written to the v4l2sink: yuv420p,\n"
+        "        nv12, yuyv or rgb24.\n"
+        "        Default is yuv420p (no conversion).\n"
+        "\n"
+        "    --v4l2sink-fps value\n"
+        "        Write the frames to the v4l2sink at a constant rate: on each\n"
+        "        tick, the latest frame is written (repeated if the device\n"
+        "        screen did not change, intermediate frames are dropped).\n"
+        "        By default, the frames are written as soon as they arrive.\n"
+        "\n"
+        "    --v4l2sink-size WIDTHxHEIGHT\n"
+        "        Fixed size of the frames written to the v4l2sink (e.g.\n"
+        "        1280x720). The device frames are scaled to fit, with black\n"
+        "        borders, so that rotations never change the output format.\n"
+        "        Default is the initial device frame size (the frames are\n"
+        "        then scaled down on rotation).\n"
         "\n"
 #endif
         "    -v, --version\n"
@@ -252,6 +386,9 @@ scrcpy_print_usage(const char *arg0) {
         "    MOD+s\n"
         "        Click on APP_SWITCH\n"
         "\n"
+        "    MOD+Shift+s\n"
+        "        Save the replay buffer (see --replay-buffer)\n"
+        "\n"
         "    MOD+m\n"
         "        Click on MENU\n"
         "\n"
@@ -276,6 +413,9 @@ scrcpy_print_usage(const char *arg0) {
         "    MOD+r\n"
         "        Rotate device screen\n"
         "\n"
+        "    MOD+Shift+r\n"
+        "        Start/stop recording (see --record-on-demand)\n"
+        "\n"
         "    MOD+n\n"
         "        Expand notification panel\n"
         "\n"
@@ -308,7 +448,8 @@ scrcpy_print_usage(const char *arg0) {
         DEFAULT_BIT_RATE,
         DEFAULT_LOCK_VIDEO_ORIENTATION, DEFAULT_LOCK_VIDEO_ORIENTATION >= 0 ? "" : " (unlocked)",
         DEFAULT_MAX_SIZE, DEFAULT_MAX_SIZE ? "" : " (unlimited)",
-        DEFAULT_LOCAL_PORT_RANGE_FIRST, DEFAULT_LOCAL_PORT_RANGE_LAST);
+        DEFAULT_LOCAL_PORT_RANGE_FIRST, DEFAULT_LOCAL_PORT_RANGE_LAST,
+        SC_MAX_RECORD_OUTPUTS);
 }
 
 static bool
@@ -395,6 +536,18 @@ parse_max_fps(const char *s, uint16_t *max_fps) {
     return true;
 }
 
+static bool
+parse_hidden_max_fps(const char *s, uint16_t *max_fps) {
+    long value;
+    bool ok = parse_integer_arg(s, &value, false, 0, 1000, "hidden max fps");
+    if (!ok) {
+        return false;
+    }
+
+    *max_fps = (uint16_t) value;
+    return true;
+}
+
 static bool
 parse_lock_video_orientation(const char *s, int8_t *lock_video_orientation) {
     long value;
@@ -627,14 +780,208 @@ parse_record_format(const char *optarg, enum sc_record_format *format) {
         *format = SC_RECORD_FORMAT_MKV;
         return true;
     }
+    if (!strcmp(optarg, "ts")) {
+        *format = SC_RECORD_FORMAT_TS;
+        return true;
+    }
 
-    LOGE("Unsupported format: %s (expected mp4 or mkv)", optarg);
+    LOGE("Unsupported format: %s (expected mp4, mkv or ts)", optarg);
     return false;
 }
 
+#ifdef V4L2SINK
+static bool
+parse_v4l2sink_format(const char *optarg, enum sc_v4l2sink_format *format) {
+    if (!strcmp(optarg, "yuv420p")) {
+        *format = SC_V4L2SINK_FORMAT_YUV420P;
+        return true;
+    }
+    if (!strcmp(optarg, "nv12")) {
+        *format = SC_V4L2SINK_FORMAT_NV12;
+        return true;
+    }
+    if (!strcmp(optarg, "yuyv")) {
+        *format = SC_V4L2SINK_FORMAT_YUYV;
+        return true;
+    }
+    if (!strcmp(optarg, "rgb24")) {
+        *format = SC_V4L2SINK_FORMAT_RGB24;
+        return true;
+    }
+
+    LOGE("Unsupported v4l2sink format: %s (expected yuv420p, nv12, yuyv or "
+         "rgb24)", optarg);
+    return false;
+}
+
+static bool
+parse_v4l2sink_size(const char *s, uint16_t *width, uint16_t *height) {
+    long values[2];
+    size_t count = parse_integers(s, 'x', 2, values);
+    if (count != 2) {
+        LOGE("Could not parse v4l2sink size (expected WIDTHxHEIGHT): %s", s);
+        return false;
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        // the dimensions must be even for YUV 4:2:0
+        if (values[i] < 2 || values[i] > 0xFFFF || values[i] % 2) {
+            LOGE("Invalid v4l2sink size (dimensions must be even): %s", s);
+            return false;
+        }
+    }
+
+    *width = (uint16_t) values[0];
+    *height = (uint16_t) values[1];
+    return true;
+}
+
+static bool
+parse_v4l2sink_fps(const char *s, uint16_t *fps) {
+    long value;
+    bool ok = parse_integer_arg(s, &value, false, 1, 240, "v4l2sink fps");
+    if (!ok) {
+        return false;
+    }
+
+    *fps = (uint16_t) value;
+    return true;
+}
+#endif
+
+static bool
+parse_max_bit_rate(const char *s, uint32_t *bit_rate) {
+    long value;
+    bool ok = parse_integer_arg(s, &value, true, 0, 0x7FFFFFFF,
+                                "max bit-rate");
+    if (!ok) {
+        return false;
+    }
+
+    *bit_rate = (uint32_t) value;
+    return true;
+}
+
+static bool
+parse_touch_batch_window(const char *s, uint16_t *window) {
+    long value;
+    bool ok = parse_integer_arg(s, &value, false, 0, 1000,
+                                "touch batch window");
+    if (!ok) {
+        return false;
+    }
+
+    *window = (uint16_t) value;
+    return true;
+}
+
+static bool
+parse_record_fragment_duration(const char *s, uint32_t *duration) {
+    long value;
+    bool ok = parse_integer_arg(s, &value, false, 1, 0x7FFFFFFF,
+                                "record fragment duration");
+    if (!ok) {
+        return false;
+    }
+
+    *duration = (uint32_t) value;
+    return true;
+}
+
+static bool
+parse_record_segment_duration(const char *s, uint32_t *duration) {
+    long value;
+    bool ok = parse_integer_arg(s, &value, false, 1, 0x7FFFFFFF,
+                                "record segment duration");
+    if (!ok) {
+        return false;
+    }
+
+    *duration = (uint32_t) value;
+    return true;
+}
+
+static bool
+parse_record_segment_size(const char *s, uint32_t *size) {
+    long value;
+    // long may be 32 bits (it is the case on mingw), so do not use more than
+    // 31 bits (long is signed)
+    bool ok = parse_integer_arg(s, &value, true, 1, 0x7FFFFFFF,
+                                "record segment size");
+    if (!ok) {
+        return false;
+    }
+
+    *size = (uint32_t) value;
+    return true;
+}
+
+static bool
+parse_record_buffer_size(const char *s, uint32_t *size) {
+    long value;
+    // long may be 32 bits (it is the case on mingw), so do not use more than
+    // 31 bits (long is signed)
+    bool ok = parse_integer_arg(s, &value, true, 0, 0x7FFFFFFF,
+                                "record buffer size");
+    if (!ok) {
+        return false;
+    }
+
+    *size = (uint32_t) value;
+    return true;
+}
+
+static bool
+parse_record_preallocate(const char *s, uint32_t *size) {
+    long value;
+    bool ok = parse_integer_arg(s, &value, true, 1, 0x7FFFFFFF,
+                                "record preallocation size");
+    if (!ok) {
+        return false;
+    }
+
+    *size = (uint32_t) value;
+    return true;
+}
+
+static bool
+parse_replay_buffer(const char *s, uint32_t *duration) {
+    long value;
+    bool ok = parse_integer_arg(s, &value, false, 1, 0x7FFFFFFF,
+                                "replay buffer duration");
+    if (!ok) {
+        return false;
+    }
+
+    *duration = (uint32_t) value;
+    return true;
+}
+
+static bool
+parse_replay_buffer_size(const char *s, uint32_t *size) {
+    long value;
+    // long may be 32 bits (it is the case on mingw), so do not use more than
+    // 31 bits (long is signed)
+    bool ok = parse_integer_arg(s, &value, true, 1, 0x7FFFFFFF,
+                                "replay buffer size");
+    if (!ok) {
+        return false;
+    }
+
+    *size = (uint32_t) value;
+    return true;
+}
+
 static enum sc_record_format
 guess_record_format(const char *filename) {
+    if (!strcmp(filename, "-")) {
+        // stdout is not seekable, MPEG-TS is designed for streaming
+        return SC_RECORD_FORMAT_TS;
+    }
     size_t len = strlen(filename);
+    if (len >= 3 && !strcmp(&filename[len - 3], ".ts")) {
+        return SC_RECORD_FORMAT_TS;
+    }
     if (len < 4) {
         return 0;
     }
@@ -675,6 +1022,127 @@ guess_record_format(const char *filename) {
 #define OPT_LEGACY_PASTE           1024
 #define OPT_ENCODER_NAME           1025
 #define OPT_V4L2SINK               1026
+#define OPT_RECORD_FRAGMENTED      1027
+#define OPT_RECORD_FRAGMENT_DURATION 1028
+#define OPT_RECORD_SEGMENT_DURATION 1029
+#define OPT_RECORD_SEGMENT_SIZE    1030
+#define OPT_REPLAY_BUFFER          1031
+#define OPT_REPLAY_BUFFER_SIZE     1032
+#define OPT_REPLAY_FILE            1033
+#define OPT_RECORD_ON_DEMAND       1034
+#define OPT_RECORD_BUFFER_SIZE     1035
+#define OPT_RECORD_PREALLOCATE     1036
+#define OPT_RECORD_DIRECT_IO       1037
+#define OPT_RECORD_INDEX           1038
+#define OPT_V4L2SINK_FORMAT        1039
+#define OPT_V4L2SINK_SIZE          1040
+#define OPT_V4L2SINK_FPS           1041
+#define OPT_PRINT_INPUT_LATENCY    1042
+#define OPT_TOUCH_BATCH_WINDOW     1043
+#define OPT_MAX_BIT_RATE           1044
+#define OPT_HIDDEN_MAX_FPS         1045
+
+// --record-format applies to the last --record, or to the first one if it is
+// passed before any --record
+static bool
+set_record_format(struct scrcpy_options *opts, const char *s,
+                  enum sc_record_format *pending) {
+    enum sc_record_format format;
+    if (!parse_record_format(s, &format)) {
+        return false;
+    }
+
+    if (opts->record_output_count) {
+        opts->record_outputs[opts->record_output_count - 1].format = format;
+    } else {
+        *pending = format;
+    }
+    return true;
+}
+
+static bool
+add_record_output(struct scrcpy_options *opts, const char *filename) {
+    if (opts->record_output_count == SC_MAX_RECORD_OUTPUTS) {
+        LOGE("Too many recording outputs (max %d)", SC_MAX_RECORD_OUTPUTS);
+        return false;
+    }
+
+    struct sc_record_output *output =
+        &opts->record_outputs[opts->record_output_count++];
+    output->filename = filename;
+    output->format = SC_RECORD_FORMAT_AUTO;
+    return true;
+}
+
+static bool
+check_record_outputs(struct scrcpy_options *opts,
+                     enum sc_record_format pending_format) {
+    if (pending_format) {
+        if (!opts->record_output_count) {
+            LOGE("Record format specified without recording");
+            return false;
+        }
+        if (!opts->record_outputs[0].format) {
+            opts->record_outputs[0].format = pending_format;
+        }
+    }
+
+    bool has_mp4 = false;
+    bool has_stdout = false;
+    for (unsigned i = 0; i < opts->record_output_count; ++i) {
+        struct sc_record_output *output = &opts->record_outputs[i];
+        bool is_stdout = !strcmp(output->filename, "-");
+        if (is_stdout) {
+            if (has_stdout) {
+                LOGE("Stdout may only be used by one recording output");
+                return false;
+            }
+            has_stdout = true;
+        }
+
+        if (!output->format) {
+            output->format = guess_record_format(output->filename);
+            if (!output->format) {
+                LOGE("No format specified for \"%s\" (try with -F mkv)",
+                     output->filename);
+                return false;
+            }
+        }
+
+        if (output->format == SC_RECORD_FORMAT_MP4) {
+            has_mp4 = true;
+            if (is_stdout && !opts->record_fragmented) {
+                // the mp4 muxer must seek back to write the index
+                LOGE("Recording mp4 to stdout requires --record-fragmented");
+                return false;
+            }
+        }
+    }
+
+    if (opts->record_fragmented) {
+        if (!opts->record_output_count) {
+            LOGE("Fragmented recording specified without recording");
+            return false;
+        }
+        if (!has_mp4) {
+            LOGE("Fragmented recording is only supported for mp4");
+            return false;
+        }
+    }
+
+    if (opts->record_segment_duration || opts->record_segment_size) {
+        if (!opts->record_output_count) {
+            LOGE("Segmented recording specified without recording");
+            return false;
+        }
+        if (has_stdout) {
+            LOGE("Segmented recording is not supported on stdout");
+            return false;
+        }
+    }
+
+    return true;
+}
 
 bool
 scrcpy_parse_args(struct scrcpy_cli_args *args, int argc, char *argv[]) {
@@ -693,9 +1161,12 @@ scrcpy_parse_args(struct scrcpy_cli_args *args, int argc, char *argv[]) {
                                                   OPT_FORWARD_ALL_CLICKS},
         {"fullscreen",             no_argument,       NULL, 'f'},
         {"help",                   no_argument,       NULL, 'h'},
+        {"hidden-max-fps",         required_argument, NULL,
+                                                  OPT_HIDDEN_MAX_FPS},
         {"legacy-paste",           no_argument,       NULL, OPT_LEGACY_PASTE},
         {"lock-video-orientation", required_argument, NULL,
                                                   OPT_LOCK_VIDEO_ORIENTATION},
+        {"max-bit-rate",           required_argument, NULL, OPT_MAX_BIT_RATE},
         {"max-fps",                required_argument, NULL, OPT_MAX_FPS},
         {"max-size",               required_argument, NULL, 'm'},
         {"no-control",             no_argument,       NULL, 'n'},
@@ -704,20 +1175,49 @@ scrcpy_parse_args(struct scrcpy_cli_args *args, int argc, char *argv[]) {
         {"no-mipmaps",             no_argument,       NULL, OPT_NO_MIPMAPS},
         {"port",                   required_argument, NULL, 'p'},
         {"prefer-text",            no_argument,       NULL, OPT_PREFER_TEXT},
+        {"print-input-latency",    no_argument,       NULL,
+                                                  OPT_PRINT_INPUT_LATENCY},
         {"push-target",            required_argument, NULL, OPT_PUSH_TARGET},
         {"record",                 required_argument, NULL, 'r'},
+        {"record-buffer-size",     required_argument, NULL,
+                                                  OPT_RECORD_BUFFER_SIZE},
+        {"record-direct-io",       no_argument,       NULL,
+                                                  OPT_RECORD_DIRECT_IO},
         {"record-format",          required_argument, NULL, OPT_RECORD_FORMAT},
+        {"record-fragment-duration", required_argument, NULL,
+                                                  OPT_RECORD_FRAGMENT_DURATION},
+        {"record-fragmented",      no_argument,       NULL,
+                                                  OPT_RECORD_FRAGMENTED},
+        {"record-index",           no_argument,       NULL, OPT_RECORD_INDEX},
+        {"record-on-demand",       no_argument,       NULL,
+                                                  OPT_RECORD_ON_DEMAND},
+        {"record-preallocate",     required_argument, NULL,
+                                                  OPT_RECORD_PREALLOCATE},
+        {"record-segment-duration", required_argument, NULL,
+                                                  OPT_RECORD_SEGMENT_DURATION},
+        {"record-segment-size",    required_argument, NULL,
+                                                  OPT_RECORD_SEGMENT_SIZE},
         {"render-driver",          required_argument, NULL, OPT_RENDER_DRIVER},
         {"render-expired-frames",  no_argument,       NULL,
                                                   OPT_RENDER_EXPIRED_FRAMES},
+        {"replay-buffer",          required_argument, NULL, OPT_REPLAY_BUFFER},
+        {"replay-buffer-size",     required_argument, NULL,
+                                                  OPT_REPLAY_BUFFER_SIZE},
+        {"replay-file",            required_argument, NULL, OPT_REPLAY_FILE},
         {"rotation",               required_argument, NULL, OPT_ROTATION},
         {"serial",                 required_argument, NULL, 's'},
         {"shortcut-mod",           required_argument, NULL, OPT_SHORTCUT_MOD},
         {"show-touches",           no_argument,       NULL, 't'},
         {"stay-awake",             no_argument,       NULL, 'w'},
+        {"touch-batch-window",     required_argument, NULL,
+                                                  OPT_TOUCH_BATCH_WINDOW},
         {"turn-screen-off",        no_argument,       NULL, 'S'},
 #ifdef V4L2SINK
         {"v4l2sink",               required_argument, NULL, OPT_V4L2SINK},
+        {"v4l2sink-format",        required_argument, NULL,
+                                                  OPT_V4L2SINK_FORMAT},
+        {"v4l2sink-fps",           required_argument, NULL, OPT_V4L2SINK_FPS},
+        {"v4l2sink-size",          required_argument, NULL, OPT_V4L2SINK_SIZE},
 #endif
         {"verbosity",              required_argument, NULL, 'V'},
         {"version",                no_argument,       NULL, 'v'},
@@ -735,6 +1235,8 @@ scrcpy_parse_args(struct scrcpy_cli_args *args, int argc, char *argv[]) {
 
     optind = 0; // reset to start from the first argument in tests
 
+    enum sc_record_format pending_record_format = SC_RECORD_FORMAT_AUTO;
+
     int c;
     while ((c = getopt_long(argc, argv, "b:c:fF:hm:nNp:r:s:StTvV:w",
                             long_options, NULL)) != -1) {
@@ -762,13 +1264,23 @@ scrcpy_parse_args(struct scrcpy_cli_args *args, int argc, char *argv[]) {
                 LOGW("Deprecated option -F. Use --record-format instead.");
                 // fall through
             case OPT_RECORD_FORMAT:
-                if (!parse_record_format(optarg, &opts->record_format)) {
+                if (!set_record_format(opts, optarg, &pending_record_format)) {
                     return false;
                 }
                 break;
             case 'h':
                 args->help = true;
                 break;
+            case OPT_HIDDEN_MAX_FPS:
+                if (!parse_hidden_max_fps(optarg, &opts->hidden_max_fps)) {
+                    return false;
+                }
+                break;
+            case OPT_MAX_BIT_RATE:
+                if (!parse_max_bit_rate(optarg, &opts->max_bit_rate)) {
+                    return false;
+                }
+                break;
             case OPT_MAX_FPS:
                 if (!parse_max_fps(optarg, &opts->max_fps)) {
                     return false;
@@ -796,7 +1308,9 @@ scrcpy_parse_args(struct scrcpy_cli_args *args, int argc, char *argv[]) {
                 }
                 break;
             case 'r':
-                opts->record_filename = optarg;
+                if (!add_record_output(opts, optarg)) {
+                    return false;
+                }
                 break;
             case 's':
                 opts->serial = optarg;
@@ -896,10 +1410,92 @@ scrcpy_parse_args(struct scrcpy_cli_args *args, int argc, char *argv[]) {
             case OPT_LEGACY_PASTE:
                 opts->legacy_paste = true;
                 break;
+            case OPT_PRINT_INPUT_LATENCY:
+                opts->print_input_latency = true;
+                break;
+            case OPT_TOUCH_BATCH_WINDOW:
+                if (!parse_touch_batch_window(optarg,
+                                              &opts->touch_batch_window)) {
+                    return false;
+                }
+                break;
+            case OPT_RECORD_FRAGMENTED:
+                opts->record_fragmented = true;
+                break;
+            case OPT_RECORD_FRAGMENT_DURATION:
+                if (!parse_record_fragment_duration(optarg,
+                                        &opts->record_fragment_duration)) {
+                    return false;
+                }
+                opts->record_fragmented = true;
+                break;
+            case OPT_RECORD_INDEX:
+                opts->record_index = true;
+                break;
+            case OPT_RECORD_ON_DEMAND:
+                opts->record_on_demand = true;
+                break;
+            case OPT_RECORD_SEGMENT_DURATION:
+                if (!parse_record_segment_duration(optarg,
+                                        &opts->record_segment_duration)) {
+                    return false;
+                }
+                break;
+            case OPT_RECORD_SEGMENT_SIZE:
+                if (!parse_record_segment_size(optarg,
+                                               &opts->record_segment_size)) {
+                    return false;
+                }
+                break;
+            case OPT_RECORD_BUFFER_SIZE:
+                if (!parse_record_buffer_size(optarg,
+                                              &opts->record_buffer_size)) {
+                    return false;
+                }
+                break;
+            case OPT_RECORD_PREALLOCATE:
+                if (!parse_record_preallocate(optarg,
+                                              &opts->record_preallocate)) {
+                    return false;
+                }
+                break;
+            case OPT_RECORD_DIRECT_IO:
+                opts->record_direct_io = true;
+                break;
+            case OPT_REPLAY_BUFFER:
+                if (!parse_replay_buffer(optarg, &opts->replay_buffer)) {
+                    return false;
+                }
+                break;
+            case OPT_REPLAY_BUFFER_SIZE:
+                if (!parse_replay_buffer_size(optarg,
+                                              &opts->replay_buffer_size)) {
+                    return false;
+                }
+                break;
+            case OPT_REPLAY_FILE:
+                opts->replay_filename = optarg;
+                break;
 #ifdef V4L2SINK
             case OPT_V4L2SINK:
                 opts->v4l2sink_device = optarg;
                 break;
+            case OPT_V4L2SINK_FORMAT:
+                if (!parse_v4l2sink_format(optarg, &opts->v4l2sink_format)) {
+                    return false;
+                }
+                break;
+            case OPT_V4L2SINK_FPS:
+                if (!parse_v4l2sink_fps(optarg, &opts->v4l2sink_fps)) {
+                    return false;
+                }
+                break;
+            case OPT_V4L2SINK_SIZE:
+                if (!parse_v4l2sink_size(optarg, &opts->v4l2sink_width,
+                                         &opts->v4l2sink_height)) {
+                    return false;
+                }
+                break;
 #endif
             default:
                 // getopt prints the error message on stderr
@@ -907,11 +1503,12 @@ scrcpy_parse_args(struct scrcpy_cli_args *args, int argc, char *argv[]) {
         }
     }
 
-    if (!opts->display && !opts->record_filename && !opts->v4l2sink_device) {
+    if (!opts->display && !opts->record_output_count && !opts->v4l2sink_device
+            && !opts->replay_buffer) {
 #ifdef V4L2SINK
-        LOGE("-N/--no-display requires screen recording (-r/--record) or sink to v4l2loopback device (--v4l2sink)");
+        LOGE("-N/--no-display requires screen recording (-r/--record), replay buffer (--replay-buffer) or sink to v4l2loopback device (--v4l2sink)");
 #else
-        LOGE("-N/--no-display requires screen recording (-r/--record)");
+        LOGE("-N/--no-display requires screen recording (-r/--record) or replay buffer (--replay-buffer)");
 #endif
         return false;
     }
@@ -922,20 +1519,63 @@ scrcpy_parse_args(struct scrcpy_cli_args *args, int argc, char *argv[]) {
         return false;
     }
 
-    if (opts->record_format && !opts->record_filename) {
-        LOGE("Record format specified without recording");
+    if (!check_record_outputs(opts, pending_record_format)) {
         return false;
     }
 
-    if (opts->record_filename && !opts->record_format) {
-        opts->record_format = guess_record_format(opts->record_filename);
-        if (!opts->record_format) {
-            LOGE("No format specified for \"%s\" (try with -F mkv)",
-                 opts->record_filename);
+    if (opts->record_on_demand) {
+        if (!opts->record_output_count) {
+            LOGE("On-demand recording requires a record file (-r/--record)");
+            return false;
+        }
+        if (opts->record_segment_duration || opts->record_segment_size) {
+            LOGE("On-demand recording does not support segments");
             return false;
         }
     }
 
+    if (opts->record_index && !opts->record_output_count) {
+        LOGE("Record index specified without recording");
+        return false;
+    }
+
+    if (opts->record_preallocate || opts->record_direct_io) {
+        if (!opts->record_output_count) {
+            LOGE("Record I/O options specified without recording");
+            return false;
+        }
+        if (!opts->record_buffer_size) {
+            LOGE("Preallocation and direct I/O require the buffered writer "
+                 "(--record-buffer-size)");
+            return false;
+        }
+    }
+
+    if (opts->replay_buffer) {
+        if (!opts->replay_filename) {
+            LOGE("Replay buffer requires a replay file (--replay-file)");
+            return false;
+        }
+        opts->replay_format = guess_record_format(opts->replay_filename);
+        if (!opts->replay_format) {
+            LOGE("No format specified for \"%s\" (expected .mp4 or .mkv)",
+                 opts->replay_filename);
+            return false;
+        }
+    } else if (opts->replay_buffer_size || opts->replay_filename) {
+        LOGE("Replay options specified without replay buffer");
+        return false;
+    }
+
+#ifdef V4L2SINK
+    if ((opts->v4l2sink_format != SC_V4L2SINK_FORMAT_YUV420P
+            || opts->v4l2sink_width || opts->v4l2sink_fps)
+            && !opts->v4l2sink_device) {
+        LOGE("V4l2sink options specified without v4l2sink (--v4l2sink)");
+        return false;
+    }
+#endif
+
     if (!opts->control && opts->turn_screen_off) {
         LOGE("Could not request to turn screen off if control is disabled");
         return false;
@@ -946,5 +1586,33 @@ scrcpy_parse_args(struct scrcpy_cli_args *args, int argc, char *argv[]) {
         return false;
     }
 
+    if (!opts->control && opts->print_input_latency) {
+        LOGE("Could not measure input latency if control is disabled");
+        return false;
+    }
+
+    if (!opts->control && opts->touch_batch_window) {
+        LOGE("Could not batch touch events if control is disabled");
+        return false;
+    }
+
+    if (opts->hidden_max_fps && (!opts->control || !opts->display)) {
+        LOGE("Could not throttle the hidden window if control or display is "
+             "disabled");
+        return false;
+    }
+
+    if (opts->max_bit_rate) {
+        if (opts->max_bit_rate < opts->bit_rate) {
+            LOGE("The max bit-rate must not be lower than the bit-rate");
+            return false;
+        }
+        if (!opts->control || !opts->display) {
+            LOGE("Could not adapt the bit rate if control or display is "
+                 "disabled");
+            return false;
+        }
+    }
+
     return true;
 }
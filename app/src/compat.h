@@ -25,6 +25,17 @@
 # define SCRCPY_LAVF_REQUIRES_REGISTER_ALL
 #endif
 
+// In ffmpeg/doc/APIchanges:
+// 2017-09-01 - xxxxxxx - lavf 57.80.100 / 57.11.0 - avio.h
+//   Add avio_context_free(). From now on it must be used for freeing
+//   AVIOContext.
+#if    (LIBAVFORMAT_VERSION_MICRO >= 100 /* FFmpeg */ && \
+        LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(57, 80, 100)) \
+    || (LIBAVFORMAT_VERSION_MICRO < 100 && /* Libav */ \
+        LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(57, 11, 0))
+# define SCRCPY_LAVF_HAS_AVIO_CONTEXT_FREE
+#endif
+
 // In ffmpeg/doc/APIchanges:
 // 2016-04-21 - 7fc329e - lavc 57.37.100 - avcodec.h
 //   Add a new audio/video encoding and decoding API with decoupled input
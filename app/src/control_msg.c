@@ -77,11 +77,25 @@ control_msg_serialize(const struct control_msg *msg, unsigned char *buf) {
         case CONTROL_MSG_TYPE_SET_SCREEN_POWER_MODE:
             buf[1] = msg->set_screen_power_mode.mode;
             return 2;
+        case CONTROL_MSG_TYPE_REQUEST_ACK:
+            buffer_write32be(&buf[1], msg->request_ack.sequence);
+            buffer_write64be(&buf[5], msg->request_ack.timestamp);
+            return 13;
+        case CONTROL_MSG_TYPE_SET_PROTOCOL_VERSION:
+            buf[1] = msg->set_protocol_version.version;
+            return 2;
+        case CONTROL_MSG_TYPE_SET_BIT_RATE:
+            buffer_write32be(&buf[1], msg->set_bit_rate.bit_rate);
+            return 5;
+        case CONTROL_MSG_TYPE_SET_MAX_FPS:
+            buffer_write16be(&buf[1], msg->set_max_fps.max_fps);
+            return 3;
         case CONTROL_MSG_TYPE_BACK_OR_SCREEN_ON:
         case CONTROL_MSG_TYPE_EXPAND_NOTIFICATION_PANEL:
         case CONTROL_MSG_TYPE_COLLAPSE_NOTIFICATION_PANEL:
         case CONTROL_MSG_TYPE_GET_CLIPBOARD:
         case CONTROL_MSG_TYPE_ROTATE_DEVICE:
+        case CONTROL_MSG_TYPE_REQUEST_KEYFRAME:
             // no additional data
             return 1;
         default:
@@ -90,6 +104,174 @@ control_msg_serialize(const struct control_msg *msg, unsigned char *buf) {
     }
 }
 
+void
+control_msg_encoder_init(struct control_msg_encoder *encoder) {
+    encoder->screen_size.width = 0;
+    encoder->screen_size.height = 0;
+    for (unsigned i = 0; i < CONTROL_MSG_COMPACT_MAX_POINTERS; ++i) {
+        struct control_msg_compact_pointer *pointer = &encoder->pointers[i];
+        pointer->active = false;
+        pointer->pointer_id = 0;
+        pointer->point.x = 0;
+        pointer->point.y = 0;
+        pointer->pressure = 0;
+        pointer->buttons = 0;
+    }
+}
+
+// unsigned LEB128
+static size_t
+write_varint(uint32_t value, unsigned char *buf) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        buf[len++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    buf[len++] = value;
+    return len;
+}
+
+// zigzag encoding, so that small negative values are small too
+static size_t
+write_signed_varint(int32_t value, unsigned char *buf) {
+    uint32_t zigzag = ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+    return write_varint(zigzag, buf);
+}
+
+static inline bool
+is_compact_action(enum android_motionevent_action action) {
+    return action == AMOTION_EVENT_ACTION_DOWN
+        || action == AMOTION_EVENT_ACTION_UP
+        || action == AMOTION_EVENT_ACTION_MOVE;
+}
+
+// return the compact index of the pointer of a touch event, or -1 if it has
+// none (and none can be assigned)
+static int
+get_compact_index(const struct control_msg_encoder *encoder,
+                  const struct control_msg *msg) {
+    if (!is_compact_action(msg->inject_touch_event.action)) {
+        return -1;
+    }
+
+    int free_index = -1;
+    for (int i = 0; i < CONTROL_MSG_COMPACT_MAX_POINTERS; ++i) {
+        const struct control_msg_compact_pointer *pointer =
+            &encoder->pointers[i];
+        if (pointer->active) {
+            if (pointer->pointer_id == msg->inject_touch_event.pointer_id) {
+                return i;
+            }
+        } else if (free_index == -1) {
+            free_index = i;
+        }
+    }
+
+    // An index is only assigned when the pointer goes down, so that a pointer
+    // down before the protocol version 2 is enabled keeps its version 1
+    // encoding until it goes up.
+    if (msg->inject_touch_event.action != AMOTION_EVENT_ACTION_DOWN) {
+        return -1;
+    }
+    return free_index;
+}
+
+static inline bool
+size_equals(struct size a, struct size b) {
+    return a.width == b.width && a.height == b.height;
+}
+
+// head byte: index (4 bits), action (2 bits), pressure flag, buttons flag
+#define COMPACT_HAS_PRESSURE 0x40
+#define COMPACT_HAS_BUTTONS 0x80
+
+static size_t
+write_compact_touch(struct control_msg_encoder *encoder, unsigned index,
+                    const struct control_msg *msg, unsigned char *buf) {
+    struct control_msg_compact_pointer *pointer = &encoder->pointers[index];
+    const struct point *point = &msg->inject_touch_event.position.point;
+    uint16_t pressure = to_fixed_point_16(msg->inject_touch_event.pressure);
+    enum android_motionevent_buttons buttons =
+        msg->inject_touch_event.buttons;
+
+    uint8_t head = index | msg->inject_touch_event.action << 4;
+    if (pressure != pointer->pressure) {
+        head |= COMPACT_HAS_PRESSURE;
+    }
+    if (buttons != pointer->buttons) {
+        head |= COMPACT_HAS_BUTTONS;
+    }
+
+    size_t len = 0;
+    buf[len++] = head;
+    len += write_signed_varint(point->x - pointer->point.x, &buf[len]);
+    len += write_signed_varint(point->y - pointer->point.y, &buf[len]);
+    if (head & COMPACT_HAS_PRESSURE) {
+        buffer_write16be(&buf[len], pressure);
+        len += 2;
+    }
+    if (head & COMPACT_HAS_BUTTONS) {
+        len += write_varint(buttons, &buf[len]);
+    }
+
+    pointer->pointer_id = msg->inject_touch_event.pointer_id;
+    pointer->active = msg->inject_touch_event.action != AMOTION_EVENT_ACTION_UP;
+    pointer->point = *point;
+    pointer->pressure = pressure;
+    pointer->buttons = buttons;
+
+    return len;
+}
+
+unsigned
+control_msg_serialize_compact(struct control_msg_encoder *encoder,
+                              const struct control_msg *msgs, unsigned count,
+                              unsigned char *buf, size_t *len) {
+    if (!count || msgs[0].type != CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT
+            || get_compact_index(encoder, &msgs[0]) == -1) {
+        return 0;
+    }
+
+    size_t l = 0;
+    struct size screen_size =
+        msgs[0].inject_touch_event.position.screen_size;
+    if (!size_equals(screen_size, encoder->screen_size)) {
+        buf[l++] = CONTROL_MSG_TYPE_SET_SCREEN_SIZE;
+        buffer_write16be(&buf[l], screen_size.width);
+        buffer_write16be(&buf[l + 2], screen_size.height);
+        l += 4;
+        encoder->screen_size = screen_size;
+    }
+
+    buf[l] = CONTROL_MSG_TYPE_INJECT_TOUCH_FRAME;
+    unsigned char *event_count = &buf[l + 1];
+    l += 2;
+
+    unsigned n = 0;
+    while (n < count && n < CONTROL_MSG_TOUCH_FRAME_MAX_EVENTS) {
+        const struct control_msg *msg = &msgs[n];
+        if (msg->type != CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT
+                || !size_equals(msg->inject_touch_event.position.screen_size,
+                                screen_size)) {
+            break;
+        }
+        int index = get_compact_index(encoder, msg);
+        if (index == -1) {
+            break;
+        }
+        l += write_compact_touch(encoder, index, msg, &buf[l]);
+        ++n;
+        if (msg->ack_sequence) {
+            break;
+        }
+    }
+
+    assert(n);
+    *event_count = n;
+    *len = l;
+    return n;
+}
+
 void
 control_msg_destroy(struct control_msg *msg) {
     switch (msg->type) {
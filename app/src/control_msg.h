@@ -19,6 +19,15 @@
 #define POINTER_ID_MOUSE UINT64_C(-1);
 #define POINTER_ID_VIRTUAL_FINGER UINT64_C(-2);
 
+// The protocol version 2 adds compact encodings for the touch events (the
+// version 1 messages are still supported)
+#define CONTROL_PROTOCOL_VERSION 2
+
+// pointers simultaneously down with a compact index (the others fall back to
+// the version 1 encoding)
+#define CONTROL_MSG_COMPACT_MAX_POINTERS 16
+#define CONTROL_MSG_TOUCH_FRAME_MAX_EVENTS 32
+
 enum control_msg_type {
     CONTROL_MSG_TYPE_INJECT_KEYCODE,
     CONTROL_MSG_TYPE_INJECT_TEXT,
@@ -31,6 +40,14 @@ enum control_msg_type {
     CONTROL_MSG_TYPE_SET_CLIPBOARD,
     CONTROL_MSG_TYPE_SET_SCREEN_POWER_MODE,
     CONTROL_MSG_TYPE_ROTATE_DEVICE,
+    CONTROL_MSG_TYPE_REQUEST_ACK,
+    // protocol version 2
+    CONTROL_MSG_TYPE_SET_PROTOCOL_VERSION,
+    CONTROL_MSG_TYPE_SET_SCREEN_SIZE,
+    CONTROL_MSG_TYPE_INJECT_TOUCH_FRAME,
+    CONTROL_MSG_TYPE_SET_BIT_RATE,
+    CONTROL_MSG_TYPE_SET_MAX_FPS,
+    CONTROL_MSG_TYPE_REQUEST_KEYFRAME,
 };
 
 enum screen_power_mode {
@@ -70,7 +87,46 @@ struct control_msg {
         struct {
             enum screen_power_mode mode;
         } set_screen_power_mode;
+        struct {
+            uint32_t sequence;
+            uint64_t timestamp; // in us, echoed by the device
+        } request_ack;
+        struct {
+            uint8_t version;
+        } set_protocol_version;
+        struct {
+            uint32_t bit_rate; // in bits/s
+        } set_bit_rate;
+        struct {
+            uint16_t max_fps; // 0 for no limit
+        } set_max_fps;
     };
+    // Not serialized: if not 0, the controller sends a "request ack" message
+    // with this sequence number right after this message (see
+    // input_latency.h). Only set by the controller.
+    uint32_t ack_sequence;
+};
+
+struct control_msg_compact_pointer {
+    bool active; // assigned to a pointer currently down
+    uint64_t pointer_id;
+    // the last values sent, the next ones are encoded relative to them
+    struct point point;
+    uint16_t pressure;
+    enum android_motionevent_buttons buttons;
+};
+
+// Session state of the compact encodings (protocol version 2), mirrored by
+// the device.
+//
+// The screen size is sent once (SET_SCREEN_SIZE) rather than in every event.
+// A pointer gets a small index when it goes down, kept until it goes up, and
+// its successive positions are sent as varint deltas. Consecutive touch
+// events are batched into a single INJECT_TOUCH_FRAME message.
+struct control_msg_encoder {
+    struct size screen_size; // 0x0 until sent
+    struct control_msg_compact_pointer
+        pointers[CONTROL_MSG_COMPACT_MAX_POINTERS];
 };
 
 // buf size must be at least CONTROL_MSG_MAX_SIZE
@@ -78,6 +134,21 @@ struct control_msg {
 size_t
 control_msg_serialize(const struct control_msg *msg, unsigned char *buf);
 
+void
+control_msg_encoder_init(struct control_msg_encoder *encoder);
+
+// Serialize the first touch events of msgs into a touch frame (preceded by a
+// SET_SCREEN_SIZE message if the screen size changed).
+// The frame ends on a tracked message (msg->ack_sequence), so that its
+// acknowledgement request may follow it.
+// buf size must be at least CONTROL_MSG_MAX_SIZE
+// return the number of messages serialized (0 if msgs[0] cannot be compact
+// encoded), and write the number of bytes written to len
+unsigned
+control_msg_serialize_compact(struct control_msg_encoder *encoder,
+                              const struct control_msg *msgs, unsigned count,
+                              unsigned char *buf, size_t *len);
+
 void
 control_msg_destroy(struct control_msg *msg);
 
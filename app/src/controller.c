@@ -1,55 +1,243 @@
 #include "controller.h"
 
 #include <assert.h>
+#include <inttypes.h>
+#include <libavutil/time.h>
 
 #include "config.h"
 #include "util/lock.h"
 #include "util/log.h"
 
 bool
-controller_init(struct controller *controller, socket_t control_socket) {
-    cbuf_init(&controller->queue);
+controller_init(struct controller *controller, socket_t control_socket,
+                struct input_latency *latency,
+                struct fps_counter *fps_counter) {
+    cbuf_init(&controller->droppable_queue);
+    queue_init(&controller->reliable_queue);
+    controller->reliable_count = 0;
 
-    if (!receiver_init(&controller->receiver, control_socket)) {
+    controller->buffer = SDL_malloc(CONTROLLER_BUFFER_SIZE);
+    if (!controller->buffer) {
+        LOGC("Could not allocate controller buffer");
+        return false;
+    }
+
+    if (!receiver_init(&controller->receiver, control_socket, latency,
+                       fps_counter)) {
+        SDL_free(controller->buffer);
         return false;
     }
 
     if (!(controller->mutex = SDL_CreateMutex())) {
         receiver_destroy(&controller->receiver);
+        SDL_free(controller->buffer);
         return false;
     }
 
     if (!(controller->msg_cond = SDL_CreateCond())) {
         receiver_destroy(&controller->receiver);
         SDL_DestroyMutex(controller->mutex);
+        SDL_free(controller->buffer);
         return false;
     }
 
     controller->control_socket = control_socket;
+    controller->latency = latency;
+    control_msg_encoder_init(&controller->encoder);
     controller->stopped = false;
+    controller->pushed_count = 0;
+    controller->coalesced_count = 0;
+    controller->dropped_count = 0;
+    controller->discarded_count = 0;
+    controller->max_reliable_count = 0;
+    controller->sent_count = 0;
+    controller->send_count = 0;
+    controller->sent_bytes = 0;
+    controller->send_time = 0;
+    controller->max_send_time = 0;
 
     return true;
 }
 
 void
 controller_destroy(struct controller *controller) {
+    if (controller->coalesced_count || controller->discarded_count
+            || controller->dropped_count) {
+        LOGI("Controller: %" PRIu32 " messages, %" PRIu32 " moves coalesced, "
+             "%" PRIu32 " superseded, %" PRIu32 " dropped, max %u pending "
+             "reliable messages", controller->pushed_count,
+             controller->coalesced_count, controller->discarded_count,
+             controller->dropped_count, controller->max_reliable_count);
+    }
+
+    if (controller->send_count) {
+        LOGD("Controller: %" PRIu32 " messages sent in %" PRIu32 " calls "
+             "(%" PRIu64 " bytes), send avg %" PRIu64 " us, max %" PRIu32
+             " us", controller->sent_count, controller->send_count,
+             controller->sent_bytes,
+             controller->send_time / controller->send_count,
+             controller->max_send_time);
+    }
+
     SDL_DestroyCond(controller->msg_cond);
     SDL_DestroyMutex(controller->mutex);
 
     struct control_msg msg;
-    while (cbuf_take(&controller->queue, &msg)) {
+    while (cbuf_take(&controller->droppable_queue, &msg)) {
         control_msg_destroy(&msg);
     }
 
+    while (!queue_is_empty(&controller->reliable_queue)) {
+        struct control_msg_node *node;
+        queue_take(&controller->reliable_queue, next, &node);
+        control_msg_destroy(&node->msg);
+        SDL_free(node);
+    }
+
     receiver_destroy(&controller->receiver);
+    SDL_free(controller->buffer);
 }
 
-bool
-controller_push_msg(struct controller *controller,
-                      const struct control_msg *msg) {
+static inline bool
+is_touch_move(const struct control_msg *msg) {
+    return msg->type == CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT
+        && msg->inject_touch_event.action == AMOTION_EVENT_ACTION_MOVE;
+}
+
+static inline bool
+is_droppable(const struct control_msg *msg) {
+    return is_touch_move(msg)
+        || msg->type == CONTROL_MSG_TYPE_INJECT_SCROLL_EVENT;
+}
+
+// a tracked message leaves the queue without being sent
+static void
+supersede(struct controller *controller, const struct control_msg *msg) {
+    if (msg->ack_sequence) {
+        assert(controller->latency);
+        input_latency_superseded(controller->latency, msg->ack_sequence);
+    }
+}
+
+// If the last queued touch event for the same pointer is a move (with the
+// same buttons), it is still pending: replace its position in place by the
+// new one, rather than sending a stale position. The other events (down, up,
+// keys, text...) are never reordered.
+static bool
+coalesce_move(struct controller *controller, const struct control_msg *msg) {
+    assert(is_touch_move(msg));
+
+    struct control_msg_queue *queue = &controller->droppable_queue;
+    size_t size = cbuf_size_(queue);
+    size_t i = queue->head;
+    while (i != queue->tail) {
+        // iterate from the most recent message
+        i = (i + size - 1) % size;
+        struct control_msg *queued = &queue->data[i];
+        if (queued->type == CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT
+                && queued->inject_touch_event.pointer_id
+                        == msg->inject_touch_event.pointer_id) {
+            if (!is_touch_move(queued)
+                    || queued->inject_touch_event.buttons
+                            != msg->inject_touch_event.buttons) {
+                return false;
+            }
+            // the new message is tracked instead, if any
+            supersede(controller, queued);
+            *queued = *msg;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// A down or up event is sent before the moves queued in the droppable lane,
+// so discard the pending moves of the same pointer (the event has its own
+// position anyway), to never move a pointer after it has been released.
+// Return the number of discarded moves.
+static unsigned
+discard_moves(struct controller *controller, uint64_t pointer_id) {
+    struct control_msg_queue *queue = &controller->droppable_queue;
+    unsigned discarded = 0;
+    size_t count = (queue->head + cbuf_size_(queue) - queue->tail)
+                 % cbuf_size_(queue);
+    for (size_t i = 0; i < count; ++i) {
+        // take each message, and push it back unless it is discarded
+        struct control_msg msg;
+        bool ok = cbuf_take(queue, &msg);
+        assert(ok);
+        if (is_touch_move(&msg)
+                && msg.inject_touch_event.pointer_id == pointer_id) {
+            supersede(controller, &msg);
+            ++discarded;
+        } else {
+            ok = cbuf_push(queue, msg);
+            assert(ok);
+        }
+        (void) ok;
+    }
+    return discarded;
+}
+
+static bool
+push_droppable(struct controller *controller, const struct control_msg *msg) {
+    struct control_msg_queue *queue = &controller->droppable_queue;
+    if (is_touch_move(msg) && coalesce_move(controller, msg)) {
+        ++controller->coalesced_count;
+        return true;
+    }
+
+    if (cbuf_is_full(queue)) {
+        // drop the oldest message, the most recent ones are more relevant
+        struct control_msg oldest;
+        bool ok = cbuf_take(queue, &oldest);
+        assert(ok);
+        (void) ok;
+        supersede(controller, &oldest);
+        control_msg_destroy(&oldest);
+        ++controller->dropped_count;
+    }
+
+    bool ok = cbuf_push(queue, *msg);
+    assert(ok);
+    return ok;
+}
+
+static bool
+push_reliable(struct controller *controller, const struct control_msg *msg) {
+    struct control_msg_node *node = SDL_malloc(sizeof(*node));
+    if (!node) {
+        LOGC("Could not allocate control message");
+        return false;
+    }
+    node->msg = *msg;
+
+    if (msg->type == CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT) {
+        controller->discarded_count +=
+            discard_moves(controller, msg->inject_touch_event.pointer_id);
+    }
+
+    queue_push(&controller->reliable_queue, next, node);
+    if (++controller->reliable_count > controller->max_reliable_count) {
+        controller->max_reliable_count = controller->reliable_count;
+    }
+    return true;
+}
+
+static inline bool
+is_queue_empty(struct controller *controller) {
+    return cbuf_is_empty(&controller->droppable_queue)
+        && queue_is_empty(&controller->reliable_queue);
+}
+
+static bool
+push_msg(struct controller *controller, const struct control_msg *msg) {
     mutex_lock(controller->mutex);
-    bool was_empty = cbuf_is_empty(&controller->queue);
-    bool res = cbuf_push(&controller->queue, *msg);
+    ++controller->pushed_count;
+    bool was_empty = is_queue_empty(controller);
+    bool res = is_droppable(msg) ? push_droppable(controller, msg)
+                                 : push_reliable(controller, msg);
     if (was_empty) {
         cond_signal(controller->msg_cond);
     }
@@ -57,16 +245,136 @@ controller_push_msg(struct controller *controller,
     return res;
 }
 
+bool
+controller_push_msg(struct controller *controller,
+                    const struct control_msg *msg) {
+    struct control_msg copy = *msg;
+    copy.ack_sequence = 0;
+    return push_msg(controller, &copy);
+}
+
+bool
+controller_push_input_msg(struct controller *controller,
+                          const struct control_msg *msg,
+                          uint32_t event_timestamp) {
+    struct control_msg copy = *msg;
+    copy.ack_sequence = controller->latency
+        ? input_latency_register(controller->latency, event_timestamp)
+        : 0;
+    return push_msg(controller, &copy);
+}
+
+// take up to max pending messages, the reliable ones first
+static unsigned
+take_msgs(struct controller *controller, struct control_msg *msgs,
+          unsigned max) {
+    unsigned count = 0;
+    while (count < max && !queue_is_empty(&controller->reliable_queue)) {
+        struct control_msg_node *node;
+        queue_take(&controller->reliable_queue, next, &node);
+        msgs[count++] = node->msg;
+        SDL_free(node);
+        --controller->reliable_count;
+    }
+    while (count < max
+            && cbuf_take(&controller->droppable_queue, &msgs[count])) {
+        ++count;
+    }
+    return count;
+}
+
 static bool
-process_msg(struct controller *controller,
-              const struct control_msg *msg) {
-    static unsigned char serialized_msg[CONTROL_MSG_MAX_SIZE];
-    int length = control_msg_serialize(msg, serialized_msg);
-    if (!length) {
+send_buffer(struct controller *controller, size_t len) {
+    int64_t start = av_gettime_relative();
+    ssize_t w = net_send_all(controller->control_socket, controller->buffer,
+                             len);
+    uint32_t elapsed = av_gettime_relative() - start;
+
+    ++controller->send_count;
+    controller->send_time += elapsed;
+    if (elapsed > controller->max_send_time) {
+        controller->max_send_time = elapsed;
+    }
+
+    controller->sent_bytes += len;
+    return w == (ssize_t) len;
+}
+
+static void
+mark_sent(struct controller *controller, const uint32_t *sequences,
+          unsigned count) {
+    for (unsigned i = 0; i < count; ++i) {
+        input_latency_sent(controller->latency, sequences[i]);
+    }
+}
+
+// serialize the messages back to back, and send them at once
+static bool
+process_msgs(struct controller *controller, const struct control_msg *msgs,
+             unsigned count) {
+    // the tracked messages in the buffer
+    uint32_t sequences[CONTROLLER_QUEUE_SIZE];
+    unsigned sequence_count = 0;
+
+    bool compact = receiver_get_protocol_version(&controller->receiver) >= 2;
+
+    size_t len = 0;
+    unsigned i = 0;
+    while (i < count) {
+        if (CONTROLLER_BUFFER_SIZE - len < CONTROL_MSG_MAX_SIZE) {
+            // not enough space for any message (e.g. after a large clipboard)
+            if (!send_buffer(controller, len)) {
+                return false;
+            }
+            mark_sent(controller, sequences, sequence_count);
+            sequence_count = 0;
+            len = 0;
+        }
+
+        size_t length;
+        unsigned n = compact
+                   ? control_msg_serialize_compact(&controller->encoder,
+                                                   &msgs[i], count - i,
+                                                   controller->buffer + len,
+                                                   &length)
+                   : 0;
+        if (!n) {
+            // version 1 encoding
+            length = control_msg_serialize(&msgs[i],
+                                           controller->buffer + len);
+            if (!length) {
+                return false;
+            }
+            n = 1;
+        }
+        len += length;
+        i += n;
+
+        // only the last message of a touch frame may be tracked
+        const struct control_msg *last = &msgs[i - 1];
+        if (last->ack_sequence) {
+            // the device acknowledges once the previous message is injected
+            struct control_msg ack = {
+                .type = CONTROL_MSG_TYPE_REQUEST_ACK,
+                .request_ack = {
+                    .sequence = last->ack_sequence,
+                    .timestamp = av_gettime_relative(),
+                },
+            };
+            // only (small) input events are tracked, so there is enough
+            // space left
+            len += control_msg_serialize(&ack, controller->buffer + len);
+            sequences[sequence_count++] = last->ack_sequence;
+        }
+    }
+
+    if (len && !send_buffer(controller, len)) {
         return false;
     }
-    int w = net_send_all(controller->control_socket, serialized_msg, length);
-    return w == length;
+    mark_sent(controller, sequences, sequence_count);
+
+    controller->sent_count += count;
+    return true;
 }
 
 static int
@@ -75,7 +383,7 @@ run_controller(void *data) {
 
     for (;;) {
         mutex_lock(controller->mutex);
-        while (!controller->stopped && cbuf_is_empty(&controller->queue)) {
+        while (!controller->stopped && is_queue_empty(controller)) {
             cond_wait(controller->msg_cond, controller->mutex);
         }
         if (controller->stopped) {
@@ -83,14 +391,16 @@ run_controller(void *data) {
             mutex_unlock(controller->mutex);
             break;
         }
-        struct control_msg msg;
-        bool non_empty = cbuf_take(&controller->queue, &msg);
-        assert(non_empty);
-        (void) non_empty;
+        // take all the pending messages (up to CONTROLLER_QUEUE_SIZE)
+        struct control_msg msgs[CONTROLLER_QUEUE_SIZE];
+        unsigned count = take_msgs(controller, msgs, CONTROLLER_QUEUE_SIZE);
+        assert(count);
         mutex_unlock(controller->mutex);
 
-        bool ok = process_msg(controller, &msg);
-        control_msg_destroy(&msg);
+        bool ok = process_msgs(controller, msgs, count);
+        for (unsigned i = 0; i < count; ++i) {
+            control_msg_destroy(&msgs[i]);
+        }
         if (!ok) {
             LOGD("Could not write msg to socket");
             break;
@@ -103,6 +413,18 @@ bool
 controller_start(struct controller *controller) {
     LOGD("Starting controller thread");
 
+    // Propose the compact encodings. Until the device accepts them, the
+    // messages are sent in the version 1 encoding.
+    struct control_msg msg = {
+        .type = CONTROL_MSG_TYPE_SET_PROTOCOL_VERSION,
+        .set_protocol_version = {
+            .version = CONTROL_PROTOCOL_VERSION,
+        },
+    };
+    if (!controller_push_msg(controller, &msg)) {
+        return false;
+    }
+
     controller->thread = SDL_CreateThread(run_controller, "controller",
                                           controller);
     if (!controller->thread) {
@@ -2,16 +2,31 @@
 #define CONTROLLER_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <SDL2/SDL_mutex.h>
 #include <SDL2/SDL_thread.h>
 
 #include "config.h"
 #include "control_msg.h"
+#include "fps_counter.h"
+#include "input_latency.h"
 #include "receiver.h"
 #include "util/cbuf.h"
 #include "util/net.h"
+#include "util/queue.h"
 
-struct control_msg_queue CBUF(struct control_msg, 64);
+#define CONTROLLER_QUEUE_SIZE 64
+// the messages are serialized back to back, and sent in a single call
+#define CONTROLLER_BUFFER_SIZE (2 * CONTROL_MSG_MAX_SIZE)
+
+struct control_msg_queue CBUF(struct control_msg, CONTROLLER_QUEUE_SIZE);
+
+struct control_msg_node {
+    struct control_msg msg;
+    struct control_msg_node *next;
+};
+
+struct control_msg_list QUEUE(struct control_msg_node);
 
 struct controller {
     socket_t control_socket;
@@ -19,12 +34,41 @@ struct controller {
     SDL_mutex *mutex;
     SDL_cond *msg_cond;
     bool stopped;
-    struct control_msg_queue queue;
+    // The messages are queued in two lanes, each one keeping its order:
+    //  - the moves and scrolls, which may be coalesced, or dropped if the
+    //    bounded queue is full;
+    //  - the other messages (keys, buttons, text, clipboard...), which must
+    //    never be dropped (a lost "up" event would leave a key or a finger
+    //    pressed), so this queue grows as necessary.
+    // The reliable lane is sent first.
+    struct control_msg_queue droppable_queue;
+    struct control_msg_list reliable_queue;
+    unsigned reliable_count;
     struct receiver receiver;
+    unsigned char *buffer; // CONTROLLER_BUFFER_SIZE bytes
+    struct input_latency *latency; // NULL if not measured
+    // only accessed from the controller thread
+    struct control_msg_encoder encoder;
+
+    // statistics, protected by the mutex
+    uint32_t pushed_count;
+    uint32_t coalesced_count; // moves replaced by a newer position
+    uint32_t dropped_count; // droppable queue full
+    uint32_t discarded_count; // moves superseded by a down or up event
+    unsigned max_reliable_count;
+
+    // statistics, only accessed from the controller thread
+    uint32_t sent_count; // messages
+    uint32_t send_count; // send calls
+    uint64_t sent_bytes;
+    uint64_t send_time; // in us
+    uint32_t max_send_time; // in us
 };
 
 bool
-controller_init(struct controller *controller, socket_t control_socket);
+controller_init(struct controller *controller, socket_t control_socket,
+                struct input_latency *latency,
+                struct fps_counter *fps_counter);
 
 void
 controller_destroy(struct controller *controller);
@@ -42,4 +86,11 @@ bool
 controller_push_msg(struct controller *controller,
                     const struct control_msg *msg);
 
+// push a message generated by an input event, with its SDL event timestamp,
+// to measure its latency (if enabled)
+bool
+controller_push_input_msg(struct controller *controller,
+                          const struct control_msg *msg,
+                          uint32_t event_timestamp);
+
 #endif
@@ -1,5 +1,6 @@
 #include "decoder.h"
 
+#include <assert.h>
 #include <libavformat/avformat.h>
 #include <libavutil/time.h>
 #include <SDL2/SDL_events.h>
@@ -10,30 +11,48 @@
 #include "config.h"
 #include "compat.h"
 #include "events.h"
+#include "keyframe_request.h"
 #include "recorder.h"
+#include "v4l2sink.h"
 #include "video_buffer.h"
 #include "util/buffer_util.h"
 #include "util/log.h"
 
 // set the decoded frame as ready for rendering, and notify
-static void
+static bool
 push_frame(struct decoder *decoder) {
+#ifdef V4L2SINK
+    // share the decoded frame before it is swapped by the video buffer
+    if (decoder->v4l2sink
+            && !v4l2sink_push_frame(decoder->v4l2sink,
+                                    decoder->video_buffer->decoding_frame)) {
+        LOGE("Could not send frame to v4l2sink");
+        return false;
+    }
+#endif
+
     bool previous_frame_skipped;
     video_buffer_offer_decoded_frame(decoder->video_buffer,
                                      &previous_frame_skipped);
     if (previous_frame_skipped) {
         // the previous EVENT_NEW_FRAME will consume this frame
-        return;
+        return true;
     }
     static SDL_Event new_frame_event = {
         .type = EVENT_NEW_FRAME,
     };
     SDL_PushEvent(&new_frame_event);
+    return true;
 }
 
 void
-decoder_init(struct decoder *decoder, struct video_buffer *vb) {
+decoder_init(struct decoder *decoder, struct video_buffer *vb,
+             struct v4l2sink *v4l2sink) {
     decoder->video_buffer = vb;
+    decoder->v4l2sink = v4l2sink;
+    atomic_init(&decoder->paused, false);
+    decoder->wait_keyframe = false;
+    decoder->keyframe_requested = false;
 }
 
 bool
@@ -59,24 +78,61 @@ decoder_close(struct decoder *decoder) {
     avcodec_free_context(&decoder->codec_ctx);
 }
 
+static void
+wait_keyframe(struct decoder *decoder) {
+    decoder->wait_keyframe = true;
+    decoder->keyframe_requested = false;
+}
+
+// A corrupted packet must not stop the mirroring: drop the decoder state, and
+// resume on the next keyframe
+static bool
+recover(struct decoder *decoder) {
+    avcodec_flush_buffers(decoder->codec_ctx);
+    wait_keyframe(decoder);
+    return true;
+}
+
 bool
 decoder_push(struct decoder *decoder, const AVPacket *packet) {
+    if (atomic_load_explicit(&decoder->paused, memory_order_relaxed)) {
+        if (!decoder->wait_keyframe) {
+            wait_keyframe(decoder);
+        }
+        return true;
+    }
+    if (decoder->wait_keyframe) {
+        if (!(packet->flags & AV_PKT_FLAG_KEY)) {
+            // the frame depends on frames which have not been decoded
+            if (!decoder->keyframe_requested) {
+                // do not wait for the next periodic keyframe (the device
+                // encoder produces one every 10 seconds)
+                request_keyframe();
+                decoder->keyframe_requested = true;
+            }
+            return true;
+        }
+        decoder->wait_keyframe = false;
+    }
+
 // the new decoding/encoding API has been introduced by:
 // <http://git.videolan.org/?p=ffmpeg.git;a=commitdiff;h=7fc329e2dd6226dfecaa4a1d7adf353bf2773726>
 #ifdef SCRCPY_LAVF_HAS_NEW_ENCODING_DECODING_API
     int ret;
     if ((ret = avcodec_send_packet(decoder->codec_ctx, packet)) < 0) {
-        LOGE("Could not send video packet: %d", ret);
-        return false;
+        LOGW("Could not send video packet: %d", ret);
+        return recover(decoder);
     }
     ret = avcodec_receive_frame(decoder->codec_ctx,
                                 decoder->video_buffer->decoding_frame);
     if (!ret) {
         // a frame was received
-        push_frame(decoder);
+        if (!push_frame(decoder)) {
+            return false;
+        }
     } else if (ret != AVERROR(EAGAIN)) {
-        LOGE("Could not receive video frame: %d", ret);
-        return false;
+        LOGW("Could not receive video frame: %d", ret);
+        return recover(decoder);
     }
 #else
     int got_picture;
@@ -85,11 +141,11 @@ decoder_push(struct decoder *decoder, const AVPacket *packet) {
                                     &got_picture,
                                     packet);
     if (len < 0) {
-        LOGE("Could not decode video packet: %d", len);
-        return false;
+        LOGW("Could not decode video packet: %d", len);
+        return recover(decoder);
     }
-    if (got_picture) {
-        push_frame(decoder);
+    if (got_picture && !push_frame(decoder)) {
+        return false;
     }
 #endif
     return true;
@@ -99,3 +155,9 @@ void
 decoder_interrupt(struct decoder *decoder) {
     video_buffer_interrupt(decoder->video_buffer);
 }
+
+void
+decoder_set_paused(struct decoder *decoder, bool paused) {
+    assert(!decoder->v4l2sink || !paused);
+    atomic_store_explicit(&decoder->paused, paused, memory_order_relaxed);
+}
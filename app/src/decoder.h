@@ -1,20 +1,31 @@
 #ifndef DECODER_H
 #define DECODER_H
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <libavformat/avformat.h>
 
 #include "config.h"
 
 struct video_buffer;
+struct v4l2sink;
 
 struct decoder {
     struct video_buffer *video_buffer;
+    struct v4l2sink *v4l2sink; // receives the decoded frames, may be NULL
     AVCodecContext *codec_ctx;
+    // set from the main thread while the window is hidden (the packets are
+    // dropped)
+    atomic_bool paused;
+    // after a pause or a decoding error, the decoding resumes on a keyframe,
+    // requested to the device (only accessed from the stream thread)
+    bool wait_keyframe;
+    bool keyframe_requested;
 };
 
 void
-decoder_init(struct decoder *decoder, struct video_buffer *vb);
+decoder_init(struct decoder *decoder, struct video_buffer *vb,
+             struct v4l2sink *v4l2sink);
 
 bool
 decoder_open(struct decoder *decoder, const AVCodec *codec);
@@ -28,4 +39,8 @@ decoder_push(struct decoder *decoder, const AVPacket *packet);
 void
 decoder_interrupt(struct decoder *decoder);
 
+// must not be paused if it shares its frames with a v4l2sink
+void
+decoder_set_paused(struct decoder *decoder, bool paused);
+
 #endif
@@ -9,14 +9,17 @@
 ssize_t
 device_msg_deserialize(const unsigned char *buf, size_t len,
                        struct device_msg *msg) {
-    if (len < 5) {
-        // at least type + empty string length
+    if (!len) {
         return 0; // not available
     }
 
     msg->type = buf[0];
     switch (msg->type) {
         case DEVICE_MSG_TYPE_CLIPBOARD: {
+            if (len < 5) {
+                // at least type + empty string length
+                return 0; // not available
+            }
             size_t clipboard_len = buffer_read32be(&buf[1]);
             if (clipboard_len > len - 5) {
                 return 0; // not available
@@ -34,6 +37,35 @@ device_msg_deserialize(const unsigned char *buf, size_t len,
             msg->clipboard.text = text;
             return 5 + clipboard_len;
         }
+        case DEVICE_MSG_TYPE_ACK:
+            if (len < 19) {
+                return 0; // not available
+            }
+            msg->ack.sequence = buffer_read32be(&buf[1]);
+            msg->ack.timestamp = buffer_read64be(&buf[5]);
+            msg->ack.injection_time = buffer_read32be(&buf[13]);
+            msg->ack.queue_depth = buffer_read16be(&buf[17]);
+            return 19;
+        case DEVICE_MSG_TYPE_PROTOCOL_VERSION:
+            if (len < 2) {
+                return 0; // not available
+            }
+            msg->protocol_version.version = buf[1];
+            return 2;
+        case DEVICE_MSG_TYPE_ENCODER_STATS: {
+            if (len < 27) {
+                return 0; // not available
+            }
+            struct device_encoder_stats *stats = &msg->encoder_stats;
+            stats->interval = buffer_read32be(&buf[1]);
+            stats->frames = buffer_read32be(&buf[5]);
+            stats->bytes = buffer_read32be(&buf[9]);
+            stats->write_blocked_time = buffer_read32be(&buf[13]);
+            stats->rotation_restarts = buffer_read16be(&buf[17]);
+            stats->dequeue_latency_avg = buffer_read32be(&buf[19]);
+            stats->dequeue_latency_max = buffer_read32be(&buf[23]);
+            return 27;
+        }
         default:
             LOGW("Unknown device message type: %d", (int) msg->type);
             return -1; // error, we cannot recover
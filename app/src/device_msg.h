@@ -13,6 +13,20 @@
 
 enum device_msg_type {
     DEVICE_MSG_TYPE_CLIPBOARD,
+    DEVICE_MSG_TYPE_ACK,
+    DEVICE_MSG_TYPE_PROTOCOL_VERSION,
+    DEVICE_MSG_TYPE_ENCODER_STATS,
+};
+
+// periodic stats of the device encoder
+struct device_encoder_stats {
+    uint32_t interval; // in ms
+    uint32_t frames; // output by the encoder
+    uint32_t bytes; // written to the video socket
+    uint32_t write_blocked_time; // in us
+    uint16_t rotation_restarts;
+    uint32_t dequeue_latency_avg; // from capture to encoder output, in us
+    uint32_t dequeue_latency_max; // in us
 };
 
 struct device_msg {
@@ -21,6 +35,16 @@ struct device_msg {
         struct {
             char *text; // owned, to be freed by SDL_free()
         } clipboard;
+        struct {
+            uint32_t sequence;
+            uint64_t timestamp; // echoed from the request
+            uint32_t injection_time; // in us
+            uint16_t queue_depth; // messages waiting to be injected
+        } ack;
+        struct {
+            uint8_t version; // accepted by the device
+        } protocol_version;
+        struct device_encoder_stats encoder_stats;
     };
 };
 
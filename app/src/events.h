@@ -1,3 +1,8 @@
 #define EVENT_NEW_SESSION SDL_USEREVENT
 #define EVENT_NEW_FRAME (SDL_USEREVENT + 1)
 #define EVENT_STREAM_STOPPED (SDL_USEREVENT + 2)
+#define EVENT_SAVE_REPLAY (SDL_USEREVENT + 3)
+#define EVENT_TOGGLE_RECORDING (SDL_USEREVENT + 4)
+#define EVENT_SET_BIT_RATE (SDL_USEREVENT + 5)
+#define EVENT_REQUEST_KEYFRAME (SDL_USEREVENT + 6)
+#define EVENT_KEYFRAME_RECEIVED (SDL_USEREVENT + 7)
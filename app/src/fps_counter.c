@@ -1,6 +1,7 @@
 #include "fps_counter.h"
 
 #include <assert.h>
+#include <inttypes.h>
 #include <SDL2/SDL_timer.h>
 
 #include "config.h"
@@ -45,6 +46,39 @@ set_started(struct fps_counter *counter, bool started) {
     atomic_store_explicit(&counter->started, started, memory_order_release);
 }
 
+// must be called with mutex locked
+static void
+reset_device_stats(struct fps_counter *counter) {
+    counter->device.interval = 0;
+    counter->device.frames = 0;
+    counter->device.bytes = 0;
+    counter->device.write_blocked_time = 0;
+    counter->device.rotation_restarts = 0;
+    counter->device.dequeue_latency_sum = 0;
+    counter->device.dequeue_latency_max = 0;
+}
+
+// must be called with mutex locked
+static void
+display_device_stats(struct fps_counter *counter) {
+    uint32_t interval = counter->device.interval;
+    uint32_t frames = counter->device.frames;
+    uint32_t dequeue_latency_avg =
+        frames ? counter->device.dequeue_latency_sum / frames : 0;
+    // write_blocked_time is in us and interval in ms
+    unsigned blocked_percent =
+        counter->device.write_blocked_time / 10 / interval;
+    LOGI("    device: %" PRIu32 " fps, %" PRIu64 " KiB/s, %u%% blocked in "
+         "writes, dequeue latency avg %" PRIu32 " us, max %" PRIu32 " us",
+         frames * 1000 / interval,
+         counter->device.bytes * 1000 / interval / 1024, blocked_percent,
+         dequeue_latency_avg, counter->device.dequeue_latency_max);
+    if (counter->device.rotation_restarts) {
+        LOGI("    device: %u encoder restarts on rotation",
+             counter->device.rotation_restarts);
+    }
+}
+
 // must be called with mutex locked
 static void
 display_fps(struct fps_counter *counter) {
@@ -56,6 +90,9 @@ display_fps(struct fps_counter *counter) {
     } else {
         LOGI("%u fps", rendered_per_second);
     }
+    if (counter->device.interval) {
+        display_device_stats(counter);
+    }
 }
 
 // must be called with mutex locked
@@ -68,6 +105,7 @@ check_interval_expired(struct fps_counter *counter, uint32_t now) {
     display_fps(counter);
     counter->nr_rendered = 0;
     counter->nr_skipped = 0;
+    reset_device_stats(counter);
     // add a multiple of the interval
     uint32_t elapsed_slices =
         (now - counter->next_timestamp) / FPS_COUNTER_INTERVAL_MS + 1;
@@ -104,6 +142,7 @@ fps_counter_start(struct fps_counter *counter) {
     counter->next_timestamp = SDL_GetTicks() + FPS_COUNTER_INTERVAL_MS;
     counter->nr_rendered = 0;
     counter->nr_skipped = 0;
+    reset_device_stats(counter);
     mutex_unlock(counter->mutex);
 
     set_started(counter, true);
@@ -178,3 +217,24 @@ fps_counter_add_skipped_frame(struct fps_counter *counter) {
     ++counter->nr_skipped;
     mutex_unlock(counter->mutex);
 }
+
+void
+fps_counter_add_device_stats(struct fps_counter *counter,
+                             const struct device_encoder_stats *stats) {
+    if (!is_started(counter) || !stats->interval) {
+        return;
+    }
+
+    mutex_lock(counter->mutex);
+    counter->device.interval += stats->interval;
+    counter->device.frames += stats->frames;
+    counter->device.bytes += stats->bytes;
+    counter->device.write_blocked_time += stats->write_blocked_time;
+    counter->device.rotation_restarts += stats->rotation_restarts;
+    counter->device.dequeue_latency_sum +=
+        (uint64_t) stats->dequeue_latency_avg * stats->frames;
+    if (stats->dequeue_latency_max > counter->device.dequeue_latency_max) {
+        counter->device.dequeue_latency_max = stats->dequeue_latency_max;
+    }
+    mutex_unlock(counter->mutex);
+}
@@ -8,6 +8,7 @@
 #include <SDL2/SDL_thread.h>
 
 #include "config.h"
+#include "device_msg.h"
 
 struct fps_counter {
     SDL_Thread *thread;
@@ -23,6 +24,17 @@ struct fps_counter {
     unsigned nr_rendered;
     unsigned nr_skipped;
     uint32_t next_timestamp;
+
+    // the device encoder stats received during the interval
+    struct {
+        uint32_t interval; // 0 if none received
+        uint32_t frames;
+        uint64_t bytes;
+        uint64_t write_blocked_time;
+        unsigned rotation_restarts;
+        uint64_t dequeue_latency_sum;
+        uint32_t dequeue_latency_max;
+    } device;
 };
 
 bool
@@ -54,4 +66,9 @@ fps_counter_add_rendered_frame(struct fps_counter *counter);
 void
 fps_counter_add_skipped_frame(struct fps_counter *counter);
 
+// merge the stats periodically sent by the device into the next output
+void
+fps_counter_add_device_stats(struct fps_counter *counter,
+                             const struct device_encoder_stats *stats);
+
 #endif
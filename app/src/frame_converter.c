@@ -0,0 +1,365 @@
+#include "frame_converter.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <string.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/time.h>
+#include <libswscale/swscale.h>
+#include <SDL2/SDL_cpuinfo.h>
+
+#include "config.h"
+#include "util/lock.h"
+#include "util/log.h"
+
+// do not split the image into slices smaller than this number of rows
+#define MIN_SLICE_HEIGHT 64
+
+// offset the plane pointers to the given (even) position
+static void
+offset_planes(enum AVPixelFormat format, uint8_t *const data[4],
+              const int linesize[4], unsigned col, unsigned row,
+              uint8_t *out[4]) {
+    int h_shift;
+    int v_shift;
+    av_pix_fmt_get_chroma_sub_sample(format, &h_shift, &v_shift);
+
+    // the size in bytes of col pixels in each plane
+    int col_offsets[4];
+    av_image_fill_linesizes(col_offsets, format, col);
+
+    for (int i = 0; i < 4; ++i) {
+        if (!data[i]) {
+            out[i] = NULL;
+            continue;
+        }
+        // planes 1 and 2 are the chroma planes (if any)
+        unsigned r = i == 1 || i == 2 ? row >> v_shift : row;
+        out[i] = data[i] + r * linesize[i] + col_offsets[i];
+    }
+}
+
+// fill an (even) area of the output image with black
+static void
+fill_black(struct frame_converter *converter, unsigned x, unsigned y,
+           unsigned w, unsigned h) {
+    if (!w || !h) {
+        return;
+    }
+
+    uint8_t *data[4];
+    offset_planes(converter->format, converter->dst_data,
+                  converter->dst_linesize, x, y, data);
+    int widths[4];
+    av_image_fill_linesizes(widths, converter->format, w);
+    const int *linesize = converter->dst_linesize;
+
+    switch (converter->format) {
+        case AV_PIX_FMT_YUYV422:
+            for (unsigned row = 0; row < h; ++row) {
+                uint8_t *p = data[0] + row * linesize[0];
+                for (int i = 0; i < widths[0]; i += 4) {
+                    p[i] = 16;
+                    p[i + 1] = 128;
+                    p[i + 2] = 16;
+                    p[i + 3] = 128;
+                }
+            }
+            return;
+        case AV_PIX_FMT_RGB24:
+            for (unsigned row = 0; row < h; ++row) {
+                memset(data[0] + row * linesize[0], 0, widths[0]);
+            }
+            return;
+        default:
+            // planar or semi-planar YUV 4:2:0 (limited range)
+            for (int i = 0; i < 4 && data[i]; ++i) {
+                unsigned rows = i ? h / 2 : h;
+                uint8_t value = i ? 128 : 16;
+                for (unsigned row = 0; row < rows; ++row) {
+                    memset(data[i] + row * linesize[i], value, widths[i]);
+                }
+            }
+    }
+}
+
+// compute the area where the frame is scaled (keeping its aspect ratio)
+static void
+update_geometry(struct frame_converter *converter, unsigned src_width,
+                unsigned src_height) {
+    unsigned w = converter->width;
+    unsigned h = converter->height;
+    if ((uint64_t) src_width * h > (uint64_t) w * src_height) {
+        // the frame is wider than the output
+        h = ((uint64_t) src_height * w / src_width) & ~1u;
+    } else {
+        w = ((uint64_t) src_width * h / src_height) & ~1u;
+    }
+
+    converter->src_width = src_width;
+    converter->src_height = src_height;
+    converter->w = w ? w : 2;
+    converter->h = h ? h : 2;
+    converter->x = ((converter->width - converter->w) / 2) & ~1u;
+    converter->y = ((converter->height - converter->h) / 2) & ~1u;
+    ++converter->geometry_changes;
+
+    LOGD("Frame converter: %ux%u scaled to %ux%u at (%u, %u)", src_width,
+         src_height, converter->w, converter->h, converter->x, converter->y);
+}
+
+static bool
+convert_slice(struct frame_converter_slice *slice) {
+    struct frame_converter *converter = slice->converter;
+    const AVFrame *src = converter->src;
+
+    // The output area is split into slices of rows, each one scaled from the
+    // matching rows of the frame. The slices are scaled independently, so the
+    // filter does not cross the slice boundaries (this is negligible with a
+    // bilinear filter). The boundaries must be aligned on chroma rows.
+    unsigned rows = (converter->h / converter->slice_count) & ~1u;
+    unsigned dy = slice->index * rows;
+    bool last = slice->index == converter->slice_count - 1;
+    if (last) {
+        // the last slice takes the remaining rows
+        rows = converter->h - dy;
+    }
+    if (!rows) {
+        return true;
+    }
+
+    unsigned src_height = converter->src_height;
+    unsigned sy = ((uint64_t) dy * src_height / converter->h) & ~1u;
+    unsigned sy_end = last ? src_height
+                           : ((uint64_t) (dy + rows) * src_height
+                                    / converter->h) & ~1u;
+    if (sy_end <= sy) {
+        sy_end = sy + 2 <= src_height ? sy + 2 : src_height;
+    }
+
+    slice->ctx = sws_getCachedContext(slice->ctx, converter->src_width,
+                                      sy_end - sy, src->format, converter->w,
+                                      rows, converter->format, SWS_BILINEAR,
+                                      NULL, NULL, NULL);
+    if (!slice->ctx) {
+        LOGE("Could not create conversion context");
+        return false;
+    }
+
+    uint8_t *src_data[4];
+    uint8_t *dst_data[4];
+    offset_planes(src->format, src->data, src->linesize, 0, sy, src_data);
+    offset_planes(converter->format, converter->dst_data,
+                  converter->dst_linesize, converter->x, converter->y + dy,
+                  dst_data);
+
+    sws_scale(slice->ctx, (const uint8_t *const *) src_data, src->linesize, 0,
+              sy_end - sy, dst_data, converter->dst_linesize);
+    return true;
+}
+
+static int
+run_slice(void *data) {
+    struct frame_converter_slice *slice = data;
+    struct frame_converter *converter = slice->converter;
+
+    unsigned generation = 0;
+    for (;;) {
+        mutex_lock(converter->mutex);
+        while (!converter->stopped && converter->generation == generation) {
+            cond_wait(converter->job_cond, converter->mutex);
+        }
+        if (converter->stopped) {
+            mutex_unlock(converter->mutex);
+            break;
+        }
+        generation = converter->generation;
+        mutex_unlock(converter->mutex);
+
+        bool ok = convert_slice(slice);
+
+        mutex_lock(converter->mutex);
+        slice->failed = !ok;
+        assert(converter->remaining);
+        if (!--converter->remaining) {
+            cond_signal(converter->done_cond);
+        }
+        mutex_unlock(converter->mutex);
+    }
+
+    return 0;
+}
+
+static void
+stop_slices(struct frame_converter *converter, unsigned count) {
+    mutex_lock(converter->mutex);
+    converter->stopped = true;
+    cond_broadcast(converter->job_cond);
+    mutex_unlock(converter->mutex);
+
+    for (unsigned i = 0; i < count; ++i) {
+        struct frame_converter_slice *slice = &converter->slices[i];
+        SDL_WaitThread(slice->thread, NULL);
+        sws_freeContext(slice->ctx);
+    }
+}
+
+bool
+frame_converter_init(struct frame_converter *converter,
+                     enum AVPixelFormat format, unsigned width,
+                     unsigned height) {
+    converter->format = format;
+    converter->width = width;
+    converter->height = height;
+    converter->stopped = false;
+    converter->generation = 0;
+    converter->remaining = 0;
+    converter->frame_count = 0;
+    converter->total_time = 0;
+    converter->max_time = 0;
+    converter->geometry_changes = 0;
+    converter->src_width = 0;
+    converter->src_height = 0;
+
+    unsigned count = SDL_GetCPUCount();
+    if (count > FRAME_CONVERTER_MAX_SLICES) {
+        count = FRAME_CONVERTER_MAX_SLICES;
+    }
+    if (count > height / MIN_SLICE_HEIGHT) {
+        count = height / MIN_SLICE_HEIGHT;
+    }
+    if (!count) {
+        count = 1;
+    }
+    converter->slice_count = count;
+
+    converter->mutex = SDL_CreateMutex();
+    if (!converter->mutex) {
+        LOGC("Could not create converter mutex");
+        return false;
+    }
+
+    converter->job_cond = SDL_CreateCond();
+    if (!converter->job_cond) {
+        LOGC("Could not create converter job cond");
+        goto error_destroy_mutex;
+    }
+
+    converter->done_cond = SDL_CreateCond();
+    if (!converter->done_cond) {
+        LOGC("Could not create converter done cond");
+        goto error_destroy_job_cond;
+    }
+
+    for (unsigned i = 0; i < count; ++i) {
+        struct frame_converter_slice *slice = &converter->slices[i];
+        slice->converter = converter;
+        slice->index = i;
+        slice->thread = NULL;
+        slice->ctx = NULL;
+        slice->failed = false;
+
+        // the slice 0 is converted by the caller thread
+        if (i) {
+            slice->thread = SDL_CreateThread(run_slice, "converter", slice);
+            if (!slice->thread) {
+                LOGC("Could not start converter thread");
+                stop_slices(converter, i);
+                goto error_destroy_done_cond;
+            }
+        }
+    }
+
+    LOGD("Frame converter: %s, %ux%u, %u slices",
+         av_get_pix_fmt_name(format), width, height, count);
+
+    return true;
+
+error_destroy_done_cond:
+    SDL_DestroyCond(converter->done_cond);
+error_destroy_job_cond:
+    SDL_DestroyCond(converter->job_cond);
+error_destroy_mutex:
+    SDL_DestroyMutex(converter->mutex);
+
+    return false;
+}
+
+void
+frame_converter_destroy(struct frame_converter *converter) {
+    stop_slices(converter, converter->slice_count);
+    SDL_DestroyCond(converter->done_cond);
+    SDL_DestroyCond(converter->job_cond);
+    SDL_DestroyMutex(converter->mutex);
+}
+
+bool
+frame_converter_convert(struct frame_converter *converter,
+                        const AVFrame *frame, uint8_t *dst) {
+    int64_t start = av_gettime_relative();
+
+    if ((unsigned) frame->width != converter->src_width
+            || (unsigned) frame->height != converter->src_height) {
+        update_geometry(converter, frame->width, frame->height);
+    }
+
+    mutex_lock(converter->mutex);
+    converter->src = frame;
+    av_image_fill_arrays(converter->dst_data, converter->dst_linesize, dst,
+                         converter->format, converter->width,
+                         converter->height, 1);
+
+    // the borders (if any), the image may be reused for a different geometry
+    unsigned x_end = converter->x + converter->w;
+    unsigned y_end = converter->y + converter->h;
+    fill_black(converter, 0, 0, converter->width, converter->y);
+    fill_black(converter, 0, y_end, converter->width,
+               converter->height - y_end);
+    fill_black(converter, 0, converter->y, converter->x, converter->h);
+    fill_black(converter, x_end, converter->y, converter->width - x_end,
+               converter->h);
+
+    converter->remaining = converter->slice_count - 1;
+    ++converter->generation;
+    cond_broadcast(converter->job_cond);
+    mutex_unlock(converter->mutex);
+
+    bool ok = convert_slice(&converter->slices[0]);
+
+    mutex_lock(converter->mutex);
+    while (converter->remaining) {
+        cond_wait(converter->done_cond, converter->mutex);
+    }
+    for (unsigned i = 1; i < converter->slice_count; ++i) {
+        if (converter->slices[i].failed) {
+            ok = false;
+        }
+    }
+    converter->src = NULL;
+    mutex_unlock(converter->mutex);
+
+    uint32_t elapsed = av_gettime_relative() - start;
+    ++converter->frame_count;
+    converter->total_time += elapsed;
+    if (elapsed > converter->max_time) {
+        converter->max_time = elapsed;
+    }
+
+    return ok;
+}
+
+void
+frame_converter_log_stats(struct frame_converter *converter,
+                          const char *name) {
+    if (!converter->frame_count) {
+        return;
+    }
+
+    LOGI("%s: %" PRIu32 " frames converted to %ux%u %s (%u slices), "
+         "avg %" PRIu64 " us, max %" PRIu32 " us, %" PRIu32 " geometries",
+         name, converter->frame_count, converter->width, converter->height,
+         av_get_pix_fmt_name(converter->format), converter->slice_count,
+         converter->total_time / converter->frame_count, converter->max_time,
+         converter->geometry_changes);
+}
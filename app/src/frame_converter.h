@@ -0,0 +1,87 @@
+#ifndef FRAME_CONVERTER_H
+#define FRAME_CONVERTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <libavutil/frame.h>
+#include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_thread.h>
+
+#include "config.h"
+
+#define FRAME_CONVERTER_MAX_SLICES 8
+
+struct frame_converter;
+
+struct frame_converter_slice {
+    struct frame_converter *converter;
+    unsigned index;
+    SDL_Thread *thread; // NULL for the slice converted by the caller
+    struct SwsContext *ctx;
+    bool failed;
+};
+
+// Convert decoded frames to another pixel format and a fixed size, into a
+// contiguous image.
+//
+// The frames are scaled to fit the output (preserving the aspect ratio) and
+// centered, with black borders. The frame size may change at any time (e.g. on
+// device rotation), the output size never changes.
+//
+// The image is split into horizontal slices, converted in parallel by swscale
+// (which uses SIMD kernels where available): one slice on the caller thread,
+// the others on worker threads.
+struct frame_converter {
+    enum AVPixelFormat format;
+    unsigned width;
+    unsigned height;
+
+    struct frame_converter_slice slices[FRAME_CONVERTER_MAX_SLICES];
+    unsigned slice_count;
+
+    SDL_mutex *mutex;
+    SDL_cond *job_cond; // signaled when a new frame is to be converted
+    SDL_cond *done_cond; // signaled when all the worker slices are converted
+    bool stopped;
+    unsigned generation; // incremented for each frame
+    unsigned remaining; // worker slices not converted yet
+
+    // the current job
+    const AVFrame *src;
+    uint8_t *dst_data[4];
+    int dst_linesize[4];
+    // the area of the output image where the frame is scaled, updated when
+    // the frame size changes
+    unsigned src_width;
+    unsigned src_height;
+    unsigned x;
+    unsigned y;
+    unsigned w;
+    unsigned h;
+
+    // statistics, only accessed from the caller thread
+    uint32_t frame_count;
+    uint64_t total_time; // in us
+    uint32_t max_time; // in us
+    uint32_t geometry_changes;
+};
+
+// width and height must be even
+bool
+frame_converter_init(struct frame_converter *converter,
+                     enum AVPixelFormat format, unsigned width,
+                     unsigned height);
+
+void
+frame_converter_destroy(struct frame_converter *converter);
+
+// convert the frame into dst, a contiguous image (as computed by
+// av_image_get_buffer_size() with alignment 1)
+bool
+frame_converter_convert(struct frame_converter *converter,
+                        const AVFrame *frame, uint8_t *dst);
+
+void
+frame_converter_log_stats(struct frame_converter *converter, const char *name);
+
+#endif
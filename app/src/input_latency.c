@@ -0,0 +1,261 @@
+#include "input_latency.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <string.h>
+#include <libavutil/time.h>
+#include <SDL2/SDL_timer.h>
+
+#include "config.h"
+#include "util/lock.h"
+#include "util/log.h"
+
+// log2(LATENCY_HISTOGRAM_SUB_BUCKETS)
+#define SUB_BUCKET_BITS 3
+
+static const char *const stage_names[] = {
+    [INPUT_LATENCY_STAGE_EVENT] = "event",
+    [INPUT_LATENCY_STAGE_QUEUE] = "queue",
+    [INPUT_LATENCY_STAGE_SEND] = "send",
+    [INPUT_LATENCY_STAGE_ACK] = "ack",
+    [INPUT_LATENCY_STAGE_INJECT] = "inject",
+    [INPUT_LATENCY_STAGE_TOTAL] = "total",
+};
+
+static unsigned
+bucket_index(uint32_t value) {
+    if (value < LATENCY_HISTOGRAM_SUB_BUCKETS) {
+        return value;
+    }
+    unsigned msb = SUB_BUCKET_BITS;
+    while (msb < 31 && value >> (msb + 1)) {
+        ++msb;
+    }
+    unsigned shift = msb - SUB_BUCKET_BITS;
+    unsigned sub = (value >> shift) & (LATENCY_HISTOGRAM_SUB_BUCKETS - 1);
+    return LATENCY_HISTOGRAM_SUB_BUCKETS * (shift + 1) + sub;
+}
+
+static uint32_t
+bucket_lower_bound(unsigned index) {
+    if (index < LATENCY_HISTOGRAM_SUB_BUCKETS) {
+        return index;
+    }
+    unsigned shift = index / LATENCY_HISTOGRAM_SUB_BUCKETS - 1;
+    unsigned sub = index % LATENCY_HISTOGRAM_SUB_BUCKETS;
+    return (uint32_t) (LATENCY_HISTOGRAM_SUB_BUCKETS + sub) << shift;
+}
+
+void
+latency_histogram_init(struct latency_histogram *histogram) {
+    memset(histogram->buckets, 0, sizeof(histogram->buckets));
+    histogram->count = 0;
+    histogram->sum = 0;
+    histogram->max = 0;
+}
+
+void
+latency_histogram_record(struct latency_histogram *histogram, uint32_t value) {
+    unsigned index = bucket_index(value);
+    assert(index < LATENCY_HISTOGRAM_BUCKETS);
+    ++histogram->buckets[index];
+    ++histogram->count;
+    histogram->sum += value;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+uint32_t
+latency_histogram_percentile(const struct latency_histogram *histogram,
+                             unsigned percent) {
+    assert(percent <= 100);
+    if (!histogram->count) {
+        return 0;
+    }
+
+    // the rank of the value, rounded up
+    uint64_t rank = ((uint64_t) histogram->count * percent + 99) / 100;
+    if (!rank) {
+        rank = 1;
+    }
+
+    uint64_t cumulated = 0;
+    for (unsigned i = 0; i < LATENCY_HISTOGRAM_BUCKETS; ++i) {
+        cumulated += histogram->buckets[i];
+        if (cumulated >= rank) {
+            uint32_t upper = i + 1 < LATENCY_HISTOGRAM_BUCKETS
+                           ? bucket_lower_bound(i + 1) - 1
+                           : UINT32_MAX;
+            return upper < histogram->max ? upper : histogram->max;
+        }
+    }
+
+    assert(!"unreachable");
+    return histogram->max;
+}
+
+bool
+input_latency_init(struct input_latency *latency) {
+    if (!(latency->mutex = SDL_CreateMutex())) {
+        LOGC("Could not create input latency mutex");
+        return false;
+    }
+
+    latency->next_sequence = 1;
+    for (unsigned i = 0; i < INPUT_LATENCY_MAX_PENDING; ++i) {
+        latency->pending[i].sequence = 0;
+    }
+    for (unsigned i = 0; i < INPUT_LATENCY_STAGE_COUNT; ++i) {
+        latency_histogram_init(&latency->stages[i]);
+    }
+    latency->superseded_count = 0;
+    latency->unacknowledged_count = 0;
+    latency->total_queue_depth = 0;
+    latency->max_queue_depth = 0;
+
+    return true;
+}
+
+void
+input_latency_destroy(struct input_latency *latency) {
+    SDL_DestroyMutex(latency->mutex);
+}
+
+static inline struct input_latency_sample *
+get_sample(struct input_latency *latency, uint32_t sequence) {
+    return &latency->pending[sequence % INPUT_LATENCY_MAX_PENDING];
+}
+
+uint32_t
+input_latency_register(struct input_latency *latency,
+                       uint32_t event_timestamp) {
+    int64_t now = av_gettime_relative();
+    int64_t event_time = now;
+    if (event_timestamp) {
+        // the SDL event timestamp is expressed in ms, from SDL_GetTicks()
+        uint32_t age = SDL_GetTicks() - event_timestamp;
+        if (age < 60000) {
+            event_time -= (int64_t) age * 1000;
+        }
+    }
+
+    mutex_lock(latency->mutex);
+    uint32_t sequence = latency->next_sequence++;
+    if (!latency->next_sequence) {
+        // 0 means "not tracked"
+        latency->next_sequence = 1;
+    }
+
+    struct input_latency_sample *sample = get_sample(latency, sequence);
+    if (sample->sequence) {
+        // never acknowledged
+        ++latency->unacknowledged_count;
+    }
+    sample->sequence = sequence;
+    sample->event_time = event_time;
+    sample->push_time = now;
+    sample->send_time = 0;
+    mutex_unlock(latency->mutex);
+
+    return sequence;
+}
+
+void
+input_latency_sent(struct input_latency *latency, uint32_t sequence) {
+    int64_t now = av_gettime_relative();
+
+    mutex_lock(latency->mutex);
+    struct input_latency_sample *sample = get_sample(latency, sequence);
+    if (sample->sequence == sequence) {
+        sample->send_time = now;
+    }
+    mutex_unlock(latency->mutex);
+}
+
+void
+input_latency_superseded(struct input_latency *latency, uint32_t sequence) {
+    mutex_lock(latency->mutex);
+    struct input_latency_sample *sample = get_sample(latency, sequence);
+    if (sample->sequence == sequence) {
+        // release the slot, so that it is not counted as unacknowledged
+        sample->sequence = 0;
+        ++latency->superseded_count;
+    }
+    mutex_unlock(latency->mutex);
+}
+
+static void
+record(struct input_latency *latency, enum input_latency_stage stage,
+       int64_t value) {
+    if (value < 0) {
+        value = 0;
+    } else if (value > UINT32_MAX) {
+        value = UINT32_MAX;
+    }
+    latency_histogram_record(&latency->stages[stage], value);
+}
+
+void
+input_latency_acked(struct input_latency *latency, uint32_t sequence,
+                    uint64_t timestamp, uint32_t injection_time,
+                    uint16_t queue_depth) {
+    int64_t now = av_gettime_relative();
+
+    mutex_lock(latency->mutex);
+    struct input_latency_sample *sample = get_sample(latency, sequence);
+    if (sample->sequence != sequence) {
+        // the slot has been reused meanwhile
+        LOGD("Unexpected input acknowledgement: %" PRIu32, sequence);
+        mutex_unlock(latency->mutex);
+        return;
+    }
+
+    // the acknowledgement may be received before the controller thread
+    // records the end of the send() call
+    int64_t send_time = sample->send_time ? sample->send_time : now;
+    int64_t serialize_time = timestamp;
+
+    record(latency, INPUT_LATENCY_STAGE_EVENT,
+           sample->push_time - sample->event_time);
+    record(latency, INPUT_LATENCY_STAGE_QUEUE,
+           serialize_time - sample->push_time);
+    record(latency, INPUT_LATENCY_STAGE_SEND, send_time - serialize_time);
+    record(latency, INPUT_LATENCY_STAGE_ACK, now - send_time);
+    record(latency, INPUT_LATENCY_STAGE_INJECT, injection_time);
+    record(latency, INPUT_LATENCY_STAGE_TOTAL, now - sample->event_time);
+    latency->total_queue_depth += queue_depth;
+    if (queue_depth > latency->max_queue_depth) {
+        latency->max_queue_depth = queue_depth;
+    }
+
+    sample->sequence = 0;
+    mutex_unlock(latency->mutex);
+}
+
+void
+input_latency_log(struct input_latency *latency) {
+    mutex_lock(latency->mutex);
+    uint32_t count = latency->stages[INPUT_LATENCY_STAGE_TOTAL].count;
+    if (!count) {
+        mutex_unlock(latency->mutex);
+        return;
+    }
+
+    LOGI("Input latency: %" PRIu32 " events acknowledged, %" PRIu32
+         " superseded before being sent, %" PRIu32 " unacknowledged", count,
+         latency->superseded_count, latency->unacknowledged_count);
+    for (unsigned i = 0; i < INPUT_LATENCY_STAGE_COUNT; ++i) {
+        const struct latency_histogram *histogram = &latency->stages[i];
+        LOGI("    %-6s avg %6" PRIu64 " us, p50 %6" PRIu32 " us, "
+             "p90 %6" PRIu32 " us, p99 %6" PRIu32 " us, max %6" PRIu32 " us",
+             stage_names[i], histogram->sum / histogram->count,
+             latency_histogram_percentile(histogram, 50),
+             latency_histogram_percentile(histogram, 90),
+             latency_histogram_percentile(histogram, 99), histogram->max);
+    }
+    LOGI("    device queue depth avg %.1f, max %u",
+         (double) latency->total_queue_depth / count,
+         (unsigned) latency->max_queue_depth);
+    mutex_unlock(latency->mutex);
+}
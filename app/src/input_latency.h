@@ -0,0 +1,110 @@
+#ifndef INPUT_LATENCY_H
+#define INPUT_LATENCY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <SDL2/SDL_mutex.h>
+
+#include "config.h"
+
+// Values below 8 have their own bucket, then each power of 2 is split into 8
+// buckets (so the relative error is at most 12.5%).
+#define LATENCY_HISTOGRAM_SUB_BUCKETS 8
+#define LATENCY_HISTOGRAM_BUCKETS (LATENCY_HISTOGRAM_SUB_BUCKETS * 30)
+
+// the number of input events waiting for their acknowledgement
+#define INPUT_LATENCY_MAX_PENDING 256
+
+struct latency_histogram {
+    uint32_t buckets[LATENCY_HISTOGRAM_BUCKETS];
+    uint32_t count;
+    uint64_t sum; // in us
+    uint32_t max; // in us
+};
+
+void
+latency_histogram_init(struct latency_histogram *histogram);
+
+void
+latency_histogram_record(struct latency_histogram *histogram, uint32_t value);
+
+// return the upper bound of the bucket containing the given percentile
+// (capped to the max value), or 0 if the histogram is empty
+uint32_t
+latency_histogram_percentile(const struct latency_histogram *histogram,
+                             unsigned percent);
+
+enum input_latency_stage {
+    INPUT_LATENCY_STAGE_EVENT, // SDL event -> pushed to the controller
+    INPUT_LATENCY_STAGE_QUEUE, // pushed -> serialized
+    INPUT_LATENCY_STAGE_SEND, // serialized -> sent on the socket
+    INPUT_LATENCY_STAGE_ACK, // sent -> acknowledgement received
+    INPUT_LATENCY_STAGE_INJECT, // injection on the device (reported)
+    INPUT_LATENCY_STAGE_TOTAL, // SDL event -> acknowledgement received
+    INPUT_LATENCY_STAGE_COUNT,
+};
+
+struct input_latency_sample {
+    uint32_t sequence; // 0 if the slot is unused
+    int64_t event_time;
+    int64_t push_time;
+    int64_t send_time; // 0 until sent
+};
+
+// Measure the latency of the input events, from the SDL event to their
+// injection on the device.
+//
+// Each tracked control message is followed by a "request ack" message,
+// containing its sequence number and the time it is serialized. The device
+// handles the messages in order, so it replies once the input event has been
+// injected, with the duration of the injection. All the times are measured
+// on the client clock (in us, from av_gettime_relative()).
+//
+// The events are registered from the main thread, sent from the controller
+// thread, and acknowledged from the receiver thread.
+struct input_latency {
+    SDL_mutex *mutex;
+    uint32_t next_sequence;
+    struct input_latency_sample pending[INPUT_LATENCY_MAX_PENDING];
+    struct latency_histogram stages[INPUT_LATENCY_STAGE_COUNT];
+    // coalesced, dropped or discarded by the controller before being sent
+    uint32_t superseded_count;
+    uint32_t unacknowledged_count; // sent, but never acknowledged
+    // the number of messages waiting in the device queue on injection
+    uint64_t total_queue_depth;
+    uint16_t max_queue_depth;
+};
+
+bool
+input_latency_init(struct input_latency *latency);
+
+void
+input_latency_destroy(struct input_latency *latency);
+
+// register a new input event, from its SDL event timestamp (in ms, 0 if
+// unknown), and return its sequence number (never 0)
+uint32_t
+input_latency_register(struct input_latency *latency,
+                       uint32_t event_timestamp);
+
+// the message of the given sequence number has been sent
+void
+input_latency_sent(struct input_latency *latency, uint32_t sequence);
+
+// the message of the given sequence number will never be sent (it has been
+// replaced by a more recent one, or dropped)
+void
+input_latency_superseded(struct input_latency *latency, uint32_t sequence);
+
+// the device acknowledged the given sequence number, serialized at the given
+// time, and injected in injection_time us while queue_depth messages were
+// waiting behind it
+void
+input_latency_acked(struct input_latency *latency, uint32_t sequence,
+                    uint64_t timestamp, uint32_t injection_time,
+                    uint16_t queue_depth);
+
+void
+input_latency_log(struct input_latency *latency);
+
+#endif
@@ -5,6 +5,7 @@
 
 #include "config.h"
 #include "event_converter.h"
+#include "events.h"
 #include "util/lock.h"
 #include "util/log.h"
 
@@ -262,6 +263,26 @@ rotate_device(struct controller *controller) {
     }
 }
 
+static void
+save_replay(void) {
+    // the replay buffer is handled by the main event loop
+    SDL_Event event;
+    event.type = EVENT_SAVE_REPLAY;
+    if (SDL_PushEvent(&event) < 0) {
+        LOGW("Could not request to save the replay buffer");
+    }
+}
+
+static void
+toggle_recording(void) {
+    // the on-demand recording is handled by the main event loop
+    SDL_Event event;
+    event.type = EVENT_TOGGLE_RECORDING;
+    if (SDL_PushEvent(&event) < 0) {
+        LOGW("Could not request to start/stop recording");
+    }
+}
+
 static void
 rotate_client_left(struct screen *screen) {
     unsigned new_rotation = (screen->rotation + 1) % 4;
@@ -386,7 +407,11 @@ input_manager_process_key(struct input_manager *im,
                 }
                 return;
             case SDLK_s:
-                if (control && !shift && !repeat) {
+                if (shift) {
+                    if (!repeat && down) {
+                        save_replay();
+                    }
+                } else if (control && !repeat) {
                     action_app_switch(controller, action);
                 }
                 return;
@@ -483,8 +508,12 @@ input_manager_process_key(struct input_manager *im,
                 }
                 return;
             case SDLK_r:
-                if (control && !shift && !repeat && down) {
-                    rotate_device(controller);
+                if (!repeat && down) {
+                    if (shift) {
+                        toggle_recording();
+                    } else if (control) {
+                        rotate_device(controller);
+                    }
                 }
                 return;
         }
@@ -518,7 +547,7 @@ input_manager_process_key(struct input_manager *im,
 
     struct control_msg msg;
     if (convert_input_key(event, &msg, im->prefer_text, im->repeat)) {
-        if (!controller_push_msg(controller, &msg)) {
+        if (!controller_push_input_msg(controller, &msg, event->timestamp)) {
             LOGW("Could not request 'inject keycode'");
         }
     }
@@ -555,7 +584,8 @@ input_manager_process_mouse_motion(struct input_manager *im,
         return;
     }
 
-    if (!controller_push_msg(im->controller, &msg)) {
+    if (!controller_push_input_msg(im->controller, &msg,
+                                   event->timestamp)) {
         LOGW("Could not request 'inject mouse motion event'");
     }
 
@@ -598,7 +628,8 @@ input_manager_process_touch(struct input_manager *im,
                             const SDL_TouchFingerEvent *event) {
     struct control_msg msg;
     if (convert_touch(event, im->screen, &msg)) {
-        if (!controller_push_msg(im->controller, &msg)) {
+        if (!controller_push_input_msg(im->controller, &msg,
+                                   event->timestamp)) {
             LOGW("Could not request 'inject touch event'");
         }
     }
@@ -671,7 +702,8 @@ input_manager_process_mouse_button(struct input_manager *im,
         return;
     }
 
-    if (!controller_push_msg(im->controller, &msg)) {
+    if (!controller_push_input_msg(im->controller, &msg,
+                                   event->timestamp)) {
         LOGW("Could not request 'inject mouse button event'");
         return;
     }
@@ -729,7 +761,8 @@ input_manager_process_mouse_wheel(struct input_manager *im,
                                   const SDL_MouseWheelEvent *event) {
     struct control_msg msg;
     if (convert_mouse_wheel(event, im->screen, &msg)) {
-        if (!controller_push_msg(im->controller, &msg)) {
+        if (!controller_push_input_msg(im->controller, &msg,
+                                   event->timestamp)) {
             LOGW("Could not request 'inject mouse wheel event'");
         }
     }
@@ -0,0 +1,58 @@
+#include "keyframe_request.h"
+
+#include <SDL2/SDL_events.h>
+
+#include "config.h"
+#include "events.h"
+
+void
+keyframe_limiter_init(struct keyframe_limiter *limiter, uint32_t min_interval) {
+    limiter->min_interval = min_interval;
+    limiter->has_last = false;
+    limiter->last_time = 0;
+    limiter->deferred = false;
+}
+
+enum keyframe_limiter_action
+keyframe_limiter_request(struct keyframe_limiter *limiter, uint32_t now,
+                         bool retry, uint32_t *delay) {
+    if (retry) {
+        if (!limiter->deferred) {
+            // already satisfied by a request sent meanwhile
+            return KEYFRAME_LIMITER_IGNORE;
+        }
+        limiter->deferred = false;
+    }
+
+    // unsigned subtraction, so that it is correct if the ticks wrap around
+    uint32_t elapsed = now - limiter->last_time;
+    if (!limiter->has_last || elapsed >= limiter->min_interval) {
+        limiter->has_last = true;
+        limiter->last_time = now;
+        // a deferred request is satisfied by this one
+        limiter->deferred = false;
+        return KEYFRAME_LIMITER_SEND;
+    }
+
+    if (limiter->deferred) {
+        return KEYFRAME_LIMITER_IGNORE;
+    }
+
+    limiter->deferred = true;
+    *delay = limiter->min_interval - elapsed;
+    return KEYFRAME_LIMITER_DEFER;
+}
+
+void
+keyframe_limiter_keyframe_received(struct keyframe_limiter *limiter) {
+    // the retry will be ignored
+    limiter->deferred = false;
+}
+
+void
+request_keyframe(void) {
+    SDL_Event event;
+    event.type = EVENT_REQUEST_KEYFRAME;
+    event.user.code = 0; // not a retry
+    SDL_PushEvent(&event);
+}
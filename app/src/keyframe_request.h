@@ -0,0 +1,59 @@
+#ifndef KEYFRAME_REQUEST_H
+#define KEYFRAME_REQUEST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+
+// the minimal interval between two keyframe requests, in ms
+#define KEYFRAME_REQUEST_MIN_INTERVAL 1000
+
+// Rate-limit the keyframe requests sent to the device.
+//
+// A keyframe is several times larger than the other frames: if several
+// consumers (or several decoding errors in a row) request one, requesting a
+// keyframe each time would saturate the link, and cause more errors.
+//
+// A request received too early is not dropped, but deferred to the end of
+// the interval (once, whatever the number of requests meanwhile). A keyframe
+// received meanwhile satisfies it, so that it is not sent uselessly.
+//
+// The times are given by the caller (it never reads the clock itself).
+struct keyframe_limiter {
+    uint32_t min_interval; // in ms
+    bool has_last;
+    uint32_t last_time; // in ms
+    bool deferred; // a request is scheduled at the end of the interval
+};
+
+enum keyframe_limiter_action {
+    KEYFRAME_LIMITER_SEND, // send the request now
+    KEYFRAME_LIMITER_DEFER, // request again after the returned delay
+    KEYFRAME_LIMITER_IGNORE, // a request is already deferred
+};
+
+void
+keyframe_limiter_init(struct keyframe_limiter *limiter, uint32_t min_interval);
+
+// Record a keyframe request at time now (in ms).
+// retry must be true for the deferred request (the first one would be ignored
+// otherwise).
+// On KEYFRAME_LIMITER_DEFER, the delay (in ms) is written to *delay.
+enum keyframe_limiter_action
+keyframe_limiter_request(struct keyframe_limiter *limiter, uint32_t now,
+                         bool retry, uint32_t *delay);
+
+// Notify that a keyframe has been received from the device: a deferred
+// request (if any) is cancelled.
+void
+keyframe_limiter_keyframe_received(struct keyframe_limiter *limiter);
+
+// Request a keyframe to the device (may be called from any thread)
+//
+// The request is forwarded to the main thread, which applies the limiter and
+// sends the control message (if the controller is enabled).
+void
+request_keyframe(void);
+
+#endif
@@ -4,9 +4,6 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <libavformat/avformat.h>
-#ifdef V4L2SINK
-#include <libavdevice/avdevice.h>
-#endif
 
 #define SDL_MAIN_HANDLED // avoid link error on Linux Windows Subsystem
 #include <SDL2/SDL.h>
@@ -32,11 +29,6 @@ print_version(void) {
     fprintf(stderr, " - libavutil %d.%d.%d\n", LIBAVUTIL_VERSION_MAJOR,
                                                LIBAVUTIL_VERSION_MINOR,
                                                LIBAVUTIL_VERSION_MICRO);
-#ifdef V4L2SINK
-    fprintf(stderr, " - libavdevice %d.%d.%d\n", LIBAVDEVICE_VERSION_MAJOR,
-                                                 LIBAVDEVICE_VERSION_MINOR,
-                                                 LIBAVDEVICE_VERSION_MICRO);
-#endif
 }
 
 static SDL_LogPriority
@@ -99,10 +91,6 @@ main(int argc, char *argv[]) {
     av_register_all();
 #endif
 
-#ifdef V4L2SINK
-    avdevice_register_all();
-#endif
-
     if (avformat_network_init()) {
         return 1;
     }
@@ -9,11 +9,16 @@
 #include "util/log.h"
 
 bool
-receiver_init(struct receiver *receiver, socket_t control_socket) {
+receiver_init(struct receiver *receiver, socket_t control_socket,
+              struct input_latency *latency,
+              struct fps_counter *fps_counter) {
     if (!(receiver->mutex = SDL_CreateMutex())) {
         return false;
     }
     receiver->control_socket = control_socket;
+    receiver->latency = latency;
+    receiver->fps_counter = fps_counter;
+    receiver->protocol_version = 1;
     return true;
 }
 
@@ -22,8 +27,16 @@ receiver_destroy(struct receiver *receiver) {
     SDL_DestroyMutex(receiver->mutex);
 }
 
+uint8_t
+receiver_get_protocol_version(struct receiver *receiver) {
+    mutex_lock(receiver->mutex);
+    uint8_t version = receiver->protocol_version;
+    mutex_unlock(receiver->mutex);
+    return version;
+}
+
 static void
-process_msg(struct device_msg *msg) {
+process_msg(struct receiver *receiver, struct device_msg *msg) {
     switch (msg->type) {
         case DEVICE_MSG_TYPE_CLIPBOARD: {
             char *current = SDL_GetClipboardText();
@@ -38,11 +51,33 @@ process_msg(struct device_msg *msg) {
             SDL_SetClipboardText(msg->clipboard.text);
             break;
         }
+        case DEVICE_MSG_TYPE_ACK:
+            if (receiver->latency) {
+                input_latency_acked(receiver->latency, msg->ack.sequence,
+                                    msg->ack.timestamp,
+                                    msg->ack.injection_time,
+                                    msg->ack.queue_depth);
+            }
+            break;
+        case DEVICE_MSG_TYPE_PROTOCOL_VERSION:
+            LOGD("Control protocol version %u",
+                 (unsigned) msg->protocol_version.version);
+            mutex_lock(receiver->mutex);
+            receiver->protocol_version = msg->protocol_version.version;
+            mutex_unlock(receiver->mutex);
+            break;
+        case DEVICE_MSG_TYPE_ENCODER_STATS:
+            if (receiver->fps_counter) {
+                fps_counter_add_device_stats(receiver->fps_counter,
+                                             &msg->encoder_stats);
+            }
+            break;
     }
 }
 
 static ssize_t
-process_msgs(const unsigned char *buf, size_t len) {
+process_msgs(struct receiver *receiver, const unsigned char *buf,
+             size_t len) {
     size_t head = 0;
     for (;;) {
         struct device_msg msg;
@@ -54,7 +89,7 @@ process_msgs(const unsigned char *buf, size_t len) {
             return head;
         }
 
-        process_msg(&msg);
+        process_msg(receiver, &msg);
         device_msg_destroy(&msg);
 
         head += r;
@@ -82,7 +117,7 @@ run_receiver(void *data) {
         }
 
         head += r;
-        ssize_t consumed = process_msgs(buf, head);
+        ssize_t consumed = process_msgs(receiver, buf, head);
         if (consumed == -1) {
             // an error occurred
             break;
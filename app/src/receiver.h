@@ -6,6 +6,8 @@
 #include <SDL2/SDL_thread.h>
 
 #include "config.h"
+#include "fps_counter.h"
+#include "input_latency.h"
 #include "util/net.h"
 
 // receive events from the device
@@ -14,10 +16,18 @@ struct receiver {
     socket_t control_socket;
     SDL_Thread *thread;
     SDL_mutex *mutex;
+    struct input_latency *latency; // NULL if not measured
+    // receives the device encoder stats (may be NULL)
+    struct fps_counter *fps_counter;
+    // the control protocol version accepted by the device, 1 until it
+    // replies to the SET_PROTOCOL_VERSION request (protected by the mutex)
+    uint8_t protocol_version;
 };
 
 bool
-receiver_init(struct receiver *receiver, socket_t control_socket);
+receiver_init(struct receiver *receiver, socket_t control_socket,
+              struct input_latency *latency,
+              struct fps_counter *fps_counter);
 
 void
 receiver_destroy(struct receiver *receiver);
@@ -25,6 +35,9 @@ receiver_destroy(struct receiver *receiver);
 bool
 receiver_start(struct receiver *receiver);
 
+uint8_t
+receiver_get_protocol_version(struct receiver *receiver);
+
 // no receiver_stop(), it will automatically stop on control_socket shutdown
 
 void
@@ -1,10 +1,15 @@
 #include "recorder.h"
 
 #include <assert.h>
+#include <inttypes.h>
 #include <libavutil/time.h>
 
 #include "config.h"
 #include "compat.h"
+#include "keyframe_request.h"
+#ifndef _WIN32
+# include "avio_writer.h"
+#endif
 #include "util/lock.h"
 #include "util/log.h"
 
@@ -60,11 +65,49 @@ recorder_queue_clear(struct recorder_queue *queue) {
     }
 }
 
+static void
+record_segment_delete(struct record_segment *segment) {
+    SDL_free(segment->filename);
+    SDL_free(segment);
+}
+
+char *
+recorder_get_indexed_filename(const char *pattern, unsigned index) {
+    size_t size = strlen(pattern) + 32;
+    char *filename = SDL_malloc(size);
+    if (!filename) {
+        return NULL;
+    }
+
+    if (av_get_frame_filename2(filename, size, pattern, index,
+                               AV_FRAME_FILENAME_FLAGS_MULTIPLE) < 0) {
+        SDL_free(filename);
+        return NULL;
+    }
+
+    return filename;
+}
+
 bool
 recorder_init(struct recorder *recorder,
               const char *filename,
               enum sc_record_format format,
-              struct size declared_frame_size) {
+              struct size declared_frame_size,
+              const struct recorder_params *params) {
+    recorder->params = *params;
+    recorder->segmented = params->segment_duration || params->segment_size;
+
+    if (recorder->segmented) {
+        // check that the pattern is valid
+        char *first = recorder_get_indexed_filename(filename, 0);
+        if (!first) {
+            LOGE("Invalid segment pattern (e.g. file_%%03d.mp4): %s",
+                 filename);
+            return false;
+        }
+        SDL_free(first);
+    }
+
     recorder->filename = SDL_strdup(filename);
     if (!recorder->filename) {
         LOGE("Could not strdup filename");
@@ -86,12 +129,43 @@ recorder_init(struct recorder *recorder,
         return false;
     }
 
+    recorder->finisher.mutex = SDL_CreateMutex();
+    if (!recorder->finisher.mutex) {
+        LOGC("Could not create mutex");
+        SDL_DestroyCond(recorder->queue_cond);
+        SDL_DestroyMutex(recorder->mutex);
+        SDL_free(recorder->filename);
+        return false;
+    }
+
+    recorder->finisher.queue_cond = SDL_CreateCond();
+    if (!recorder->finisher.queue_cond) {
+        LOGC("Could not create cond");
+        SDL_DestroyMutex(recorder->finisher.mutex);
+        SDL_DestroyCond(recorder->queue_cond);
+        SDL_DestroyMutex(recorder->mutex);
+        SDL_free(recorder->filename);
+        return false;
+    }
+
     queue_init(&recorder->queue);
     recorder->stopped = false;
     recorder->failed = false;
     recorder->format = format;
     recorder->declared_frame_size = declared_frame_size;
+    // only the mp4 muxer supports fragmentation (checked by the CLI)
+    assert(!params->fragmented || format == SC_RECORD_FORMAT_MP4);
     recorder->header_written = false;
+    recorder->extradata = NULL;
+    recorder->extradata_size = 0;
+    recorder->segment_index = 0;
+    recorder->segment_filename = NULL;
+    recorder->segment_start_pts = AV_NOPTS_VALUE;
+    recorder->keyframe_requested = false;
+    recorder->index = NULL;
+    recorder->finisher.thread = NULL;
+    recorder->finisher.stopped = false;
+    queue_init(&recorder->finisher.queue);
     recorder->previous = NULL;
 
     return true;
@@ -99,6 +173,11 @@ recorder_init(struct recorder *recorder,
 
 void
 recorder_destroy(struct recorder *recorder) {
+    // packets may have been pushed before the recorder was started
+    recorder_queue_clear(&recorder->queue);
+    av_free(recorder->extradata);
+    SDL_DestroyCond(recorder->finisher.queue_cond);
+    SDL_DestroyMutex(recorder->finisher.mutex);
     SDL_DestroyCond(recorder->queue_cond);
     SDL_DestroyMutex(recorder->mutex);
     SDL_free(recorder->filename);
@@ -109,39 +188,41 @@ recorder_get_format_name(enum sc_record_format format) {
     switch (format) {
         case SC_RECORD_FORMAT_MP4: return "mp4";
         case SC_RECORD_FORMAT_MKV: return "matroska";
+        case SC_RECORD_FORMAT_TS: return "mpegts";
         default: return NULL;
     }
 }
 
-bool
-recorder_open(struct recorder *recorder, const AVCodec *input_codec) {
+static AVFormatContext *
+recorder_open_output(struct recorder *recorder, const AVCodec *input_codec,
+                     const char *filename) {
     const char *format_name = recorder_get_format_name(recorder->format);
     assert(format_name);
     const AVOutputFormat *format = find_muxer(format_name);
     if (!format) {
         LOGE("Could not find muxer");
-        return false;
+        return NULL;
     }
 
-    recorder->ctx = avformat_alloc_context();
-    if (!recorder->ctx) {
+    AVFormatContext *ctx = avformat_alloc_context();
+    if (!ctx) {
         LOGE("Could not allocate output context");
-        return false;
+        return NULL;
     }
 
     // contrary to the deprecated API (av_oformat_next()), av_muxer_iterate()
     // returns (on purpose) a pointer-to-const, but AVFormatContext.oformat
     // still expects a pointer-to-non-const (it has not be updated accordingly)
     // <https://github.com/FFmpeg/FFmpeg/commit/0694d8702421e7aff1340038559c438b61bb30dd>
-    recorder->ctx->oformat = (AVOutputFormat *) format;
+    ctx->oformat = (AVOutputFormat *) format;
 
-    av_dict_set(&recorder->ctx->metadata, "comment",
+    av_dict_set(&ctx->metadata, "comment",
                 "Recorded by scrcpy " SCRCPY_VERSION, 0);
 
-    AVStream *ostream = avformat_new_stream(recorder->ctx, input_codec);
+    AVStream *ostream = avformat_new_stream(ctx, input_codec);
     if (!ostream) {
-        avformat_free_context(recorder->ctx);
-        return false;
+        avformat_free_context(ctx);
+        return NULL;
     }
 
 #ifdef SCRCPY_LAVF_HAS_NEW_CODEC_PARAMS_API
@@ -158,101 +239,494 @@ recorder_open(struct recorder *recorder, const AVCodec *input_codec) {
     ostream->codec->height = recorder->declared_frame_size.height;
 #endif
 
-    int ret = avio_open(&recorder->ctx->pb, recorder->filename,
-                        AVIO_FLAG_WRITE);
+#ifndef _WIN32
+    // pipes and devices are written synchronously
+    if (recorder->params.buffer_size && avio_writer_supports(filename)) {
+        struct avio_writer *writer = SDL_malloc(sizeof(*writer));
+        if (!writer) {
+            LOGC("Could not allocate AVIO writer");
+            avformat_free_context(ctx);
+            return NULL;
+        }
+
+        if (!avio_writer_open(writer, filename, recorder->params.buffer_size,
+                              recorder->params.preallocate,
+                              recorder->params.direct_io)) {
+            LOGE("Failed to open output file: %s", filename);
+            SDL_free(writer);
+            avformat_free_context(ctx);
+            return NULL;
+        }
+
+        ctx->pb = writer->avio;
+        // retrieved by recorder_close_io()
+        ctx->opaque = writer;
+        return ctx;
+    }
+#endif
+
+    int ret = avio_open(&ctx->pb, filename, AVIO_FLAG_WRITE);
     if (ret < 0) {
-        LOGE("Failed to open output file: %s", recorder->filename);
+        LOGE("Failed to open output file: %s", filename);
         // ostream will be cleaned up during context cleaning
-        avformat_free_context(recorder->ctx);
-        return false;
+        avformat_free_context(ctx);
+        return NULL;
     }
 
-    LOGI("Recording started to %s file: %s", format_name, recorder->filename);
+    return ctx;
+}
 
-    return true;
+static bool
+recorder_close_io(AVFormatContext *ctx, const char *filename) {
+#ifndef _WIN32
+    struct avio_writer *writer = ctx->opaque;
+    if (writer) {
+        // wait for the pending data to be written
+        bool ok = avio_writer_close(writer);
+        if (!ok) {
+            LOGE("Failed to write to %s", filename);
+        }
+        SDL_free(writer);
+        return ok;
+    }
+#endif
+
+    return avio_close(ctx->pb) >= 0;
 }
 
-void
-recorder_close(struct recorder *recorder) {
-    if (recorder->header_written) {
-        int ret = av_write_trailer(recorder->ctx);
+// write the trailer and close the file
+static bool
+recorder_finish_output(AVFormatContext *ctx, const char *filename,
+                       bool header_written) {
+    bool ok = true;
+    if (header_written) {
+        int ret = av_write_trailer(ctx);
         if (ret < 0) {
-            LOGE("Failed to write trailer to %s", recorder->filename);
-            recorder->failed = true;
+            LOGE("Failed to write trailer to %s", filename);
+            ok = false;
         }
     } else {
         // the recorded file is empty
+        ok = false;
+    }
+    if (!recorder_close_io(ctx, filename)) {
+        ok = false;
+    }
+    avformat_free_context(ctx);
+    return ok;
+}
+
+// The index is a text file, written along the recording (and flushed on each
+// keyframe), so that it is usable even if the file is never finalized.
+//
+// Each line describes a frame: "<pts> <offset> <size> <keyframe>", where pts
+// is in microseconds from the start of the file, and offset is the position
+// from which the keyframe can be decoded (-1 for other frames).
+static bool
+recorder_open_index(struct recorder *recorder, const char *filename) {
+    assert(!recorder->index);
+
+    size_t len = strlen(filename);
+    char *index_filename = SDL_malloc(len + sizeof(".idx"));
+    if (!index_filename) {
+        LOGC("Could not allocate index filename");
+        return false;
+    }
+    memcpy(index_filename, filename, len);
+    memcpy(&index_filename[len], ".idx", sizeof(".idx"));
+
+    recorder->index = fopen(index_filename, "w");
+    if (!recorder->index) {
+        LOGE("Could not open index file: %s", index_filename);
+        SDL_free(index_filename);
+        return false;
+    }
+
+    SDL_free(index_filename);
+
+    if (fprintf(recorder->index, "# scrcpy index: pts(us) offset size key\n")
+            < 0) {
+        LOGE("Could not write index header");
+        fclose(recorder->index);
+        recorder->index = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+static void
+recorder_close_index(struct recorder *recorder) {
+    if (recorder->index) {
+        if (fclose(recorder->index)) {
+            LOGW("Could not close index file");
+        }
+        recorder->index = NULL;
+    }
+}
+
+// the index must not fail the recording, it is disabled on error
+static void
+recorder_write_index(struct recorder *recorder, int64_t pts, int64_t offset,
+                     int size, bool key) {
+    assert(recorder->index);
+
+    int r = fprintf(recorder->index, "%" PRId64 " %" PRId64 " %d %d\n", pts,
+                    offset, size, key);
+    if (r >= 0 && key) {
+        // the content up to this keyframe is immediately available
+        r = fflush(recorder->index);
+    }
+
+    if (r < 0) {
+        LOGW("Could not write index, index disabled");
+        recorder_close_index(recorder);
+    }
+}
+
+// Some muxers buffer the frames (in a cluster or a fragment) and write them
+// once the next keyframe is received. In that case, the keyframe offset is
+// the position of the cluster or fragment containing it, i.e. the position
+// just after the previous one has been flushed (on av_write_frame() of the
+// keyframe).
+static bool
+recorder_index_offset_after_write(struct recorder *recorder) {
+    return recorder->format == SC_RECORD_FORMAT_MKV
+        || recorder->params.fragmented;
+}
+
+static const char *
+recorder_get_output_filename(struct recorder *recorder) {
+    return recorder->segmented ? recorder->segment_filename
+                               : recorder->filename;
+}
+
+bool
+recorder_open(struct recorder *recorder, const AVCodec *input_codec) {
+    recorder->codec = input_codec;
+
+    const char *filename = recorder->filename;
+    if (recorder->segmented) {
+        recorder->segment_filename =
+            recorder_get_indexed_filename(recorder->filename, 0);
+        if (!recorder->segment_filename) {
+            LOGC("Could not allocate segment filename");
+            return false;
+        }
+        filename = recorder->segment_filename;
+    }
+
+    recorder->ctx = recorder_open_output(recorder, input_codec, filename);
+    if (!recorder->ctx) {
+        SDL_free(recorder->segment_filename);
+        return false;
+    }
+
+    if (recorder->params.index && !recorder_open_index(recorder, filename)) {
+        LOGW("Recording without index");
+    }
+
+    const char *format_name = recorder_get_format_name(recorder->format);
+    LOGI("Recording started to %s file: %s", format_name, filename);
+
+    return true;
+}
+
+void
+recorder_close(struct recorder *recorder) {
+    const char *filename = recorder_get_output_filename(recorder);
+    bool ok = recorder_finish_output(recorder->ctx, filename,
+                                     recorder->header_written);
+    if (!ok) {
         recorder->failed = true;
     }
-    avio_close(recorder->ctx->pb);
-    avformat_free_context(recorder->ctx);
 
     if (recorder->failed) {
-        LOGE("Recording failed to %s", recorder->filename);
+        LOGE("Recording failed to %s", filename);
     } else {
         const char *format_name = recorder_get_format_name(recorder->format);
-        LOGI("Recording complete to %s file: %s", format_name, recorder->filename);
+        LOGI("Recording complete to %s file: %s", format_name, filename);
     }
+
+    recorder_close_index(recorder);
+    SDL_free(recorder->segment_filename);
 }
 
 static bool
-recorder_write_header(struct recorder *recorder, const AVPacket *packet) {
+recorder_write_header(struct recorder *recorder) {
     AVStream *ostream = recorder->ctx->streams[0];
 
-    uint8_t *extradata = av_malloc(packet->size * sizeof(uint8_t));
+    assert(recorder->extradata);
+    uint8_t *extradata = av_malloc(recorder->extradata_size);
     if (!extradata) {
         LOGC("Could not allocate extradata");
         return false;
     }
 
-    // copy the first packet to the extra data
-    memcpy(extradata, packet->data, packet->size);
+    // the output context owns its own copy
+    memcpy(extradata, recorder->extradata, recorder->extradata_size);
 
 #ifdef SCRCPY_LAVF_HAS_NEW_CODEC_PARAMS_API
     ostream->codecpar->extradata = extradata;
-    ostream->codecpar->extradata_size = packet->size;
+    ostream->codecpar->extradata_size = recorder->extradata_size;
 #else
     ostream->codec->extradata = extradata;
-    ostream->codec->extradata_size = packet->size;
+    ostream->codec->extradata_size = recorder->extradata_size;
 #endif
 
-    int ret = avformat_write_header(recorder->ctx, NULL);
+    AVDictionary *opts = NULL;
+    if (recorder->params.fragmented) {
+        // The moov atom is written immediately without any sample (so the
+        // file is playable even if it is truncated), then samples are written
+        // in fragments which are released as soon as they are written. This
+        // keeps the memory usage flat and makes the trailer trivial.
+        if (recorder->params.fragment_duration) {
+            av_dict_set(&opts, "movflags", "empty_moov+default_base_moof", 0);
+            // frag_duration is expressed in microseconds
+            av_dict_set_int(&opts, "frag_duration",
+                            (int64_t) recorder->params.fragment_duration * 1000,
+                            0);
+        } else {
+            av_dict_set(&opts, "movflags",
+                        "frag_keyframe+empty_moov+default_base_moof", 0);
+        }
+        // flush the I/O buffer to the file whenever a fragment is complete
+        av_dict_set(&opts, "flush_packets", "1", 0);
+    }
+
+    int ret = avformat_write_header(recorder->ctx, &opts);
+    av_dict_free(&opts);
     if (ret < 0) {
-        LOGE("Failed to write header to %s", recorder->filename);
+        LOGE("Failed to write header to %s",
+             recorder_get_output_filename(recorder));
         return false;
     }
 
     return true;
 }
 
+// keep a copy of the config packet (SPS/PPS) for the header of each segment
+static bool
+recorder_set_extradata(struct recorder *recorder, const AVPacket *packet) {
+    uint8_t *extradata = av_malloc(packet->size * sizeof(uint8_t));
+    if (!extradata) {
+        LOGC("Could not allocate extradata");
+        return false;
+    }
+
+    memcpy(extradata, packet->data, packet->size);
+
+    av_free(recorder->extradata);
+    recorder->extradata = extradata;
+    recorder->extradata_size = packet->size;
+    return true;
+}
+
 static void
 recorder_rescale_packet(struct recorder *recorder, AVPacket *packet) {
     AVStream *ostream = recorder->ctx->streams[0];
     av_packet_rescale_ts(packet, SCRCPY_TIME_BASE, ostream->time_base);
 }
 
-bool
-recorder_write(struct recorder *recorder, AVPacket *packet) {
+static bool
+recorder_segment_full(struct recorder *recorder, const AVPacket *packet) {
+    uint32_t duration = recorder->params.segment_duration;
+    if (duration && packet->pts - recorder->segment_start_pts
+                        >= (int64_t) duration * 1000000) {
+        return true;
+    }
+
+    uint32_t size = recorder->params.segment_size;
+    return size && avio_tell(recorder->ctx->pb) >= size;
+}
+
+static bool
+recorder_must_rotate(struct recorder *recorder, const AVPacket *packet) {
+    if (!recorder->segmented
+            || recorder->segment_start_pts == AV_NOPTS_VALUE
+            || !recorder_segment_full(recorder, packet)) {
+        return false;
+    }
+
+    if (!(packet->flags & AV_PKT_FLAG_KEY)) {
+        // a segment must start on a keyframe: request one rather than wait
+        // for the next periodic keyframe, so that the segments do not exceed
+        // the limits by several seconds
+        if (!recorder->keyframe_requested) {
+            request_keyframe();
+            recorder->keyframe_requested = true;
+        }
+        return false;
+    }
+
+    return true;
+}
+
+// start a new segment, the previous one is finalized by the finisher thread
+static bool
+recorder_rotate(struct recorder *recorder) {
+    unsigned index = recorder->segment_index + 1;
+    char *filename = recorder_get_indexed_filename(recorder->filename, index);
+    if (!filename) {
+        LOGC("Could not allocate segment filename");
+        return false;
+    }
+
+    struct record_segment *segment = SDL_malloc(sizeof(*segment));
+    if (!segment) {
+        LOGC("Could not allocate segment");
+        SDL_free(filename);
+        return false;
+    }
+
+    AVFormatContext *ctx =
+        recorder_open_output(recorder, recorder->codec, filename);
+    if (!ctx) {
+        SDL_free(segment);
+        SDL_free(filename);
+        return false;
+    }
+
+    segment->ctx = recorder->ctx;
+    segment->filename = recorder->segment_filename;
+
+    mutex_lock(recorder->finisher.mutex);
+    queue_push(&recorder->finisher.queue, next, segment);
+    cond_signal(recorder->finisher.queue_cond);
+    mutex_unlock(recorder->finisher.mutex);
+
+    recorder->ctx = ctx;
+    recorder->segment_filename = filename;
+    recorder->segment_index = index;
+    recorder->segment_start_pts = AV_NOPTS_VALUE;
+    recorder->keyframe_requested = false;
+
+    if (recorder->params.index) {
+        // each segment has its own index
+        recorder_close_index(recorder);
+        if (!recorder_open_index(recorder, filename)) {
+            LOGW("Recording segment without index");
+        }
+    }
+
+    recorder->header_written = recorder_write_header(recorder);
     if (!recorder->header_written) {
-        if (packet->pts != AV_NOPTS_VALUE) {
-            LOGE("The first packet is not a config packet");
+        return false;
+    }
+
+    LOGI("Recording segment started: %s", filename);
+    return true;
+}
+
+static bool
+recorder_write(struct recorder *recorder, AVPacket *packet) {
+    if (packet->pts == AV_NOPTS_VALUE) {
+        // config packet
+        if (!recorder_set_extradata(recorder, packet)) {
             return false;
         }
-        bool ok = recorder_write_header(recorder, packet);
+        if (!recorder->header_written) {
+            bool ok = recorder_write_header(recorder);
+            if (!ok) {
+                return false;
+            }
+            recorder->header_written = true;
+        }
+        // a config packet is not written as a frame
+        return true;
+    }
+
+    if (!recorder->header_written) {
+        LOGE("The first packet is not a config packet");
+        return false;
+    }
+
+    if (recorder_must_rotate(recorder, packet)) {
+        bool ok = recorder_rotate(recorder);
         if (!ok) {
+            LOGE("Could not start a new segment");
             return false;
         }
-        recorder->header_written = true;
-        return true;
     }
 
-    if (packet->pts == AV_NOPTS_VALUE) {
-        // ignore config packets
-        return true;
+    if (recorder->segment_start_pts == AV_NOPTS_VALUE) {
+        recorder->segment_start_pts = packet->pts;
     }
 
+    // each segment (or the whole recording) starts at 0
+    packet->pts -= recorder->segment_start_pts;
+    packet->dts = packet->pts;
+
+    // read before rescaling
+    int64_t pts = packet->pts;
+    bool key = packet->flags & AV_PKT_FLAG_KEY;
+    int size = packet->size;
+    int64_t offset = avio_tell(recorder->ctx->pb);
+
     recorder_rescale_packet(recorder, packet);
-    return av_write_frame(recorder->ctx, packet) >= 0;
+    if (av_write_frame(recorder->ctx, packet) < 0) {
+        return false;
+    }
+
+    if (recorder->index) {
+        if (!key) {
+            offset = -1;
+        } else if (recorder_index_offset_after_write(recorder)) {
+            offset = avio_tell(recorder->ctx->pb);
+        }
+        recorder_write_index(recorder, pts, offset, size, key);
+    }
+
+#ifndef _WIN32
+    struct avio_writer *writer = recorder->ctx->opaque;
+    if (writer && recorder->params.fragmented) {
+        // a complete fragment must reach the file, so that it is playable
+        // if scrcpy is killed
+        avio_writer_flush(writer);
+    }
+#endif
+
+    return true;
+}
+
+static int
+run_finisher(void *data) {
+    struct recorder *recorder = data;
+
+    for (;;) {
+        mutex_lock(recorder->finisher.mutex);
+
+        while (!recorder->finisher.stopped
+                && queue_is_empty(&recorder->finisher.queue)) {
+            cond_wait(recorder->finisher.queue_cond, recorder->finisher.mutex);
+        }
+
+        if (queue_is_empty(&recorder->finisher.queue)) {
+            // stopped and nothing left to finish
+            mutex_unlock(recorder->finisher.mutex);
+            break;
+        }
+
+        struct record_segment *segment;
+        queue_take(&recorder->finisher.queue, next, &segment);
+
+        mutex_unlock(recorder->finisher.mutex);
+
+        bool ok = recorder_finish_output(segment->ctx, segment->filename, true);
+        if (ok) {
+            LOGI("Recording segment complete: %s", segment->filename);
+        } else {
+            LOGE("Recording segment failed: %s", segment->filename);
+            mutex_lock(recorder->mutex);
+            recorder->failed = true;
+            mutex_unlock(recorder->mutex);
+        }
+        record_segment_delete(segment);
+    }
+
+    LOGD("Recorder finisher thread ended");
+
+    return 0;
 }
 
 static int
@@ -330,11 +804,29 @@ run_recorder(void *data) {
 
 bool
 recorder_start(struct recorder *recorder) {
+    if (recorder->segmented) {
+        LOGD("Starting recorder finisher thread");
+
+        recorder->finisher.thread =
+            SDL_CreateThread(run_finisher, "recorder-finisher", recorder);
+        if (!recorder->finisher.thread) {
+            LOGC("Could not start recorder finisher thread");
+            return false;
+        }
+    }
+
     LOGD("Starting recorder thread");
 
     recorder->thread = SDL_CreateThread(run_recorder, "recorder", recorder);
     if (!recorder->thread) {
         LOGC("Could not start recorder thread");
+        if (recorder->finisher.thread) {
+            mutex_lock(recorder->finisher.mutex);
+            recorder->finisher.stopped = true;
+            cond_signal(recorder->finisher.queue_cond);
+            mutex_unlock(recorder->finisher.mutex);
+            SDL_WaitThread(recorder->finisher.thread, NULL);
+        }
         return false;
     }
 
@@ -352,6 +844,17 @@ recorder_stop(struct recorder *recorder) {
 void
 recorder_join(struct recorder *recorder) {
     SDL_WaitThread(recorder->thread, NULL);
+
+    if (recorder->finisher.thread) {
+        // the recorder thread will not produce any new segment, finish the
+        // pending ones
+        mutex_lock(recorder->finisher.mutex);
+        recorder->finisher.stopped = true;
+        cond_signal(recorder->finisher.queue_cond);
+        mutex_unlock(recorder->finisher.mutex);
+
+        SDL_WaitThread(recorder->finisher.thread, NULL);
+    }
 }
 
 bool
@@ -2,6 +2,7 @@
 #define RECORDER_H
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <libavformat/avformat.h>
 #include <SDL2/SDL_mutex.h>
 #include <SDL2/SDL_thread.h>
@@ -18,13 +19,67 @@ struct record_packet {
 
 struct recorder_queue QUEUE(struct record_packet);
 
-struct recorder {
+// a finished segment, to be finalized (trailer written and file closed)
+struct record_segment {
+    AVFormatContext *ctx;
     char *filename;
+    struct record_segment *next;
+};
+
+struct record_segment_queue QUEUE(struct record_segment);
+
+struct recorder_params {
+    // fragmented MP4: write the sample index in small fragments (moof) along
+    // the stream instead of a single moov at the end
+    bool fragmented;
+    uint32_t fragment_duration; // in ms, 0 to fragment on keyframes
+
+    // segmented recording: the filename is a pattern (e.g. "file_%03d.mp4")
+    // and a new file is started on the first keyframe after the limit
+    uint32_t segment_duration; // in seconds, 0 for no limit
+    uint32_t segment_size; // in bytes, 0 for no limit
+
+    // write through an asynchronous buffered writer (see avio_writer.h),
+    // ignored on Windows
+    uint32_t buffer_size; // in bytes, 0 to write synchronously
+    uint32_t preallocate; // in bytes, 0 to disable
+    bool direct_io;
+
+    // write an index of the frames to "<file>.idx" along the recording
+    bool index;
+};
+
+struct recorder {
+    char *filename; // the pattern if the recording is segmented
     enum sc_record_format format;
+    const AVCodec *codec;
     AVFormatContext *ctx;
     struct size declared_frame_size;
+    struct recorder_params params;
     bool header_written;
 
+    // the last config packet (SPS/PPS), to write the header of each segment
+    uint8_t *extradata;
+    int extradata_size;
+
+    // only accessed from the recorder thread (after recorder_open())
+    bool segmented;
+    unsigned segment_index;
+    char *segment_filename;
+    int64_t segment_start_pts; // rebase the timestamps of each segment
+    bool keyframe_requested; // to end the current segment
+    FILE *index; // the index of the current file, or NULL
+
+    // finished segments are finalized in a separate thread, so that a
+    // rotation never stalls the recorder queue
+    struct {
+        SDL_Thread *thread;
+        SDL_mutex *mutex;
+        SDL_cond *queue_cond;
+        bool stopped;
+        struct record_segment_queue queue;
+    } finisher;
+
     SDL_Thread *thread;
     SDL_mutex *mutex;
     SDL_cond *queue_cond;
@@ -41,7 +96,8 @@ struct recorder {
 
 bool
 recorder_init(struct recorder *recorder, const char *filename,
-              enum sc_record_format format, struct size declared_frame_size);
+              enum sc_record_format format, struct size declared_frame_size,
+              const struct recorder_params *params);
 
 void
 recorder_destroy(struct recorder *recorder);
@@ -64,4 +120,9 @@ recorder_join(struct recorder *recorder);
 bool
 recorder_push(struct recorder *recorder, const AVPacket *packet);
 
+// expand the pattern (e.g. "file_%03d.mp4") for the given index
+// return NULL if there is no pattern (or on allocation failure)
+char *
+recorder_get_indexed_filename(const char *pattern, unsigned index);
+
 #endif
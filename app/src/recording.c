@@ -0,0 +1,152 @@
+#include "recording.h"
+
+#include <assert.h>
+
+#include "config.h"
+#include "keyframe_request.h"
+#include "util/log.h"
+
+bool
+recording_init(struct recording *recording, struct stream *stream,
+               const char *filename, enum sc_record_format format,
+               struct size declared_frame_size,
+               const struct recorder_params *params) {
+    // the pattern, if any, is used for the recording index
+    assert(!params->segment_duration && !params->segment_size);
+
+    recording->filename = SDL_strdup(filename);
+    if (!recording->filename) {
+        LOGE("Could not strdup filename");
+        return false;
+    }
+
+    recording->stream = stream;
+    recording->format = format;
+    recording->declared_frame_size = declared_frame_size;
+    recording->params = *params;
+    recording->active = false;
+    recording->index = 0;
+    recording->finisher_thread = NULL;
+
+    return true;
+}
+
+void
+recording_destroy(struct recording *recording) {
+    assert(!recording->active);
+    SDL_free(recording->filename);
+}
+
+static void
+recording_finish(struct recording *recording) {
+    struct recorder *recorder = &recording->recorder;
+
+    recorder_stop(recorder);
+    LOGI("Finishing recording...");
+    recorder_join(recorder);
+    recorder_close(recorder);
+    recorder_destroy(recorder);
+}
+
+static int
+run_finisher(void *data) {
+    struct recording *recording = data;
+    recording_finish(recording);
+    return 0;
+}
+
+bool
+recording_start(struct recording *recording) {
+    if (recording->active) {
+        return true;
+    }
+
+    // the recorder of the previous recording must be released
+    recording_join(recording);
+
+    char *filename = recorder_get_indexed_filename(recording->filename,
+                                                   recording->index);
+    if (!filename) {
+        // no pattern, always use the same file
+        filename = SDL_strdup(recording->filename);
+        if (!filename) {
+            LOGC("Could not allocate filename");
+            return false;
+        }
+    }
+
+    struct recorder *recorder = &recording->recorder;
+    bool ok = recorder_init(recorder, filename, recording->format,
+                            recording->declared_frame_size,
+                            &recording->params);
+    SDL_free(filename);
+    if (!ok) {
+        return false;
+    }
+
+    // the recorder only needs the codec id
+    const AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+    assert(codec);
+
+    if (!recorder_open(recorder, codec)) {
+        LOGE("Could not open recorder");
+        recorder_destroy(recorder);
+        return false;
+    }
+
+    if (!recorder_start(recorder)) {
+        LOGE("Could not start recorder");
+        recorder_close(recorder);
+        recorder_destroy(recorder);
+        return false;
+    }
+
+    if (!stream_attach_recorder(recording->stream, recorder)) {
+        LOGW("No keyframe received yet, could not start recording (retry "
+             "shortly)");
+        // so that the next attempt succeeds
+        request_keyframe();
+        recording_finish(recording);
+        return false;
+    }
+
+    recording->active = true;
+    ++recording->index;
+    return true;
+}
+
+void
+recording_stop(struct recording *recording) {
+    if (!recording->active) {
+        return;
+    }
+
+    // the live stream is not impacted
+    stream_detach_recorder(recording->stream, &recording->recorder);
+    recording->active = false;
+
+    // writing the remaining packets and the trailer may take some time
+    recording->finisher_thread =
+        SDL_CreateThread(run_finisher, "recording-finisher", recording);
+    if (!recording->finisher_thread) {
+        LOGW("Could not start recording finisher thread");
+        recording_finish(recording);
+    }
+}
+
+void
+recording_toggle(struct recording *recording) {
+    if (recording->active) {
+        recording_stop(recording);
+    } else {
+        recording_start(recording);
+    }
+}
+
+void
+recording_join(struct recording *recording) {
+    if (recording->finisher_thread) {
+        SDL_WaitThread(recording->finisher_thread, NULL);
+        recording->finisher_thread = NULL;
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <stdbool.h>
+#include <SDL2/SDL_thread.h>
+
+#include "config.h"
+#include "common.h"
+#include "recorder.h"
+#include "scrcpy.h"
+#include "stream.h"
+
+// Recording started and stopped on demand while the stream is running.
+//
+// A new recording starts immediately from the current GOP cached by the
+// stream, so it does not need to wait for the next keyframe.
+struct recording {
+    struct stream *stream;
+    char *filename; // may contain a pattern for the recording index
+    enum sc_record_format format;
+    struct size declared_frame_size;
+    struct recorder_params params;
+
+    // only accessed from the main thread
+    bool active;
+    unsigned index;
+    struct recorder recorder;
+    // finalize a stopped recording without blocking the main thread
+    SDL_Thread *finisher_thread;
+};
+
+bool
+recording_init(struct recording *recording, struct stream *stream,
+               const char *filename, enum sc_record_format format,
+               struct size declared_frame_size,
+               const struct recorder_params *params);
+
+void
+recording_destroy(struct recording *recording);
+
+bool
+recording_start(struct recording *recording);
+
+void
+recording_stop(struct recording *recording);
+
+void
+recording_toggle(struct recording *recording);
+
+// wait for the last stopped recording to be finalized
+void
+recording_join(struct recording *recording);
+
+#endif
@@ -0,0 +1,430 @@
+#include "replay_buffer.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "config.h"
+#include "util/lock.h"
+#include "util/log.h"
+
+// config may be NULL (if the packet does not start a GOP)
+static struct replay_packet *
+replay_packet_new(const AVPacket *packet, const AVPacket *config) {
+    struct replay_packet *rp = SDL_malloc(sizeof(*rp));
+    if (!rp) {
+        return NULL;
+    }
+
+    // av_packet_ref() does not initialize all fields in old FFmpeg versions
+    // See <https://github.com/Genymobile/scrcpy/issues/707>
+    av_init_packet(&rp->packet);
+
+    if (av_packet_ref(&rp->packet, packet)) {
+        SDL_free(rp);
+        return NULL;
+    }
+
+    rp->has_config = config;
+    if (config) {
+        av_init_packet(&rp->config);
+        if (av_packet_ref(&rp->config, config)) {
+            av_packet_unref(&rp->packet);
+            SDL_free(rp);
+            return NULL;
+        }
+    }
+    return rp;
+}
+
+static void
+replay_packet_delete(struct replay_packet *rp) {
+    av_packet_unref(&rp->packet);
+    if (rp->has_config) {
+        av_packet_unref(&rp->config);
+    }
+    SDL_free(rp);
+}
+
+static void
+replay_packet_queue_clear(struct replay_packet_queue *queue) {
+    while (!queue_is_empty(queue)) {
+        struct replay_packet *rp;
+        queue_take(queue, next, &rp);
+        replay_packet_delete(rp);
+    }
+}
+
+static bool
+is_same_config(const AVPacket *a, const AVPacket *b) {
+    return a->size == b->size && !memcmp(a->data, b->data, a->size);
+}
+
+bool
+replay_buffer_init(struct replay_buffer *rb, const char *filename,
+                   enum sc_record_format format,
+                   struct size declared_frame_size, uint32_t max_duration,
+                   size_t max_size) {
+    if (filename) {
+        rb->filename = SDL_strdup(filename);
+        if (!rb->filename) {
+            LOGE("Could not strdup filename");
+            return false;
+        }
+        char *first = recorder_get_indexed_filename(filename, 0);
+        rb->has_pattern = first;
+        SDL_free(first);
+    } else {
+        // the buffer is only used as a cache
+        rb->filename = NULL;
+        rb->has_pattern = false;
+    }
+
+    rb->mutex = SDL_CreateMutex();
+    if (!rb->mutex) {
+        LOGC("Could not create mutex");
+        SDL_free(rb->filename);
+        return false;
+    }
+
+    rb->format = format;
+    rb->declared_frame_size = declared_frame_size;
+    rb->max_duration = (int64_t) max_duration * 1000000;
+    rb->max_size = max_size;
+    rb->has_config = false;
+    queue_init(&rb->queue);
+    rb->next_gop = NULL;
+    rb->last_gop = NULL;
+    rb->size = 0;
+    rb->saving = false;
+    rb->saver_thread = NULL;
+    queue_init(&rb->snapshot);
+    rb->save_index = 0;
+
+    return true;
+}
+
+void
+replay_buffer_destroy(struct replay_buffer *rb) {
+    replay_packet_queue_clear(&rb->queue);
+    assert(queue_is_empty(&rb->snapshot));
+    if (rb->has_config) {
+        av_packet_unref(&rb->config);
+    }
+    SDL_DestroyMutex(rb->mutex);
+    SDL_free(rb->filename);
+}
+
+// remove the oldest GOP
+static void
+replay_buffer_drop_gop(struct replay_buffer *rb) {
+    assert(rb->next_gop);
+    while (rb->queue.first != rb->next_gop) {
+        struct replay_packet *rp;
+        queue_take(&rb->queue, next, &rp);
+        rb->size -= rp->packet.size;
+        replay_packet_delete(rp);
+    }
+
+    // find the start of the next GOP, if any
+    struct replay_packet *rp = rb->queue.first->next;
+    while (rp && !(rp->packet.flags & AV_PKT_FLAG_KEY)) {
+        rp = rp->next;
+    }
+    rb->next_gop = rp;
+}
+
+static bool
+replay_buffer_must_drop_gop(struct replay_buffer *rb, int64_t last_pts) {
+    if (!rb->next_gop) {
+        // never drop the last GOP
+        return false;
+    }
+
+    if (last_pts - rb->next_gop->packet.pts >= rb->max_duration) {
+        // the following GOPs are sufficient to cover the duration
+        return true;
+    }
+
+    return rb->max_size && rb->size > rb->max_size;
+}
+
+bool
+replay_buffer_push(struct replay_buffer *rb, const AVPacket *packet) {
+    mutex_lock(rb->mutex);
+
+    if (packet->pts == AV_NOPTS_VALUE) {
+        // A new config packet is sent when the encoder is restarted (e.g. on
+        // device rotation): it only applies to the following GOPs, the
+        // previous ones keep a reference to their own config
+        if (rb->has_config) {
+            av_packet_unref(&rb->config);
+        }
+        av_init_packet(&rb->config);
+        rb->has_config = !av_packet_ref(&rb->config, packet);
+        mutex_unlock(rb->mutex);
+        if (!rb->has_config) {
+            LOGE("Could not reference config packet");
+            return false;
+        }
+        return true;
+    }
+
+    bool key = packet->flags & AV_PKT_FLAG_KEY;
+    if (queue_is_empty(&rb->queue) && (!key || !rb->has_config)) {
+        // the buffer must start with a keyframe (and its config)
+        mutex_unlock(rb->mutex);
+        return true;
+    }
+
+    const AVPacket *config = key && rb->has_config ? &rb->config : NULL;
+    struct replay_packet *rp = replay_packet_new(packet, config);
+    if (!rp) {
+        LOGC("Could not allocate replay packet");
+        mutex_unlock(rb->mutex);
+        return false;
+    }
+
+    if (key) {
+        if (!rb->next_gop && !queue_is_empty(&rb->queue)) {
+            rb->next_gop = rp;
+        }
+        rb->last_gop = rp;
+    }
+
+    queue_push(&rb->queue, next, rp);
+    rb->size += packet->size;
+
+    while (replay_buffer_must_drop_gop(rb, packet->pts)) {
+        replay_buffer_drop_gop(rb);
+    }
+
+    mutex_unlock(rb->mutex);
+    return true;
+}
+
+bool
+replay_buffer_feed(struct replay_buffer *rb, struct recorder *recorder) {
+    mutex_lock(rb->mutex);
+
+    if (queue_is_empty(&rb->queue)) {
+        mutex_unlock(rb->mutex);
+        return false;
+    }
+
+    struct replay_packet *first = rb->last_gop;
+    assert(first && (first->packet.flags & AV_PKT_FLAG_KEY));
+    assert(first->has_config);
+
+    // the packets are refcounted, this does not copy the data
+    bool ok = recorder_push(recorder, &first->config);
+    for (struct replay_packet *rp = first; ok && rp; rp = rp->next) {
+        ok = recorder_push(recorder, &rp->packet);
+    }
+
+    mutex_unlock(rb->mutex);
+    return ok;
+}
+
+static char *
+replay_buffer_get_filename(struct replay_buffer *rb, unsigned index) {
+    char *filename = recorder_get_indexed_filename(rb->filename, index);
+    if (!filename) {
+        // no pattern, always use the same file
+        filename = SDL_strdup(rb->filename);
+    }
+    return filename;
+}
+
+// Write the packets from the snapshot to a new file, until the config changes
+// (or the end of the snapshot)
+static bool
+replay_buffer_save_part(struct replay_buffer *rb, const AVCodec *codec) {
+    assert(!queue_is_empty(&rb->snapshot));
+
+    char *filename = replay_buffer_get_filename(rb, rb->save_index);
+    if (!filename) {
+        LOGC("Could not allocate replay filename");
+        return false;
+    }
+
+    struct recorder_params params = {
+        .fragmented = false,
+        .fragment_duration = 0,
+        .segment_duration = 0,
+        .segment_size = 0,
+        // the replay is written at once, not in real time
+        .buffer_size = 0,
+        .preallocate = 0,
+        .direct_io = false,
+        .index = false,
+    };
+    struct recorder *recorder = &rb->recorder;
+    bool ok = recorder_init(recorder, filename, rb->format,
+                            rb->declared_frame_size, &params);
+    SDL_free(filename);
+    if (!ok) {
+        return false;
+    }
+    ++rb->save_index;
+
+    if (!recorder_open(recorder, codec)) {
+        LOGE("Could not open replay file");
+        recorder_destroy(recorder);
+        return false;
+    }
+
+    if (!recorder_start(recorder)) {
+        LOGE("Could not start replay recorder");
+        recorder_close(recorder);
+        recorder_destroy(recorder);
+        return false;
+    }
+
+    struct replay_packet *first = rb->snapshot.first;
+    assert(first->has_config);
+    // the packets are refcounted, this does not copy the data
+    ok = recorder_push(recorder, &first->config);
+    while (ok && !queue_is_empty(&rb->snapshot)) {
+        struct replay_packet *rp = rb->snapshot.first;
+        if (rp != first && rp->has_config
+                && !is_same_config(&rp->config, &first->config)) {
+            // the next part starts here
+            break;
+        }
+        queue_take(&rb->snapshot, next, &rp);
+        ok = recorder_push(recorder, &rp->packet);
+        replay_packet_delete(rp);
+    }
+
+    // all the packets are queued, write them and stop
+    recorder_stop(recorder);
+    recorder_join(recorder);
+    recorder_close(recorder);
+    recorder_destroy(recorder);
+    return ok;
+}
+
+// Without a pattern for the replay index, all the parts would be written to
+// the same file: only keep the last one
+static void
+replay_buffer_keep_last_part(struct replay_buffer *rb) {
+    struct replay_packet *last = rb->snapshot.first;
+    for (struct replay_packet *rp = last; rp; rp = rp->next) {
+        if (rp->has_config && !is_same_config(&rp->config, &last->config)) {
+            last = rp;
+        }
+    }
+
+    if (last == rb->snapshot.first) {
+        return;
+    }
+
+    int64_t duration = last->packet.pts - rb->snapshot.first->packet.pts;
+    LOGW("The device encoder config changed, the first %" PRIi64 " ms of the "
+         "replay are not saved (use a pattern in --replay-file to save them "
+         "to separate files)", duration / 1000);
+    while (rb->snapshot.first != last) {
+        struct replay_packet *rp;
+        queue_take(&rb->snapshot, next, &rp);
+        replay_packet_delete(rp);
+    }
+}
+
+static int
+run_saver(void *data) {
+    struct replay_buffer *rb = data;
+
+    // the recorder only needs the codec id
+    const AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+    assert(codec);
+
+    if (!rb->has_pattern) {
+        replay_buffer_keep_last_part(rb);
+    }
+
+    while (!queue_is_empty(&rb->snapshot)) {
+        if (!replay_buffer_save_part(rb, codec)) {
+            LOGE("Could not save replay");
+            break;
+        }
+    }
+    replay_packet_queue_clear(&rb->snapshot);
+
+    mutex_lock(rb->mutex);
+    rb->saving = false;
+    mutex_unlock(rb->mutex);
+
+    return 0;
+}
+
+// capture the whole content (the packets are refcounted, this does not copy
+// the data)
+static bool
+replay_buffer_take_snapshot(struct replay_buffer *rb) {
+    assert(queue_is_empty(&rb->snapshot));
+
+    for (struct replay_packet *rp = rb->queue.first; rp; rp = rp->next) {
+        struct replay_packet *copy =
+            replay_packet_new(&rp->packet, rp->has_config ? &rp->config : NULL);
+        if (!copy) {
+            LOGC("Could not allocate replay packet");
+            replay_packet_queue_clear(&rb->snapshot);
+            return false;
+        }
+        queue_push(&rb->snapshot, next, copy);
+    }
+    return true;
+}
+
+bool
+replay_buffer_save(struct replay_buffer *rb) {
+    assert(rb->filename);
+
+    mutex_lock(rb->mutex);
+    if (rb->saving) {
+        mutex_unlock(rb->mutex);
+        LOGW("Replay already being saved");
+        return false;
+    }
+    rb->saving = true;
+    mutex_unlock(rb->mutex);
+
+    // the previous saver thread, if any, is terminated
+    replay_buffer_join(rb);
+
+    // capture the content immediately, the files are written asynchronously
+    mutex_lock(rb->mutex);
+    bool empty = queue_is_empty(&rb->queue);
+    bool ok = !empty && replay_buffer_take_snapshot(rb);
+    mutex_unlock(rb->mutex);
+    if (empty) {
+        LOGW("Replay buffer is empty");
+    }
+    if (!ok) {
+        goto error;
+    }
+
+    rb->saver_thread = SDL_CreateThread(run_saver, "replay-saver", rb);
+    if (!rb->saver_thread) {
+        LOGC("Could not start replay saver thread");
+        replay_packet_queue_clear(&rb->snapshot);
+        goto error;
+    }
+
+    return true;
+
+error:
+    mutex_lock(rb->mutex);
+    rb->saving = false;
+    mutex_unlock(rb->mutex);
+    return false;
+}
+
+void
+replay_buffer_join(struct replay_buffer *rb) {
+    if (rb->saver_thread) {
+        SDL_WaitThread(rb->saver_thread, NULL);
+        rb->saver_thread = NULL;
+    }
+}
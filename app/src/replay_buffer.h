@@ -0,0 +1,99 @@
+#ifndef REPLAY_BUFFER_H
+#define REPLAY_BUFFER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <libavformat/avformat.h>
+#include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_thread.h>
+
+#include "config.h"
+#include "common.h"
+#include "recorder.h"
+#include "scrcpy.h"
+#include "util/queue.h"
+
+struct replay_packet {
+    AVPacket packet;
+    // the first packet of each GOP references the config packet (SPS/PPS) it
+    // has been encoded with
+    bool has_config;
+    AVPacket config;
+    struct replay_packet *next;
+};
+
+struct replay_packet_queue QUEUE(struct replay_packet);
+
+// Keep the most recent packets in memory, so that the last seconds can be
+// saved to a file on demand ("instant replay").
+//
+// The buffer is GOP-aligned: it always starts with a keyframe, and only whole
+// GOPs are discarded, so that its content can be decoded from the start.
+//
+// The device encoder is restarted on rotation (or on max fps change), with a
+// new config packet: the GOPs before it are kept, each associated to its own
+// config. On save, a new file is started whenever the config changes.
+struct replay_buffer {
+    char *filename; // may contain a pattern for the replay index (or NULL)
+    bool has_pattern;
+    enum sc_record_format format;
+    struct size declared_frame_size;
+    int64_t max_duration; // in us
+    size_t max_size; // in bytes, 0 for no limit
+
+    SDL_mutex *mutex;
+
+    // the following fields are protected by the mutex
+    bool has_config;
+    AVPacket config; // the last config packet (SPS/PPS), for the next GOP
+    struct replay_packet_queue queue;
+    // the first packet of the second GOP (NULL if there is only one GOP)
+    struct replay_packet *next_gop;
+    // the first packet of the current (last) GOP
+    struct replay_packet *last_gop;
+    size_t size; // total size of the queued packets
+    bool saving;
+
+    // only accessed from the main thread
+    SDL_Thread *saver_thread;
+
+    // only accessed from the saver thread (once started)
+    struct replay_packet_queue snapshot; // the content to save
+    unsigned save_index;
+    struct recorder recorder;
+};
+
+// If filename is NULL, the buffer may not be saved (it is only used as a
+// cache). With a max_duration of 0, only the current GOP is kept.
+bool
+replay_buffer_init(struct replay_buffer *rb, const char *filename,
+                   enum sc_record_format format,
+                   struct size declared_frame_size, uint32_t max_duration,
+                   size_t max_size);
+
+void
+replay_buffer_destroy(struct replay_buffer *rb);
+
+bool
+replay_buffer_push(struct replay_buffer *rb, const AVPacket *packet);
+
+// Push the config packet then the current GOP to the recorder, so that it
+// starts with a keyframe.
+// Return false if the buffer contains no keyframe yet.
+bool
+replay_buffer_feed(struct replay_buffer *rb, struct recorder *recorder);
+
+// save the current content to a new file (one per encoder config), in a
+// separate thread (the live stream is not paused)
+//
+// If the filename contains no pattern for the replay index, only the content
+// encoded with the last config is saved.
+bool
+replay_buffer_save(struct replay_buffer *rb);
+
+// wait for the pending save, if any
+void
+replay_buffer_join(struct replay_buffer *rb);
+
+#endif
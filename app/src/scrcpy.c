@@ -1,7 +1,16 @@
+#ifndef _WIN32
+// for sigwait(), pthread_sigmask() and dup()
+# define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "scrcpy.h"
 
+#include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#ifndef _WIN32
+# include <signal.h>
+#endif
 #include <unistd.h>
 #include <libavformat/avformat.h>
 #include <sys/time.h>
@@ -14,6 +23,7 @@
 #endif
 
 #include "config.h"
+#include "adaptive_bit_rate.h"
 #include "command.h"
 #include "common.h"
 #include "compat.h"
@@ -23,8 +33,12 @@
 #include "events.h"
 #include "file_handler.h"
 #include "fps_counter.h"
+#include "input_latency.h"
 #include "input_manager.h"
+#include "keyframe_request.h"
 #include "recorder.h"
+#include "recording.h"
+#include "replay_buffer.h"
 #include "screen.h"
 #include "server.h"
 #include "stream.h"
@@ -41,8 +55,13 @@ static struct fps_counter fps_counter;
 static struct video_buffer video_buffer;
 static struct stream stream;
 static struct decoder decoder;
-static struct recorder recorder;
+static struct recorder recorders[SC_MAX_RECORD_OUTPUTS];
+static struct replay_buffer replay_buffer;
+static struct recording recordings[SC_MAX_RECORD_OUTPUTS];
 static struct controller controller;
+static struct input_latency input_latency;
+static struct adaptive_bit_rate adaptive_bit_rate;
+static struct keyframe_limiter keyframe_limiter;
 static struct file_handler file_handler;
 #ifdef V4L2SINK
 static struct v4l2sink v4l2sink;
@@ -74,6 +93,130 @@ BOOL WINAPI windows_ctrl_handler(DWORD ctrl_type) {
 }
 #endif // _WIN32
 
+#ifndef _WIN32
+static sigset_t watched_signals;
+
+// Signals are received synchronously by a dedicated thread (blocked in
+// sigwait()), so that they can be safely converted to SDL events
+static int
+run_signal_watcher(void *data) {
+    (void) data;
+    for (;;) {
+        int sig;
+        if (sigwait(&watched_signals, &sig)) {
+            LOGE("Could not wait for signals");
+            break;
+        }
+
+        SDL_Event event;
+        if (sig == SIGUSR1) {
+            event.type = EVENT_SAVE_REPLAY;
+        } else {
+            assert(sig == SIGUSR2);
+            event.type = EVENT_TOGGLE_RECORDING;
+        }
+        SDL_PushEvent(&event);
+    }
+    return 0;
+}
+
+// must be called before any other thread is created, so that they inherit the
+// signal mask
+static bool
+block_watched_signals(void) {
+    sigemptyset(&watched_signals);
+    sigaddset(&watched_signals, SIGUSR1);
+    sigaddset(&watched_signals, SIGUSR2);
+    return !pthread_sigmask(SIG_BLOCK, &watched_signals, NULL);
+}
+
+static bool
+start_signal_watcher(void) {
+    SDL_Thread *thread =
+        SDL_CreateThread(run_signal_watcher, "signal-watcher", NULL);
+    if (!thread) {
+        return false;
+    }
+    // the thread is blocked in sigwait() until the process exits
+    SDL_DetachThread(thread);
+    return true;
+}
+#endif // _WIN32
+
+// all the on-demand recordings are started and stopped together
+static void
+toggle_recordings(unsigned count) {
+    bool active = false;
+    for (unsigned i = 0; i < count; ++i) {
+        active |= recordings[i].active;
+    }
+
+    for (unsigned i = 0; i < count; ++i) {
+        if (active) {
+            recording_stop(&recordings[i]);
+        } else {
+            recording_start(&recordings[i]);
+        }
+    }
+}
+
+// the filename passed to the recorder for the "-" output
+static char stdout_record_filename[16] = "pipe:1";
+
+static bool
+prepare_stdout_recording(void) {
+#ifndef _WIN32
+    // The video is written to a duplicate of the original stdout, and stdout
+    // is redirected to stderr, so that nothing else (including the output of
+    // adb, inherited by the child processes) may corrupt the stream
+    int fd = dup(STDOUT_FILENO);
+    if (fd == -1) {
+        LOGE("Could not duplicate stdout");
+        return false;
+    }
+
+    if (dup2(STDERR_FILENO, STDOUT_FILENO) == -1) {
+        LOGE("Could not redirect stdout");
+        close(fd);
+        return false;
+    }
+
+    // if the consumer exits, the write must fail (EPIPE) instead of killing
+    // scrcpy, so that the other outputs are not impacted
+    signal(SIGPIPE, SIG_IGN);
+
+    snprintf(stdout_record_filename, sizeof(stdout_record_filename),
+             "pipe:%d", fd);
+#endif
+    return true;
+}
+
+static const char *
+get_record_filename(const struct sc_record_output *output) {
+    return strcmp(output->filename, "-") ? output->filename
+                                         : stdout_record_filename;
+}
+
+static struct recorder_params
+get_recorder_params(const struct scrcpy_options *options,
+                    const struct sc_record_output *output) {
+    bool is_stdout = !strcmp(output->filename, "-");
+    struct recorder_params params = {
+        // only the mp4 muxer supports fragmentation
+        .fragmented = options->record_fragmented
+                   && output->format == SC_RECORD_FORMAT_MP4,
+        .fragment_duration = options->record_fragment_duration,
+        .segment_duration = options->record_segment_duration,
+        .segment_size = options->record_segment_size,
+        // stdout is not seekable, it is written synchronously
+        .buffer_size = is_stdout ? 0 : options->record_buffer_size,
+        .preallocate = options->record_preallocate,
+        .direct_io = options->record_direct_io,
+        .index = options->record_index && !is_stdout,
+    };
+    return params;
+}
+
 // init SDL and set appropriate hints
 static bool
 sdl_init_and_configure(bool display, const char *render_driver,
@@ -167,6 +310,91 @@ is_apk(const char *file) {
     return ext && !strcmp(ext, ".apk");
 }
 
+// Throttle the mirroring while the window is hidden (see --hidden-max-fps)
+static void
+set_window_hidden(const struct scrcpy_options *options, bool hidden) {
+    static bool window_hidden = false;
+    if (hidden == window_hidden) {
+        return;
+    }
+    window_hidden = hidden;
+
+    LOGD("Window %s", hidden ? "hidden, throttling" : "visible");
+
+    if (!decoder.v4l2sink) {
+        // on resume, the decoder waits for a keyframe
+        decoder_set_paused(&decoder, hidden);
+    }
+
+    struct control_msg msg;
+    msg.type = CONTROL_MSG_TYPE_SET_MAX_FPS;
+    msg.set_max_fps.max_fps = hidden ? options->hidden_max_fps
+                                     : options->max_fps;
+    if (!controller_push_msg(&controller, &msg)) {
+        LOGW("Could not request max fps change");
+    }
+
+    if (!hidden) {
+        // Refresh the window immediately: the encoder restart (if the max fps
+        // changed) only happens once the next frame is produced, so with a
+        // static device screen, nothing would be received until the next
+        // periodic keyframe
+        request_keyframe();
+    }
+}
+
+static void
+handle_window_visibility(const SDL_WindowEvent *event,
+                         const struct scrcpy_options *options) {
+    switch (event->event) {
+        case SDL_WINDOWEVENT_HIDDEN:
+        case SDL_WINDOWEVENT_MINIMIZED:
+            set_window_hidden(options, true);
+            break;
+        case SDL_WINDOWEVENT_SHOWN:
+        case SDL_WINDOWEVENT_EXPOSED:
+        case SDL_WINDOWEVENT_RESTORED:
+        case SDL_WINDOWEVENT_MAXIMIZED:
+            set_window_hidden(options, false);
+            break;
+    }
+}
+
+static Uint32
+retry_keyframe_request(Uint32 interval, void *userdata) {
+    (void) interval;
+    (void) userdata;
+
+    SDL_Event event;
+    event.type = EVENT_REQUEST_KEYFRAME;
+    event.user.code = 1; // retry
+    SDL_PushEvent(&event);
+    return 0; // do not repeat
+}
+
+static void
+handle_keyframe_request(bool retry) {
+    uint32_t delay;
+    enum keyframe_limiter_action action =
+        keyframe_limiter_request(&keyframe_limiter, SDL_GetTicks(), retry,
+                                 &delay);
+    if (action == KEYFRAME_LIMITER_DEFER) {
+        if (!SDL_AddTimer(delay, retry_keyframe_request, NULL)) {
+            LOGW("Could not defer keyframe request: %s", SDL_GetError());
+        }
+        return;
+    }
+    if (action == KEYFRAME_LIMITER_IGNORE) {
+        return;
+    }
+
+    struct control_msg msg;
+    msg.type = CONTROL_MSG_TYPE_REQUEST_KEYFRAME;
+    if (!controller_push_msg(&controller, &msg)) {
+        LOGW("Could not request keyframe");
+    }
+}
+
 enum event_result {
     EVENT_RESULT_CONTINUE,
     EVENT_RESULT_STOPPED_BY_USER,
@@ -192,8 +420,46 @@ handle_event(SDL_Event *event, const struct scrcpy_options *options) {
                 return EVENT_RESULT_CONTINUE;
             }
             break;
+        case EVENT_SAVE_REPLAY:
+            if (options->replay_buffer) {
+                replay_buffer_save(&replay_buffer);
+            } else {
+                LOGW("Replay buffer disabled (see --replay-buffer)");
+            }
+            break;
+        case EVENT_SET_BIT_RATE: {
+            // only sent if the controller is started
+            struct control_msg msg;
+            msg.type = CONTROL_MSG_TYPE_SET_BIT_RATE;
+            msg.set_bit_rate.bit_rate = (uint32_t) event->user.code;
+            if (!controller_push_msg(&controller, &msg)) {
+                LOGW("Could not request bit rate change");
+            }
+            break;
+        }
+        case EVENT_REQUEST_KEYFRAME:
+            // the controller is only started with control and display
+            if (options->control && options->display) {
+                handle_keyframe_request(event->user.code);
+            }
+            break;
+        case EVENT_KEYFRAME_RECEIVED:
+            if (options->control && options->display) {
+                keyframe_limiter_keyframe_received(&keyframe_limiter);
+            }
+            break;
+        case EVENT_TOGGLE_RECORDING:
+            if (options->record_on_demand) {
+                toggle_recordings(options->record_output_count);
+            } else {
+                LOGW("On-demand recording disabled (see --record-on-demand)");
+            }
+            break;
         case SDL_WINDOWEVENT:
             screen_handle_window_event(&screen, &event->window);
+            if (options->hidden_max_fps) {
+                handle_window_visibility(&event->window, options);
+            }
             break;
         case SDL_TEXTINPUT:
             if (!options->control) {
@@ -318,13 +584,35 @@ scrcpy(const struct scrcpy_options *options) {
     bool fps_counter_initialized = false;
     bool video_buffer_initialized = false;
     bool file_handler_initialized = false;
-    bool recorder_initialized = false;
+    unsigned recorder_count = 0;
+    bool replay_buffer_initialized = false;
+    unsigned recording_count = 0;
+    bool stream_initialized = false;
     bool stream_started = false;
     bool controller_initialized = false;
     bool controller_started = false;
+    bool input_latency_initialized = false;
+
+    bool record = options->record_output_count && !options->record_on_demand;
+    bool replay = !!options->replay_buffer;
+    // the replay buffer is also used as a cache for on-demand recording
+    bool cache = replay || options->record_on_demand;
+
+    for (unsigned i = 0; i < options->record_output_count; ++i) {
+        // must be done before any child process is started
+        if (!strcmp(options->record_outputs[i].filename, "-")
+                && !prepare_stdout_recording()) {
+            goto end;
+        }
+    }
 
-    bool record = !!options->record_filename;
-    
+#ifndef _WIN32
+    // SIGUSR1 saves the replay buffer, SIGUSR2 starts/stops the recording
+    bool watch_signals = cache && block_watched_signals();
+    if (cache && !watch_signals) {
+        LOGW("Could not block signals");
+    }
+#endif
 #ifdef V4L2SINK
     bool v4l2sink_initialized = false;
     bool v4l2 = !!options->v4l2sink_device;
@@ -340,6 +628,7 @@ scrcpy(const struct scrcpy_options *options) {
         .lock_video_orientation = options->lock_video_orientation,
         .control = options->control,
         .display_id = options->display_id,
+        .touch_batch_window = options->touch_batch_window,
         .show_touches = options->show_touches,
         .stay_awake = options->stay_awake,
         .codec_options = options->codec_options,
@@ -392,28 +681,69 @@ scrcpy(const struct scrcpy_options *options) {
             file_handler_initialized = true;
         }
 
-        decoder_init(&decoder, &video_buffer);
+        struct v4l2sink *decoder_sink = NULL;
+#ifdef V4L2SINK
+        if (v4l2) {
+            decoder_sink = &v4l2sink;
+        }
+#endif
+        decoder_init(&decoder, &video_buffer, decoder_sink);
         dec = &decoder;
     }
 
-    struct recorder *rec = NULL;
     if (record) {
-        if (!recorder_init(&recorder,
-                           options->record_filename,
-                           options->record_format,
-                           frame_size)) {
+        for (unsigned i = 0; i < options->record_output_count; ++i) {
+            const struct sc_record_output *output = &options->record_outputs[i];
+            struct recorder_params recorder_params =
+                get_recorder_params(options, output);
+            if (!recorder_init(&recorders[i],
+                               get_record_filename(output),
+                               output->format,
+                               frame_size,
+                               &recorder_params)) {
+                goto end;
+            }
+            ++recorder_count;
+        }
+    }
+
+    struct replay_buffer *rb = NULL;
+    if (cache) {
+        // without replay, only keep the current GOP
+        if (!replay_buffer_init(&replay_buffer,
+                                replay ? options->replay_filename : NULL,
+                                options->replay_format,
+                                frame_size,
+                                options->replay_buffer,
+                                options->replay_buffer_size)) {
             goto end;
         }
-        rec = &recorder;
-        recorder_initialized = true;
+        rb = &replay_buffer;
+        replay_buffer_initialized = true;
+
+#ifndef _WIN32
+        if (watch_signals && !start_signal_watcher()) {
+            LOGW("Could not start signal watcher thread");
+        }
+#endif
     }
 
     struct v4l2sink *sink = NULL;
 #ifdef V4L2SINK
     if (v4l2) {
+        struct v4l2sink_params v4l2sink_params = {
+            .format = options->v4l2sink_format,
+            .size = {
+                .width = options->v4l2sink_width,
+                .height = options->v4l2sink_height,
+            },
+            .fps = options->v4l2sink_fps,
+        };
         if (!v4l2sink_init(&v4l2sink,
                            options->v4l2sink_device,
-                           frame_size)) {
+                           frame_size,
+                           !dec,
+                           &v4l2sink_params)) {
             goto end;
         }
         sink = &v4l2sink;
@@ -423,7 +753,34 @@ scrcpy(const struct scrcpy_options *options) {
 
     av_log_set_callback(av_log_callback);
 
-    stream_init(&stream, server.video_socket, dec, rec, sink);
+    struct adaptive_bit_rate *abr = NULL;
+    if (options->max_bit_rate && options->display && options->control) {
+        adaptive_bit_rate_init(&adaptive_bit_rate, options->bit_rate,
+                               options->max_bit_rate);
+        abr = &adaptive_bit_rate;
+    }
+
+    if (!stream_init(&stream, server.video_socket, dec, recorders,
+                     recorder_count, sink, rb, abr)) {
+        goto end;
+    }
+    stream_initialized = true;
+
+    if (options->record_on_demand) {
+        for (unsigned i = 0; i < options->record_output_count; ++i) {
+            const struct sc_record_output *output = &options->record_outputs[i];
+            struct recorder_params recorder_params =
+                get_recorder_params(options, output);
+            if (!recording_init(&recordings[i], &stream,
+                                get_record_filename(output),
+                                output->format,
+                                frame_size,
+                                &recorder_params)) {
+                goto end;
+            }
+            ++recording_count;
+        }
+    }
 
     // now we consumed the header values, the socket receives the video stream
     // start the stream
@@ -434,11 +791,24 @@ scrcpy(const struct scrcpy_options *options) {
 
     if (options->display) {
         if (options->control) {
-            if (!controller_init(&controller, server.control_socket)) {
+            if (options->print_input_latency) {
+                if (!input_latency_init(&input_latency)) {
+                    goto end;
+                }
+                input_latency_initialized = true;
+            }
+
+            struct input_latency *latency =
+                input_latency_initialized ? &input_latency : NULL;
+            if (!controller_init(&controller, server.control_socket,
+                                 latency, &fps_counter)) {
                 goto end;
             }
             controller_initialized = true;
 
+            keyframe_limiter_init(&keyframe_limiter,
+                                  KEYFRAME_REQUEST_MIN_INTERVAL);
+
             if (!controller_start(&controller)) {
                 goto end;
             }
@@ -511,9 +881,31 @@ end:
     if (controller_initialized) {
         controller_destroy(&controller);
     }
+    if (input_latency_initialized) {
+        input_latency_log(&input_latency);
+        input_latency_destroy(&input_latency);
+    }
+
+    for (unsigned i = 0; i < recorder_count; ++i) {
+        recorder_destroy(&recorders[i]);
+    }
+
+    // the stream is stopped, finalize the current recordings, if any
+    for (unsigned i = 0; i < recording_count; ++i) {
+        recording_stop(&recordings[i]);
+    }
+    for (unsigned i = 0; i < recording_count; ++i) {
+        recording_join(&recordings[i]);
+        recording_destroy(&recordings[i]);
+    }
+
+    if (stream_initialized) {
+        stream_destroy(&stream);
+    }
 
-    if (recorder_initialized) {
-        recorder_destroy(&recorder);
+    if (replay_buffer_initialized) {
+        replay_buffer_join(&replay_buffer);
+        replay_buffer_destroy(&replay_buffer);
     }
 
 #ifdef V4L2SINK
@@ -18,6 +18,21 @@ enum sc_record_format {
     SC_RECORD_FORMAT_AUTO,
     SC_RECORD_FORMAT_MP4,
     SC_RECORD_FORMAT_MKV,
+    SC_RECORD_FORMAT_TS,
+};
+
+enum sc_v4l2sink_format {
+    SC_V4L2SINK_FORMAT_YUV420P,
+    SC_V4L2SINK_FORMAT_NV12,
+    SC_V4L2SINK_FORMAT_YUYV,
+    SC_V4L2SINK_FORMAT_RGB24,
+};
+
+#define SC_MAX_RECORD_OUTPUTS 8
+
+struct sc_record_output {
+    const char *filename; // "-" for stdout
+    enum sc_record_format format;
 };
 
 #define SC_MAX_SHORTCUT_MODS 8
@@ -46,20 +61,25 @@ struct sc_port_range {
 struct scrcpy_options {
     const char *serial;
     const char *crop;
-    const char *record_filename;
     const char *window_title;
     const char *push_target;
     const char *render_driver;
     const char *codec_options;
     const char *encoder_name;
     const char *v4l2sink_device;
+    const char *replay_filename;
     enum sc_log_level log_level;
-    enum sc_record_format record_format;
+    enum sc_record_format replay_format;
+    enum sc_v4l2sink_format v4l2sink_format;
+    struct sc_record_output record_outputs[SC_MAX_RECORD_OUTPUTS];
+    unsigned record_output_count;
     struct sc_port_range port_range;
     struct sc_shortcut_mods shortcut_mods;
     uint16_t max_size;
     uint32_t bit_rate;
+    uint32_t max_bit_rate; // 0 for a fixed bit rate
     uint16_t max_fps;
+    uint16_t hidden_max_fps; // 0 to disable the throttling
     int8_t lock_video_orientation;
     uint8_t rotation;
     int16_t window_x; // SC_WINDOW_POSITION_UNDEFINED for "auto"
@@ -67,6 +87,21 @@ struct scrcpy_options {
     uint16_t window_width;
     uint16_t window_height;
     uint16_t display_id;
+    uint16_t v4l2sink_width; // 0 for the initial frame size
+    uint16_t v4l2sink_height;
+    uint16_t v4l2sink_fps; // 0 for no output clock
+    uint16_t touch_batch_window; // in ms, 0 to disable
+    uint32_t record_fragment_duration; // in ms, 0 to fragment on keyframes
+    uint32_t record_segment_duration; // in seconds, 0 for no limit
+    uint32_t record_segment_size; // in bytes, 0 for no limit
+    uint32_t record_buffer_size; // in bytes, 0 to write synchronously
+    uint32_t record_preallocate; // in bytes, 0 to disable
+    uint32_t replay_buffer; // in seconds, 0 to disable
+    uint32_t replay_buffer_size; // in bytes, 0 for no limit
+    bool record_fragmented;
+    bool record_on_demand;
+    bool record_direct_io;
+    bool record_index;
     bool show_touches;
     bool fullscreen;
     bool always_on_top;
@@ -83,20 +118,23 @@ struct scrcpy_options {
     bool forward_key_repeat;
     bool forward_all_clicks;
     bool legacy_paste;
+    bool print_input_latency;
 };
 
 #define SCRCPY_OPTIONS_DEFAULT { \
     .serial = NULL, \
     .crop = NULL, \
-    .record_filename = NULL, \
     .window_title = NULL, \
     .push_target = NULL, \
     .render_driver = NULL, \
     .codec_options = NULL, \
     .encoder_name = NULL, \
     .v4l2sink_device = NULL, \
+    .replay_filename = NULL, \
     .log_level = SC_LOG_LEVEL_INFO, \
-    .record_format = SC_RECORD_FORMAT_AUTO, \
+    .replay_format = SC_RECORD_FORMAT_AUTO, \
+    .v4l2sink_format = SC_V4L2SINK_FORMAT_YUV420P, \
+    .record_output_count = 0, \
     .port_range = { \
         .first = DEFAULT_LOCAL_PORT_RANGE_FIRST, \
         .last = DEFAULT_LOCAL_PORT_RANGE_LAST, \
@@ -107,7 +145,9 @@ struct scrcpy_options {
     }, \
     .max_size = DEFAULT_MAX_SIZE, \
     .bit_rate = DEFAULT_BIT_RATE, \
+    .max_bit_rate = 0, \
     .max_fps = 0, \
+    .hidden_max_fps = 0, \
     .lock_video_orientation = DEFAULT_LOCK_VIDEO_ORIENTATION, \
     .rotation = 0, \
     .window_x = SC_WINDOW_POSITION_UNDEFINED, \
@@ -115,6 +155,21 @@ struct scrcpy_options {
     .window_width = 0, \
     .window_height = 0, \
     .display_id = 0, \
+    .v4l2sink_width = 0, \
+    .v4l2sink_height = 0, \
+    .v4l2sink_fps = 0, \
+    .touch_batch_window = 0, \
+    .record_fragment_duration = 0, \
+    .record_segment_duration = 0, \
+    .record_segment_size = 0, \
+    .record_buffer_size = 16000000, \
+    .record_preallocate = 0, \
+    .replay_buffer = 0, \
+    .replay_buffer_size = 0, \
+    .record_fragmented = false, \
+    .record_on_demand = false, \
+    .record_direct_io = false, \
+    .record_index = false, \
     .show_touches = false, \
     .fullscreen = false, \
     .always_on_top = false, \
@@ -131,6 +186,7 @@ struct scrcpy_options {
     .forward_key_repeat = true, \
     .forward_all_clicks = false, \
     .legacy_paste = false, \
+    .print_input_latency = false, \
 }
 
 bool
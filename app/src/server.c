@@ -259,11 +259,13 @@ execute_server(struct server *server, const struct server_params *params) {
     char max_fps_string[6];
     char lock_video_orientation_string[5];
     char display_id_string[6];
+    char touch_batch_window_string[6];
     sprintf(max_size_string, "%"PRIu16, params->max_size);
     sprintf(bit_rate_string, "%"PRIu32, params->bit_rate);
     sprintf(max_fps_string, "%"PRIu16, params->max_fps);
     sprintf(lock_video_orientation_string, "%"PRIi8, params->lock_video_orientation);
     sprintf(display_id_string, "%"PRIu16, params->display_id);
+    sprintf(touch_batch_window_string, "%"PRIu16, params->touch_batch_window);
     const char *const cmd[] = {
         "shell",
         "CLASSPATH=" DEVICE_SERVER_PATH,
@@ -296,6 +298,7 @@ execute_server(struct server *server, const struct server_params *params) {
         params->stay_awake ? "true" : "false",
         params->codec_options ? params->codec_options : "-",
         params->encoder_name ? params->encoder_name : "-",
+        touch_batch_window_string,
     };
 #ifdef SERVER_DEBUGGER
     LOGI("Server debugger waiting for a client on device port "
@@ -44,6 +44,7 @@ struct server_params {
     int8_t lock_video_orientation;
     bool control;
     uint16_t display_id;
+    uint16_t touch_batch_window; // in ms
     bool show_touches;
     bool stay_awake;
     bool force_adb_forward;
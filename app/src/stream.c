@@ -13,8 +13,10 @@
 #include "decoder.h"
 #include "events.h"
 #include "recorder.h"
+#include "replay_buffer.h"
 #include "v4l2sink.h"
 #include "util/buffer_util.h"
+#include "util/lock.h"
 #include "util/log.h"
 
 #define BUFSIZE 0x10000
@@ -70,13 +72,89 @@ notify_stopped(void) {
     SDL_PushEvent(&stop_event);
 }
 
+// the control messages are sent from the main thread
+static void
+notify_bit_rate(uint32_t bit_rate) {
+    SDL_Event event;
+    event.type = EVENT_SET_BIT_RATE;
+    event.user.code = (Sint32) bit_rate;
+    SDL_PushEvent(&event);
+}
+
+// the keyframe requests are limited from the main thread
+static void
+notify_keyframe(void) {
+    SDL_Event event;
+    event.type = EVENT_KEYFRAME_RECEIVED;
+    SDL_PushEvent(&event);
+}
+
+// push to the replay buffer and to the on-demand recorder, if any
+static bool
+stream_push_cached(struct stream *stream, const AVPacket *packet) {
+    if (!stream->replay_buffer) {
+        return true;
+    }
+
+    // the replay buffer and the on-demand recorder must receive the packets
+    // atomically (see stream_attach_recorder())
+    mutex_lock(stream->mutex);
+
+    if (!replay_buffer_push(stream->replay_buffer, packet)) {
+        LOGE("Could not send packet to replay buffer");
+        mutex_unlock(stream->mutex);
+        return false;
+    }
+
+    for (unsigned i = 0; i < SC_MAX_RECORD_OUTPUTS; ++i) {
+        struct recorder *rec = stream->ondemand_recorders[i];
+        if (rec && !recorder_push(rec, packet)) {
+            // do not stop the stream, just stop sending packets to this
+            // recorder (it will be finalized when it is stopped)
+            LOGE("Could not send packet to recorder, recording interrupted");
+            stream->ondemand_recorders[i] = NULL;
+        }
+    }
+
+    mutex_unlock(stream->mutex);
+    return true;
+}
+
+// the packets are refcounted, they are shared by all the recorders
+static bool
+stream_push_recorders(struct stream *stream, const AVPacket *packet) {
+    if (!stream->recorder_count) {
+        return true;
+    }
+
+    unsigned alive = 0;
+    for (unsigned i = 0; i < stream->recorder_count; ++i) {
+        if (stream->recorder_failed[i]) {
+            continue;
+        }
+
+        struct recorder *recorder = &stream->recorders[i];
+        if (!recorder_push(recorder, packet)) {
+            LOGE("Could not send packet to recorder, recording to %s "
+                 "interrupted", recorder->filename);
+            stream->recorder_failed[i] = true;
+            continue;
+        }
+        ++alive;
+    }
+
+    // stop the stream only if no recorder is left
+    return alive;
+}
+
 static bool
 process_config_packet(struct stream *stream, AVPacket *packet) {
-    if (stream->recorder && !recorder_push(stream->recorder, packet)) {
+    if (!stream_push_recorders(stream, packet)) {
         LOGE("Could not send config packet to recorder");
         return false;
     }
-    return true;
+
+    return stream_push_cached(stream, packet);
 }
 
 static bool
@@ -85,17 +163,26 @@ process_frame(struct stream *stream, AVPacket *packet) {
         return false;
     }
 
-    if (stream->recorder) {
+    if (stream->recorder_count) {
         packet->dts = packet->pts;
 
-        if (!recorder_push(stream->recorder, packet)) {
+        if (!stream_push_recorders(stream, packet)) {
             LOGE("Could not send packet to recorder");
             return false;
         }
     }
 
+    if (stream->replay_buffer) {
+        packet->dts = packet->pts;
+
+        if (!stream_push_cached(stream, packet)) {
+            return false;
+        }
+    }
+
 #ifdef V4L2SINK
-    if (stream->v4l2sink) {
+    // otherwise, the decoder shares its frames with the v4l2sink
+    if (stream->v4l2sink && stream->v4l2sink->decode) {
         packet->dts = packet->pts;
 
         if (!v4l2sink_push(stream->v4l2sink, packet)) {
@@ -125,6 +212,7 @@ stream_parse(struct stream *stream, AVPacket *packet) {
 
     if (stream->parser->key_frame == 1) {
         packet->flags |= AV_PKT_FLAG_KEY;
+        notify_keyframe();
     }
 
     bool ok = process_frame(stream, packet);
@@ -193,6 +281,45 @@ stream_push_packet(struct stream *stream, AVPacket *packet) {
     return true;
 }
 
+// stop, join and close the first count recorders
+static void
+stream_close_recorders(struct stream *stream, unsigned count) {
+    // stop all the recorders first, so that they finish in parallel
+    for (unsigned i = 0; i < count; ++i) {
+        recorder_stop(&stream->recorders[i]);
+    }
+
+    if (count) {
+        LOGI("Finishing recording...");
+    }
+
+    for (unsigned i = 0; i < count; ++i) {
+        recorder_join(&stream->recorders[i]);
+        recorder_close(&stream->recorders[i]);
+    }
+}
+
+static bool
+stream_open_recorders(struct stream *stream, const AVCodec *codec) {
+    for (unsigned i = 0; i < stream->recorder_count; ++i) {
+        struct recorder *recorder = &stream->recorders[i];
+        if (!recorder_open(recorder, codec)) {
+            LOGE("Could not open recorder");
+            stream_close_recorders(stream, i);
+            return false;
+        }
+
+        if (!recorder_start(recorder)) {
+            LOGE("Could not start recorder");
+            recorder_close(recorder);
+            stream_close_recorders(stream, i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
 static int
 run_stream(void *data) {
     struct stream *stream = data;
@@ -214,28 +341,21 @@ run_stream(void *data) {
         goto finally_free_codec_ctx;
     }
 
-    if (stream->recorder) {
-        if (!recorder_open(stream->recorder, codec)) {
-            LOGE("Could not open recorder");
-            goto finally_close_decoder;
-        }
-
-        if (!recorder_start(stream->recorder)) {
-            LOGE("Could not start recorder");
-            goto finally_close_recorder;
-        }
+    if (!stream_open_recorders(stream, codec)) {
+        goto finally_close_decoder;
     }
 
 #ifdef V4L2SINK
     if (stream->v4l2sink) {
         if (!v4l2sink_open(stream->v4l2sink, codec)) {
             LOGE("Could not open v4l2sink");
-            goto finally_close_v4l2sink;
+            goto finally_close_recorders;
         }
 
         if (!v4l2sink_start(stream->v4l2sink)) {
             LOGE("Could not start v4l2sink");
-            goto finally_close_v4l2sink;
+            v4l2sink_close(stream->v4l2sink);
+            goto finally_close_recorders;
         }
     }
 #endif
@@ -243,7 +363,7 @@ run_stream(void *data) {
     stream->parser = av_parser_init(AV_CODEC_ID_H264);
     if (!stream->parser) {
         LOGE("Could not initialize parser");
-        goto finally_stop_and_join_recorder;
+        goto finally_close_v4l2sink;
     }
 
     // We must only pass complete frames to av_parser_parse2()!
@@ -258,6 +378,14 @@ run_stream(void *data) {
             break;
         }
 
+        if (stream->abr) {
+            int64_t pts = packet.pts != AV_NOPTS_VALUE ? packet.pts : -1;
+            if (adaptive_bit_rate_push(stream->abr, av_gettime_relative(),
+                                       pts, packet.size)) {
+                notify_bit_rate(stream->abr->bit_rate);
+            }
+        }
+
         ok = stream_push_packet(stream, &packet);
         av_packet_unref(&packet);
         if (!ok) {
@@ -273,18 +401,8 @@ run_stream(void *data) {
     }
 
     av_parser_close(stream->parser);
-finally_stop_and_join_recorder:
-    if (stream->recorder) {
-        recorder_stop(stream->recorder);
-        LOGI("Finishing recording...");
-        recorder_join(stream->recorder);
-    }
-finally_close_recorder:
-    if (stream->recorder) {
-        recorder_close(stream->recorder);
-    }
-#ifdef V4L2SINK
 finally_close_v4l2sink:
+#ifdef V4L2SINK
     if (stream->v4l2sink) {
         v4l2sink_stop(stream->v4l2sink);
         LOGI("Finishing v4l2sink...");
@@ -293,6 +411,8 @@ finally_close_v4l2sink:
         v4l2sink_close(stream->v4l2sink);
     }
 #endif
+finally_close_recorders:
+    stream_close_recorders(stream, stream->recorder_count);
 finally_close_decoder:
     if (stream->decoder) {
         decoder_close(stream->decoder);
@@ -304,14 +424,38 @@ end:
     return 0;
 }
 
-void
+bool
 stream_init(struct stream *stream, socket_t socket,
-            struct decoder *decoder, struct recorder *recorder, struct v4l2sink *v4l2sink) {
+            struct decoder *decoder, struct recorder *recorders,
+            unsigned recorder_count, struct v4l2sink *v4l2sink,
+            struct replay_buffer *replay_buffer,
+            struct adaptive_bit_rate *abr) {
+    assert(recorder_count <= SC_MAX_RECORD_OUTPUTS);
+
+    stream->mutex = SDL_CreateMutex();
+    if (!stream->mutex) {
+        LOGC("Could not create mutex");
+        return false;
+    }
+
     stream->socket = socket;
     stream->decoder = decoder,
-    stream->recorder = recorder;
+    stream->recorders = recorders;
+    stream->recorder_count = recorder_count;
+    for (unsigned i = 0; i < SC_MAX_RECORD_OUTPUTS; ++i) {
+        stream->recorder_failed[i] = false;
+        stream->ondemand_recorders[i] = NULL;
+    }
     stream->v4l2sink = v4l2sink;
+    stream->replay_buffer = replay_buffer;
+    stream->abr = abr;
     stream->has_pending = false;
+    return true;
+}
+
+void
+stream_destroy(struct stream *stream) {
+    SDL_DestroyMutex(stream->mutex);
 }
 
 bool
@@ -337,3 +481,41 @@ void
 stream_join(struct stream *stream) {
     SDL_WaitThread(stream->thread, NULL);
 }
+
+bool
+stream_attach_recorder(struct stream *stream, struct recorder *recorder) {
+    assert(stream->replay_buffer);
+
+    mutex_lock(stream->mutex);
+
+    struct recorder **slot = NULL;
+    for (unsigned i = 0; i < SC_MAX_RECORD_OUTPUTS; ++i) {
+        assert(stream->ondemand_recorders[i] != recorder);
+        if (!slot && !stream->ondemand_recorders[i]) {
+            slot = &stream->ondemand_recorders[i];
+        }
+    }
+    // there are at most SC_MAX_RECORD_OUTPUTS on-demand recordings
+    assert(slot);
+
+    // the packets are pushed to the replay buffer under the same lock, so the
+    // recorder will receive exactly the following ones
+    bool ok = replay_buffer_feed(stream->replay_buffer, recorder);
+    if (ok) {
+        *slot = recorder;
+    }
+
+    mutex_unlock(stream->mutex);
+    return ok;
+}
+
+void
+stream_detach_recorder(struct stream *stream, struct recorder *recorder) {
+    mutex_lock(stream->mutex);
+    for (unsigned i = 0; i < SC_MAX_RECORD_OUTPUTS; ++i) {
+        if (stream->ondemand_recorders[i] == recorder) {
+            stream->ondemand_recorders[i] = NULL;
+        }
+    }
+    mutex_unlock(stream->mutex);
+}
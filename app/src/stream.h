@@ -5,9 +5,12 @@
 #include <stdint.h>
 #include <libavformat/avformat.h>
 #include <SDL2/SDL_atomic.h>
+#include <SDL2/SDL_mutex.h>
 #include <SDL2/SDL_thread.h>
 
 #include "config.h"
+#include "adaptive_bit_rate.h"
+#include "scrcpy.h"
 #include "util/net.h"
 
 struct video_buffer;
@@ -16,8 +19,23 @@ struct stream {
     socket_t socket;
     SDL_Thread *thread;
     struct decoder *decoder;
-    struct recorder *recorder;
+    // each recorder has its own thread, so a slow output does not delay the
+    // others; a failing recorder is detached, the stream is stopped only if
+    // all of them failed
+    struct recorder *recorders; // array
+    unsigned recorder_count;
+    bool recorder_failed[SC_MAX_RECORD_OUTPUTS]; // accessed from the stream
     struct v4l2sink *v4l2sink;
+    struct replay_buffer *replay_buffer;
+    // NULL if the bit rate is fixed (only accessed from the stream thread)
+    struct adaptive_bit_rate *abr;
+
+    // recorders may be attached and detached while the stream is running
+    // (the replay buffer is then used as a cache of the current GOP)
+    SDL_mutex *mutex;
+    // protected by the mutex (NULL for a free slot)
+    struct recorder *ondemand_recorders[SC_MAX_RECORD_OUTPUTS];
+
     AVCodecContext *codec_ctx;
     AVCodecParserContext *parser;
     // successive packets may need to be concatenated, until a non-config
@@ -26,9 +44,15 @@ struct stream {
     AVPacket pending;
 };
 
-void
+bool
 stream_init(struct stream *stream, socket_t socket,
-            struct decoder *decoder, struct recorder *recorder, struct v4l2sink *v4l2sink);
+            struct decoder *decoder, struct recorder *recorders,
+            unsigned recorder_count, struct v4l2sink *v4l2sink,
+            struct replay_buffer *replay_buffer,
+            struct adaptive_bit_rate *abr);
+
+void
+stream_destroy(struct stream *stream);
 
 bool
 stream_start(struct stream *stream);
@@ -39,4 +63,14 @@ stream_stop(struct stream *stream);
 void
 stream_join(struct stream *stream);
 
+// Attach a started recorder, which immediately receives the last config
+// packet and the current GOP from the replay buffer.
+// Return false if no keyframe has been received yet.
+bool
+stream_attach_recorder(struct stream *stream, struct recorder *recorder);
+
+// Detach the recorder (it does not receive any packet after this call)
+void
+stream_detach_recorder(struct stream *stream, struct recorder *recorder);
+
 #endif
@@ -1,71 +1,120 @@
+// for mmap() and writev()
+#define _POSIX_C_SOURCE 200809L
+
 #include "config.h"
 
 #ifdef V4L2SINK
 #include "v4l2sink.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
 #include <libavutil/time.h>
+#include <linux/videodev2.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "compat.h"
 #include "util/lock.h"
 #include "util/log.h"
 
-static const AVRational SCRCPY_TIME_BASE = {1, 1000000}; // timestamps in us
+static struct v4l2sink_item *
+v4l2sink_item_new_packet(const AVPacket *packet) {
+    struct v4l2sink_item *item = SDL_malloc(sizeof(*item));
+    if (!item) {
+        return NULL;
+    }
 
-static const AVOutputFormat *
-find_muxer(const char *name) {
-#ifdef SCRCPY_LAVF_HAS_NEW_MUXER_ITERATOR_API
-    void *opaque = NULL;
-#endif
-    const AVOutputFormat *oformat = NULL;
-    do {
-#ifdef SCRCPY_LAVF_HAS_NEW_MUXER_ITERATOR_API
-        oformat = av_muxer_iterate(&opaque);
-#else
-        oformat = av_oformat_next(oformat);
-#endif
-        // until null or with name "v4l2"
-    } while (oformat && !strstr(oformat->name, name));
-    return oformat;
+    item->frame = NULL;
+
+    // av_packet_ref() does not initialize all fields in old FFmpeg versions
+    // See <https://github.com/Genymobile/scrcpy/issues/707>
+    av_init_packet(&item->packet);
+
+    if (av_packet_ref(&item->packet, packet)) {
+        SDL_free(item);
+        return NULL;
+    }
+    return item;
 }
 
-static struct v4l2sink_packet *
-v4l2sink_packet_new(const AVPacket *packet) {
-    struct v4l2sink_packet *rec = SDL_malloc(sizeof(*rec));
-    if (!rec) {
+static struct v4l2sink_item *
+v4l2sink_item_new_frame(const AVFrame *frame) {
+    struct v4l2sink_item *item = SDL_malloc(sizeof(*item));
+    if (!item) {
         return NULL;
     }
 
-    // av_packet_ref() does not initialize all fields in old FFmpeg versions
-    // See <https://github.com/Genymobile/scrcpy/issues/707>
-    av_init_packet(&rec->packet);
+    item->frame = av_frame_alloc();
+    if (!item->frame) {
+        SDL_free(item);
+        return NULL;
+    }
 
-    if (av_packet_ref(&rec->packet, packet)) {
-        SDL_free(rec);
+    // the frame buffers are refcounted, the data is not copied
+    if (av_frame_ref(item->frame, frame)) {
+        av_frame_free(&item->frame);
+        SDL_free(item);
         return NULL;
     }
-    return rec;
+    return item;
 }
 
 static void
-v4l2sink_packet_delete(struct v4l2sink_packet *rec) {
-    av_packet_unref(&rec->packet);
-    SDL_free(rec);
+v4l2sink_item_delete(struct v4l2sink_item *item) {
+    if (item->frame) {
+        av_frame_free(&item->frame);
+    } else {
+        av_packet_unref(&item->packet);
+    }
+    SDL_free(item);
 }
 
 static void
 v4l2sink_queue_clear(struct v4l2sink_queue *queue) {
     while (!queue_is_empty(queue)) {
-        struct v4l2sink_packet *rec;
-        queue_take(queue, next, &rec);
-        v4l2sink_packet_delete(rec);
+        struct v4l2sink_item *item;
+        queue_take(queue, next, &item);
+        v4l2sink_item_delete(item);
+    }
+}
+
+static void
+get_formats(enum sc_v4l2sink_format format, enum AVPixelFormat *pix_fmt,
+            uint32_t *fourcc) {
+    switch (format) {
+        case SC_V4L2SINK_FORMAT_NV12:
+            *pix_fmt = AV_PIX_FMT_NV12;
+            *fourcc = V4L2_PIX_FMT_NV12;
+            return;
+        case SC_V4L2SINK_FORMAT_YUYV:
+            *pix_fmt = AV_PIX_FMT_YUYV422;
+            *fourcc = V4L2_PIX_FMT_YUYV;
+            return;
+        case SC_V4L2SINK_FORMAT_RGB24:
+            *pix_fmt = AV_PIX_FMT_RGB24;
+            *fourcc = V4L2_PIX_FMT_RGB24;
+            return;
+        default:
+            assert(format == SC_V4L2SINK_FORMAT_YUV420P);
+            *pix_fmt = AV_PIX_FMT_YUV420P;
+            *fourcc = V4L2_PIX_FMT_YUV420;
     }
 }
 
 bool
 v4l2sink_init(struct v4l2sink *v4l2sink,
               const char *devicename,
-              struct size declared_frame_size) {
+              struct size declared_frame_size,
+              bool decode,
+              const struct v4l2sink_params *params) {
     v4l2sink->devicename = SDL_strdup(devicename);
     if (!v4l2sink->devicename) {
         LOGE("Could not strdup devicename for v4l2sink");
@@ -88,24 +137,29 @@ v4l2sink_init(struct v4l2sink *v4l2sink,
     }
 
     queue_init(&v4l2sink->queue);
+    v4l2sink->decode = decode;
     v4l2sink->stopped = false;
     v4l2sink->failed = false;
-    v4l2sink->declared_frame_size = declared_frame_size;
-    v4l2sink->header_written = false;
-    v4l2sink->previous = NULL;
+    // the output geometry never changes, the frames are scaled if necessary
+    struct size size = params->size.width ? params->size : declared_frame_size;
+    v4l2sink->size.width = size.width & ~1u;
+    v4l2sink->size.height = size.height & ~1u;
+    get_formats(params->format, &v4l2sink->format, &v4l2sink->fourcc);
+    v4l2sink->fps = params->fps;
 
     return true;
 }
 
 void
 v4l2sink_destroy(struct v4l2sink *v4l2sink) {
+    v4l2sink_queue_clear(&v4l2sink->queue);
     SDL_DestroyCond(v4l2sink->queue_cond);
     SDL_DestroyMutex(v4l2sink->mutex);
     SDL_free(v4l2sink->devicename);
 }
 
-bool
-v4l2sink_open(struct v4l2sink *v4l2sink, const AVCodec *codec) {
+static bool
+v4l2sink_open_decoder(struct v4l2sink *v4l2sink, const AVCodec *codec) {
     v4l2sink->decoder_ctx = avcodec_alloc_context3(codec);
     if (!v4l2sink->decoder_ctx) {
         LOGC("Could not allocate decoder context for v4l2sink");
@@ -118,178 +172,570 @@ v4l2sink_open(struct v4l2sink *v4l2sink, const AVCodec *codec) {
         return false;
     }
 
-    const AVCodec *encoder = avcodec_find_encoder(AV_CODEC_ID_RAWVIDEO);
-    if (!encoder) {
-        LOGE("RAWVIDEO encoder not found");
+    v4l2sink->decoded_frame = av_frame_alloc();
+    if (!v4l2sink->decoded_frame) {
+        LOGC("Could not allocate frame for v4l2sink");
+        avcodec_close(v4l2sink->decoder_ctx);
+        avcodec_free_context(&v4l2sink->decoder_ctx);
         return false;
     }
 
-    v4l2sink->encoder_ctx = avcodec_alloc_context3(encoder);
-    if (!v4l2sink->encoder_ctx) {
-        LOGC("Could not allocate encoder context for v4l2sink");
+    return true;
+}
+
+static int
+xioctl(int fd, unsigned long request, void *arg) {
+    int r;
+    do {
+        r = ioctl(fd, request, arg);
+    } while (r == -1 && errno == EINTR);
+    return r;
+}
+
+static void
+v4l2sink_release_buffers(struct v4l2sink *v4l2sink) {
+    for (unsigned i = 0; i < v4l2sink->buffer_count; ++i) {
+        munmap(v4l2sink->buffers[i].start, v4l2sink->buffers[i].length);
+    }
+    v4l2sink->buffer_count = 0;
+
+    struct v4l2_requestbuffers req = {
+        .count = 0,
+        .type = V4L2_BUF_TYPE_VIDEO_OUTPUT,
+        .memory = V4L2_MEMORY_MMAP,
+    };
+    xioctl(v4l2sink->fd, VIDIOC_REQBUFS, &req);
+}
+
+static bool
+v4l2sink_request_buffers(struct v4l2sink *v4l2sink) {
+    struct v4l2_requestbuffers req = {
+        .count = V4L2SINK_BUFFER_COUNT,
+        .type = V4L2_BUF_TYPE_VIDEO_OUTPUT,
+        .memory = V4L2_MEMORY_MMAP,
+    };
+    if (xioctl(v4l2sink->fd, VIDIOC_REQBUFS, &req) == -1) {
+        LOGD("V4l2sink: mmap streaming not supported");
         return false;
     }
 
-    v4l2sink->encoder_ctx->width=v4l2sink->declared_frame_size.width;
-    v4l2sink->encoder_ctx->height=v4l2sink->declared_frame_size.height;
-    v4l2sink->encoder_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
-    v4l2sink->encoder_ctx->time_base.num =1;
+    if (req.count < 2) {
+        LOGD("V4l2sink: not enough streaming buffers (%u)", req.count);
+        v4l2sink_release_buffers(v4l2sink);
+        return false;
+    }
+
+    unsigned count = req.count < V4L2SINK_BUFFER_COUNT ? req.count
+                                                       : V4L2SINK_BUFFER_COUNT;
+    for (unsigned i = 0; i < count; ++i) {
+        struct v4l2_buffer buf = {
+            .index = i,
+            .type = V4L2_BUF_TYPE_VIDEO_OUTPUT,
+            .memory = V4L2_MEMORY_MMAP,
+        };
+        if (xioctl(v4l2sink->fd, VIDIOC_QUERYBUF, &buf) == -1
+                || buf.length < v4l2sink->image_size) {
+            LOGW("V4l2sink: could not query buffer %u", i);
+            v4l2sink_release_buffers(v4l2sink);
+            return false;
+        }
+
+        void *start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, v4l2sink->fd, buf.m.offset);
+        if (start == MAP_FAILED) {
+            LOGW("V4l2sink: could not map buffer %u", i);
+            v4l2sink_release_buffers(v4l2sink);
+            return false;
+        }
+
+        v4l2sink->buffers[i].start = start;
+        v4l2sink->buffers[i].length = buf.length;
+        v4l2sink->buffer_count = i + 1;
+    }
+
+    return true;
+}
 
-    if (avcodec_open2(v4l2sink->encoder_ctx, encoder, NULL) < 0) {
-        LOGE("Could not open encoder codec for v4l2sink");
-        avcodec_free_context(&v4l2sink->encoder_ctx);
+// set the output format once, and select the I/O method
+static bool
+v4l2sink_configure_device(struct v4l2sink *v4l2sink) {
+    struct v4l2_capability cap;
+    if (xioctl(v4l2sink->fd, VIDIOC_QUERYCAP, &cap) == -1) {
+        LOGE("%s is not a V4L2 device", v4l2sink->devicename);
         return false;
     }
 
-    const AVOutputFormat *format = find_muxer("v4l2");
-    if (!format) {
-        LOGE("Could not find muxer for v4l2sink");
+    uint32_t caps = cap.capabilities & V4L2_CAP_DEVICE_CAPS ? cap.device_caps
+                                                            : cap.capabilities;
+    if (!(caps & V4L2_CAP_VIDEO_OUTPUT)) {
+        LOGE("%s is not a video output device", v4l2sink->devicename);
         return false;
     }
-    v4l2sink->ctx = avformat_alloc_context();
-    if (!v4l2sink->ctx) {
-        LOGE("Could not allocate output context for v4l2sink");
+
+    struct v4l2_format fmt = {
+        .type = V4L2_BUF_TYPE_VIDEO_OUTPUT,
+    };
+    fmt.fmt.pix.width = v4l2sink->size.width;
+    fmt.fmt.pix.height = v4l2sink->size.height;
+    fmt.fmt.pix.pixelformat = v4l2sink->fourcc;
+    fmt.fmt.pix.field = V4L2_FIELD_NONE;
+    fmt.fmt.pix.bytesperline = v4l2sink->bytesperline;
+    fmt.fmt.pix.sizeimage = v4l2sink->image_size;
+    if (xioctl(v4l2sink->fd, VIDIOC_S_FMT, &fmt) == -1) {
+        LOGE("Could not set the format of %s", v4l2sink->devicename);
         return false;
     }
 
-    // contrary to the deprecated API (av_oformat_next()), av_muxer_iterate()
-    // returns (on purpose) a pointer-to-const, but AVFormatContext.oformat
-    // still expects a pointer-to-non-const (it has not be updated accordingly)
-    // <https://github.com/FFmpeg/FFmpeg/commit/0694d8702421e7aff1340038559c438b61bb30dd>
-    v4l2sink->ctx->oformat = (AVOutputFormat *) format;
+    if (fmt.fmt.pix.pixelformat != v4l2sink->fourcc
+            || fmt.fmt.pix.width != v4l2sink->size.width
+            || fmt.fmt.pix.height != v4l2sink->size.height
+            || fmt.fmt.pix.bytesperline != v4l2sink->bytesperline) {
+        LOGE("Format %ux%u %s not supported by %s", v4l2sink->size.width,
+             v4l2sink->size.height, av_get_pix_fmt_name(v4l2sink->format),
+             v4l2sink->devicename);
+        return false;
+    }
 
-    av_dict_set(&v4l2sink->ctx->metadata, "comment",
-                "Recorded by scrcpy " SCRCPY_VERSION, 0);
+    if (caps & V4L2_CAP_STREAMING && v4l2sink_request_buffers(v4l2sink)) {
+        v4l2sink->streaming = true;
+        return true;
+    }
 
-    AVStream *ostream = avformat_new_stream(v4l2sink->ctx, encoder);
-    if (!ostream) {
-        avformat_free_context(v4l2sink->ctx);
+    if (!(caps & V4L2_CAP_READWRITE)) {
+        LOGE("%s supports neither mmap streaming nor write()",
+             v4l2sink->devicename);
         return false;
     }
 
-#ifdef SCRCPY_LAVF_HAS_NEW_CODEC_PARAMS_API
-    ostream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
-    ostream->codecpar->codec_id = encoder->id;
-    ostream->codecpar->format = AV_PIX_FMT_YUV420P;
-    ostream->codecpar->width = v4l2sink->declared_frame_size.width;
-    ostream->codecpar->height = v4l2sink->declared_frame_size.height;
-#else
-    ostream->codec->codec_type = AVMEDIA_TYPE_VIDEO;
-    ostream->codec->codec_id = encoder->id;
-    ostream->codec->pix_fmt = AV_PIX_FMT_YUV420P;
-    ostream->codec->width = v4l2sink->declared_frame_size.width;
-    ostream->codec->height = v4l2sink->declared_frame_size.height;
-#endif
+    return true;
+}
 
-    int ret = avio_open(&v4l2sink->ctx->pb, v4l2sink->devicename,
-                        AVIO_FLAG_WRITE);
-    if (ret < 0) {
-        LOGE("Failed to open output device: %s", v4l2sink->devicename);
-        // ostream will be cleaned up during context cleaning
-        avformat_free_context(v4l2sink->ctx);
+bool
+v4l2sink_open(struct v4l2sink *v4l2sink, const AVCodec *codec) {
+    // without display, the stream is not decoded by the decoder
+    if (v4l2sink->decode && !v4l2sink_open_decoder(v4l2sink, codec)) {
         return false;
     }
 
-    v4l2sink->decoded_frame = av_frame_alloc();
-    v4l2sink->raw_packet = av_packet_alloc();
+    unsigned w = v4l2sink->size.width;
+    unsigned h = v4l2sink->size.height;
+    v4l2sink->image_size = av_image_get_buffer_size(v4l2sink->format, w, h, 1);
+    v4l2sink->bytesperline = av_image_get_linesize(v4l2sink->format, w, 0);
+    v4l2sink->converter_initialized = false;
+
+    if (v4l2sink->fps) {
+        v4l2sink->latest = av_frame_alloc();
+        if (!v4l2sink->latest) {
+            LOGC("Could not allocate frame for v4l2sink");
+            goto error_close_decoder;
+        }
+        v4l2sink->has_latest = false;
+        v4l2sink->next_tick = 0;
+        v4l2sink->written_count = 0;
+        v4l2sink->repeated_count = 0;
+        v4l2sink->dropped_count = 0;
+        v4l2sink->total_latency = 0;
+        v4l2sink->max_latency = 0;
+    }
+    v4l2sink->streaming = false;
+    v4l2sink->streamon = false;
+    v4l2sink->buffer_count = 0;
+    v4l2sink->queued_count = 0;
+    v4l2sink->write_buffer = NULL;
+
+    // an existing regular file or pipe receives the raw frames, without any
+    // ioctl; never create a file for a mistyped device path
+    struct stat st;
+    if (stat(v4l2sink->devicename, &st)) {
+        LOGE("Could not access output device: %s (%s)", v4l2sink->devicename,
+             strerror(errno));
+        goto error_free_latest;
+    }
+    bool device = S_ISCHR(st.st_mode);
+    if (device) {
+        // mmap() requires the device to be open for reading
+        v4l2sink->fd = open(v4l2sink->devicename, O_RDWR);
+    } else if (S_ISREG(st.st_mode)) {
+        v4l2sink->fd = open(v4l2sink->devicename, O_WRONLY | O_TRUNC);
+    } else if (S_ISFIFO(st.st_mode)) {
+        v4l2sink->fd = open(v4l2sink->devicename, O_WRONLY);
+    } else {
+        LOGE("Output is not a device, a regular file or a pipe: %s",
+             v4l2sink->devicename);
+        goto error_free_latest;
+    }
+    if (v4l2sink->fd == -1) {
+        LOGE("Failed to open output device: %s", v4l2sink->devicename);
+        goto error_free_latest;
+    }
+
+    if (device && !v4l2sink_configure_device(v4l2sink)) {
+        goto error_close_fd;
+    }
 
-    LOGI("V4l2sink started to device: %s", v4l2sink->devicename);
+    LOGI("V4l2sink started to device: %s (%ux%u %s, %s)",
+         v4l2sink->devicename, v4l2sink->size.width, v4l2sink->size.height,
+         av_get_pix_fmt_name(v4l2sink->format),
+         v4l2sink->streaming ? "mmap" : "write");
 
     return true;
+
+error_close_fd:
+    close(v4l2sink->fd);
+error_free_latest:
+    if (v4l2sink->fps) {
+        av_frame_free(&v4l2sink->latest);
+    }
+error_close_decoder:
+    if (v4l2sink->decode) {
+        avcodec_close(v4l2sink->decoder_ctx);
+        avcodec_free_context(&v4l2sink->decoder_ctx);
+        av_frame_free(&v4l2sink->decoded_frame);
+    }
+    return false;
 }
 
 void
 v4l2sink_close(struct v4l2sink *v4l2sink) {
-    avcodec_close(v4l2sink->decoder_ctx);
-    avcodec_free_context(&v4l2sink->decoder_ctx);
-
-    avcodec_close(v4l2sink->encoder_ctx);
-    avcodec_free_context(&v4l2sink->encoder_ctx);
-  
-    if (v4l2sink->header_written) {
-        int ret = av_write_trailer(v4l2sink->ctx);
-        if (ret < 0) {
-            LOGE("Failed to write trailer to %s", v4l2sink->devicename);
-            v4l2sink->failed = true;
+    if (v4l2sink->decode) {
+        avcodec_close(v4l2sink->decoder_ctx);
+        avcodec_free_context(&v4l2sink->decoder_ctx);
+        av_frame_free(&v4l2sink->decoded_frame);
+    }
+
+    if (v4l2sink->streamon) {
+        int type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        xioctl(v4l2sink->fd, VIDIOC_STREAMOFF, &type);
+    }
+    if (v4l2sink->streaming) {
+        v4l2sink_release_buffers(v4l2sink);
+    }
+    SDL_free(v4l2sink->write_buffer);
+    close(v4l2sink->fd);
+
+    if (v4l2sink->converter_initialized) {
+        frame_converter_log_stats(&v4l2sink->converter, "V4l2sink");
+        frame_converter_destroy(&v4l2sink->converter);
+    }
+
+    if (v4l2sink->fps) {
+        av_frame_free(&v4l2sink->latest);
+        if (v4l2sink->written_count) {
+            LOGI("V4l2sink clock: %u fps, %" PRIu32 " frames written, %" PRIu32
+                 " repeated, %" PRIu32 " dropped, latency avg %" PRIu64
+                 " us, max %" PRIu32 " us", v4l2sink->fps,
+                 v4l2sink->written_count, v4l2sink->repeated_count,
+                 v4l2sink->dropped_count,
+                 v4l2sink->total_latency / v4l2sink->written_count,
+                 v4l2sink->max_latency);
         }
-    } else {
-        // the v4l2sinked file is empty
-        v4l2sink->failed = true;
     }
-    avio_close(v4l2sink->ctx->pb);
-    avformat_free_context(v4l2sink->ctx);
 
     if (v4l2sink->failed) {
         LOGE("Sink failed to %s", v4l2sink->devicename);
     } else {
         LOGI("Sink completed device: %s", v4l2sink->devicename);
     }
+}
 
-    if (v4l2sink->decoded_frame) {
-        av_frame_free(&v4l2sink->decoded_frame);
+// copy the YUV420P planes contiguously to dst (image_size bytes)
+static void
+v4l2sink_copy_planes(struct v4l2sink *v4l2sink, const AVFrame *frame,
+                     uint8_t *dst) {
+    for (int i = 0; i < 3; ++i) {
+        unsigned w = v4l2sink->size.width;
+        unsigned h = v4l2sink->size.height;
+        if (i) {
+            // chroma planes
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+        }
+
+        const uint8_t *src = frame->data[i];
+        if ((unsigned) frame->linesize[i] == w) {
+            memcpy(dst, src, w * h);
+            dst += w * h;
+        } else {
+            for (unsigned y = 0; y < h; ++y) {
+                memcpy(dst, src, w);
+                src += frame->linesize[i];
+                dst += w;
+            }
+        }
+    }
+}
+
+static bool
+v4l2sink_write_iov(struct v4l2sink *v4l2sink, struct iovec *iov, int count) {
+    while (count) {
+        ssize_t w = writev(v4l2sink->fd, iov, count);
+        if (w == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("Could not write to %s", v4l2sink->devicename);
+            return false;
+        }
+
+        // skip the written data
+        while (count && (size_t) w >= iov->iov_len) {
+            w -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count) {
+            iov->iov_base = (uint8_t *) iov->iov_base + w;
+            iov->iov_len -= w;
+        }
     }
+    return true;
+}
+
+// the frame may be written as is, without conversion nor scaling
+static inline bool
+v4l2sink_is_direct(struct v4l2sink *v4l2sink, const AVFrame *frame) {
+    return frame->format == AV_PIX_FMT_YUV420P
+        && v4l2sink->format == AV_PIX_FMT_YUV420P
+        && (unsigned) frame->width == v4l2sink->size.width
+        && (unsigned) frame->height == v4l2sink->size.height;
+}
 
-    if (v4l2sink->raw_packet) {
-        av_packet_free(&v4l2sink->raw_packet);
+// write the image to dst (image_size bytes), converted if necessary
+static bool
+v4l2sink_fill_image(struct v4l2sink *v4l2sink, const AVFrame *frame,
+                    uint8_t *dst) {
+    if (v4l2sink_is_direct(v4l2sink, frame)) {
+        v4l2sink_copy_planes(v4l2sink, frame, dst);
+        return true;
     }
 
+    if (!v4l2sink->converter_initialized) {
+        if (!frame_converter_init(&v4l2sink->converter, v4l2sink->format,
+                                  v4l2sink->size.width,
+                                  v4l2sink->size.height)) {
+            return false;
+        }
+        v4l2sink->converter_initialized = true;
+    }
+
+    return frame_converter_convert(&v4l2sink->converter, frame, dst);
 }
 
+// write the image by write() (for a regular file, a pipe, or a device which
+// does not support streaming)
 static bool
-v4l2sink_write_header(struct v4l2sink *v4l2sink, const AVPacket *packet) {
-    AVStream *ostream = v4l2sink->ctx->streams[0];
+v4l2sink_write_planes(struct v4l2sink *v4l2sink, const AVFrame *frame) {
+    unsigned w = v4l2sink->size.width;
+    unsigned h = v4l2sink->size.height;
+    unsigned cw = (w + 1) / 2;
+    unsigned ch = (h + 1) / 2;
+
+    if (v4l2sink_is_direct(v4l2sink, frame)
+            && (unsigned) frame->linesize[0] == w
+            && (unsigned) frame->linesize[1] == cw
+            && (unsigned) frame->linesize[2] == cw) {
+        // the planes are contiguous, write them directly (no copy)
+        struct iovec iov[3] = {
+            { .iov_base = frame->data[0], .iov_len = w * h },
+            { .iov_base = frame->data[1], .iov_len = cw * ch },
+            { .iov_base = frame->data[2], .iov_len = cw * ch },
+        };
+        return v4l2sink_write_iov(v4l2sink, iov, 3);
+    }
+
+    if (!v4l2sink->write_buffer) {
+        v4l2sink->write_buffer = SDL_malloc(v4l2sink->image_size);
+        if (!v4l2sink->write_buffer) {
+            LOGC("Could not allocate v4l2sink write buffer");
+            return false;
+        }
+    }
 
-    uint8_t *extradata = av_malloc(packet->size * sizeof(uint8_t));
-    if (!extradata) {
-        LOGC("Could not allocate extradata");
+    if (!v4l2sink_fill_image(v4l2sink, frame, v4l2sink->write_buffer)) {
         return false;
     }
 
-    // copy the first packet to the extra data
-    memcpy(extradata, packet->data, packet->size);
+    struct iovec iov = {
+        .iov_base = v4l2sink->write_buffer,
+        .iov_len = v4l2sink->image_size,
+    };
+    return v4l2sink_write_iov(v4l2sink, &iov, 1);
+}
 
-#ifdef SCRCPY_LAVF_HAS_NEW_CODEC_PARAMS_API
-    ostream->codecpar->extradata = extradata;
-    ostream->codecpar->extradata_size = packet->size;
-#else
-    ostream->codec->extradata = extradata;
-    ostream->codec->extradata_size = packet->size;
-#endif
-    
-    v4l2sink->ctx->url = SDL_strdup(v4l2sink->devicename);
+static bool
+v4l2sink_queue_buffer(struct v4l2sink *v4l2sink, const AVFrame *frame) {
+    struct v4l2_buffer buf = {
+        .type = V4L2_BUF_TYPE_VIDEO_OUTPUT,
+        .memory = V4L2_MEMORY_MMAP,
+    };
+
+    if (v4l2sink->queued_count < v4l2sink->buffer_count) {
+        // this buffer has never been queued, it is available
+        buf.index = v4l2sink->queued_count++;
+    } else if (xioctl(v4l2sink->fd, VIDIOC_DQBUF, &buf) == -1) {
+        LOGE("Could not dequeue buffer from %s", v4l2sink->devicename);
+        return false;
+    }
+
+    assert(buf.index < v4l2sink->buffer_count);
+    if (!v4l2sink_fill_image(v4l2sink, frame,
+                             v4l2sink->buffers[buf.index].start)) {
+        return false;
+    }
 
-    int ret = avformat_write_header(v4l2sink->ctx, NULL);
-    if (ret < 0) {
-        LOGE("Failed to write header to %s", v4l2sink->devicename);
+    buf.bytesused = v4l2sink->image_size;
+    buf.field = V4L2_FIELD_NONE;
+    buf.flags = V4L2_BUF_FLAG_TIMESTAMP_COPY;
+    if (frame->pts != AV_NOPTS_VALUE) {
+        buf.timestamp.tv_sec = frame->pts / 1000000;
+        buf.timestamp.tv_usec = frame->pts % 1000000;
+    }
+    if (xioctl(v4l2sink->fd, VIDIOC_QBUF, &buf) == -1) {
+        LOGE("Could not queue buffer to %s", v4l2sink->devicename);
         return false;
     }
 
+    if (!v4l2sink->streamon) {
+        int type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        if (xioctl(v4l2sink->fd, VIDIOC_STREAMON, &type) == -1) {
+            LOGE("Could not start streaming to %s", v4l2sink->devicename);
+            return false;
+        }
+        v4l2sink->streamon = true;
+    }
+
     return true;
 }
 
-static void
-v4l2sink_rescale_packet(struct v4l2sink *v4l2sink, AVPacket *packet) {
-    AVStream *ostream = v4l2sink->ctx->streams[0];
-    av_packet_rescale_ts(packet, SCRCPY_TIME_BASE, ostream->time_base);
+// write the decoded frame as a raw image
+static bool
+v4l2sink_write_frame(struct v4l2sink *v4l2sink, const AVFrame *frame) {
+    if (v4l2sink->streaming) {
+        return v4l2sink_queue_buffer(v4l2sink, frame);
+    }
+    return v4l2sink_write_planes(v4l2sink, frame);
 }
 
-bool
-v4l2sink_write(struct v4l2sink *v4l2sink, AVPacket *packet) {
-    if (!v4l2sink->header_written) {
-        bool ok = v4l2sink_write_header(v4l2sink, packet);
+// with an output clock, keep the frame until the next tick, otherwise write it
+// immediately
+static bool
+v4l2sink_process_frame(struct v4l2sink *v4l2sink, const AVFrame *frame) {
+    if (!v4l2sink->fps) {
+        return v4l2sink_write_frame(v4l2sink, frame);
+    }
+
+    if (v4l2sink->has_latest) {
+        if (!v4l2sink->latest_written) {
+            // replaced before the next tick
+            ++v4l2sink->dropped_count;
+        }
+        av_frame_unref(v4l2sink->latest);
+    }
+
+    if (av_frame_ref(v4l2sink->latest, frame)) {
+        LOGC("Could not reference v4l2sink frame");
+        v4l2sink->has_latest = false;
+        return false;
+    }
+
+    int64_t now = av_gettime_relative();
+    v4l2sink->has_latest = true;
+    v4l2sink->latest_written = false;
+    v4l2sink->latest_time = now;
+    if (!v4l2sink->next_tick) {
+        // start the clock on the first frame
+        v4l2sink->clock_start = now;
+        v4l2sink->next_tick = now;
+    }
+    return true;
+}
+
+static inline bool
+v4l2sink_is_tick_due(struct v4l2sink *v4l2sink, int64_t now) {
+    return v4l2sink->fps && v4l2sink->has_latest
+        && now >= v4l2sink->next_tick;
+}
+
+// write the latest frame (again if it has not changed)
+static bool
+v4l2sink_tick(struct v4l2sink *v4l2sink, int64_t now) {
+    assert(v4l2sink->has_latest);
+
+    // timestamp the frames with the output clock
+    v4l2sink->latest->pts = v4l2sink->next_tick - v4l2sink->clock_start;
+    bool ok = v4l2sink_write_frame(v4l2sink, v4l2sink->latest);
+
+    if (v4l2sink->latest_written) {
+        ++v4l2sink->repeated_count;
+    } else {
+        uint32_t latency = now - v4l2sink->latest_time;
+        ++v4l2sink->written_count;
+        v4l2sink->total_latency += latency;
+        if (latency > v4l2sink->max_latency) {
+            v4l2sink->max_latency = latency;
+        }
+        v4l2sink->latest_written = true;
+    }
+
+    int64_t interval = 1000000 / v4l2sink->fps;
+    v4l2sink->next_tick += interval;
+    if (v4l2sink->next_tick <= now) {
+        // the writer was too slow, skip the missed ticks
+        v4l2sink->next_tick = now + interval;
+    }
+
+    return ok;
+}
+
+// decode the packet, and write the resulting frames
+static bool
+v4l2sink_decode(struct v4l2sink *v4l2sink, const AVPacket *packet) {
+    assert(v4l2sink->decode);
+
+// the new decoding/encoding API has been introduced by:
+// <http://git.videolan.org/?p=ffmpeg.git;a=commitdiff;h=7fc329e2dd6226dfecaa4a1d7adf353bf2773726>
+#ifdef SCRCPY_LAVF_HAS_NEW_ENCODING_DECODING_API
+    int ret;
+    if ((ret = avcodec_send_packet(v4l2sink->decoder_ctx, packet)) < 0) {
+        LOGE("Could not send video packet: %d", ret);
+        return false;
+    }
+
+    for (;;) {
+        ret = avcodec_receive_frame(v4l2sink->decoder_ctx,
+                                    v4l2sink->decoded_frame);
+        if (ret == AVERROR(EAGAIN)) {
+            return true;
+        }
+        if (ret < 0) {
+            LOGE("Could not receive video frame: %d", ret);
+            return false;
+        }
+
+        bool ok = v4l2sink_process_frame(v4l2sink, v4l2sink->decoded_frame);
+        av_frame_unref(v4l2sink->decoded_frame);
         if (!ok) {
             return false;
         }
-        v4l2sink->header_written = true;
     }
-
-    if (packet->pts == AV_NOPTS_VALUE) {
-        // ignore config packets
+#else
+    int got_picture;
+    int len = avcodec_decode_video2(v4l2sink->decoder_ctx,
+                                    v4l2sink->decoded_frame,
+                                    &got_picture,
+                                    packet);
+    if (len < 0) {
+        LOGE("Could not decode video packet: %d", len);
+        return false;
+    }
+    if (!got_picture) {
         return true;
     }
 
-    v4l2sink_rescale_packet(v4l2sink, packet);
-    return av_write_frame(v4l2sink->ctx, packet) >= 0;
+    bool ok = v4l2sink_process_frame(v4l2sink, v4l2sink->decoded_frame);
+    av_frame_unref(v4l2sink->decoded_frame);
+    return ok;
+#endif
 }
 
 static int
@@ -300,64 +746,61 @@ run_v4l2sink(void *data) {
         mutex_lock(v4l2sink->mutex);
 
         while (!v4l2sink->stopped && queue_is_empty(&v4l2sink->queue)) {
-            cond_wait(v4l2sink->queue_cond, v4l2sink->mutex);
-        }
+            if (!v4l2sink->fps || !v4l2sink->has_latest) {
+                cond_wait(v4l2sink->queue_cond, v4l2sink->mutex);
+                continue;
+            }
 
-        // if stopped is set, continue to process the remaining events (to
-        // finish the v4l2sinking) before actually stopping
+            // wake up for the next tick of the output clock
+            int64_t now = av_gettime_relative();
+            if (v4l2sink_is_tick_due(v4l2sink, now)) {
+                break;
+            }
+            uint32_t ms = (v4l2sink->next_tick - now + 999) / 1000;
+            cond_wait_timeout(v4l2sink->queue_cond, v4l2sink->mutex, ms);
+        }
 
+        // if stopped is set, continue to process the remaining items before
+        // actually stopping
         if (v4l2sink->stopped && queue_is_empty(&v4l2sink->queue)) {
             mutex_unlock(v4l2sink->mutex);
-            struct v4l2sink_packet *last = v4l2sink->previous;
-            if (last) {
-                // assign an arbitrary duration to the last packet
-                last->packet.duration = 100000;
-                bool ok = v4l2sink_write(v4l2sink, &last->packet);
-                if (!ok) {
-                    // failing to write the last frame is not very serious, no
-                    // future frame may depend on it, so the resulting file
-                    // will still be valid
-                    LOGW("Could not send last packet to v4l2sink");
-                }
-                v4l2sink_packet_delete(last);
+            if (v4l2sink->fps && v4l2sink->has_latest
+                    && !v4l2sink->latest_written) {
+                // flush the last frame
+                v4l2sink_tick(v4l2sink, av_gettime_relative());
             }
             break;
         }
 
-        struct v4l2sink_packet *rec;
-        queue_take(&v4l2sink->queue, next, &rec);
+        struct v4l2sink_item *item = NULL;
+        if (!queue_is_empty(&v4l2sink->queue)) {
+            queue_take(&v4l2sink->queue, next, &item);
+        }
 
         mutex_unlock(v4l2sink->mutex);
 
-        // v4l2sink->previous is only written from this thread, no need to lock
-        struct v4l2sink_packet *previous = v4l2sink->previous;
-        v4l2sink->previous = rec;
-
-        if (!previous) {
-            // we just received the first packet
-            continue;
+        bool ok = true;
+        if (item) {
+            ok = item->frame ? v4l2sink_process_frame(v4l2sink, item->frame)
+                             : v4l2sink_decode(v4l2sink, &item->packet);
+            v4l2sink_item_delete(item);
         }
 
-        // config packets have no PTS, we must ignore them
-        if (rec->packet.pts != AV_NOPTS_VALUE
-            && previous->packet.pts != AV_NOPTS_VALUE) {
-            // we now know the duration of the previous packet
-            previous->packet.duration = rec->packet.pts - previous->packet.pts;
+        int64_t now = av_gettime_relative();
+        if (ok && v4l2sink_is_tick_due(v4l2sink, now)) {
+            ok = v4l2sink_tick(v4l2sink, now);
         }
 
-        bool ok = v4l2sink_write(v4l2sink, &previous->packet);
-        v4l2sink_packet_delete(previous);
         if (!ok) {
-            LOGE("V4l2sink: Could not decode packet");
+            LOGE("V4l2sink: Could not write frame");
 
             mutex_lock(v4l2sink->mutex);
             v4l2sink->failed = true;
-            // discard pending packets
+            // discard pending items
             v4l2sink_queue_clear(&v4l2sink->queue);
             mutex_unlock(v4l2sink->mutex);
             break;
         }
-
     }
 
     LOGD("V4l2sink thread ended");
@@ -392,56 +835,33 @@ v4l2sink_join(struct v4l2sink *v4l2sink) {
 }
 
 bool
-v4l2sink_push(struct v4l2sink *v4l2sink, const AVPacket *packet) {
-// the new decoding/encoding API has been introduced by:
-// <http://git.videolan.org/?p=ffmpeg.git;a=commitdiff;h=7fc329e2dd6226dfecaa4a1d7adf353bf2773726>
-#ifdef SCRCPY_LAVF_HAS_NEW_ENCODING_DECODING_API
-    int ret;
-    if ((ret = avcodec_send_packet(v4l2sink->decoder_ctx, packet)) < 0) {
-        LOGE("Could not send video packet x: %d", ret);
+v4l2sink_push_frame(struct v4l2sink *v4l2sink, const AVFrame *frame) {
+    mutex_lock(v4l2sink->mutex);
+    assert(!v4l2sink->stopped);
+
+    if (v4l2sink->failed) {
+        // reject any new frame (this will stop the stream)
+        mutex_unlock(v4l2sink->mutex);
         return false;
     }
 
-    if ((ret = avcodec_receive_frame(v4l2sink->decoder_ctx, v4l2sink->decoded_frame)) < 0) {
-        LOGE("Could not receive video frame: %d", ret);
+    struct v4l2sink_item *item = v4l2sink_item_new_frame(frame);
+    if (!item) {
+        LOGC("Could not allocate v4l2sink frame");
+        mutex_unlock(v4l2sink->mutex);
         return false;
     }
 
-    if ((ret = avcodec_send_frame(v4l2sink->encoder_ctx, v4l2sink->decoded_frame)) < 0) {
-        LOGE("Could not send video frame: %d", ret);
-        return true;
-    }
+    queue_push(&v4l2sink->queue, next, item);
+    cond_signal(v4l2sink->queue_cond);
 
-    if ((ret = avcodec_receive_packet(v4l2sink->encoder_ctx, v4l2sink->raw_packet)) < 0) {
-        LOGE("Could not receive video packet: %d", ret);
-        return false;
-    }
-#else
-    int got_picture;
-    int len = avcodec_decode_video2(v4l2sink->decoder_ctx,
-                                    v4l2sink->decoded_frame,
-                                    &got_picture,
-                                    packet);
-    if (len < 0) {
-        LOGE("Could not decode video packet: %d", len);
-        return false;
-    }
-    if (!got_picture) {
-        return false;
-    }
+    mutex_unlock(v4l2sink->mutex);
+    return true;
+}
 
-    len = avcodec_encode_video2(v4l2sink->encoder_ctx,
-                                v4l2sink->raw_packet,
-                                v4l2sink->decoded_frame,
-                                &got_picture);
-    if (len < 0) {
-        LOGE("Could not encode video packet: %d", len);
-        return false;
-    }
-    if (!got_picture) {
-        return false;
-    }
-#endif
+bool
+v4l2sink_push(struct v4l2sink *v4l2sink, const AVPacket *packet) {
+    assert(v4l2sink->decode);
 
     mutex_lock(v4l2sink->mutex);
     assert(!v4l2sink->stopped);
@@ -452,15 +872,14 @@ v4l2sink_push(struct v4l2sink *v4l2sink, const AVPacket *packet) {
         return false;
     }
 
-    
-    struct v4l2sink_packet *rec = v4l2sink_packet_new(v4l2sink->raw_packet);
-    if (!rec) {
+    struct v4l2sink_item *item = v4l2sink_item_new_packet(packet);
+    if (!item) {
         LOGC("Could not allocate v4l2sink packet");
         mutex_unlock(v4l2sink->mutex);
         return false;
     }
 
-    queue_push(&v4l2sink->queue, next, rec);
+    queue_push(&v4l2sink->queue, next, item);
     cond_signal(v4l2sink->queue_cond);
 
     mutex_unlock(v4l2sink->mutex);
@@ -6,49 +6,97 @@
 #ifdef V4L2SINK
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <libavformat/avformat.h>
 #include <SDL2/SDL_mutex.h>
 #include <SDL2/SDL_thread.h>
 
 #include "common.h"
+#include "frame_converter.h"
 #include "scrcpy.h"
 #include "video_buffer.h"
 #include "util/queue.h"
 
-struct v4l2sink_packet {
+#define V4L2SINK_BUFFER_COUNT 4
+
+// either a packet to decode or a decoded frame
+struct v4l2sink_item {
+    AVFrame *frame; // NULL for a packet
     AVPacket packet;
-    struct v4l2sink_packet *next;
+    struct v4l2sink_item *next;
 };
 
-struct v4l2sink_queue QUEUE(struct v4l2sink_packet);
+struct v4l2sink_queue QUEUE(struct v4l2sink_item);
+
+struct v4l2sink_buffer {
+    void *start;
+    size_t length;
+};
+
+struct v4l2sink_params {
+    enum sc_v4l2sink_format format;
+    struct size size; // 0 for the initial frame size
+    uint16_t fps; // output clock, 0 to write the frames as they arrive
+};
 
 struct v4l2sink {
-    AVCodecContext *decoder_ctx;
-    AVCodecContext *encoder_ctx;
-    AVFrame *decoded_frame;
-    AVPacket *raw_packet;
+    // If the stream is already decoded for the display, the decoder shares
+    // its frames (see v4l2sink_push_frame()). Otherwise, the v4l2sink decodes
+    // the packets itself, on its own thread (see v4l2sink_push()).
+    bool decode;
+    // only accessed from the v4l2sink thread
+    AVCodecContext *decoder_ctx; // only if decode is set
+    AVFrame *decoded_frame; // only if decode is set
 
     char *devicename;
-    AVFormatContext *ctx;
-    struct size declared_frame_size;
-    bool header_written;
+    struct size size; // output geometry
+
+    // The frames are written as raw images (converted to the output format
+    // if necessary), either to the mmap streaming buffers of the V4L2 device,
+    // or by write() (also for a regular file or a pipe).
+    enum AVPixelFormat format;
+    uint32_t fourcc; // V4L2 pixel format
+    int fd;
+    size_t image_size;
+    unsigned bytesperline;
+    bool streaming;
+    bool streamon;
+    struct v4l2sink_buffer buffers[V4L2SINK_BUFFER_COUNT];
+    unsigned buffer_count;
+    unsigned queued_count; // buffers queued at least once
+    uint8_t *write_buffer; // to pack or convert the image before write()
+    struct frame_converter converter; // initialized on first use
+    bool converter_initialized;
+
+    // With an output clock, the latest frame is written on each tick (so it
+    // is repeated if no new frame arrived, and intermediate frames are
+    // dropped). A frame waits at most one interval.
+    uint16_t fps; // 0 for no output clock
+    AVFrame *latest; // only if fps is set
+    bool has_latest;
+    bool latest_written;
+    int64_t latest_time; // arrival time of the latest frame
+    int64_t clock_start;
+    int64_t next_tick; // 0 before the first frame
+    uint32_t written_count; // distinct frames written
+    uint32_t repeated_count;
+    uint32_t dropped_count;
+    uint64_t total_latency; // in us, from arrival to write
+    uint32_t max_latency; // in us
 
     SDL_Thread *thread;
     SDL_mutex *mutex;
     SDL_cond *queue_cond;
     bool stopped; // set on v4l2sink_stop() by the stream reader
-    bool failed; // set on packet write failure
-    struct v4l2sink_queue queue;
-
-    // we can write a packet only once we received the next one so that we can
-    // set its duration (next_pts - current_pts)
-    // "previous" is only accessed from the v4l2sink thread, so it does not
-    // need to be protected by the mutex
-    struct v4l2sink_packet *previous;
+    bool failed; // set on frame write failure
+    struct v4l2sink_queue queue; // packets to decode or frames to write
 };
 
 bool
-v4l2sink_init(struct v4l2sink *v4l2sink, const char *devicename, struct size declared_frame_size);
+v4l2sink_init(struct v4l2sink *v4l2sink, const char *devicename,
+              struct size declared_frame_size, bool decode,
+              const struct v4l2sink_params *params);
 
 void
 v4l2sink_destroy(struct v4l2sink *v4l2sink);
@@ -62,9 +110,15 @@ v4l2sink_close(struct v4l2sink *v4l2sink);
 bool
 v4l2sink_start(struct v4l2sink *v4l2sink);
 
+// push a packet to decode (only if decode is set)
+// the packet is referenced, it is decoded on the v4l2sink thread
 bool
 v4l2sink_push(struct v4l2sink *v4l2sink, const AVPacket *packet);
 
+// push a decoded frame (it is referenced, not copied)
+bool
+v4l2sink_push_frame(struct v4l2sink *v4l2sink, const AVFrame *frame);
+
 void
 v4l2sink_stop(struct v4l2sink *v4l2sink);
 
@@ -0,0 +1,126 @@
+#include <assert.h>
+
+#include "adaptive_bit_rate.h"
+
+#define FRAME_INTERVAL 16667 // us (60 fps)
+#define PROPAGATION_DELAY 5000 // us
+
+// A trace of the packets received through a link of limited capacity: the
+// frames are produced at the current target bit rate, and wait in the link
+// queue while the previous ones are transmitted.
+struct link {
+    uint32_t capacity; // in bits/s
+    int64_t pts; // of the next frame
+    int64_t free_time; // when the last packet is transmitted
+    uint32_t max_queueing_delay; // on the last second
+};
+
+static void
+link_init(struct link *link, uint32_t capacity) {
+    link->capacity = capacity;
+    link->pts = 0;
+    link->free_time = 0;
+    link->max_queueing_delay = 0;
+}
+
+// return the number of bit rate changes
+static unsigned
+run(struct adaptive_bit_rate *abr, struct link *link, unsigned seconds,
+    uint32_t frame_size) {
+    unsigned changes = 0;
+    int64_t end = link->pts + (int64_t) seconds * 1000000;
+    while (link->pts < end) {
+        // 0 for a frame at the target bit rate
+        uint32_t size = frame_size ? frame_size
+                                   : (uint64_t) abr->bit_rate / 8
+                                        * FRAME_INTERVAL / 1000000;
+        int64_t start = link->free_time > link->pts ? link->free_time
+                                                    : link->pts;
+        link->free_time = start + (int64_t) size * 8 * 1000000
+                                                 / link->capacity;
+        int64_t arrival_time = link->free_time + PROPAGATION_DELAY;
+
+        if (end - link->pts <= 1000000) {
+            uint32_t delay = start - link->pts;
+            if (delay > link->max_queueing_delay) {
+                link->max_queueing_delay = delay;
+            }
+        }
+
+        if (adaptive_bit_rate_push(abr, arrival_time, link->pts, size)) {
+            ++changes;
+        }
+        link->pts += FRAME_INTERVAL;
+    }
+    return changes;
+}
+
+static void test_decrease_on_congestion(void) {
+    struct adaptive_bit_rate abr;
+    adaptive_bit_rate_init(&abr, 8000000, 8000000);
+
+    struct link link;
+    link_init(&link, 4000000);
+
+    unsigned changes = run(&abr, &link, 60, 0);
+    assert(changes);
+
+    // it oscillates around the capacity, the queues drain quickly
+    for (unsigned i = 0; i < 30; ++i) {
+        run(&abr, &link, 1, 0);
+        assert(abr.bit_rate >= 2000000 && abr.bit_rate <= 4400000);
+        assert(link.max_queueing_delay < 500000);
+    }
+}
+
+static void test_increase_up_to_max(void) {
+    struct adaptive_bit_rate abr;
+    adaptive_bit_rate_init(&abr, 8000000, 20000000);
+
+    struct link link;
+    link_init(&link, 100000000);
+
+    run(&abr, &link, 60, 0);
+    assert(abr.bit_rate == 20000000);
+    assert(abr.queueing_delay < 30000);
+
+    // the capacity drops (e.g. Wi-Fi congestion)
+    link.capacity = 5000000;
+    run(&abr, &link, 30, 0);
+    assert(abr.bit_rate <= 5500000);
+}
+
+static void test_no_increase_while_unused(void) {
+    struct adaptive_bit_rate abr;
+    adaptive_bit_rate_init(&abr, 8000000, 20000000);
+
+    struct link link;
+    link_init(&link, 100000000);
+
+    // the screen content does not change, the frames are tiny
+    unsigned changes = run(&abr, &link, 60, 500);
+    assert(!changes);
+    assert(abr.bit_rate == 8000000);
+}
+
+static void test_min_bit_rate(void) {
+    struct adaptive_bit_rate abr;
+    adaptive_bit_rate_init(&abr, 2000000, 8000000);
+
+    struct link link;
+    link_init(&link, 100000);
+
+    run(&abr, &link, 60, 0);
+    assert(abr.bit_rate == 500000);
+}
+
+int main(int argc, char *argv[]) {
+    (void) argc;
+    (void) argv;
+
+    test_decrease_on_congestion();
+    test_increase_up_to_max();
+    test_no_increase_while_unused();
+    test_min_bit_rate();
+    return 0;
+}
@@ -48,6 +48,8 @@ static void test_options(void) {
         "--bit-rate", "5M",
         "--crop", "100:200:300:400",
         "--fullscreen",
+        "--hidden-max-fps", "5",
+        "--max-bit-rate", "20M",
         "--max-fps", "30",
         "--max-size", "1024",
         "--lock-video-orientation", "2",
@@ -57,11 +59,14 @@ static void test_options(void) {
         "--push-target", "/sdcard/Movies",
         "--record", "file",
         "--record-format", "mkv",
+        "--record-segment-size", "64M",
         "--render-expired-frames",
         "--serial", "0123456789abcdef",
         "--show-touches",
         "--turn-screen-off",
         "--prefer-text",
+        "--print-input-latency",
+        "--touch-batch-window", "8",
         "--window-title", "my device",
         "--window-x", "100",
         "--window-y", "-1",
@@ -78,19 +83,25 @@ static void test_options(void) {
     assert(opts->bit_rate == 5000000);
     assert(!strcmp(opts->crop, "100:200:300:400"));
     assert(opts->fullscreen);
+    assert(opts->hidden_max_fps == 5);
+    assert(opts->max_bit_rate == 20000000);
     assert(opts->max_fps == 30);
     assert(opts->max_size == 1024);
     assert(opts->lock_video_orientation == 2);
     assert(opts->port_range.first == 1234);
     assert(opts->port_range.last == 1236);
     assert(!strcmp(opts->push_target, "/sdcard/Movies"));
-    assert(!strcmp(opts->record_filename, "file"));
-    assert(opts->record_format == SC_RECORD_FORMAT_MKV);
+    assert(opts->record_output_count == 1);
+    assert(!strcmp(opts->record_outputs[0].filename, "file"));
+    assert(opts->record_outputs[0].format == SC_RECORD_FORMAT_MKV);
+    assert(opts->record_segment_size == 64000000);
     assert(opts->render_expired_frames);
     assert(!strcmp(opts->serial, "0123456789abcdef"));
     assert(opts->show_touches);
     assert(opts->turn_screen_off);
     assert(opts->prefer_text);
+    assert(opts->print_input_latency);
+    assert(opts->touch_batch_window == 8);
     assert(!strcmp(opts->window_title, "my device"));
     assert(opts->window_x == 100);
     assert(opts->window_y == -1);
@@ -111,6 +122,11 @@ static void test_options2(void) {
         "--no-control",
         "--no-display",
         "--record", "file.mp4", // cannot enable --no-display without recording
+        "--record-fragment-duration", "2000",
+        "--record-buffer-size", "4M",
+        "--record-preallocate", "1000K",
+        "--record-direct-io",
+        "--record-index",
     };
 
     bool ok = scrcpy_parse_args(&args, ARRAY_LEN(argv), argv);
@@ -119,10 +135,94 @@ static void test_options2(void) {
     const struct scrcpy_options *opts = &args.opts;
     assert(!opts->control);
     assert(!opts->display);
-    assert(!strcmp(opts->record_filename, "file.mp4"));
-    assert(opts->record_format == SC_RECORD_FORMAT_MP4);
+    assert(opts->record_output_count == 1);
+    assert(!strcmp(opts->record_outputs[0].filename, "file.mp4"));
+    assert(opts->record_outputs[0].format == SC_RECORD_FORMAT_MP4);
+    assert(opts->record_fragmented);
+    assert(opts->record_fragment_duration == 2000);
+    assert(opts->record_buffer_size == 4000000);
+    assert(opts->record_preallocate == 1000000);
+    assert(opts->record_direct_io);
+    assert(opts->record_index);
 }
 
+static void test_record_outputs(void) {
+    struct scrcpy_cli_args args = {
+        .opts = SCRCPY_OPTIONS_DEFAULT,
+        .help = false,
+        .version = false,
+    };
+
+    char *argv[] = {
+        "scrcpy",
+        "--no-display",
+        "--record-format", "mkv", // applies to the first --record
+        "--record", "archive",
+        "--record", "-",
+        "--record", "live.fifo",
+        "--record-format", "ts",
+    };
+
+    bool ok = scrcpy_parse_args(&args, ARRAY_LEN(argv), argv);
+    assert(ok);
+
+    const struct scrcpy_options *opts = &args.opts;
+    assert(opts->record_output_count == 3);
+    assert(!strcmp(opts->record_outputs[0].filename, "archive"));
+    assert(opts->record_outputs[0].format == SC_RECORD_FORMAT_MKV);
+    assert(!strcmp(opts->record_outputs[1].filename, "-"));
+    assert(opts->record_outputs[1].format == SC_RECORD_FORMAT_TS);
+    assert(!strcmp(opts->record_outputs[2].filename, "live.fifo"));
+    assert(opts->record_outputs[2].format == SC_RECORD_FORMAT_TS);
+}
+
+static void test_record_mp4_to_stdout(void) {
+    struct scrcpy_cli_args args = {
+        .opts = SCRCPY_OPTIONS_DEFAULT,
+        .help = false,
+        .version = false,
+    };
+
+    char *argv[] = {
+        "scrcpy",
+        "--record", "-",
+        "--record-format", "mp4",
+    };
+
+    // the mp4 muxer cannot write its index on a pipe
+    bool ok = scrcpy_parse_args(&args, ARRAY_LEN(argv), argv);
+    assert(!ok);
+}
+
+#ifdef V4L2SINK
+static void test_v4l2sink_options(void) {
+    struct scrcpy_cli_args args = {
+        .opts = SCRCPY_OPTIONS_DEFAULT,
+        .help = false,
+        .version = false,
+    };
+
+    char *argv[] = {
+        "scrcpy",
+        "--no-display",
+        "--v4l2sink", "/dev/video2",
+        "--v4l2sink-format", "nv12",
+        "--v4l2sink-size", "1280x720",
+        "--v4l2sink-fps", "30",
+    };
+
+    bool ok = scrcpy_parse_args(&args, ARRAY_LEN(argv), argv);
+    assert(ok);
+
+    const struct scrcpy_options *opts = &args.opts;
+    assert(!strcmp(opts->v4l2sink_device, "/dev/video2"));
+    assert(opts->v4l2sink_format == SC_V4L2SINK_FORMAT_NV12);
+    assert(opts->v4l2sink_width == 1280);
+    assert(opts->v4l2sink_height == 720);
+    assert(opts->v4l2sink_fps == 30);
+}
+#endif
+
 static void test_parse_shortcut_mods(void) {
     struct sc_shortcut_mods mods;
     bool ok;
@@ -168,6 +268,11 @@ int main(int argc, char *argv[]) {
     test_flag_help();
     test_options();
     test_options2();
+    test_record_outputs();
+    test_record_mp4_to_stdout();
+#ifdef V4L2SINK
+    test_v4l2sink_options();
+#endif
     test_parse_shortcut_mods();
     return 0;
 };
@@ -2,6 +2,7 @@
 #include <string.h>
 
 #include "control_msg.h"
+#include "util/buffer_util.h"
 
 static void test_serialize_inject_keycode(void) {
     struct control_msg msg = {
@@ -257,6 +258,358 @@ static void test_serialize_rotate_device(void) {
     assert(!memcmp(buf, expected, sizeof(expected)));
 }
 
+static void test_serialize_request_ack(void) {
+    struct control_msg msg = {
+        .type = CONTROL_MSG_TYPE_REQUEST_ACK,
+        .request_ack = {
+            .sequence = 0x01020304,
+            .timestamp = UINT64_C(0x1122334455667788),
+        },
+    };
+
+    unsigned char buf[CONTROL_MSG_MAX_SIZE];
+    int size = control_msg_serialize(&msg, buf);
+    assert(size == 13);
+
+    const unsigned char expected[] = {
+        CONTROL_MSG_TYPE_REQUEST_ACK,
+        0x01, 0x02, 0x03, 0x04, // sequence
+        0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, // timestamp
+    };
+    assert(!memcmp(buf, expected, sizeof(expected)));
+}
+
+static void test_serialize_set_protocol_version(void) {
+    struct control_msg msg = {
+        .type = CONTROL_MSG_TYPE_SET_PROTOCOL_VERSION,
+        .set_protocol_version = {
+            .version = 2,
+        },
+    };
+
+    unsigned char buf[CONTROL_MSG_MAX_SIZE];
+    int size = control_msg_serialize(&msg, buf);
+    assert(size == 2);
+
+    const unsigned char expected[] = {
+        CONTROL_MSG_TYPE_SET_PROTOCOL_VERSION,
+        0x02,
+    };
+    assert(!memcmp(buf, expected, sizeof(expected)));
+}
+
+static void test_serialize_set_bit_rate(void) {
+    struct control_msg msg = {
+        .type = CONTROL_MSG_TYPE_SET_BIT_RATE,
+        .set_bit_rate = {
+            .bit_rate = 4000000,
+        },
+    };
+
+    unsigned char buf[CONTROL_MSG_MAX_SIZE];
+    int size = control_msg_serialize(&msg, buf);
+    assert(size == 5);
+
+    const unsigned char expected[] = {
+        CONTROL_MSG_TYPE_SET_BIT_RATE,
+        0x00, 0x3d, 0x09, 0x00, // 4000000
+    };
+    assert(!memcmp(buf, expected, sizeof(expected)));
+}
+
+static void test_serialize_set_max_fps(void) {
+    struct control_msg msg = {
+        .type = CONTROL_MSG_TYPE_SET_MAX_FPS,
+        .set_max_fps = {
+            .max_fps = 300,
+        },
+    };
+
+    unsigned char buf[CONTROL_MSG_MAX_SIZE];
+    int size = control_msg_serialize(&msg, buf);
+    assert(size == 3);
+
+    const unsigned char expected[] = {
+        CONTROL_MSG_TYPE_SET_MAX_FPS,
+        0x01, 0x2c, // 300
+    };
+    assert(!memcmp(buf, expected, sizeof(expected)));
+}
+
+static void test_serialize_request_keyframe(void) {
+    struct control_msg msg = {
+        .type = CONTROL_MSG_TYPE_REQUEST_KEYFRAME,
+    };
+
+    unsigned char buf[CONTROL_MSG_MAX_SIZE];
+    int size = control_msg_serialize(&msg, buf);
+    assert(size == 1);
+
+    const unsigned char expected[] = {
+        CONTROL_MSG_TYPE_REQUEST_KEYFRAME,
+    };
+    assert(!memcmp(buf, expected, sizeof(expected)));
+}
+
+static struct control_msg
+touch(enum android_motionevent_action action, uint64_t pointer_id, int32_t x,
+      int32_t y) {
+    struct control_msg msg = {
+        .type = CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT,
+        .inject_touch_event = {
+            .action = action,
+            .pointer_id = pointer_id,
+            .position = {
+                .point = {
+                    .x = x,
+                    .y = y,
+                },
+                .screen_size = {
+                    .width = 1080,
+                    .height = 1920,
+                },
+            },
+            .pressure = action == AMOTION_EVENT_ACTION_UP ? 0.0f : 1.0f,
+            .buttons = 0,
+        },
+        .ack_sequence = 0,
+    };
+    return msg;
+}
+
+static void test_serialize_touch_frame(void) {
+    struct control_msg_encoder encoder;
+    control_msg_encoder_init(&encoder);
+
+    struct control_msg msgs[] = {
+        touch(AMOTION_EVENT_ACTION_DOWN, 42, 100, 200),
+        touch(AMOTION_EVENT_ACTION_MOVE, 42, 105, 197),
+        touch(AMOTION_EVENT_ACTION_DOWN, 7, 300, 400),
+    };
+
+    unsigned char buf[CONTROL_MSG_MAX_SIZE];
+    size_t len;
+    unsigned n = control_msg_serialize_compact(&encoder, msgs, 3, buf, &len);
+    assert(n == 3);
+    assert(len == 24);
+
+    const unsigned char expected[] = {
+        CONTROL_MSG_TYPE_SET_SCREEN_SIZE,
+        0x04, 0x38, 0x07, 0x80, // 1080x1920
+        CONTROL_MSG_TYPE_INJECT_TOUCH_FRAME,
+        0x03, // 3 events
+        0x40, // index 0, AMOTION_EVENT_ACTION_DOWN, pressure
+        0xc8, 0x01, // dx = 100 (zigzag varint)
+        0x90, 0x03, // dy = 200
+        0xff, 0xff, // pressure 1.0
+        0x20, // index 0, AMOTION_EVENT_ACTION_MOVE
+        0x0a, // dx = 5
+        0x05, // dy = -3
+        0x41, // index 1, AMOTION_EVENT_ACTION_DOWN, pressure
+        0xd8, 0x04, // dx = 300
+        0xa0, 0x06, // dy = 400
+        0xff, 0xff, // pressure 1.0
+    };
+    assert(!memcmp(buf, expected, sizeof(expected)));
+
+    // the same screen size is not sent again
+    struct control_msg up = touch(AMOTION_EVENT_ACTION_UP, 42, 105, 197);
+    n = control_msg_serialize_compact(&encoder, &up, 1, buf, &len);
+    assert(n == 1);
+    const unsigned char expected_up[] = {
+        CONTROL_MSG_TYPE_INJECT_TOUCH_FRAME,
+        0x01, // 1 event
+        0x50, // index 0, AMOTION_EVENT_ACTION_UP, pressure
+        0x00, // dx = 0
+        0x00, // dy = 0
+        0x00, 0x00, // pressure 0.0
+    };
+    assert(len == sizeof(expected_up));
+    assert(!memcmp(buf, expected_up, sizeof(expected_up)));
+
+    // the pointer is up, it has no index anymore
+    struct control_msg move = touch(AMOTION_EVENT_ACTION_MOVE, 42, 110, 200);
+    n = control_msg_serialize_compact(&encoder, &move, 1, buf, &len);
+    assert(n == 0);
+
+    // not a touch event
+    struct control_msg rotate = {
+        .type = CONTROL_MSG_TYPE_ROTATE_DEVICE,
+    };
+    n = control_msg_serialize_compact(&encoder, &rotate, 1, buf, &len);
+    assert(n == 0);
+}
+
+static void test_serialize_touch_frame_split(void) {
+    struct control_msg_encoder encoder;
+    control_msg_encoder_init(&encoder);
+
+    struct control_msg msgs[] = {
+        touch(AMOTION_EVENT_ACTION_DOWN, 1, 100, 200),
+        touch(AMOTION_EVENT_ACTION_MOVE, 1, 105, 197),
+        touch(AMOTION_EVENT_ACTION_MOVE, 1, 110, 190),
+    };
+    // a tracked message ends the frame
+    msgs[1].ack_sequence = 1;
+
+    unsigned char buf[CONTROL_MSG_MAX_SIZE];
+    size_t len;
+    unsigned n = control_msg_serialize_compact(&encoder, msgs, 3, buf, &len);
+    assert(n == 2);
+
+    // a different screen size ends the frame
+    msgs[2].inject_touch_event.position.screen_size.width = 1920;
+    msgs[2].inject_touch_event.position.screen_size.height = 1080;
+    struct control_msg next[] = {
+        msgs[2],
+        touch(AMOTION_EVENT_ACTION_MOVE, 1, 110, 190),
+    };
+    n = control_msg_serialize_compact(&encoder, next, 2, buf, &len);
+    assert(n == 1);
+    assert(buf[0] == CONTROL_MSG_TYPE_SET_SCREEN_SIZE);
+}
+
+// decode the compact encodings (as the device does)
+struct compact_decoder {
+    struct size screen_size;
+    struct point points[CONTROL_MSG_COMPACT_MAX_POINTERS];
+    uint16_t pressures[CONTROL_MSG_COMPACT_MAX_POINTERS];
+    uint32_t buttons[CONTROL_MSG_COMPACT_MAX_POINTERS];
+};
+
+struct decoded_touch {
+    unsigned index;
+    enum android_motionevent_action action;
+    struct point point;
+    uint16_t pressure;
+    uint32_t buttons;
+};
+
+static uint32_t
+read_varint(const unsigned char *buf, size_t *pos) {
+    uint32_t value = 0;
+    unsigned shift = 0;
+    for (;;) {
+        unsigned char b = buf[(*pos)++];
+        value |= (uint32_t) (b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return value;
+        }
+        shift += 7;
+    }
+}
+
+static int32_t
+read_signed_varint(const unsigned char *buf, size_t *pos) {
+    uint32_t zigzag = read_varint(buf, pos);
+    return (int32_t) (zigzag >> 1) ^ -(int32_t) (zigzag & 1);
+}
+
+static unsigned
+decode(struct compact_decoder *decoder, const unsigned char *buf, size_t len,
+       struct decoded_touch *out) {
+    unsigned count = 0;
+    size_t pos = 0;
+    while (pos < len) {
+        unsigned char type = buf[pos++];
+        if (type == CONTROL_MSG_TYPE_SET_SCREEN_SIZE) {
+            decoder->screen_size.width = buffer_read16be(&buf[pos]);
+            decoder->screen_size.height = buffer_read16be(&buf[pos + 2]);
+            pos += 4;
+            continue;
+        }
+        assert(type == CONTROL_MSG_TYPE_INJECT_TOUCH_FRAME);
+        unsigned n = buf[pos++];
+        for (unsigned i = 0; i < n; ++i) {
+            unsigned char head = buf[pos++];
+            unsigned index = head & 0xf;
+            struct point *point = &decoder->points[index];
+            point->x += read_signed_varint(buf, &pos);
+            point->y += read_signed_varint(buf, &pos);
+            if (head & 0x40) {
+                decoder->pressures[index] = buffer_read16be(&buf[pos]);
+                pos += 2;
+            }
+            if (head & 0x80) {
+                decoder->buttons[index] = read_varint(buf, &pos);
+            }
+            out[count].index = index;
+            out[count].action = (head >> 4) & 0x3;
+            out[count].point = *point;
+            out[count].pressure = decoder->pressures[index];
+            out[count].buttons = decoder->buttons[index];
+            ++count;
+        }
+    }
+    assert(pos == len);
+    return count;
+}
+
+static void test_serialize_touch_frame_round_trip(void) {
+    struct control_msg_encoder encoder;
+    control_msg_encoder_init(&encoder);
+    struct compact_decoder decoder;
+    memset(&decoder, 0, sizeof(decoder));
+
+    // two pointers moving in opposite directions, with small and large steps
+    struct control_msg msgs[64];
+    unsigned count = 0;
+    msgs[count++] = touch(AMOTION_EVENT_ACTION_DOWN, 0x1234567890, 540, 960);
+    msgs[count++] = touch(AMOTION_EVENT_ACTION_DOWN, UINT64_C(-1), 0, 0);
+    msgs[count - 1].inject_touch_event.buttons = AMOTION_EVENT_BUTTON_PRIMARY;
+    for (int i = 1; i <= 30; ++i) {
+        int32_t step = i * i * 3;
+        msgs[count++] = touch(AMOTION_EVENT_ACTION_MOVE, 0x1234567890,
+                              540 + step, 960 - step);
+        msgs[count++] = touch(AMOTION_EVENT_ACTION_MOVE,
+                              UINT64_C(-1), step, 2 * step);
+        msgs[count - 1].inject_touch_event.buttons =
+            AMOTION_EVENT_BUTTON_PRIMARY;
+        msgs[count - 1].inject_touch_event.pressure = i / 30.0f;
+    }
+    msgs[count++] = touch(AMOTION_EVENT_ACTION_UP, 0x1234567890, 0, 0);
+    msgs[count++] = touch(AMOTION_EVENT_ACTION_UP, UINT64_C(-1), 0, 0);
+    assert(count == 64);
+
+    unsigned char buf[CONTROL_MSG_MAX_SIZE];
+    struct decoded_touch decoded[64];
+    unsigned decoded_count = 0;
+    unsigned i = 0;
+    size_t total = 0;
+    while (i < count) {
+        size_t len;
+        unsigned n = control_msg_serialize_compact(&encoder, &msgs[i],
+                                                   count - i, buf, &len);
+        assert(n && n <= CONTROL_MSG_TOUCH_FRAME_MAX_EVENTS);
+        unsigned r = decode(&decoder, buf, len, &decoded[decoded_count]);
+        assert(r == n);
+        decoded_count += n;
+        total += len;
+        i += n;
+    }
+    assert(decoded_count == count);
+
+    // much smaller than the 28 bytes per event of the version 1 encoding
+    assert(total < count * 8);
+
+    assert(decoder.screen_size.width == 1080);
+    assert(decoder.screen_size.height == 1920);
+    for (unsigned j = 0; j < count; ++j) {
+        const struct control_msg *msg = &msgs[j];
+        const struct decoded_touch *d = &decoded[j];
+        // the indices are assigned in order
+        assert(d->index == (msg->inject_touch_event.pointer_id == 0x1234567890
+                            ? 0 : 1));
+        assert(d->action == msg->inject_touch_event.action);
+        assert(d->point.x == msg->inject_touch_event.position.point.x);
+        assert(d->point.y == msg->inject_touch_event.position.point.y);
+        float pressure = d->pressure == 0xffff ? 1.0f : d->pressure / 0x1p16f;
+        float diff = pressure - msg->inject_touch_event.pressure;
+        assert(diff > -0.001f && diff < 0.001f);
+        assert(d->buttons == msg->inject_touch_event.buttons);
+    }
+}
+
 int main(int argc, char *argv[]) {
     (void) argc;
     (void) argv;
@@ -273,5 +626,13 @@ int main(int argc, char *argv[]) {
     test_serialize_set_clipboard();
     test_serialize_set_screen_power_mode();
     test_serialize_rotate_device();
+    test_serialize_request_ack();
+    test_serialize_set_protocol_version();
+    test_serialize_set_bit_rate();
+    test_serialize_set_max_fps();
+    test_serialize_request_keyframe();
+    test_serialize_touch_frame();
+    test_serialize_touch_frame_split();
+    test_serialize_touch_frame_round_trip();
     return 0;
 }
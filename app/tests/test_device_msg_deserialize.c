@@ -45,11 +45,88 @@ static void test_deserialize_clipboard_big(void) {
     device_msg_destroy(&msg);
 }
 
+static void test_deserialize_ack(void) {
+    const unsigned char input[] = {
+        DEVICE_MSG_TYPE_ACK,
+        0x01, 0x02, 0x03, 0x04, // sequence
+        0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, // timestamp
+        0x00, 0x00, 0x01, 0x00, // injection time
+        0x00, 0x03, // queue depth
+    };
+
+    struct device_msg msg;
+    ssize_t r = device_msg_deserialize(input, sizeof(input), &msg);
+    assert(r == 19);
+
+    assert(msg.type == DEVICE_MSG_TYPE_ACK);
+    assert(msg.ack.sequence == 0x01020304);
+    assert(msg.ack.timestamp == UINT64_C(0x1122334455667788));
+    assert(msg.ack.injection_time == 256);
+    assert(msg.ack.queue_depth == 3);
+
+    // incomplete
+    r = device_msg_deserialize(input, sizeof(input) - 1, &msg);
+    assert(r == 0);
+
+    device_msg_destroy(&msg);
+}
+
+static void test_deserialize_protocol_version(void) {
+    const unsigned char input[] = {
+        DEVICE_MSG_TYPE_PROTOCOL_VERSION,
+        0x02,
+    };
+
+    struct device_msg msg;
+    ssize_t r = device_msg_deserialize(input, sizeof(input), &msg);
+    assert(r == 2);
+
+    assert(msg.type == DEVICE_MSG_TYPE_PROTOCOL_VERSION);
+    assert(msg.protocol_version.version == 2);
+
+    device_msg_destroy(&msg);
+}
+
+static void test_deserialize_encoder_stats(void) {
+    const unsigned char input[] = {
+        DEVICE_MSG_TYPE_ENCODER_STATS,
+        0x00, 0x00, 0x03, 0xEA, // interval
+        0x00, 0x00, 0x00, 0x3C, // frames
+        0x00, 0x0F, 0x42, 0x40, // bytes
+        0x00, 0x00, 0x09, 0xC4, // write blocked time
+        0x00, 0x01, // rotation restarts
+        0x00, 0x00, 0x1F, 0x40, // dequeue latency avg
+        0x00, 0x00, 0x3E, 0x80, // dequeue latency max
+    };
+
+    struct device_msg msg;
+    ssize_t r = device_msg_deserialize(input, sizeof(input), &msg);
+    assert(r == 27);
+
+    assert(msg.type == DEVICE_MSG_TYPE_ENCODER_STATS);
+    assert(msg.encoder_stats.interval == 1002);
+    assert(msg.encoder_stats.frames == 60);
+    assert(msg.encoder_stats.bytes == 1000000);
+    assert(msg.encoder_stats.write_blocked_time == 2500);
+    assert(msg.encoder_stats.rotation_restarts == 1);
+    assert(msg.encoder_stats.dequeue_latency_avg == 8000);
+    assert(msg.encoder_stats.dequeue_latency_max == 16000);
+
+    // incomplete
+    r = device_msg_deserialize(input, sizeof(input) - 1, &msg);
+    assert(r == 0);
+
+    device_msg_destroy(&msg);
+}
+
 int main(int argc, char *argv[]) {
     (void) argc;
     (void) argv;
 
     test_deserialize_clipboard();
     test_deserialize_clipboard_big();
+    test_deserialize_ack();
+    test_deserialize_protocol_version();
+    test_deserialize_encoder_stats();
     return 0;
 }
@@ -0,0 +1,284 @@
+#include <assert.h>
+#include <string.h>
+#include <SDL2/SDL_thread.h>
+#include <SDL2/SDL_timer.h>
+
+#include "controller.h"
+#include "device_msg.h"
+#include "input_latency.h"
+#include "util/buffer_util.h"
+#include "util/net.h"
+
+#define IPV4_LOCALHOST 0x7F000001
+
+// A stand-in for the server: it reads the control messages, and replies to
+// the "request ack" messages as the device would.
+struct stand_in_server {
+    socket_t socket;
+    unsigned injected;
+    unsigned acked;
+};
+
+static size_t
+payload_length(unsigned char type) {
+    switch (type) {
+        case CONTROL_MSG_TYPE_INJECT_KEYCODE:
+            return 13;
+        case CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT:
+            return 27;
+        case CONTROL_MSG_TYPE_INJECT_SCROLL_EVENT:
+            return 20;
+        case CONTROL_MSG_TYPE_REQUEST_ACK:
+            return 12;
+        case CONTROL_MSG_TYPE_SET_PROTOCOL_VERSION:
+            return 1;
+        default:
+            assert(!"unexpected control message");
+            return 0;
+    }
+}
+
+static int
+run_stand_in_server(void *data) {
+    struct stand_in_server *server = data;
+
+    unsigned char buf[32];
+    for (;;) {
+        ssize_t r = net_recv_all(server->socket, buf, 1);
+        if (r != 1) {
+            break;
+        }
+        size_t len = payload_length(buf[0]);
+        r = net_recv_all(server->socket, &buf[1], len);
+        if (r != (ssize_t) len) {
+            break;
+        }
+
+        if (buf[0] == CONTROL_MSG_TYPE_SET_PROTOCOL_VERSION) {
+            // do not reply, so the version 1 encoding is kept
+            continue;
+        }
+
+        if (buf[0] != CONTROL_MSG_TYPE_REQUEST_ACK) {
+            ++server->injected;
+            continue;
+        }
+
+        // the previous message is "injected"
+        assert(server->injected);
+        unsigned char ack[19];
+        ack[0] = DEVICE_MSG_TYPE_ACK;
+        memcpy(&ack[1], &buf[1], 12); // sequence and timestamp
+        buffer_write32be(&ack[13], 100); // injection time
+        buffer_write16be(&ack[17], 2); // queue depth
+        r = net_send_all(server->socket, ack, sizeof(ack));
+        assert(r == sizeof(ack));
+        ++server->acked;
+    }
+
+    return 0;
+}
+
+static socket_t
+listen_local(uint16_t *port) {
+    for (uint16_t p = 27300; p < 27400; ++p) {
+        socket_t socket = net_listen(IPV4_LOCALHOST, p, 1);
+        if (socket != INVALID_SOCKET) {
+            *port = p;
+            return socket;
+        }
+    }
+    return INVALID_SOCKET;
+}
+
+static void test_histogram(void) {
+    struct latency_histogram histogram;
+    latency_histogram_init(&histogram);
+    assert(latency_histogram_percentile(&histogram, 50) == 0);
+
+    for (uint32_t i = 1; i <= 1000; ++i) {
+        latency_histogram_record(&histogram, i);
+    }
+    assert(histogram.count == 1000);
+    assert(histogram.max == 1000);
+    assert(histogram.sum == 500500);
+
+    // the error is at most 1/8
+    uint32_t p50 = latency_histogram_percentile(&histogram, 50);
+    assert(p50 >= 500 && p50 <= 500 + 500 / 8);
+    uint32_t p90 = latency_histogram_percentile(&histogram, 90);
+    assert(p90 >= 900 && p90 <= 900 + 900 / 8);
+    assert(latency_histogram_percentile(&histogram, 100) == 1000);
+
+    // small values are exact
+    latency_histogram_init(&histogram);
+    latency_histogram_record(&histogram, 3);
+    latency_histogram_record(&histogram, 5);
+    assert(latency_histogram_percentile(&histogram, 50) == 3);
+    assert(latency_histogram_percentile(&histogram, 99) == 5);
+
+    // large values
+    latency_histogram_record(&histogram, UINT32_MAX);
+    assert(latency_histogram_percentile(&histogram, 100) == UINT32_MAX);
+}
+
+static void test_acks_from_stand_in_server(void) {
+    bool ok = net_init();
+    assert(ok);
+
+    uint16_t port;
+    socket_t server_socket = listen_local(&port);
+    assert(server_socket != INVALID_SOCKET);
+    socket_t control_socket = net_connect(IPV4_LOCALHOST, port);
+    assert(control_socket != INVALID_SOCKET);
+    struct stand_in_server server = {
+        .socket = net_accept(server_socket),
+        .injected = 0,
+        .acked = 0,
+    };
+    assert(server.socket != INVALID_SOCKET);
+
+    SDL_Thread *thread = SDL_CreateThread(run_stand_in_server, "server",
+                                          &server);
+    assert(thread);
+
+    struct input_latency latency;
+    ok = input_latency_init(&latency);
+    assert(ok);
+
+    static struct controller controller;
+    ok = controller_init(&controller, control_socket, &latency, NULL);
+    assert(ok);
+    ok = controller_start(&controller);
+    assert(ok);
+
+    struct control_msg msg = {
+        .type = CONTROL_MSG_TYPE_INJECT_KEYCODE,
+        .inject_keycode = {
+            .keycode = AKEYCODE_ENTER,
+            .repeat = 0,
+            .metastate = AMETA_NONE,
+        },
+    };
+    for (unsigned i = 0; i < 10; ++i) {
+        msg.inject_keycode.action = i % 2 ? AKEY_EVENT_ACTION_UP
+                                          : AKEY_EVENT_ACTION_DOWN;
+        ok = controller_push_input_msg(&controller, &msg, SDL_GetTicks());
+        assert(ok);
+    }
+    // not tracked
+    ok = controller_push_msg(&controller, &msg);
+    assert(ok);
+
+    // wait for the acknowledgements (at most 5 seconds)
+    uint32_t acked = 0;
+    for (unsigned i = 0; i < 500 && acked < 10; ++i) {
+        SDL_Delay(10);
+        SDL_LockMutex(latency.mutex);
+        acked = latency.stages[INPUT_LATENCY_STAGE_TOTAL].count;
+        SDL_UnlockMutex(latency.mutex);
+    }
+    assert(acked == 10);
+
+    const struct latency_histogram *inject =
+        &latency.stages[INPUT_LATENCY_STAGE_INJECT];
+    assert(inject->max == 100);
+    assert(latency_histogram_percentile(inject, 50) == 100);
+    for (unsigned i = 0; i < INPUT_LATENCY_STAGE_COUNT; ++i) {
+        assert(latency.stages[i].count == 10);
+    }
+    assert(!latency.unacknowledged_count);
+    assert(latency.total_queue_depth == 20);
+    assert(latency.max_queue_depth == 2);
+
+    controller_stop(&controller);
+    net_shutdown(control_socket, SHUT_RDWR);
+    controller_join(&controller);
+    SDL_WaitThread(thread, NULL);
+
+    assert(server.acked == 10);
+    assert(server.injected >= 10);
+
+    controller_destroy(&controller);
+    input_latency_destroy(&latency);
+
+    net_close(server.socket);
+    net_close(control_socket);
+    net_close(server_socket);
+    net_cleanup();
+}
+
+static void test_superseded(void) {
+    struct input_latency latency;
+    bool ok = input_latency_init(&latency);
+    assert(ok);
+
+    uint32_t sequence = input_latency_register(&latency, 0);
+    input_latency_superseded(&latency, sequence);
+    assert(latency.superseded_count == 1);
+    // already released
+    input_latency_superseded(&latency, sequence);
+    assert(latency.superseded_count == 1);
+
+    // the controller is not started: the messages stay in its queues
+    static struct controller controller;
+    ok = controller_init(&controller, INVALID_SOCKET, &latency, NULL);
+    assert(ok);
+
+    struct control_msg msg = {
+        .type = CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT,
+        .inject_touch_event = {
+            .action = AMOTION_EVENT_ACTION_MOVE,
+            .buttons = 0,
+            .pointer_id = 42,
+            .position = {
+                .screen_size = {1080, 1920},
+                .point = {100, 200},
+            },
+            .pressure = 1.0f,
+        },
+    };
+    // coalesced in place
+    for (unsigned i = 0; i < 3; ++i) {
+        ok = controller_push_input_msg(&controller, &msg, 0);
+        assert(ok);
+    }
+    assert(controller.coalesced_count == 2);
+    assert(latency.superseded_count == 3);
+
+    // discards the pending move
+    msg.inject_touch_event.action = AMOTION_EVENT_ACTION_UP;
+    ok = controller_push_input_msg(&controller, &msg, 0);
+    assert(ok);
+    assert(controller.discarded_count == 1);
+    assert(latency.superseded_count == 4);
+
+    // overflows the droppable queue
+    msg.type = CONTROL_MSG_TYPE_INJECT_SCROLL_EVENT;
+    msg.inject_scroll_event.position.screen_size.width = 1080;
+    msg.inject_scroll_event.position.screen_size.height = 1920;
+    msg.inject_scroll_event.position.point.x = 100;
+    msg.inject_scroll_event.position.point.y = 200;
+    msg.inject_scroll_event.hscroll = 0;
+    msg.inject_scroll_event.vscroll = 1;
+    for (unsigned i = 0; i < CONTROLLER_QUEUE_SIZE + 10; ++i) {
+        ok = controller_push_input_msg(&controller, &msg, 0);
+        assert(ok);
+    }
+    assert(controller.dropped_count >= 10);
+    assert(latency.superseded_count == 4 + controller.dropped_count);
+    assert(!latency.unacknowledged_count);
+
+    controller_destroy(&controller);
+    input_latency_destroy(&latency);
+}
+
+int main(int argc, char *argv[]) {
+    (void) argc;
+    (void) argv;
+
+    test_histogram();
+    test_acks_from_stand_in_server();
+    test_superseded();
+    return 0;
+}
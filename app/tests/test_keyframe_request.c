@@ -0,0 +1,127 @@
+#include <assert.h>
+
+#include "keyframe_request.h"
+
+static void test_first_request(void) {
+    struct keyframe_limiter limiter;
+    keyframe_limiter_init(&limiter, 1000);
+
+    uint32_t delay;
+    assert(keyframe_limiter_request(&limiter, 42, false, &delay)
+            == KEYFRAME_LIMITER_SEND);
+    assert(keyframe_limiter_request(&limiter, 1042, false, &delay)
+            == KEYFRAME_LIMITER_SEND);
+    assert(keyframe_limiter_request(&limiter, 5000, false, &delay)
+            == KEYFRAME_LIMITER_SEND);
+}
+
+static void test_defer(void) {
+    struct keyframe_limiter limiter;
+    keyframe_limiter_init(&limiter, 1000);
+
+    uint32_t delay;
+    assert(keyframe_limiter_request(&limiter, 10000, false, &delay)
+            == KEYFRAME_LIMITER_SEND);
+
+    // too early, sent at the end of the interval
+    assert(keyframe_limiter_request(&limiter, 10200, false, &delay)
+            == KEYFRAME_LIMITER_DEFER);
+    assert(delay == 800);
+
+    // merged with the deferred one
+    assert(keyframe_limiter_request(&limiter, 10300, false, &delay)
+            == KEYFRAME_LIMITER_IGNORE);
+    assert(keyframe_limiter_request(&limiter, 10900, false, &delay)
+            == KEYFRAME_LIMITER_IGNORE);
+
+    assert(keyframe_limiter_request(&limiter, 11000, true, &delay)
+            == KEYFRAME_LIMITER_SEND);
+
+    // the next interval starts from the deferred request
+    assert(keyframe_limiter_request(&limiter, 11500, false, &delay)
+            == KEYFRAME_LIMITER_DEFER);
+    assert(delay == 500);
+}
+
+static void test_retry_early(void) {
+    struct keyframe_limiter limiter;
+    keyframe_limiter_init(&limiter, 1000);
+
+    uint32_t delay;
+    assert(keyframe_limiter_request(&limiter, 0, false, &delay)
+            == KEYFRAME_LIMITER_SEND);
+    assert(keyframe_limiter_request(&limiter, 600, false, &delay)
+            == KEYFRAME_LIMITER_DEFER);
+    assert(delay == 400);
+
+    // the timer expired slightly too early, the request must not be lost
+    assert(keyframe_limiter_request(&limiter, 999, true, &delay)
+            == KEYFRAME_LIMITER_DEFER);
+    assert(delay == 1);
+    assert(keyframe_limiter_request(&limiter, 1000, true, &delay)
+            == KEYFRAME_LIMITER_SEND);
+}
+
+static void test_retry_already_satisfied(void) {
+    struct keyframe_limiter limiter;
+    keyframe_limiter_init(&limiter, 1000);
+
+    uint32_t delay;
+    assert(keyframe_limiter_request(&limiter, 0, false, &delay)
+            == KEYFRAME_LIMITER_SEND);
+    assert(keyframe_limiter_request(&limiter, 500, false, &delay)
+            == KEYFRAME_LIMITER_DEFER);
+
+    // a new request is processed before the retry
+    assert(keyframe_limiter_request(&limiter, 1000, false, &delay)
+            == KEYFRAME_LIMITER_SEND);
+    assert(keyframe_limiter_request(&limiter, 1001, true, &delay)
+            == KEYFRAME_LIMITER_IGNORE);
+}
+
+static void test_keyframe_received(void) {
+    struct keyframe_limiter limiter;
+    keyframe_limiter_init(&limiter, 1000);
+
+    uint32_t delay;
+    assert(keyframe_limiter_request(&limiter, 0, false, &delay)
+            == KEYFRAME_LIMITER_SEND);
+    assert(keyframe_limiter_request(&limiter, 100, false, &delay)
+            == KEYFRAME_LIMITER_DEFER);
+
+    // the keyframe sent in response satisfies the deferred request
+    keyframe_limiter_keyframe_received(&limiter);
+    assert(keyframe_limiter_request(&limiter, 1000, true, &delay)
+            == KEYFRAME_LIMITER_IGNORE);
+
+    // the interval still starts from the last request sent
+    assert(keyframe_limiter_request(&limiter, 1100, false, &delay)
+            == KEYFRAME_LIMITER_SEND);
+}
+
+static void test_ticks_wrap_around(void) {
+    struct keyframe_limiter limiter;
+    keyframe_limiter_init(&limiter, 1000);
+
+    uint32_t delay;
+    assert(keyframe_limiter_request(&limiter, UINT32_MAX - 100, false, &delay)
+            == KEYFRAME_LIMITER_SEND);
+    assert(keyframe_limiter_request(&limiter, 100, false, &delay)
+            == KEYFRAME_LIMITER_DEFER);
+    assert(delay == 799);
+    assert(keyframe_limiter_request(&limiter, 899, true, &delay)
+            == KEYFRAME_LIMITER_SEND);
+}
+
+int main(int argc, char *argv[]) {
+    (void) argc;
+    (void) argv;
+
+    test_first_request();
+    test_defer();
+    test_retry_early();
+    test_retry_already_satisfied();
+    test_keyframe_received();
+    test_ticks_wrap_around();
+    return 0;
+}
@@ -16,6 +16,14 @@ public final class ControlMessage {
     public static final int TYPE_SET_CLIPBOARD = 8;
     public static final int TYPE_SET_SCREEN_POWER_MODE = 9;
     public static final int TYPE_ROTATE_DEVICE = 10;
+    public static final int TYPE_REQUEST_ACK = 11;
+    // protocol version 2
+    public static final int TYPE_SET_PROTOCOL_VERSION = 12;
+    public static final int TYPE_SET_SCREEN_SIZE = 13;
+    public static final int TYPE_INJECT_TOUCH_FRAME = 14;
+    public static final int TYPE_SET_BIT_RATE = 15;
+    public static final int TYPE_SET_MAX_FPS = 16;
+    public static final int TYPE_REQUEST_KEYFRAME = 17;
 
     private int type;
     private String text;
@@ -30,69 +38,146 @@ public final class ControlMessage {
     private int vScroll;
     private boolean paste;
     private int repeat;
+    private int sequence;
+    private long timestamp;
+    private int version;
+    private Size screenSize;
+    private ControlMessage[] touchEvents;
+    private int touchEventCount;
+    private int bitRate;
+    private int maxFps;
 
-    private ControlMessage() {
+    ControlMessage() {
     }
 
-    public static ControlMessage createInjectKeycode(int action, int keycode, int repeat, int metaState) {
-        ControlMessage msg = new ControlMessage();
-        msg.type = TYPE_INJECT_KEYCODE;
-        msg.action = action;
-        msg.keycode = keycode;
-        msg.repeat = repeat;
-        msg.metaState = metaState;
-        return msg;
+    // The messages are reused by the reader (see ControlMessageReader.next()), so they are initialized by the following methods rather than
+    // allocated for each message. Each method only sets the fields of the message type.
+
+    void setInjectKeycode(int action, int keycode, int repeat, int metaState) {
+        this.type = TYPE_INJECT_KEYCODE;
+        this.action = action;
+        this.keycode = keycode;
+        this.repeat = repeat;
+        this.metaState = metaState;
     }
 
-    public static ControlMessage createInjectText(String text) {
-        ControlMessage msg = new ControlMessage();
-        msg.type = TYPE_INJECT_TEXT;
-        msg.text = text;
-        return msg;
+    void setInjectText(String text) {
+        this.type = TYPE_INJECT_TEXT;
+        this.text = text;
     }
 
-    public static ControlMessage createInjectTouchEvent(int action, long pointerId, Position position, float pressure, int buttons) {
-        ControlMessage msg = new ControlMessage();
-        msg.type = TYPE_INJECT_TOUCH_EVENT;
-        msg.action = action;
-        msg.pointerId = pointerId;
-        msg.pressure = pressure;
-        msg.position = position;
-        msg.buttons = buttons;
-        return msg;
+    void setInjectTouchEvent(int action, long pointerId, int x, int y, Size screenSize, float pressure, int buttons) {
+        this.type = TYPE_INJECT_TOUCH_EVENT;
+        this.action = action;
+        this.pointerId = pointerId;
+        this.pressure = pressure;
+        setPosition(x, y, screenSize);
+        this.buttons = buttons;
     }
 
-    public static ControlMessage createInjectScrollEvent(Position position, int hScroll, int vScroll) {
-        ControlMessage msg = new ControlMessage();
-        msg.type = TYPE_INJECT_SCROLL_EVENT;
-        msg.position = position;
-        msg.hScroll = hScroll;
-        msg.vScroll = vScroll;
-        return msg;
+    void setInjectScrollEvent(int x, int y, Size screenSize, int hScroll, int vScroll) {
+        this.type = TYPE_INJECT_SCROLL_EVENT;
+        setPosition(x, y, screenSize);
+        this.hScroll = hScroll;
+        this.vScroll = vScroll;
     }
 
-    public static ControlMessage createSetClipboard(String text, boolean paste) {
-        ControlMessage msg = new ControlMessage();
-        msg.type = TYPE_SET_CLIPBOARD;
-        msg.text = text;
-        msg.paste = paste;
-        return msg;
+    void setSetClipboard(String text, boolean paste) {
+        this.type = TYPE_SET_CLIPBOARD;
+        this.text = text;
+        this.paste = paste;
     }
 
     /**
      * @param mode one of the {@code Device.SCREEN_POWER_MODE_*} constants
      */
-    public static ControlMessage createSetScreenPowerMode(int mode) {
-        ControlMessage msg = new ControlMessage();
-        msg.type = TYPE_SET_SCREEN_POWER_MODE;
-        msg.action = mode;
-        return msg;
+    void setSetScreenPowerMode(int mode) {
+        this.type = TYPE_SET_SCREEN_POWER_MODE;
+        this.action = mode;
+    }
+
+    /**
+     * @param timestamp opaque client timestamp, sent back in the acknowledgement
+     */
+    void setRequestAck(int sequence, long timestamp) {
+        this.type = TYPE_REQUEST_ACK;
+        this.sequence = sequence;
+        this.timestamp = timestamp;
+    }
+
+    void setSetProtocolVersion(int version) {
+        this.type = TYPE_SET_PROTOCOL_VERSION;
+        this.version = version;
+    }
+
+    void setSetScreenSize(Size screenSize) {
+        this.type = TYPE_SET_SCREEN_SIZE;
+        this.screenSize = screenSize;
     }
 
-    public static ControlMessage createEmpty(int type) {
-        ControlMessage msg = new ControlMessage();
-        msg.type = type;
-        return msg;
+    /**
+     * @param touchEvents the touch events of the frame, to inject in order (only the first {@code count} ones)
+     */
+    void setInjectTouchFrame(ControlMessage[] touchEvents, int count) {
+        this.type = TYPE_INJECT_TOUCH_FRAME;
+        this.touchEvents = touchEvents;
+        this.touchEventCount = count;
+    }
+
+    /**
+     * @param bitRate the encoder bit rate, in bits/s
+     */
+    void setSetBitRate(int bitRate) {
+        this.type = TYPE_SET_BIT_RATE;
+        this.bitRate = bitRate;
+    }
+
+    /**
+     * @param maxFps the max frame rate of the screen capture (0 for no limit)
+     */
+    void setSetMaxFps(int maxFps) {
+        this.type = TYPE_SET_MAX_FPS;
+        this.maxFps = maxFps;
+    }
+
+    void setEmpty(int type) {
+        this.type = type;
+    }
+
+    /**
+     * Copy the message (except the touch events of a frame), reusing the position of this message.
+     */
+    void copyFrom(ControlMessage other) {
+        type = other.type;
+        text = other.text;
+        metaState = other.metaState;
+        action = other.action;
+        keycode = other.keycode;
+        buttons = other.buttons;
+        pointerId = other.pointerId;
+        pressure = other.pressure;
+        if (other.position != null) {
+            Point point = other.position.getPoint();
+            setPosition(point.getX(), point.getY(), other.position.getScreenSize());
+        }
+        hScroll = other.hScroll;
+        vScroll = other.vScroll;
+        paste = other.paste;
+        repeat = other.repeat;
+        sequence = other.sequence;
+        timestamp = other.timestamp;
+        version = other.version;
+        screenSize = other.screenSize;
+        bitRate = other.bitRate;
+        maxFps = other.maxFps;
+    }
+
+    private void setPosition(int x, int y, Size screenSize) {
+        if (position == null) {
+            position = new Position(new Point(x, y), screenSize);
+        } else {
+            position.set(x, y, screenSize);
+        }
     }
 
     public int getType() {
@@ -146,4 +231,39 @@ public final class ControlMessage {
     public int getRepeat() {
         return repeat;
     }
+
+    public int getSequence() {
+        return sequence;
+    }
+
+    public long getTimestamp() {
+        return timestamp;
+    }
+
+    public int getVersion() {
+        return version;
+    }
+
+    public Size getScreenSize() {
+        return screenSize;
+    }
+
+    public int getBitRate() {
+        return bitRate;
+    }
+
+    public int getMaxFps() {
+        return maxFps;
+    }
+
+    /**
+     * @return the touch events of the frame (only the first {@link #getTouchEventCount()} ones are valid)
+     */
+    public ControlMessage[] getTouchEvents() {
+        return touchEvents;
+    }
+
+    public int getTouchEventCount() {
+        return touchEventCount;
+    }
 }
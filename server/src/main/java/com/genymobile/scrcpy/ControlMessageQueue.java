@@ -0,0 +1,166 @@
+package com.genymobile.scrcpy;
+
+import android.view.MotionEvent;
+
+/**
+ * Bounded queue of control messages, between the thread reading the socket and the thread injecting the events.
+ * <p>
+ * The messages are copied into preallocated slots (the reader reuses its messages). The touch frames are split into their touch events, and a
+ * touch move replaces a pending move of the same pointer (the intermediate positions are not worth injecting if the injection is late).
+ * <p>
+ * If the injector batches the moves into a single event (see {@link PointersState}), the intermediate positions are kept, and the moves are
+ * only coalesced to avoid blocking while the queue is full.
+ */
+public final class ControlMessageQueue {
+
+    public static final int DEFAULT_CAPACITY = 64;
+
+    private final ControlMessage[] slots;
+    private final boolean coalesceMoves;
+    // the pending messages are in [head, head + size) (modulo the capacity)
+    private int head;
+    private int size;
+
+    private int maxSize;
+    private long coalescedCount;
+
+    public ControlMessageQueue() {
+        this(DEFAULT_CAPACITY, true);
+    }
+
+    public ControlMessageQueue(int capacity) {
+        this(capacity, true);
+    }
+
+    /**
+     * @param coalesceMoves {@code true} to always coalesce the moves, {@code false} to coalesce them only while the queue is full
+     */
+    public ControlMessageQueue(int capacity, boolean coalesceMoves) {
+        this.coalesceMoves = coalesceMoves;
+        slots = new ControlMessage[capacity];
+        for (int i = 0; i < capacity; ++i) {
+            slots[i] = new ControlMessage();
+        }
+    }
+
+    /**
+     * Push a message, blocking while the queue is full.
+     *
+     * @param msg the message (copied, it may be reused by the caller afterwards)
+     */
+    public synchronized void push(ControlMessage msg) throws InterruptedException {
+        if (msg.getType() == ControlMessage.TYPE_INJECT_TOUCH_FRAME) {
+            ControlMessage[] events = msg.getTouchEvents();
+            for (int i = 0; i < msg.getTouchEventCount(); ++i) {
+                pushOne(events[i]);
+            }
+        } else {
+            pushOne(msg);
+        }
+    }
+
+    private void pushOne(ControlMessage msg) throws InterruptedException {
+        if ((coalesceMoves || size == slots.length) && coalesce(msg)) {
+            ++coalescedCount;
+            return;
+        }
+
+        while (size == slots.length) {
+            wait();
+        }
+        slots[(head + size) % slots.length].copyFrom(msg);
+        ++size;
+        if (size > maxSize) {
+            maxSize = size;
+        }
+        notify();
+    }
+
+    /**
+     * Replace a pending touch move of the same pointer, if any.
+     * <p>
+     * Only the moves pushed after the last message of another kind are considered, so that the moves are never reordered with other messages
+     * (in particular with the acknowledgement requests, which refer to the previous message).
+     */
+    private boolean coalesce(ControlMessage msg) {
+        if (!isTouchMove(msg)) {
+            return false;
+        }
+        for (int i = size - 1; i >= 0; --i) {
+            ControlMessage pending = slots[(head + i) % slots.length];
+            if (!isTouchMove(pending)) {
+                return false;
+            }
+            if (pending.getPointerId() == msg.getPointerId()) {
+                if (pending.getButtons() != msg.getButtons()) {
+                    return false;
+                }
+                pending.copyFrom(msg);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    private static boolean isTouchMove(ControlMessage msg) {
+        return msg.getType() == ControlMessage.TYPE_INJECT_TOUCH_EVENT && msg.getAction() == MotionEvent.ACTION_MOVE;
+    }
+
+    /**
+     * Take the next message, blocking while the queue is empty.
+     *
+     * @param msg the message to initialize with the next one
+     * @return the number of messages still pending
+     */
+    public synchronized int take(ControlMessage msg) throws InterruptedException {
+        while (size == 0) {
+            wait();
+        }
+        return remove(msg);
+    }
+
+    /**
+     * Take the next message, blocking while the queue is empty, at most for the given timeout.
+     *
+     * @param msg the message to initialize with the next one
+     * @param timeout the timeout in milliseconds (0 to return immediately if the queue is empty)
+     * @return the number of messages still pending, or -1 on timeout
+     */
+    public synchronized int take(ControlMessage msg, long timeout) throws InterruptedException {
+        long deadline = System.nanoTime() + timeout * 1000000;
+        while (size == 0) {
+            long remaining = (deadline - System.nanoTime()) / 1000000;
+            if (remaining <= 0) {
+                return -1;
+            }
+            wait(remaining);
+        }
+        return remove(msg);
+    }
+
+    private int remove(ControlMessage msg) {
+        msg.copyFrom(slots[head]);
+        head = (head + 1) % slots.length;
+        --size;
+        notify();
+        return size;
+    }
+
+    public synchronized int size() {
+        return size;
+    }
+
+    /**
+     * @return the highest number of pending messages
+     */
+    public synchronized int getMaxSize() {
+        return maxSize;
+    }
+
+    /**
+     * @return the number of touch moves replaced by a more recent one
+     */
+    public synchronized long getCoalescedCount() {
+        return coalescedCount;
+    }
+}
@@ -3,7 +3,6 @@ package com.genymobile.scrcpy;
 import java.io.EOFException;
 import java.io.IOException;
 import java.io.InputStream;
-import java.nio.ByteBuffer;
 import java.nio.charset.StandardCharsets;
 
 public class ControlMessageReader {
@@ -13,176 +12,426 @@ public class ControlMessageReader {
     static final int INJECT_SCROLL_EVENT_PAYLOAD_LENGTH = 20;
     static final int SET_SCREEN_POWER_MODE_PAYLOAD_LENGTH = 1;
     static final int SET_CLIPBOARD_FIXED_PAYLOAD_LENGTH = 1;
+    static final int REQUEST_ACK_PAYLOAD_LENGTH = 12;
+    static final int SET_PROTOCOL_VERSION_PAYLOAD_LENGTH = 1;
+    static final int SET_SCREEN_SIZE_PAYLOAD_LENGTH = 4;
+    static final int SET_BIT_RATE_PAYLOAD_LENGTH = 4;
+    static final int SET_MAX_FPS_PAYLOAD_LENGTH = 2;
+
+    /**
+     * The highest control protocol version supported.
+     * <p>
+     * The version 2 adds compact encodings for the touch events: the screen size is sent once for the session (SET_SCREEN_SIZE), each pointer
+     * down has a small index, and the positions are sent as varint deltas, in frames of several events (INJECT_TOUCH_FRAME).
+     */
+    public static final int PROTOCOL_VERSION = 2;
+
+    public static final int COMPACT_MAX_POINTERS = 16;
+
+    /**
+     * The pointer id of the compact index {@code i} is {@code COMPACT_POINTER_ID_BASE + i}, distinct from the pointer ids of the version 1
+     * messages.
+     */
+    public static final long COMPACT_POINTER_ID_BASE = Long.MIN_VALUE;
+
+    private static final int COMPACT_HAS_PRESSURE = 0x40;
+    private static final int COMPACT_HAS_BUTTONS = 0x80;
 
     private static final int MESSAGE_MAX_SIZE = 1 << 18; // 256k
 
     public static final int CLIPBOARD_TEXT_MAX_LENGTH = MESSAGE_MAX_SIZE - 6; // type: 1 byte; paste flag: 1 byte; length: 4 bytes
     public static final int INJECT_TEXT_MAX_LENGTH = 300;
 
+    // the compact touch frame count is stored in 1 byte
+    private static final int TOUCH_FRAME_MAX_EVENTS = 255;
+
+    // Ring buffer (its size is a power of 2), so that the unread bytes are never moved: the available bytes are in [head, tail). The indices
+    // are not wrapped (they may overflow), only the array accesses are.
     private final byte[] rawBuffer = new byte[MESSAGE_MAX_SIZE];
-    private final ByteBuffer buffer = ByteBuffer.wrap(rawBuffer);
+    private int head;
+    private int tail;
+    // the read position of the message being parsed
+    private int position;
+
+    // The returned messages are reused, so that parsing does not allocate (except for the texts)
+    private final ControlMessage msg = new ControlMessage();
+    private final ControlMessage[] touchEvents = new ControlMessage[TOUCH_FRAME_MAX_EVENTS];
+    private Size lastScreenSize = new Size(0, 0);
+
+    // session state of the compact encodings (the last values received for each compact index)
+    private Size screenSize = lastScreenSize;
+    private final int[] compactX = new int[COMPACT_MAX_POINTERS];
+    private final int[] compactY = new int[COMPACT_MAX_POINTERS];
+    private final int[] compactPressure = new int[COMPACT_MAX_POINTERS];
+    private final int[] compactButtons = new int[COMPACT_MAX_POINTERS];
 
     public ControlMessageReader() {
-        // invariant: the buffer is always in "get" mode
-        buffer.limit(0);
+        for (int i = 0; i < touchEvents.length; ++i) {
+            touchEvents[i] = new ControlMessage();
+        }
     }
 
     public boolean isFull() {
-        return buffer.remaining() == rawBuffer.length;
+        return tail - head == rawBuffer.length;
     }
 
     public void readFrom(InputStream input) throws IOException {
         if (isFull()) {
             throw new IllegalStateException("Buffer full, call next() to consume");
         }
-        buffer.compact();
-        int head = buffer.position();
-        int r = input.read(rawBuffer, head, rawBuffer.length - head);
+        // read into the contiguous free space after the tail (the next call will read the beginning of the array, if necessary)
+        int index = tail & (rawBuffer.length - 1);
+        int free = rawBuffer.length - (tail - head);
+        int r = input.read(rawBuffer, index, Math.min(free, rawBuffer.length - index));
         if (r == -1) {
             throw new EOFException("Controller socket closed");
         }
-        buffer.position(head + r);
-        buffer.flip();
+        tail += r;
     }
 
+    /**
+     * Parse the next message, if it is fully available.
+     * <p>
+     * The returned message is owned by the reader: it is only valid until the next call to {@code next()}.
+     *
+     * @return the message, or {@code null} if more data must be read
+     */
     public ControlMessage next() {
-        if (!buffer.hasRemaining()) {
+        if (head == tail) {
             return null;
         }
-        int savedPosition = buffer.position();
+        position = head;
 
-        int type = buffer.get();
-        ControlMessage msg;
+        int type = getByte();
+        boolean ok;
         switch (type) {
             case ControlMessage.TYPE_INJECT_KEYCODE:
-                msg = parseInjectKeycode();
+                ok = parseInjectKeycode();
                 break;
             case ControlMessage.TYPE_INJECT_TEXT:
-                msg = parseInjectText();
+                ok = parseInjectText();
                 break;
             case ControlMessage.TYPE_INJECT_TOUCH_EVENT:
-                msg = parseInjectTouchEvent();
+                ok = parseInjectTouchEvent();
                 break;
             case ControlMessage.TYPE_INJECT_SCROLL_EVENT:
-                msg = parseInjectScrollEvent();
+                ok = parseInjectScrollEvent();
                 break;
             case ControlMessage.TYPE_SET_CLIPBOARD:
-                msg = parseSetClipboard();
+                ok = parseSetClipboard();
                 break;
             case ControlMessage.TYPE_SET_SCREEN_POWER_MODE:
-                msg = parseSetScreenPowerMode();
+                ok = parseSetScreenPowerMode();
+                break;
+            case ControlMessage.TYPE_REQUEST_ACK:
+                ok = parseRequestAck();
+                break;
+            case ControlMessage.TYPE_SET_PROTOCOL_VERSION:
+                ok = parseSetProtocolVersion();
+                break;
+            case ControlMessage.TYPE_SET_SCREEN_SIZE:
+                ok = parseSetScreenSize();
+                break;
+            case ControlMessage.TYPE_INJECT_TOUCH_FRAME:
+                ok = parseInjectTouchFrame();
+                break;
+            case ControlMessage.TYPE_SET_BIT_RATE:
+                ok = parseSetBitRate();
+                break;
+            case ControlMessage.TYPE_SET_MAX_FPS:
+                ok = parseSetMaxFps();
                 break;
             case ControlMessage.TYPE_BACK_OR_SCREEN_ON:
             case ControlMessage.TYPE_EXPAND_NOTIFICATION_PANEL:
             case ControlMessage.TYPE_COLLAPSE_NOTIFICATION_PANEL:
             case ControlMessage.TYPE_GET_CLIPBOARD:
             case ControlMessage.TYPE_ROTATE_DEVICE:
-                msg = ControlMessage.createEmpty(type);
+            case ControlMessage.TYPE_REQUEST_KEYFRAME:
+                msg.setEmpty(type);
+                ok = true;
                 break;
             default:
                 Ln.w("Unknown event type: " + type);
-                msg = null;
+                ok = false;
                 break;
         }
 
-        if (msg == null) {
-            // failure, reset savedPosition
-            buffer.position(savedPosition);
+        if (!ok) {
+            // failure, the message will be parsed again from the head
+            return null;
         }
+        head = position;
         return msg;
     }
 
-    private ControlMessage parseInjectKeycode() {
-        if (buffer.remaining() < INJECT_KEYCODE_PAYLOAD_LENGTH) {
-            return null;
+    private boolean parseInjectKeycode() {
+        if (remaining() < INJECT_KEYCODE_PAYLOAD_LENGTH) {
+            return false;
         }
-        int action = toUnsigned(buffer.get());
-        int keycode = buffer.getInt();
-        int repeat = buffer.getInt();
-        int metaState = buffer.getInt();
-        return ControlMessage.createInjectKeycode(action, keycode, repeat, metaState);
+        int action = getUnsignedByte();
+        int keycode = getInt();
+        int repeat = getInt();
+        int metaState = getInt();
+        msg.setInjectKeycode(action, keycode, repeat, metaState);
+        return true;
     }
 
     private String parseString() {
-        if (buffer.remaining() < 4) {
+        if (remaining() < 4) {
             return null;
         }
-        int len = buffer.getInt();
-        if (buffer.remaining() < len) {
+        int len = getInt();
+        if (remaining() < len) {
             return null;
         }
-        int position = buffer.position();
-        // Move the buffer position to consume the text
-        buffer.position(position + len);
-        return new String(rawBuffer, position, len, StandardCharsets.UTF_8);
+        int index = position & (rawBuffer.length - 1);
+        // Move the position to consume the text
+        position += len;
+        if (index + len <= rawBuffer.length) {
+            return new String(rawBuffer, index, len, StandardCharsets.UTF_8);
+        }
+        // the text wraps around the end of the ring buffer
+        byte[] text = new byte[len];
+        int firstPart = rawBuffer.length - index;
+        System.arraycopy(rawBuffer, index, text, 0, firstPart);
+        System.arraycopy(rawBuffer, 0, text, firstPart, len - firstPart);
+        return new String(text, StandardCharsets.UTF_8);
     }
 
-    private ControlMessage parseInjectText() {
+    private boolean parseInjectText() {
         String text = parseString();
         if (text == null) {
-            return null;
+            return false;
         }
-        return ControlMessage.createInjectText(text);
+        msg.setInjectText(text);
+        return true;
     }
 
-    private ControlMessage parseInjectTouchEvent() {
-        if (buffer.remaining() < INJECT_TOUCH_EVENT_PAYLOAD_LENGTH) {
-            return null;
+    private boolean parseInjectTouchEvent() {
+        if (remaining() < INJECT_TOUCH_EVENT_PAYLOAD_LENGTH) {
+            return false;
         }
-        int action = toUnsigned(buffer.get());
-        long pointerId = buffer.getLong();
-        Position position = readPosition(buffer);
+        int action = getUnsignedByte();
+        long pointerId = getLong();
+        int x = getInt();
+        int y = getInt();
+        Size size = getScreenSize();
         // 16 bits fixed-point
-        int pressureInt = toUnsigned(buffer.getShort());
-        // convert it to a float between 0 and 1 (0x1p16f is 2^16 as float)
-        float pressure = pressureInt == 0xffff ? 1f : (pressureInt / 0x1p16f);
-        int buttons = buffer.getInt();
-        return ControlMessage.createInjectTouchEvent(action, pointerId, position, pressure, buttons);
+        float pressure = toPressure(getUnsignedShort());
+        int buttons = getInt();
+        msg.setInjectTouchEvent(action, pointerId, x, y, size, pressure, buttons);
+        return true;
     }
 
-    private ControlMessage parseInjectScrollEvent() {
-        if (buffer.remaining() < INJECT_SCROLL_EVENT_PAYLOAD_LENGTH) {
-            return null;
+    private boolean parseInjectScrollEvent() {
+        if (remaining() < INJECT_SCROLL_EVENT_PAYLOAD_LENGTH) {
+            return false;
         }
-        Position position = readPosition(buffer);
-        int hScroll = buffer.getInt();
-        int vScroll = buffer.getInt();
-        return ControlMessage.createInjectScrollEvent(position, hScroll, vScroll);
+        int x = getInt();
+        int y = getInt();
+        Size size = getScreenSize();
+        int hScroll = getInt();
+        int vScroll = getInt();
+        msg.setInjectScrollEvent(x, y, size, hScroll, vScroll);
+        return true;
     }
 
-    private ControlMessage parseSetClipboard() {
-        if (buffer.remaining() < SET_CLIPBOARD_FIXED_PAYLOAD_LENGTH) {
-            return null;
+    private boolean parseSetClipboard() {
+        if (remaining() < SET_CLIPBOARD_FIXED_PAYLOAD_LENGTH) {
+            return false;
         }
-        boolean paste = buffer.get() != 0;
+        boolean paste = getByte() != 0;
         String text = parseString();
         if (text == null) {
-            return null;
+            return false;
         }
-        return ControlMessage.createSetClipboard(text, paste);
+        msg.setSetClipboard(text, paste);
+        return true;
     }
 
-    private ControlMessage parseSetScreenPowerMode() {
-        if (buffer.remaining() < SET_SCREEN_POWER_MODE_PAYLOAD_LENGTH) {
-            return null;
+    private boolean parseSetScreenPowerMode() {
+        if (remaining() < SET_SCREEN_POWER_MODE_PAYLOAD_LENGTH) {
+            return false;
+        }
+        int mode = getByte();
+        msg.setSetScreenPowerMode(mode);
+        return true;
+    }
+
+    private boolean parseRequestAck() {
+        if (remaining() < REQUEST_ACK_PAYLOAD_LENGTH) {
+            return false;
+        }
+        int sequence = getInt();
+        long timestamp = getLong();
+        msg.setRequestAck(sequence, timestamp);
+        return true;
+    }
+
+    private boolean parseSetProtocolVersion() {
+        if (remaining() < SET_PROTOCOL_VERSION_PAYLOAD_LENGTH) {
+            return false;
+        }
+        int version = getUnsignedByte();
+        msg.setSetProtocolVersion(version);
+        return true;
+    }
+
+    private boolean parseSetBitRate() {
+        if (remaining() < SET_BIT_RATE_PAYLOAD_LENGTH) {
+            return false;
+        }
+        int bitRate = getInt();
+        msg.setSetBitRate(bitRate);
+        return true;
+    }
+
+    private boolean parseSetMaxFps() {
+        if (remaining() < SET_MAX_FPS_PAYLOAD_LENGTH) {
+            return false;
         }
-        int mode = buffer.get();
-        return ControlMessage.createSetScreenPowerMode(mode);
+        int maxFps = getUnsignedShort();
+        msg.setSetMaxFps(maxFps);
+        return true;
+    }
+
+    private boolean parseSetScreenSize() {
+        if (remaining() < SET_SCREEN_SIZE_PAYLOAD_LENGTH) {
+            return false;
+        }
+        screenSize = getScreenSize();
+        msg.setSetScreenSize(screenSize);
+        return true;
+    }
+
+    /**
+     * Skip a compact touch event.
+     *
+     * @return {@code false} if the event is not fully available
+     */
+    private boolean skipCompactTouch() {
+        if (remaining() < 1) {
+            return false;
+        }
+        int header = getUnsignedByte();
+        if (!skipVarint() || !skipVarint()) {
+            return false;
+        }
+        if ((header & COMPACT_HAS_PRESSURE) != 0) {
+            if (remaining() < 2) {
+                return false;
+            }
+            position += 2;
+        }
+        return (header & COMPACT_HAS_BUTTONS) == 0 || skipVarint();
+    }
+
+    private boolean parseInjectTouchFrame() {
+        if (remaining() < 1) {
+            return false;
+        }
+        int count = getUnsignedByte();
+
+        // The events update the session state, so check that the whole frame is available before parsing it
+        int start = position;
+        for (int i = 0; i < count; ++i) {
+            if (!skipCompactTouch()) {
+                return false;
+            }
+        }
+        position = start;
+
+        for (int i = 0; i < count; ++i) {
+            int header = getUnsignedByte();
+            int index = header & 0xf;
+            int action = (header >> 4) & 0x3;
+            compactX[index] += readSignedVarint();
+            compactY[index] += readSignedVarint();
+            if ((header & COMPACT_HAS_PRESSURE) != 0) {
+                compactPressure[index] = getUnsignedShort();
+            }
+            if ((header & COMPACT_HAS_BUTTONS) != 0) {
+                compactButtons[index] = readVarint();
+            }
+            float pressure = toPressure(compactPressure[index]);
+            touchEvents[i].setInjectTouchEvent(action, COMPACT_POINTER_ID_BASE + index, compactX[index], compactY[index], screenSize, pressure,
+                    compactButtons[index]);
+        }
+        msg.setInjectTouchFrame(touchEvents, count);
+        return true;
+    }
+
+    private boolean skipVarint() {
+        while (remaining() > 0) {
+            if ((getByte() & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // unsigned LEB128, the value must be available
+    private int readVarint() {
+        int value = 0;
+        int shift = 0;
+        int b;
+        do {
+            b = getByte();
+            value |= (b & 0x7f) << shift;
+            shift += 7;
+        } while ((b & 0x80) != 0);
+        return value;
+    }
+
+    // zigzag encoding
+    private int readSignedVarint() {
+        int zigzag = readVarint();
+        return (zigzag >>> 1) ^ -(zigzag & 1);
+    }
+
+    private static float toPressure(int fixedPoint) {
+        // 16 bits fixed-point, convert it to a float between 0 and 1 (0x1p16f is 2^16 as float)
+        return fixedPoint == 0xffff ? 1f : (fixedPoint / 0x1p16f);
+    }
+
+    /**
+     * Read a screen size, reusing the previous instance if it did not change (it is the case for almost all the messages).
+     */
+    private Size getScreenSize() {
+        int width = getUnsignedShort();
+        int height = getUnsignedShort();
+        if (width != lastScreenSize.getWidth() || height != lastScreenSize.getHeight()) {
+            lastScreenSize = new Size(width, height);
+        }
+        return lastScreenSize;
+    }
+
+    // The accessors of the ring buffer, in big-endian. They read at the current position, the data must be available.
+
+    private int remaining() {
+        return tail - position;
+    }
+
+    private byte getByte() {
+        return rawBuffer[position++ & (rawBuffer.length - 1)];
+    }
+
+    private int getUnsignedByte() {
+        return getByte() & 0xff;
     }
 
-    private static Position readPosition(ByteBuffer buffer) {
-        int x = buffer.getInt();
-        int y = buffer.getInt();
-        int screenWidth = toUnsigned(buffer.getShort());
-        int screenHeight = toUnsigned(buffer.getShort());
-        return new Position(x, y, screenWidth, screenHeight);
+    private int getUnsignedShort() {
+        int high = getUnsignedByte();
+        return (high << 8) | getUnsignedByte();
     }
 
-    private static int toUnsigned(short value) {
-        return value & 0xffff;
+    private int getInt() {
+        int high = getUnsignedShort();
+        return (high << 16) | getUnsignedShort();
     }
 
-    private static int toUnsigned(byte value) {
-        return value & 0xff;
+    private long getLong() {
+        long high = getInt();
+        return (high << 32) | (getInt() & 0xffffffffL);
     }
 }
@@ -20,20 +20,33 @@ public class Controller {
 
     private final Device device;
     private final DesktopConnection connection;
+    private final ScreenEncoder screenEncoder;
     private final DeviceMessageSender sender;
+    // the touch frames are split into touch events by the queue
+    private final ControlMessageQueue queue;
 
     private final KeyCharacterMap charMap = KeyCharacterMap.load(KeyCharacterMap.VIRTUAL_KEYBOARD);
 
     private long lastTouchDown;
-    private final PointersState pointersState = new PointersState();
+    private final PointersState pointersState;
     private final MotionEvent.PointerProperties[] pointerProperties = new MotionEvent.PointerProperties[PointersState.MAX_POINTERS];
     private final MotionEvent.PointerCoords[] pointerCoords = new MotionEvent.PointerCoords[PointersState.MAX_POINTERS];
 
     private boolean keepPowerModeOff;
 
-    public Controller(Device device, DesktopConnection connection) {
+    // the time spent to handle the last message (except acknowledgement requests), in microseconds
+    private int lastHandlingTime;
+
+    /**
+     * @param touchBatchWindow the window to batch the consecutive touch moves into a single event, in ms (0 to disable)
+     */
+    public Controller(Device device, DesktopConnection connection, ScreenEncoder screenEncoder, int touchBatchWindow) {
         this.device = device;
         this.connection = connection;
+        this.screenEncoder = screenEncoder;
+        // if the moves are batched, the intermediate positions are injected as history, so they must not be coalesced by the queue
+        queue = new ControlMessageQueue(ControlMessageQueue.DEFAULT_CAPACITY, touchBatchWindow == 0);
+        pointersState = new PointersState(touchBatchWindow);
         initPointers();
         sender = new DeviceMessageSender(connection);
     }
@@ -52,7 +65,22 @@ public class Controller {
         }
     }
 
-    public void control() throws IOException {
+    /**
+     * Read the control messages from the socket, and push them to the queue of the injector.
+     * <p>
+     * The socket is read on its own thread, so that a slow injection does not stall the client.
+     */
+    public void control() throws IOException, InterruptedException {
+        while (true) {
+            ControlMessage msg = connection.receiveControlMessage();
+            queue.push(msg);
+        }
+    }
+
+    /**
+     * Inject the control messages from the queue.
+     */
+    public void inject() throws InterruptedException {
         // on start, power on the device
         if (!Device.isScreenOn()) {
             device.injectKeycode(KeyEvent.KEYCODE_POWER);
@@ -67,8 +95,21 @@ public class Controller {
             SystemClock.sleep(500);
         }
 
+        ControlMessage msg = new ControlMessage();
         while (true) {
-            handleEvent();
+            int queueDepth;
+            if (pointersState.hasBatch()) {
+                long timeout = pointersState.getBatchDeadline() - SystemClock.uptimeMillis();
+                queueDepth = timeout > 0 ? queue.take(msg, timeout) : -1;
+                if (queueDepth == -1) {
+                    // the batch window is over
+                    injectBatch();
+                    continue;
+                }
+            } else {
+                queueDepth = queue.take(msg);
+            }
+            handleEvent(msg, queueDepth);
         }
     }
 
@@ -76,8 +117,16 @@ public class Controller {
         return sender;
     }
 
-    private void handleEvent() throws IOException {
-        ControlMessage msg = connection.receiveControlMessage();
+    public ControlMessageQueue getQueue() {
+        return queue;
+    }
+
+    private void handleEvent(ControlMessage msg, int queueDepth) {
+        long start = System.nanoTime();
+        if (msg.getType() != ControlMessage.TYPE_INJECT_TOUCH_EVENT && pointersState.hasBatch()) {
+            // keep the order of the events
+            injectBatch();
+        }
         switch (msg.getType()) {
             case ControlMessage.TYPE_INJECT_KEYCODE:
                 if (device.supportsInputEvents()) {
@@ -132,9 +181,27 @@ public class Controller {
             case ControlMessage.TYPE_ROTATE_DEVICE:
                 Device.rotateDevice();
                 break;
+            case ControlMessage.TYPE_SET_PROTOCOL_VERSION:
+                int version = Math.min(msg.getVersion(), ControlMessageReader.PROTOCOL_VERSION);
+                sender.pushProtocolVersion(version);
+                break;
+            case ControlMessage.TYPE_SET_BIT_RATE:
+                screenEncoder.setBitRate(msg.getBitRate());
+                break;
+            case ControlMessage.TYPE_SET_MAX_FPS:
+                screenEncoder.setMaxFps(msg.getMaxFps());
+                break;
+            case ControlMessage.TYPE_REQUEST_KEYFRAME:
+                screenEncoder.requestKeyFrame();
+                break;
+            case ControlMessage.TYPE_REQUEST_ACK:
+                // the messages are handled in order, so the previous one has been injected
+                sender.pushAck(msg.getSequence(), msg.getTimestamp(), lastHandlingTime, queueDepth);
+                return;
             default:
                 // do nothing
         }
+        lastHandlingTime = (int) Math.min((System.nanoTime() - start) / 1000, Integer.MAX_VALUE);
     }
 
     private boolean injectKeycode(int action, int keycode, int repeat, int metaState) {
@@ -180,6 +247,11 @@ public class Controller {
             return false;
         }
 
+        boolean batch = pointersState.canBatch(action, pointerId, buttons);
+        if (!batch && pointersState.hasBatch()) {
+            injectBatch();
+        }
+
         int pointerIndex = pointersState.getPointerIndex(pointerId);
         if (pointerIndex == -1) {
             Ln.w("Too many pointers for touch event");
@@ -190,6 +262,11 @@ public class Controller {
         pointer.setPressure(pressure);
         pointer.setUp(action == MotionEvent.ACTION_UP);
 
+        if (batch) {
+            boolean full = pointersState.addBatchSample(now, buttons);
+            return !full || injectBatch();
+        }
+
         int pointerCount = pointersState.update(pointerProperties, pointerCoords);
 
         if (pointerCount == 1) {
@@ -205,16 +282,37 @@ public class Controller {
             }
         }
 
-        // Right-click and middle-click only work if the source is a mouse
-        boolean nonPrimaryButtonPressed = (buttons & ~MotionEvent.BUTTON_PRIMARY) != 0;
-        int source = nonPrimaryButtonPressed ? InputDevice.SOURCE_MOUSE : InputDevice.SOURCE_TOUCHSCREEN;
+        MotionEvent event = MotionEvent
+                .obtain(lastTouchDown, now, action, pointerCount, pointerProperties, pointerCoords, 0, buttons, 1f, 1f, DEVICE_ID_VIRTUAL, 0,
+                        getTouchSource(buttons), 0);
+        return device.injectEvent(event);
+    }
 
+    /**
+     * Inject the pending batch of moves as a single move event, the previous samples being its history.
+     */
+    private boolean injectBatch() {
+        int sampleCount = pointersState.getBatchSampleCount();
+        int buttons = pointersState.getBatchButtons();
+
+        int pointerCount = pointersState.updateFromBatch(0, pointerProperties, pointerCoords);
         MotionEvent event = MotionEvent
-                .obtain(lastTouchDown, now, action, pointerCount, pointerProperties, pointerCoords, 0, buttons, 1f, 1f, DEVICE_ID_VIRTUAL, 0, source,
-                        0);
+                .obtain(lastTouchDown, pointersState.getBatchSampleTime(0), MotionEvent.ACTION_MOVE, pointerCount, pointerProperties, pointerCoords,
+                        0, buttons, 1f, 1f, DEVICE_ID_VIRTUAL, 0, getTouchSource(buttons), 0);
+        for (int i = 1; i < sampleCount; ++i) {
+            pointersState.updateFromBatch(i, pointerProperties, pointerCoords);
+            event.addBatch(pointersState.getBatchSampleTime(i), pointerCoords, 0);
+        }
+        pointersState.clearBatch();
         return device.injectEvent(event);
     }
 
+    private static int getTouchSource(int buttons) {
+        // Right-click and middle-click only work if the source is a mouse
+        boolean nonPrimaryButtonPressed = (buttons & ~MotionEvent.BUTTON_PRIMARY) != 0;
+        return nonPrimaryButtonPressed ? InputDevice.SOURCE_MOUSE : InputDevice.SOURCE_TOUCHSCREEN;
+    }
+
     private boolean injectScroll(Position position, int hScroll, int vScroll) {
         long now = SystemClock.uptimeMillis();
         Point point = device.getPhysicalPoint(position);
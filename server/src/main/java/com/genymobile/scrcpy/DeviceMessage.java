@@ -3,9 +3,24 @@ package com.genymobile.scrcpy;
 public final class DeviceMessage {
 
     public static final int TYPE_CLIPBOARD = 0;
+    public static final int TYPE_ACK = 1;
+    public static final int TYPE_PROTOCOL_VERSION = 2;
+    public static final int TYPE_ENCODER_STATS = 3;
 
     private int type;
     private String text;
+    private int sequence;
+    private long timestamp;
+    private int injectionTime;
+    private int queueDepth;
+    private int version;
+    private int interval;
+    private int frames;
+    private int bytes;
+    private int writeBlockedTime;
+    private int rotationRestarts;
+    private int dequeueLatencyAvg;
+    private int dequeueLatencyMax;
 
     private DeviceMessage() {
     }
@@ -17,6 +32,54 @@ public final class DeviceMessage {
         return event;
     }
 
+    /**
+     * @param timestamp the timestamp received in the acknowledgement request
+     * @param injectionTime the time spent to inject the acknowledged event, in microseconds
+     * @param queueDepth the number of control messages waiting to be injected
+     */
+    public static DeviceMessage createAck(int sequence, long timestamp, int injectionTime, int queueDepth) {
+        DeviceMessage event = new DeviceMessage();
+        event.type = TYPE_ACK;
+        event.sequence = sequence;
+        event.timestamp = timestamp;
+        event.injectionTime = injectionTime;
+        event.queueDepth = queueDepth;
+        return event;
+    }
+
+    /**
+     * @param version the control protocol version accepted
+     */
+    public static DeviceMessage createProtocolVersion(int version) {
+        DeviceMessage event = new DeviceMessage();
+        event.type = TYPE_PROTOCOL_VERSION;
+        event.version = version;
+        return event;
+    }
+
+    /**
+     * @param interval the duration covered by the stats, in milliseconds
+     * @param frames the number of frames output by the encoder
+     * @param bytes the number of bytes written to the video socket
+     * @param writeBlockedTime the time blocked in the video socket writes, in microseconds
+     * @param rotationRestarts the number of encoder restarts on rotation
+     * @param dequeueLatencyAvg the average time between the capture of a frame and its output by the encoder, in microseconds
+     * @param dequeueLatencyMax the maximum time between the capture of a frame and its output by the encoder, in microseconds
+     */
+    public static DeviceMessage createEncoderStats(int interval, int frames, int bytes, int writeBlockedTime, int rotationRestarts,
+            int dequeueLatencyAvg, int dequeueLatencyMax) {
+        DeviceMessage event = new DeviceMessage();
+        event.type = TYPE_ENCODER_STATS;
+        event.interval = interval;
+        event.frames = frames;
+        event.bytes = bytes;
+        event.writeBlockedTime = writeBlockedTime;
+        event.rotationRestarts = rotationRestarts;
+        event.dequeueLatencyAvg = dequeueLatencyAvg;
+        event.dequeueLatencyMax = dequeueLatencyMax;
+        return event;
+    }
+
     public int getType() {
         return type;
     }
@@ -24,4 +87,52 @@ public final class DeviceMessage {
     public String getText() {
         return text;
     }
+
+    public int getSequence() {
+        return sequence;
+    }
+
+    public long getTimestamp() {
+        return timestamp;
+    }
+
+    public int getInjectionTime() {
+        return injectionTime;
+    }
+
+    public int getQueueDepth() {
+        return queueDepth;
+    }
+
+    public int getVersion() {
+        return version;
+    }
+
+    public int getInterval() {
+        return interval;
+    }
+
+    public int getFrames() {
+        return frames;
+    }
+
+    public int getBytes() {
+        return bytes;
+    }
+
+    public int getWriteBlockedTime() {
+        return writeBlockedTime;
+    }
+
+    public int getRotationRestarts() {
+        return rotationRestarts;
+    }
+
+    public int getDequeueLatencyAvg() {
+        return dequeueLatencyAvg;
+    }
+
+    public int getDequeueLatencyMax() {
+        return dequeueLatencyMax;
+    }
 }
@@ -1,12 +1,21 @@
 package com.genymobile.scrcpy;
 
 import java.io.IOException;
+import java.util.ArrayDeque;
+import java.util.Deque;
 
 public final class DeviceMessageSender {
 
+    private static final long ENCODER_STATS_INTERVAL = 1000; // ms
+
     private final DesktopConnection connection;
 
     private String clipboardText;
+    // small messages, sent in order before the clipboard
+    private final Deque<DeviceMessage> messages = new ArrayDeque<>();
+
+    private EncoderStats encoderStats;
+    private long nextEncoderStatsTime; // in ns
 
     public DeviceMessageSender(DesktopConnection connection) {
         this.connection = connection;
@@ -17,17 +26,56 @@ public final class DeviceMessageSender {
         notify();
     }
 
+    public synchronized void pushAck(int sequence, long timestamp, int injectionTime, int queueDepth) {
+        messages.addLast(DeviceMessage.createAck(sequence, timestamp, injectionTime, queueDepth));
+        notify();
+    }
+
+    public synchronized void pushProtocolVersion(int version) {
+        messages.addLast(DeviceMessage.createProtocolVersion(version));
+        notify();
+    }
+
+    /**
+     * Send the encoder stats periodically.
+     */
+    public synchronized void setEncoderStats(EncoderStats encoderStats) {
+        this.encoderStats = encoderStats;
+        nextEncoderStatsTime = System.nanoTime() + ENCODER_STATS_INTERVAL * 1000000;
+        notify();
+    }
+
+    private boolean isEncoderStatsDue() {
+        return encoderStats != null && System.nanoTime() - nextEncoderStatsTime >= 0;
+    }
+
+    private void waitForMessage() throws InterruptedException {
+        if (encoderStats == null) {
+            wait();
+        } else {
+            long remaining = (nextEncoderStatsTime - System.nanoTime()) / 1000000;
+            wait(Math.max(remaining, 1));
+        }
+    }
+
     public void loop() throws IOException, InterruptedException {
         while (true) {
-            String text;
+            DeviceMessage event;
             synchronized (this) {
-                while (clipboardText == null) {
-                    wait();
+                while (clipboardText == null && messages.isEmpty() && !isEncoderStatsDue()) {
+                    waitForMessage();
+                }
+                if (!messages.isEmpty()) {
+                    // the acknowledgements are small and time-sensitive, send them first
+                    event = messages.removeFirst();
+                } else if (isEncoderStatsDue()) {
+                    event = encoderStats.takeMessage();
+                    nextEncoderStatsTime = System.nanoTime() + ENCODER_STATS_INTERVAL * 1000000;
+                } else {
+                    event = DeviceMessage.createClipboard(clipboardText);
+                    clipboardText = null;
                 }
-                text = clipboardText;
-                clipboardText = null;
             }
-            DeviceMessage event = DeviceMessage.createClipboard(text);
             connection.sendDeviceMessage(event);
         }
     }
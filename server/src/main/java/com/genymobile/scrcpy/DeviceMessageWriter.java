@@ -15,7 +15,7 @@ public class DeviceMessageWriter {
 
     public void writeTo(DeviceMessage msg, OutputStream output) throws IOException {
         buffer.clear();
-        buffer.put((byte) DeviceMessage.TYPE_CLIPBOARD);
+        buffer.put((byte) msg.getType());
         switch (msg.getType()) {
             case DeviceMessage.TYPE_CLIPBOARD:
                 String text = msg.getText();
@@ -25,6 +25,27 @@ public class DeviceMessageWriter {
                 buffer.put(raw, 0, len);
                 output.write(rawBuffer, 0, buffer.position());
                 break;
+            case DeviceMessage.TYPE_ACK:
+                buffer.putInt(msg.getSequence());
+                buffer.putLong(msg.getTimestamp());
+                buffer.putInt(msg.getInjectionTime());
+                buffer.putShort((short) Math.min(msg.getQueueDepth(), 0xffff));
+                output.write(rawBuffer, 0, buffer.position());
+                break;
+            case DeviceMessage.TYPE_PROTOCOL_VERSION:
+                buffer.put((byte) msg.getVersion());
+                output.write(rawBuffer, 0, buffer.position());
+                break;
+            case DeviceMessage.TYPE_ENCODER_STATS:
+                buffer.putInt(msg.getInterval());
+                buffer.putInt(msg.getFrames());
+                buffer.putInt(msg.getBytes());
+                buffer.putInt(msg.getWriteBlockedTime());
+                buffer.putShort((short) Math.min(msg.getRotationRestarts(), 0xffff));
+                buffer.putInt(msg.getDequeueLatencyAvg());
+                buffer.putInt(msg.getDequeueLatencyMax());
+                output.write(rawBuffer, 0, buffer.position());
+                break;
             default:
                 Ln.w("Unknown device message: " + msg.getType());
                 break;
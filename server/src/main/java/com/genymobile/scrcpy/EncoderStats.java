@@ -0,0 +1,57 @@
+package com.genymobile.scrcpy;
+
+/**
+ * Counters updated by the screen encoder, periodically sent to the client by the {@link DeviceMessageSender}.
+ */
+public final class EncoderStats {
+
+    private long intervalStart = System.nanoTime();
+    private int frames;
+    private long bytes;
+    private long writeBlockedTime; // in ns
+    private int rotationRestarts;
+    private long dequeueLatencySum; // in us
+    private long dequeueLatencyMax; // in us
+
+    /**
+     * @param size the size of the packet written to the socket (including the frame meta header)
+     * @param writeTime the time blocked in the socket writes, in nanoseconds
+     * @param dequeueLatency the time between the capture of the frame and its output by the encoder, in microseconds (-1 for a config packet)
+     */
+    public synchronized void addPacket(int size, long writeTime, long dequeueLatency) {
+        bytes += size;
+        writeBlockedTime += writeTime;
+        if (dequeueLatency >= 0) {
+            ++frames;
+            dequeueLatencySum += dequeueLatency;
+            if (dequeueLatency > dequeueLatencyMax) {
+                dequeueLatencyMax = dequeueLatency;
+            }
+        }
+    }
+
+    public synchronized void addRotationRestart() {
+        ++rotationRestarts;
+    }
+
+    /**
+     * Create a message for the stats since the previous call, and reset the counters.
+     */
+    public synchronized DeviceMessage takeMessage() {
+        long now = System.nanoTime();
+        int interval = (int) ((now - intervalStart) / 1000000);
+        int dequeueLatencyAvg = frames != 0 ? (int) (dequeueLatencySum / frames) : 0;
+        DeviceMessage msg = DeviceMessage.createEncoderStats(interval, frames, (int) Math.min(bytes, Integer.MAX_VALUE),
+                (int) Math.min(writeBlockedTime / 1000, Integer.MAX_VALUE), rotationRestarts, dequeueLatencyAvg,
+                (int) Math.min(dequeueLatencyMax, Integer.MAX_VALUE));
+
+        intervalStart = now;
+        frames = 0;
+        bytes = 0;
+        writeBlockedTime = 0;
+        rotationRestarts = 0;
+        dequeueLatencySum = 0;
+        dequeueLatencyMax = 0;
+        return msg;
+    }
+}
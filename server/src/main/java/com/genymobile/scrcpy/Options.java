@@ -17,6 +17,7 @@ public class Options {
     private boolean stayAwake;
     private String codecOptions;
     private String encoderName;
+    private int touchBatchWindow; // in ms, 0 to disable
 
     public Ln.Level getLogLevel() {
         return logLevel;
@@ -129,4 +130,12 @@ public class Options {
     public void setEncoderName(String encoderName) {
         this.encoderName = encoderName;
     }
+
+    public int getTouchBatchWindow() {
+        return touchBatchWindow;
+    }
+
+    public void setTouchBatchWindow(int touchBatchWindow) {
+        this.touchBatchWindow = touchBatchWindow;
+    }
 }
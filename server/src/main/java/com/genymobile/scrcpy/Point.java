@@ -3,14 +3,22 @@ package com.genymobile.scrcpy;
 import java.util.Objects;
 
 public class Point {
-    private final int x;
-    private final int y;
+    private int x;
+    private int y;
 
     public Point(int x, int y) {
         this.x = x;
         this.y = y;
     }
 
+    /**
+     * Reuse the point (only for a point not shared, see {@link Position#set(int, int, Size)}).
+     */
+    void set(int x, int y) {
+        this.x = x;
+        this.y = y;
+    }
+
     public int getX() {
         return x;
     }
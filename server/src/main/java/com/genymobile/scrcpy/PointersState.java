@@ -9,8 +9,34 @@ public class PointersState {
 
     public static final int MAX_POINTERS = 10;
 
+    /**
+     * The maximum number of samples (the current one and the history) of a batched move event.
+     */
+    public static final int MAX_BATCH_SAMPLES = 32;
+
     private final List<Pointer> pointers = new ArrayList<>();
 
+    // Consecutive moves are batched into a single move event: the state of all the pointers is recorded on each move, the last sample is the
+    // current one, the previous ones are its history. The pointers do not change during a batch (only the moves are batched).
+    private final int batchWindow; // in ms, 0 to disable batching
+    private int batchSampleCount;
+    private int batchButtons;
+    private final long[] batchTimes = new long[MAX_BATCH_SAMPLES];
+    private final float[][] batchX = new float[MAX_BATCH_SAMPLES][MAX_POINTERS];
+    private final float[][] batchY = new float[MAX_BATCH_SAMPLES][MAX_POINTERS];
+    private final float[][] batchPressures = new float[MAX_BATCH_SAMPLES][MAX_POINTERS];
+
+    public PointersState() {
+        this(0);
+    }
+
+    /**
+     * @param batchWindow the maximum duration between the first and the last sample of a batched move event, in ms (0 to disable batching)
+     */
+    public PointersState(int batchWindow) {
+        this.batchWindow = batchWindow;
+    }
+
     private int indexOf(long id) {
         for (int i = 0; i < pointers.size(); ++i) {
             Pointer pointer = pointers.get(i);
@@ -89,6 +115,96 @@ public class PointersState {
         return count;
     }
 
+    /**
+     * Tell whether a touch event can be added to the pending batch (or start a new one).
+     * <p>
+     * Only the moves of existing pointers with the same buttons are batched. If it returns {@code false}, the pending batch (if any) must be
+     * injected before the event.
+     */
+    public boolean canBatch(int action, long id, int buttons) {
+        if (batchWindow == 0 || action != MotionEvent.ACTION_MOVE || indexOf(id) == -1) {
+            return false;
+        }
+        return batchSampleCount == 0 || buttons == batchButtons;
+    }
+
+    /**
+     * Record the current state of all the pointers as a new sample of the batch.
+     *
+     * @param time the event time, in ms
+     * @return {@code true} if the batch must be injected immediately (it is full)
+     */
+    public boolean addBatchSample(long time, int buttons) {
+        if (batchSampleCount == MAX_BATCH_SAMPLES) {
+            throw new AssertionError("A full batch must be injected immediately");
+        }
+        int sample = batchSampleCount++;
+        batchTimes[sample] = time;
+        batchButtons = buttons;
+        for (int i = 0; i < pointers.size(); ++i) {
+            Pointer pointer = pointers.get(i);
+            Point point = pointer.getPoint();
+            batchX[sample][i] = point.getX();
+            batchY[sample][i] = point.getY();
+            batchPressures[sample][i] = pointer.getPressure();
+        }
+        return batchSampleCount == MAX_BATCH_SAMPLES;
+    }
+
+    public boolean hasBatch() {
+        return batchSampleCount > 0;
+    }
+
+    /**
+     * @return the time (in ms) when the pending batch must be injected, even if no other move is received
+     */
+    public long getBatchDeadline() {
+        return batchTimes[0] + batchWindow;
+    }
+
+    public int getBatchSampleCount() {
+        return batchSampleCount;
+    }
+
+    public long getBatchSampleTime(int sample) {
+        return batchTimes[sample];
+    }
+
+    public int getBatchButtons() {
+        return batchButtons;
+    }
+
+    float getBatchX(int sample, int pointerIndex) {
+        return batchX[sample][pointerIndex];
+    }
+
+    float getBatchY(int sample, int pointerIndex) {
+        return batchY[sample][pointerIndex];
+    }
+
+    /**
+     * Initialize the motion event parameters from a sample of the pending batch.
+     *
+     * @param sample the sample index
+     * @param props  the pointer properties
+     * @param coords the pointer coordinates
+     * @return The number of items initialized (the number of pointers).
+     */
+    public int updateFromBatch(int sample, MotionEvent.PointerProperties[] props, MotionEvent.PointerCoords[] coords) {
+        int count = pointers.size();
+        for (int i = 0; i < count; ++i) {
+            props[i].id = pointers.get(i).getLocalId();
+            coords[i].x = batchX[sample][i];
+            coords[i].y = batchY[sample][i];
+            coords[i].pressure = batchPressures[sample][i];
+        }
+        return count;
+    }
+
+    public void clearBatch() {
+        batchSampleCount = 0;
+    }
+
     /**
      * Remove all pointers which are UP.
      */
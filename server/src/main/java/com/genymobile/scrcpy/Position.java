@@ -15,6 +15,16 @@ public class Position {
         this(new Point(x, y), new Size(screenWidth, screenHeight));
     }
 
+    /**
+     * Reuse the position, to avoid allocations for each control message.
+     * <p>
+     * The point is modified in place, so it must be owned by this position.
+     */
+    void set(int x, int y, Size screenSize) {
+        point.set(x, y);
+        this.screenSize = screenSize;
+    }
+
     public Point getPoint() {
         return point;
     }
@@ -7,6 +7,7 @@ import android.media.MediaCodec;
 import android.media.MediaCodecInfo;
 import android.media.MediaCodecList;
 import android.media.MediaFormat;
+import android.os.Bundle;
 import android.os.IBinder;
 import android.view.Surface;
 
@@ -22,12 +23,17 @@ public class ScreenEncoder implements Device.RotationListener {
 
     private static final int DEFAULT_I_FRAME_INTERVAL = 10; // seconds
     private static final int REPEAT_FRAME_DELAY_US = 100_000; // repeat after 100ms
+    private static final long DEQUEUE_TIMEOUT_US = 100_000;
+    // restart the encoder if the requested keyframe is not produced meanwhile
+    private static final long KEY_FRAME_REQUEST_TIMEOUT_NS = 300_000_000;
     private static final String KEY_MAX_FPS_TO_ENCODER = "max-fps-to-encoder";
 
     private static final int NO_PTS = -1;
 
     private final AtomicBoolean rotationChanged = new AtomicBoolean();
+    private final AtomicBoolean maxFpsChanged = new AtomicBoolean();
     private final ByteBuffer headerBuffer = ByteBuffer.allocate(12);
+    private final EncoderStats stats = new EncoderStats();
 
     private String encoderName;
     private List<CodecOption> codecOptions;
@@ -36,6 +42,11 @@ public class ScreenEncoder implements Device.RotationListener {
     private boolean sendFrameMeta;
     private long ptsOrigin;
 
+    // the running codec, to change its parameters from another thread (protected by this)
+    private MediaCodec currentCodec;
+    private boolean keyFrameRequested; // protected by this
+    private long keyFrameRequestTime; // in ns
+
     public ScreenEncoder(boolean sendFrameMeta, int bitRate, int maxFps, List<CodecOption> codecOptions, String encoderName) {
         this.sendFrameMeta = sendFrameMeta;
         this.bitRate = bitRate;
@@ -53,6 +64,118 @@ public class ScreenEncoder implements Device.RotationListener {
         return rotationChanged.getAndSet(false);
     }
 
+    /**
+     * Change the bit rate of the running encoder (and of the next ones, after a restart).
+     *
+     * @param bitRate the bit rate, in bits/s
+     */
+    public synchronized void setBitRate(int bitRate) {
+        this.bitRate = bitRate;
+        if (currentCodec != null) {
+            applyBitRate();
+        }
+        Ln.d("Bit rate: " + bitRate);
+    }
+
+    private synchronized int getBitRate() {
+        return bitRate;
+    }
+
+    /**
+     * Request the running encoder to produce a keyframe as soon as possible (a new encoder starts with a keyframe anyway).
+     * <p>
+     * The encoder only produces a frame when the screen content changes (or repeats the last one). If the keyframe is not produced before
+     * {@link #KEY_FRAME_REQUEST_TIMEOUT_NS}, the encoder is restarted.
+     */
+    public synchronized void requestKeyFrame() {
+        if (currentCodec == null) {
+            return;
+        }
+        Bundle params = new Bundle();
+        params.putInt(MediaCodec.PARAMETER_KEY_REQUEST_SYNC_FRAME, 0);
+        try {
+            currentCodec.setParameters(params);
+            Ln.d("Keyframe requested");
+        } catch (IllegalStateException e) {
+            // the codec is being stopped, the next one will start with a keyframe
+            Ln.w("Could not request a keyframe: " + e.getMessage());
+            return;
+        }
+        if (!keyFrameRequested) {
+            keyFrameRequested = true;
+            keyFrameRequestTime = System.nanoTime();
+        }
+    }
+
+    private synchronized void onKeyFrameWritten() {
+        keyFrameRequested = false;
+    }
+
+    private synchronized boolean isKeyFrameRequestExpired() {
+        return keyFrameRequested && System.nanoTime() - keyFrameRequestTime >= KEY_FRAME_REQUEST_TIMEOUT_NS;
+    }
+
+    /**
+     * Change the max frame rate, by restarting the encoder (it is only applied on configuration).
+     *
+     * @param maxFps the max frame rate (0 for no limit)
+     */
+    public void setMaxFps(int maxFps) {
+        synchronized (this) {
+            if (maxFps == this.maxFps) {
+                return;
+            }
+            this.maxFps = maxFps;
+        }
+        maxFpsChanged.set(true);
+        Ln.d("Max fps: " + maxFps);
+    }
+
+    private synchronized int getMaxFps() {
+        return maxFps;
+    }
+
+    /**
+     * @return {@code true} if the encoder must be restarted (on rotation or on max fps change)
+     */
+    private boolean consumeRestartRequest() {
+        boolean rotation = consumeRotationChange();
+        if (rotation) {
+            stats.addRotationRestart();
+        }
+        boolean fps = maxFpsChanged.getAndSet(false);
+        return rotation || fps;
+    }
+
+    /**
+     * @param codec the started codec, or {@code null} before it is stopped
+     * @param configuredBitRate the bit rate the codec has been configured with
+     */
+    private synchronized void setCurrentCodec(MediaCodec codec, int configuredBitRate) {
+        currentCodec = codec;
+        // a new codec starts with a keyframe
+        keyFrameRequested = false;
+        if (codec != null && bitRate != configuredBitRate) {
+            // changed meanwhile
+            applyBitRate();
+        }
+    }
+
+    private void applyBitRate() {
+        Bundle params = new Bundle();
+        params.putInt(MediaCodec.PARAMETER_KEY_VIDEO_BITRATE, bitRate);
+        try {
+            currentCodec.setParameters(params);
+        } catch (IllegalStateException e) {
+            // the codec is being stopped, the next one will use the new bit rate
+            Ln.w("Could not change the bit rate: " + e.getMessage());
+        }
+    }
+
+    public EncoderStats getStats() {
+        return stats;
+    }
+
     public void streamScreen(Device device, FileDescriptor fd) throws IOException {
         Workarounds.prepareMainLooper();
 
@@ -69,7 +192,6 @@ public class ScreenEncoder implements Device.RotationListener {
     }
 
     private void internalStreamScreen(Device device, FileDescriptor fd) throws IOException {
-        MediaFormat format = createFormat(bitRate, maxFps, codecOptions);
         device.setRotationListener(this);
         boolean alive;
         try {
@@ -85,16 +207,21 @@ public class ScreenEncoder implements Device.RotationListener {
                 int videoRotation = screenInfo.getVideoRotation();
                 int layerStack = device.getLayerStack();
 
+                // the bit rate and the max fps may have been changed by the client
+                int configuredBitRate = getBitRate();
+                MediaFormat format = createFormat(configuredBitRate, getMaxFps(), codecOptions);
                 setSize(format, videoRect.width(), videoRect.height());
                 configure(codec, format);
                 Surface surface = codec.createInputSurface();
                 setDisplaySurface(display, surface, videoRotation, contentRect, unlockedVideoRect, layerStack);
                 codec.start();
+                setCurrentCodec(codec, configuredBitRate);
                 try {
                     alive = encode(codec, fd);
                     // do not call stop() on exception, it would trigger an IllegalStateException
                     codec.stop();
                 } finally {
+                    setCurrentCodec(null, 0);
                     destroyDisplay(display);
                     codec.release();
                     surface.release();
@@ -109,22 +236,36 @@ public class ScreenEncoder implements Device.RotationListener {
         boolean eof = false;
         MediaCodec.BufferInfo bufferInfo = new MediaCodec.BufferInfo();
 
-        while (!consumeRotationChange() && !eof) {
-            int outputBufferId = codec.dequeueOutputBuffer(bufferInfo, -1);
+        while (!consumeRestartRequest() && !eof) {
+            // do not block indefinitely, so that a restart request is handled even if the screen content does not change
+            int outputBufferId = codec.dequeueOutputBuffer(bufferInfo, DEQUEUE_TIMEOUT_US);
             eof = (bufferInfo.flags & MediaCodec.BUFFER_FLAG_END_OF_STREAM) != 0;
             try {
-                if (consumeRotationChange()) {
-                    // must restart encoding with new size
+                if (consumeRestartRequest()) {
+                    // must restart encoding with new size or max fps
                     break;
                 }
                 if (outputBufferId >= 0) {
                     ByteBuffer codecBuffer = codec.getOutputBuffer(outputBufferId);
+                    int size = codecBuffer.remaining();
+                    long dequeueLatency = getDequeueLatency(bufferInfo);
 
+                    long writeStart = System.nanoTime();
                     if (sendFrameMeta) {
-                        writeFrameMeta(fd, bufferInfo, codecBuffer.remaining());
+                        writeFrameMeta(fd, bufferInfo, size);
+                        size += headerBuffer.limit();
                     }
 
                     IO.writeFully(fd, codecBuffer);
+                    stats.addPacket(size, System.nanoTime() - writeStart, dequeueLatency);
+
+                    if ((bufferInfo.flags & MediaCodec.BUFFER_FLAG_KEY_FRAME) != 0) {
+                        onKeyFrameWritten();
+                    }
+                } else if (isKeyFrameRequestExpired()) {
+                    // no frame has been produced (the screen content does not change), a new encoder starts with a keyframe
+                    Ln.d("Keyframe request timed out, restarting the encoder");
+                    break;
                 }
             } finally {
                 if (outputBufferId >= 0) {
@@ -136,6 +277,20 @@ public class ScreenEncoder implements Device.RotationListener {
         return !eof;
     }
 
+    /**
+     * Return the time between the capture of the frame and its output by the encoder, in microseconds.
+     * <p>
+     * The timestamps of the frames captured from the input surface are based on the monotonic clock, like {@link System#nanoTime()}.
+     *
+     * @return the latency, or -1 for a config packet
+     */
+    private static long getDequeueLatency(MediaCodec.BufferInfo bufferInfo) {
+        if ((bufferInfo.flags & MediaCodec.BUFFER_FLAG_CODEC_CONFIG) != 0) {
+            return -1;
+        }
+        return Math.max(System.nanoTime() / 1000 - bufferInfo.presentationTimeUs, 0);
+    }
+
     private void writeFrameMeta(FileDescriptor fd, MediaCodec.BufferInfo bufferInfo, int packetSize) throws IOException {
         headerBuffer.clear();
 
@@ -59,12 +59,15 @@ public final class Server {
                     options.getEncoderName());
 
             Thread controllerThread = null;
+            Thread injectorThread = null;
             Thread deviceMessageSenderThread = null;
             if (options.getControl()) {
-                final Controller controller = new Controller(device, connection);
+                final Controller controller = new Controller(device, connection, screenEncoder, options.getTouchBatchWindow());
 
                 // asynchronous
                 controllerThread = startController(controller);
+                injectorThread = startInjector(controller);
+                controller.getSender().setEncoderStats(screenEncoder.getStats());
                 deviceMessageSenderThread = startDeviceMessageSender(controller.getSender());
 
                 device.setClipboardListener(new Device.ClipboardListener() {
@@ -85,6 +88,9 @@ public final class Server {
                 if (controllerThread != null) {
                     controllerThread.interrupt();
                 }
+                if (injectorThread != null) {
+                    injectorThread.interrupt();
+                }
                 if (deviceMessageSenderThread != null) {
                     deviceMessageSenderThread.interrupt();
                 }
@@ -98,7 +104,7 @@ public final class Server {
             public void run() {
                 try {
                     controller.control();
-                } catch (IOException e) {
+                } catch (IOException | InterruptedException e) {
                     // this is expected on close
                     Ln.d("Controller stopped");
                 }
@@ -108,6 +114,23 @@ public final class Server {
         return thread;
     }
 
+    private static Thread startInjector(final Controller controller) {
+        Thread thread = new Thread(new Runnable() {
+            @Override
+            public void run() {
+                try {
+                    controller.inject();
+                } catch (InterruptedException e) {
+                    // this is expected on close
+                    ControlMessageQueue queue = controller.getQueue();
+                    Ln.d("Injector stopped (max queue depth: " + queue.getMaxSize() + ", coalesced moves: " + queue.getCoalescedCount() + ")");
+                }
+            }
+        });
+        thread.start();
+        return thread;
+    }
+
     private static Thread startDeviceMessageSender(final DeviceMessageSender sender) {
         Thread thread = new Thread(new Runnable() {
             @Override
@@ -135,7 +158,7 @@ public final class Server {
                     "The server version (" + BuildConfig.VERSION_NAME + ") does not match the client " + "(" + clientVersion + ")");
         }
 
-        final int expectedParameters = 15;
+        final int expectedParameters = 16;
         if (args.length != expectedParameters) {
             throw new IllegalArgumentException("Expecting " + expectedParameters + " parameters");
         }
@@ -185,6 +208,9 @@ public final class Server {
         String encoderName = "-".equals(args[14]) ? null : args[14];
         options.setEncoderName(encoderName);
 
+        int touchBatchWindow = Integer.parseInt(args[15]);
+        options.setTouchBatchWindow(touchBatchWindow);
+
         return options;
     }
 
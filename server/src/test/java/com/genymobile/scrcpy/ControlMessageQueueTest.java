@@ -0,0 +1,287 @@
+package com.genymobile.scrcpy;
+
+import android.view.KeyEvent;
+import android.view.MotionEvent;
+
+import org.junit.Assert;
+import org.junit.Test;
+
+import java.util.ArrayList;
+import java.util.List;
+
+public class ControlMessageQueueTest {
+
+    private static final Size SCREEN_SIZE = new Size(1080, 1920);
+
+    private static ControlMessage createTouch(int action, long pointerId, int x) {
+        ControlMessage msg = new ControlMessage();
+        msg.setInjectTouchEvent(action, pointerId, x, 0, SCREEN_SIZE, 1f, MotionEvent.BUTTON_PRIMARY);
+        return msg;
+    }
+
+    private static ControlMessage createKeycode(int keycode) {
+        ControlMessage msg = new ControlMessage();
+        msg.setInjectKeycode(KeyEvent.ACTION_DOWN, keycode, 0, 0);
+        return msg;
+    }
+
+    private static ControlMessage createRequestAck(int sequence) {
+        ControlMessage msg = new ControlMessage();
+        msg.setRequestAck(sequence, 0);
+        return msg;
+    }
+
+    private static void assertTouch(ControlMessage msg, int action, long pointerId, int x) {
+        Assert.assertEquals(ControlMessage.TYPE_INJECT_TOUCH_EVENT, msg.getType());
+        Assert.assertEquals(action, msg.getAction());
+        Assert.assertEquals(pointerId, msg.getPointerId());
+        Assert.assertEquals(x, msg.getPosition().getPoint().getX());
+        Assert.assertEquals(SCREEN_SIZE, msg.getPosition().getScreenSize());
+    }
+
+    @Test
+    public void testCoalesceMoves() throws InterruptedException {
+        ControlMessageQueue queue = new ControlMessageQueue();
+
+        queue.push(createTouch(MotionEvent.ACTION_DOWN, 1, 0));
+        queue.push(createTouch(MotionEvent.ACTION_MOVE, 1, 1));
+        queue.push(createTouch(MotionEvent.ACTION_MOVE, 2, 10));
+        queue.push(createTouch(MotionEvent.ACTION_MOVE, 1, 2)); // replaces the move to 1
+        queue.push(createTouch(MotionEvent.ACTION_MOVE, 2, 11)); // replaces the move to 10
+        queue.push(createTouch(MotionEvent.ACTION_UP, 1, 2));
+        queue.push(createTouch(MotionEvent.ACTION_MOVE, 2, 12)); // not moved before the UP
+        Assert.assertEquals(5, queue.size());
+        Assert.assertEquals(2, queue.getCoalescedCount());
+
+        ControlMessage msg = new ControlMessage();
+        Assert.assertEquals(4, queue.take(msg));
+        assertTouch(msg, MotionEvent.ACTION_DOWN, 1, 0);
+        Assert.assertEquals(3, queue.take(msg));
+        assertTouch(msg, MotionEvent.ACTION_MOVE, 1, 2);
+        Assert.assertEquals(2, queue.take(msg));
+        assertTouch(msg, MotionEvent.ACTION_MOVE, 2, 11);
+        Assert.assertEquals(1, queue.take(msg));
+        assertTouch(msg, MotionEvent.ACTION_UP, 1, 2);
+        Assert.assertEquals(0, queue.take(msg));
+        assertTouch(msg, MotionEvent.ACTION_MOVE, 2, 12);
+    }
+
+    @Test
+    public void testNoCoalesceAcrossOtherMessages() throws InterruptedException {
+        ControlMessageQueue queue = new ControlMessageQueue();
+
+        queue.push(createTouch(MotionEvent.ACTION_MOVE, 1, 1));
+        queue.push(createRequestAck(42));
+        queue.push(createTouch(MotionEvent.ACTION_MOVE, 1, 2));
+
+        // a move with different buttons is not coalesced
+        ControlMessage move = new ControlMessage();
+        move.setInjectTouchEvent(MotionEvent.ACTION_MOVE, 1, 3, 0, SCREEN_SIZE, 1f, 0);
+        queue.push(move);
+
+        Assert.assertEquals(4, queue.size());
+        Assert.assertEquals(0, queue.getCoalescedCount());
+
+        ControlMessage msg = new ControlMessage();
+        queue.take(msg);
+        assertTouch(msg, MotionEvent.ACTION_MOVE, 1, 1);
+        queue.take(msg);
+        Assert.assertEquals(ControlMessage.TYPE_REQUEST_ACK, msg.getType());
+        Assert.assertEquals(42, msg.getSequence());
+        queue.take(msg);
+        assertTouch(msg, MotionEvent.ACTION_MOVE, 1, 2);
+        queue.take(msg);
+        assertTouch(msg, MotionEvent.ACTION_MOVE, 1, 3);
+    }
+
+    @Test
+    public void testCoalesceOnlyWhileFull() throws InterruptedException {
+        ControlMessageQueue queue = new ControlMessageQueue(3, false);
+
+        queue.push(createTouch(MotionEvent.ACTION_MOVE, 1, 1));
+        queue.push(createTouch(MotionEvent.ACTION_MOVE, 1, 2));
+        queue.push(createTouch(MotionEvent.ACTION_MOVE, 1, 3));
+        Assert.assertEquals(3, queue.size());
+        Assert.assertEquals(0, queue.getCoalescedCount());
+
+        // the queue is full, the move replaces the last one instead of blocking
+        queue.push(createTouch(MotionEvent.ACTION_MOVE, 1, 4));
+        Assert.assertEquals(3, queue.size());
+        Assert.assertEquals(1, queue.getCoalescedCount());
+
+        ControlMessage msg = new ControlMessage();
+        queue.take(msg);
+        assertTouch(msg, MotionEvent.ACTION_MOVE, 1, 1);
+        queue.take(msg);
+        assertTouch(msg, MotionEvent.ACTION_MOVE, 1, 2);
+        queue.take(msg);
+        assertTouch(msg, MotionEvent.ACTION_MOVE, 1, 4);
+    }
+
+    @Test
+    public void testTakeTimeout() throws InterruptedException {
+        ControlMessageQueue queue = new ControlMessageQueue();
+
+        ControlMessage msg = new ControlMessage();
+        Assert.assertEquals(-1, queue.take(msg, 0));
+        Assert.assertEquals(-1, queue.take(msg, 10));
+
+        queue.push(createKeycode(KeyEvent.KEYCODE_A));
+        Assert.assertEquals(0, queue.take(msg, 10));
+        Assert.assertEquals(KeyEvent.KEYCODE_A, msg.getKeycode());
+    }
+
+    @Test
+    public void testSplitTouchFrame() throws InterruptedException {
+        ControlMessageQueue queue = new ControlMessageQueue();
+
+        ControlMessage[] events = {
+                createTouch(MotionEvent.ACTION_DOWN, 1, 0),
+                createTouch(MotionEvent.ACTION_MOVE, 1, 1),
+                createTouch(MotionEvent.ACTION_MOVE, 1, 2),
+                createTouch(MotionEvent.ACTION_DOWN, 2, 3), // not part of the frame
+        };
+        ControlMessage frame = new ControlMessage();
+        frame.setInjectTouchFrame(events, 3);
+        queue.push(frame);
+
+        Assert.assertEquals(2, queue.size());
+
+        ControlMessage msg = new ControlMessage();
+        queue.take(msg);
+        assertTouch(msg, MotionEvent.ACTION_DOWN, 1, 0);
+        queue.take(msg);
+        assertTouch(msg, MotionEvent.ACTION_MOVE, 1, 2);
+    }
+
+    @Test
+    public void testPushBlocksWhileFull() throws InterruptedException {
+        final ControlMessageQueue queue = new ControlMessageQueue(2);
+        queue.push(createKeycode(KeyEvent.KEYCODE_A));
+        queue.push(createKeycode(KeyEvent.KEYCODE_B));
+
+        Thread thread = new Thread(new Runnable() {
+            @Override
+            public void run() {
+                try {
+                    queue.push(createKeycode(KeyEvent.KEYCODE_C));
+                } catch (InterruptedException e) {
+                    // stopped
+                }
+            }
+        });
+        thread.start();
+
+        thread.join(100);
+        Assert.assertTrue(thread.isAlive());
+
+        ControlMessage msg = new ControlMessage();
+        queue.take(msg);
+        Assert.assertEquals(KeyEvent.KEYCODE_A, msg.getKeycode());
+
+        thread.join(5000);
+        Assert.assertFalse(thread.isAlive());
+        Assert.assertEquals(2, queue.size());
+        Assert.assertEquals(2, queue.getMaxSize());
+    }
+
+    /**
+     * Record the messages, taking some time to "inject" each one.
+     */
+    private static class FakeInjector implements Runnable {
+        private final ControlMessageQueue queue;
+        private final int count;
+        private final List<Integer> keycodes = new ArrayList<>();
+        private int lastX = -1;
+        private boolean reordered;
+        private int maxQueueDepth;
+
+        FakeInjector(ControlMessageQueue queue, int count) {
+            this.queue = queue;
+            this.count = count;
+        }
+
+        @Override
+        public void run() {
+            ControlMessage msg = new ControlMessage();
+            try {
+                for (int i = 0; i < count; ++i) {
+                    int queueDepth = queue.take(msg);
+                    maxQueueDepth = Math.max(maxQueueDepth, queueDepth);
+                    if (msg.getType() == ControlMessage.TYPE_INJECT_KEYCODE) {
+                        keycodes.add(msg.getKeycode());
+                    } else if (msg.getType() == ControlMessage.TYPE_INJECT_TOUCH_EVENT) {
+                        int x = msg.getPosition().getPoint().getX();
+                        if (x <= lastX) {
+                            reordered = true;
+                        }
+                        lastX = x;
+                    }
+                    Thread.sleep(1);
+                }
+            } catch (InterruptedException e) {
+                // stopped
+            }
+        }
+    }
+
+    @Test
+    public void testLateInjector() throws InterruptedException {
+        ControlMessageQueue queue = new ControlMessageQueue();
+
+        // all the messages are received before the injector starts: the keycodes must all be injected in order, but the moves between them
+        // are coalesced
+        queue.push(createTouch(MotionEvent.ACTION_DOWN, 1, 0));
+        for (int i = 1; i <= 1000; ++i) {
+            if (i % 100 == 0) {
+                queue.push(createKeycode(i));
+            }
+            queue.push(createTouch(MotionEvent.ACTION_MOVE, 1, i));
+        }
+        queue.push(createTouch(MotionEvent.ACTION_UP, 1, 1001));
+
+        // DOWN, 10 * (MOVE, KEYCODE), MOVE, UP
+        Assert.assertEquals(23, queue.size());
+        Assert.assertEquals(1000 - 11, queue.getCoalescedCount());
+
+        FakeInjector injector = new FakeInjector(queue, 23);
+        Thread thread = new Thread(injector);
+        thread.start();
+        thread.join(5000);
+        Assert.assertFalse(thread.isAlive());
+
+        Assert.assertEquals(0, queue.size());
+        Assert.assertEquals(10, injector.keycodes.size());
+        for (int i = 0; i < 10; ++i) {
+            Assert.assertEquals(100 * (i + 1), (int) injector.keycodes.get(i));
+        }
+        Assert.assertFalse(injector.reordered);
+        Assert.assertEquals(1001, injector.lastX);
+        Assert.assertEquals(22, injector.maxQueueDepth);
+    }
+
+    @Test
+    public void testConcurrentReaderAndInjector() throws InterruptedException {
+        final ControlMessageQueue queue = new ControlMessageQueue(4);
+
+        // only keycodes, so that none is coalesced: the reader is blocked while the queue is full
+        final int count = 200;
+        FakeInjector injector = new FakeInjector(queue, count);
+        Thread thread = new Thread(injector);
+        thread.start();
+
+        for (int i = 0; i < count; ++i) {
+            queue.push(createKeycode(i));
+        }
+
+        thread.join(5000);
+        Assert.assertFalse(thread.isAlive());
+
+        Assert.assertEquals(count, injector.keycodes.size());
+        for (int i = 0; i < count; ++i) {
+            Assert.assertEquals(i, (int) injector.keycodes.get(i));
+        }
+        Assert.assertTrue(queue.getMaxSize() <= 4);
+        Assert.assertTrue(injector.maxQueueDepth <= 3);
+    }
+}
@@ -10,6 +10,7 @@ import java.io.ByteArrayInputStream;
 import java.io.ByteArrayOutputStream;
 import java.io.DataOutputStream;
 import java.io.IOException;
+import java.lang.reflect.Method;
 import java.nio.charset.StandardCharsets;
 import java.util.Arrays;
 
@@ -296,6 +297,29 @@ public class ControlMessageReaderTest {
         Assert.assertEquals(ControlMessage.TYPE_ROTATE_DEVICE, event.getType());
     }
 
+    @Test
+    public void testParseRequestAck() throws IOException {
+        ControlMessageReader reader = new ControlMessageReader();
+
+        ByteArrayOutputStream bos = new ByteArrayOutputStream();
+        DataOutputStream dos = new DataOutputStream(bos);
+        dos.writeByte(ControlMessage.TYPE_REQUEST_ACK);
+        dos.writeInt(0x01020304);
+        dos.writeLong(0x1122334455667788L);
+
+        byte[] packet = bos.toByteArray();
+
+        // The message type (1 byte) does not count
+        Assert.assertEquals(ControlMessageReader.REQUEST_ACK_PAYLOAD_LENGTH, packet.length - 1);
+
+        reader.readFrom(new ByteArrayInputStream(packet));
+        ControlMessage event = reader.next();
+
+        Assert.assertEquals(ControlMessage.TYPE_REQUEST_ACK, event.getType());
+        Assert.assertEquals(0x01020304, event.getSequence());
+        Assert.assertEquals(0x1122334455667788L, event.getTimestamp());
+    }
+
     @Test
     public void testMultiEvents() throws IOException {
         ControlMessageReader reader = new ControlMessageReader();
@@ -377,4 +401,396 @@ public class ControlMessageReaderTest {
         Assert.assertEquals(5, event.getRepeat());
         Assert.assertEquals(KeyEvent.META_CTRL_ON, event.getMetaState());
     }
+
+    @Test
+    public void testParseSetProtocolVersion() throws IOException {
+        ControlMessageReader reader = new ControlMessageReader();
+
+        ByteArrayOutputStream bos = new ByteArrayOutputStream();
+        DataOutputStream dos = new DataOutputStream(bos);
+        dos.writeByte(ControlMessage.TYPE_SET_PROTOCOL_VERSION);
+        dos.writeByte(2);
+
+        byte[] packet = bos.toByteArray();
+
+        // The message type (1 byte) does not count
+        Assert.assertEquals(ControlMessageReader.SET_PROTOCOL_VERSION_PAYLOAD_LENGTH, packet.length - 1);
+
+        reader.readFrom(new ByteArrayInputStream(packet));
+        ControlMessage event = reader.next();
+
+        Assert.assertEquals(ControlMessage.TYPE_SET_PROTOCOL_VERSION, event.getType());
+        Assert.assertEquals(2, event.getVersion());
+    }
+
+    @Test
+    public void testParseSetBitRate() throws IOException {
+        ControlMessageReader reader = new ControlMessageReader();
+
+        ByteArrayOutputStream bos = new ByteArrayOutputStream();
+        DataOutputStream dos = new DataOutputStream(bos);
+        dos.writeByte(ControlMessage.TYPE_SET_BIT_RATE);
+        dos.writeInt(4000000);
+
+        byte[] packet = bos.toByteArray();
+
+        // The message type (1 byte) does not count
+        Assert.assertEquals(ControlMessageReader.SET_BIT_RATE_PAYLOAD_LENGTH, packet.length - 1);
+
+        reader.readFrom(new ByteArrayInputStream(packet));
+        ControlMessage event = reader.next();
+
+        Assert.assertEquals(ControlMessage.TYPE_SET_BIT_RATE, event.getType());
+        Assert.assertEquals(4000000, event.getBitRate());
+    }
+
+    @Test
+    public void testParseSetMaxFps() throws IOException {
+        ControlMessageReader reader = new ControlMessageReader();
+
+        ByteArrayOutputStream bos = new ByteArrayOutputStream();
+        DataOutputStream dos = new DataOutputStream(bos);
+        dos.writeByte(ControlMessage.TYPE_SET_MAX_FPS);
+        dos.writeShort(300);
+
+        byte[] packet = bos.toByteArray();
+
+        // The message type (1 byte) does not count
+        Assert.assertEquals(ControlMessageReader.SET_MAX_FPS_PAYLOAD_LENGTH, packet.length - 1);
+
+        reader.readFrom(new ByteArrayInputStream(packet));
+        ControlMessage event = reader.next();
+
+        Assert.assertEquals(ControlMessage.TYPE_SET_MAX_FPS, event.getType());
+        Assert.assertEquals(300, event.getMaxFps());
+    }
+
+    @Test
+    public void testParseRequestKeyFrame() throws IOException {
+        ControlMessageReader reader = new ControlMessageReader();
+
+        ByteArrayOutputStream bos = new ByteArrayOutputStream();
+        DataOutputStream dos = new DataOutputStream(bos);
+        dos.writeByte(ControlMessage.TYPE_REQUEST_KEYFRAME);
+
+        byte[] packet = bos.toByteArray();
+
+        reader.readFrom(new ByteArrayInputStream(packet));
+        ControlMessage event = reader.next();
+
+        Assert.assertEquals(ControlMessage.TYPE_REQUEST_KEYFRAME, event.getType());
+    }
+
+    @Test
+    public void testParseTouchFrame() throws IOException {
+        ControlMessageReader reader = new ControlMessageReader();
+
+        // the same bytes as generated by the client (see test_control_msg_serialize.c)
+        byte[] packet = {
+                ControlMessage.TYPE_SET_SCREEN_SIZE,
+                0x04, 0x38, 0x07, (byte) 0x80, // 1080x1920
+                ControlMessage.TYPE_INJECT_TOUCH_FRAME,
+                0x03, // 3 events
+                0x40, // index 0, ACTION_DOWN, pressure
+                (byte) 0xc8, 0x01, // dx = 100 (zigzag varint)
+                (byte) 0x90, 0x03, // dy = 200
+                (byte) 0xff, (byte) 0xff, // pressure 1.0
+                0x20, // index 0, ACTION_MOVE
+                0x0a, // dx = 5
+                0x05, // dy = -3
+                0x41, // index 1, ACTION_DOWN, pressure
+                (byte) 0xd8, 0x04, // dx = 300
+                (byte) 0xa0, 0x06, // dy = 400
+                (byte) 0xff, (byte) 0xff, // pressure 1.0
+        };
+
+        reader.readFrom(new ByteArrayInputStream(packet));
+
+        ControlMessage event = reader.next();
+        Assert.assertEquals(ControlMessage.TYPE_SET_SCREEN_SIZE, event.getType());
+        Assert.assertEquals(new Size(1080, 1920), event.getScreenSize());
+
+        event = reader.next();
+        Assert.assertEquals(ControlMessage.TYPE_INJECT_TOUCH_FRAME, event.getType());
+        ControlMessage[] events = event.getTouchEvents();
+        Assert.assertEquals(3, event.getTouchEventCount());
+
+        long pointerId0 = ControlMessageReader.COMPACT_POINTER_ID_BASE;
+        long pointerId1 = ControlMessageReader.COMPACT_POINTER_ID_BASE + 1;
+        assertTouch(events[0], MotionEvent.ACTION_DOWN, pointerId0, 100, 200, 1f, 0);
+        assertTouch(events[1], MotionEvent.ACTION_MOVE, pointerId0, 105, 197, 1f, 0);
+        assertTouch(events[2], MotionEvent.ACTION_DOWN, pointerId1, 300, 400, 1f, 0);
+        Assert.assertEquals(new Size(1080, 1920), events[0].getPosition().getScreenSize());
+
+        Assert.assertNull(reader.next());
+    }
+
+    @Test
+    public void testParseTouchFrameRoundTrip() throws IOException {
+        CompactEncoder encoder = new CompactEncoder();
+        ByteArrayOutputStream bos = new ByteArrayOutputStream();
+        DataOutputStream dos = new DataOutputStream(bos);
+
+        encoder.writeScreenSize(dos, 1920, 1080);
+
+        // two pointers, moving in opposite directions with small and large steps, in frames of 4 events
+        int[][] expected = new int[64][];
+        int count = 0;
+        expected[count++] = new int[] {0, MotionEvent.ACTION_DOWN, 960, 540, 0xffff, 0};
+        expected[count++] = new int[] {1, MotionEvent.ACTION_DOWN, 0, 0, 0xffff, MotionEvent.BUTTON_PRIMARY};
+        for (int i = 1; i <= 30; ++i) {
+            int step = i * i * 3;
+            expected[count++] = new int[] {0, MotionEvent.ACTION_MOVE, 960 + step, 540 - step, 0xffff, 0};
+            expected[count++] = new int[] {1, MotionEvent.ACTION_MOVE, step, 2 * step, i * 0x800, MotionEvent.BUTTON_PRIMARY};
+        }
+        expected[count++] = new int[] {0, MotionEvent.ACTION_UP, 0, 0, 0, 0};
+        expected[count++] = new int[] {1, MotionEvent.ACTION_UP, 0, 0, 0, 0};
+
+        for (int i = 0; i < count; i += 4) {
+            encoder.writeFrame(dos, expected, i, Math.min(4, count - i));
+        }
+
+        byte[] packet = bos.toByteArray();
+
+        // feed the data in two parts, cut in the middle of a frame
+        int cut = packet.length / 2 + 1;
+        ControlMessageReader reader = new ControlMessageReader();
+        reader.readFrom(new ByteArrayInputStream(packet, 0, cut));
+
+        ControlMessage event = reader.next();
+        Assert.assertEquals(ControlMessage.TYPE_SET_SCREEN_SIZE, event.getType());
+
+        int parsed = 0;
+        while (parsed < count) {
+            event = reader.next();
+            if (event == null) {
+                reader.readFrom(new ByteArrayInputStream(packet, cut, packet.length - cut));
+                continue;
+            }
+            Assert.assertEquals(ControlMessage.TYPE_INJECT_TOUCH_FRAME, event.getType());
+            for (int i = 0; i < event.getTouchEventCount(); ++i) {
+                ControlMessage touch = event.getTouchEvents()[i];
+                int[] e = expected[parsed++];
+                float pressure = e[4] == 0xffff ? 1f : e[4] / 0x1p16f;
+                assertTouch(touch, e[1], ControlMessageReader.COMPACT_POINTER_ID_BASE + e[0], e[2], e[3], pressure, e[5]);
+                Assert.assertEquals(new Size(1920, 1080), touch.getPosition().getScreenSize());
+            }
+        }
+        Assert.assertEquals(count, parsed);
+        Assert.assertNull(reader.next());
+    }
+
+    @Test
+    public void testParseAcrossBufferEnd() throws IOException {
+        ControlMessageReader reader = new ControlMessageReader();
+        int bufferSize = ControlMessageReader.CLIPBOARD_TEXT_MAX_LENGTH + 6;
+
+        ByteArrayOutputStream bos = new ByteArrayOutputStream();
+        DataOutputStream dos = new DataOutputStream(bos);
+
+        // fill the buffer up to 7 bytes before its end
+        for (int i = 0; i < bufferSize - 7; ++i) {
+            dos.writeByte(ControlMessage.TYPE_ROTATE_DEVICE);
+        }
+        // then a text wrapping around the end of the buffer (type: 1 byte; length: 4 bytes; text: 6 bytes)
+        dos.writeByte(ControlMessage.TYPE_INJECT_TEXT);
+        byte[] text = "testé".getBytes(StandardCharsets.UTF_8);
+        dos.writeInt(text.length);
+        dos.write(text);
+        // and a touch event
+        dos.writeByte(ControlMessage.TYPE_INJECT_TOUCH_EVENT);
+        dos.writeByte(MotionEvent.ACTION_DOWN);
+        dos.writeLong(-42); // pointerId
+        dos.writeInt(100);
+        dos.writeInt(200);
+        dos.writeShort(1080);
+        dos.writeShort(1920);
+        dos.writeShort(0xffff); // pressure
+        dos.writeInt(MotionEvent.BUTTON_PRIMARY);
+
+        ByteArrayInputStream input = new ByteArrayInputStream(bos.toByteArray());
+        reader.readFrom(input);
+        for (int i = 0; i < bufferSize - 7; ++i) {
+            ControlMessage event = reader.next();
+            Assert.assertEquals(ControlMessage.TYPE_ROTATE_DEVICE, event.getType());
+        }
+        Assert.assertNull(reader.next());
+
+        // the first read filled the buffer up to its end, the following ones write at its beginning
+        while (input.available() > 0) {
+            reader.readFrom(input);
+        }
+
+        ControlMessage event = reader.next();
+        Assert.assertEquals(ControlMessage.TYPE_INJECT_TEXT, event.getType());
+        Assert.assertEquals("testé", event.getText());
+
+        event = reader.next();
+        assertTouch(event, MotionEvent.ACTION_DOWN, -42, 100, 200, 1f, MotionEvent.BUTTON_PRIMARY);
+        Assert.assertEquals(new Size(1080, 1920), event.getPosition().getScreenSize());
+
+        Assert.assertNull(reader.next());
+    }
+
+    /**
+     * Microbenchmark of the parsing of touch events (as sent by the client on a mouse drag), reporting the number of messages parsed per
+     * second and the allocations per message.
+     */
+    @Test
+    public void testParseTouchEventsBenchmark() throws IOException {
+        ByteArrayOutputStream bos = new ByteArrayOutputStream();
+        DataOutputStream dos = new DataOutputStream(bos);
+
+        // version 1 touch events
+        int messagesPerPacket = 0;
+        for (int i = 0; i < 1000; ++i) {
+            dos.writeByte(ControlMessage.TYPE_INJECT_TOUCH_EVENT);
+            dos.writeByte(i == 0 ? MotionEvent.ACTION_DOWN : MotionEvent.ACTION_MOVE);
+            dos.writeLong(-1); // pointerId
+            dos.writeInt(i);
+            dos.writeInt(2 * i);
+            dos.writeShort(1080);
+            dos.writeShort(1920);
+            dos.writeShort(0xffff); // pressure
+            dos.writeInt(MotionEvent.BUTTON_PRIMARY);
+            ++messagesPerPacket;
+        }
+
+        // version 2 touch frames
+        CompactEncoder encoder = new CompactEncoder();
+        encoder.writeScreenSize(dos, 1080, 1920);
+        ++messagesPerPacket;
+        int[][] events = new int[1000][];
+        for (int i = 0; i < events.length; ++i) {
+            int action = i == 0 ? MotionEvent.ACTION_DOWN : MotionEvent.ACTION_MOVE;
+            events[i] = new int[] {0, action, i, 2 * i, 0xffff, MotionEvent.BUTTON_PRIMARY};
+        }
+        for (int i = 0; i < events.length; i += 4) {
+            encoder.writeFrame(dos, events, i, 4);
+            ++messagesPerPacket;
+        }
+
+        byte[] packet = bos.toByteArray();
+        ByteArrayInputStream input = new ByteArrayInputStream(packet);
+        ControlMessageReader reader = new ControlMessageReader();
+
+        // warm up
+        parsePackets(reader, input, 200, messagesPerPacket);
+
+        int packetCount = 2000;
+        long allocatedBefore = getAllocatedBytes();
+        long start = System.nanoTime();
+        parsePackets(reader, input, packetCount, messagesPerPacket);
+        long duration = System.nanoTime() - start;
+        long allocatedAfter = getAllocatedBytes();
+
+        long messageCount = (long) packetCount * messagesPerPacket;
+        System.out.println("ControlMessageReader: " + messageCount * 1000000000L / Math.max(duration, 1) + " messages/s");
+        if (allocatedBefore != -1 && allocatedAfter != -1) {
+            double allocationsPerMessage = (double) (allocatedAfter - allocatedBefore) / messageCount;
+            System.out.println("ControlMessageReader: " + allocationsPerMessage + " bytes allocated/message");
+            // the parsing itself does not allocate (the measure may count a few bytes)
+            Assert.assertTrue(allocationsPerMessage < 1);
+        }
+    }
+
+    /**
+     * Return the number of bytes allocated by the current thread, or -1 if the JVM does not support it.
+     * <p>
+     * The tests are compiled against the Android API, so the JVM management API is called by reflection.
+     */
+    private static long getAllocatedBytes() {
+        try {
+            Object threadBean = Class.forName("java.lang.management.ManagementFactory").getMethod("getThreadMXBean").invoke(null);
+            Method method = Class.forName("com.sun.management.ThreadMXBean").getMethod("getThreadAllocatedBytes", long.class);
+            return (Long) method.invoke(threadBean, Thread.currentThread().getId());
+        } catch (ReflectiveOperationException | IllegalArgumentException e) {
+            return -1;
+        }
+    }
+
+    private static void parsePackets(ControlMessageReader reader, ByteArrayInputStream input, int packetCount, int messagesPerPacket)
+            throws IOException {
+        for (int i = 0; i < packetCount; ++i) {
+            input.reset();
+            int count = 0;
+            while (input.available() > 0) {
+                reader.readFrom(input);
+                while (reader.next() != null) {
+                    ++count;
+                }
+            }
+            Assert.assertEquals(messagesPerPacket, count);
+        }
+    }
+
+    private static void assertTouch(ControlMessage event, int action, long pointerId, int x, int y, float pressure, int buttons) {
+        Assert.assertEquals(ControlMessage.TYPE_INJECT_TOUCH_EVENT, event.getType());
+        Assert.assertEquals(action, event.getAction());
+        Assert.assertEquals(pointerId, event.getPointerId());
+        Assert.assertEquals(x, event.getPosition().getPoint().getX());
+        Assert.assertEquals(y, event.getPosition().getPoint().getY());
+        Assert.assertEquals(pressure, event.getPressure(), 0f);
+        Assert.assertEquals(buttons, event.getButtons());
+    }
+
+    /**
+     * Encode the compact touch events, as the client does.
+     */
+    private static class CompactEncoder {
+        private final int[] x = new int[ControlMessageReader.COMPACT_MAX_POINTERS];
+        private final int[] y = new int[ControlMessageReader.COMPACT_MAX_POINTERS];
+        private final int[] pressure = new int[ControlMessageReader.COMPACT_MAX_POINTERS];
+        private final int[] buttons = new int[ControlMessageReader.COMPACT_MAX_POINTERS];
+
+        void writeScreenSize(DataOutputStream dos, int width, int height) throws IOException {
+            dos.writeByte(ControlMessage.TYPE_SET_SCREEN_SIZE);
+            dos.writeShort(width);
+            dos.writeShort(height);
+        }
+
+        /**
+         * @param events {index, action, x, y, pressure (16 bits fixed-point), buttons}
+         */
+        void writeFrame(DataOutputStream dos, int[][] events, int offset, int count) throws IOException {
+            dos.writeByte(ControlMessage.TYPE_INJECT_TOUCH_FRAME);
+            dos.writeByte(count);
+            for (int i = offset; i < offset + count; ++i) {
+                int[] e = events[i];
+                int index = e[0];
+                int head = index | e[1] << 4;
+                if (e[4] != pressure[index]) {
+                    head |= 0x40;
+                }
+                if (e[5] != buttons[index]) {
+                    head |= 0x80;
+                }
+                dos.writeByte(head);
+                writeSignedVarint(dos, e[2] - x[index]);
+                writeSignedVarint(dos, e[3] - y[index]);
+                if ((head & 0x40) != 0) {
+                    dos.writeShort(e[4]);
+                }
+                if ((head & 0x80) != 0) {
+                    writeVarint(dos, e[5]);
+                }
+                x[index] = e[2];
+                y[index] = e[3];
+                pressure[index] = e[4];
+                buttons[index] = e[5];
+            }
+        }
+
+        private static void writeVarint(DataOutputStream dos, int value) throws IOException {
+            while ((value & ~0x7f) != 0) {
+                dos.writeByte((value & 0x7f) | 0x80);
+                value >>>= 7;
+            }
+            dos.writeByte(value);
+        }
+
+        private static void writeSignedVarint(DataOutputStream dos, int value) throws IOException {
+            writeVarint(dos, (value << 1) ^ (value >> 31));
+        }
+    }
 }
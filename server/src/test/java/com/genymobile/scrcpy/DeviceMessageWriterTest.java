@@ -32,4 +32,68 @@ public class DeviceMessageWriterTest {
 
         Assert.assertArrayEquals(expected, actual);
     }
+
+    @Test
+    public void testSerializeAck() throws IOException {
+        DeviceMessageWriter writer = new DeviceMessageWriter();
+
+        ByteArrayOutputStream bos = new ByteArrayOutputStream();
+        DataOutputStream dos = new DataOutputStream(bos);
+        dos.writeByte(DeviceMessage.TYPE_ACK);
+        dos.writeInt(42);
+        dos.writeLong(0x1122334455667788L);
+        dos.writeInt(1500);
+        dos.writeShort(3); // queue depth
+
+        byte[] expected = bos.toByteArray();
+
+        DeviceMessage msg = DeviceMessage.createAck(42, 0x1122334455667788L, 1500, 3);
+        bos = new ByteArrayOutputStream();
+        writer.writeTo(msg, bos);
+
+        byte[] actual = bos.toByteArray();
+
+        Assert.assertArrayEquals(expected, actual);
+    }
+
+    @Test
+    public void testSerializeProtocolVersion() throws IOException {
+        DeviceMessageWriter writer = new DeviceMessageWriter();
+
+        byte[] expected = {DeviceMessage.TYPE_PROTOCOL_VERSION, 2};
+
+        DeviceMessage msg = DeviceMessage.createProtocolVersion(2);
+        ByteArrayOutputStream bos = new ByteArrayOutputStream();
+        writer.writeTo(msg, bos);
+
+        byte[] actual = bos.toByteArray();
+
+        Assert.assertArrayEquals(expected, actual);
+    }
+
+    @Test
+    public void testSerializeEncoderStats() throws IOException {
+        DeviceMessageWriter writer = new DeviceMessageWriter();
+
+        ByteArrayOutputStream bos = new ByteArrayOutputStream();
+        DataOutputStream dos = new DataOutputStream(bos);
+        dos.writeByte(DeviceMessage.TYPE_ENCODER_STATS);
+        dos.writeInt(1002); // interval
+        dos.writeInt(60); // frames
+        dos.writeInt(1000000); // bytes
+        dos.writeInt(2500); // write blocked time
+        dos.writeShort(1); // rotation restarts
+        dos.writeInt(8000); // dequeue latency avg
+        dos.writeInt(16000); // dequeue latency max
+
+        byte[] expected = bos.toByteArray();
+
+        DeviceMessage msg = DeviceMessage.createEncoderStats(1002, 60, 1000000, 2500, 1, 8000, 16000);
+        bos = new ByteArrayOutputStream();
+        writer.writeTo(msg, bos);
+
+        byte[] actual = bos.toByteArray();
+
+        Assert.assertArrayEquals(expected, actual);
+    }
 }
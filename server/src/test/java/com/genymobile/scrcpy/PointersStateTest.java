@@ -0,0 +1,87 @@
+package com.genymobile.scrcpy;
+
+import android.view.MotionEvent;
+
+import org.junit.Assert;
+import org.junit.Test;
+
+public class PointersStateTest {
+
+    private static void setPointer(PointersState pointersState, long id, int x, int y) {
+        int index = pointersState.getPointerIndex(id);
+        Pointer pointer = pointersState.get(index);
+        pointer.setPoint(new Point(x, y));
+        pointer.setPressure(1f);
+    }
+
+    @Test
+    public void testBatchDisabled() {
+        PointersState pointersState = new PointersState();
+        setPointer(pointersState, 1, 0, 0);
+
+        Assert.assertFalse(pointersState.canBatch(MotionEvent.ACTION_MOVE, 1, 0));
+    }
+
+    @Test
+    public void testBatchMoves() {
+        PointersState pointersState = new PointersState(16);
+
+        // a new pointer is not batched
+        Assert.assertFalse(pointersState.canBatch(MotionEvent.ACTION_DOWN, 1, 0));
+        Assert.assertFalse(pointersState.canBatch(MotionEvent.ACTION_MOVE, 1, 0));
+        setPointer(pointersState, 1, 0, 0);
+        setPointer(pointersState, 2, 100, 100);
+
+        for (int i = 1; i <= 3; ++i) {
+            Assert.assertTrue(pointersState.canBatch(MotionEvent.ACTION_MOVE, 1, 0));
+            setPointer(pointersState, 1, i, 2 * i);
+            Assert.assertFalse(pointersState.addBatchSample(1000 + i, 0));
+
+            Assert.assertTrue(pointersState.canBatch(MotionEvent.ACTION_MOVE, 2, 0));
+            setPointer(pointersState, 2, 100 - i, 100);
+            Assert.assertFalse(pointersState.addBatchSample(1000 + i, 0));
+        }
+
+        Assert.assertTrue(pointersState.hasBatch());
+        Assert.assertEquals(6, pointersState.getBatchSampleCount());
+        Assert.assertEquals(1001 + 16, pointersState.getBatchDeadline());
+
+        // each sample records the state of all the pointers
+        Assert.assertEquals(1001, pointersState.getBatchSampleTime(0));
+        Assert.assertEquals(1, pointersState.getBatchX(0, 0), 0f);
+        Assert.assertEquals(2, pointersState.getBatchY(0, 0), 0f);
+        Assert.assertEquals(100, pointersState.getBatchX(0, 1), 0f);
+        Assert.assertEquals(99, pointersState.getBatchX(1, 1), 0f);
+        Assert.assertEquals(1, pointersState.getBatchX(1, 0), 0f);
+        Assert.assertEquals(3, pointersState.getBatchX(5, 0), 0f);
+        Assert.assertEquals(6, pointersState.getBatchY(5, 0), 0f);
+        Assert.assertEquals(97, pointersState.getBatchX(5, 1), 0f);
+
+        // the other events must be injected separately, after the batch
+        Assert.assertFalse(pointersState.canBatch(MotionEvent.ACTION_UP, 1, 0));
+        Assert.assertFalse(pointersState.canBatch(MotionEvent.ACTION_DOWN, 3, 0));
+        Assert.assertFalse(pointersState.canBatch(MotionEvent.ACTION_MOVE, 1, MotionEvent.BUTTON_SECONDARY));
+
+        pointersState.clearBatch();
+        Assert.assertFalse(pointersState.hasBatch());
+        Assert.assertTrue(pointersState.canBatch(MotionEvent.ACTION_MOVE, 1, MotionEvent.BUTTON_SECONDARY));
+    }
+
+    @Test
+    public void testBatchFull() {
+        PointersState pointersState = new PointersState(1000);
+        setPointer(pointersState, 1, 0, 0);
+
+        for (int i = 0; i < PointersState.MAX_BATCH_SAMPLES - 1; ++i) {
+            Assert.assertTrue(pointersState.canBatch(MotionEvent.ACTION_MOVE, 1, 0));
+            setPointer(pointersState, 1, i, i);
+            Assert.assertFalse(pointersState.addBatchSample(i, 0));
+        }
+
+        // the last sample fills the batch, it must be injected
+        setPointer(pointersState, 1, 42, 42);
+        Assert.assertTrue(pointersState.addBatchSample(100, 0));
+        Assert.assertEquals(PointersState.MAX_BATCH_SAMPLES, pointersState.getBatchSampleCount());
+        Assert.assertEquals(42, pointersState.getBatchX(PointersState.MAX_BATCH_SAMPLES - 1, 0), 0f);
+    }
+}